@@ -0,0 +1,85 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    Number of shards a \c NOBCache spreads its entries over
+ */
+#define kNOBCacheShardCount (32)
+
+/**
+    @class NOBCache
+    A thread safe cache bounded by a total cost and/or an entry count.
+    @par Entries are spread over \c kNOBCacheShardCount shards by key hash, each shard behind its own spin lock.  A hit only holds its shard's lock for the lookup and for setting the entry's reference bit, there is no global lock and no recency list to reorder.
+    @par Eviction is CLOCK (an approximation of LRU): each shard sweeps its entries in a circle, an entry that was hit since the last sweep gets a second chance, the first one that was not is evicted.  The shards take turns giving up an entry until the cache is back under its limits.
+    @par Keys are copied, objects are retained.  Evicted objects are released outside of the shard locks.
+ */
+@interface NOBCache : NSObject
+
+/**
+    Designated initializer
+    @param totalCostLimit the total cost to keep the cache under, \c 0 for no limit
+    @param countLimit the number of entries to keep the cache under, \c 0 for no limit
+ */
+- (instancetype) initWithTotalCostLimit:(NSUInteger)totalCostLimit countLimit:(NSUInteger)countLimit;
+
+/** the total cost the cache is kept under, \c 0 for no limit.  Lowering it evicts immediately. */
+@property (nonatomic, assign) NSUInteger totalCostLimit;
+/** the number of entries the cache is kept under, \c 0 for no limit.  Lowering it evicts immediately. */
+@property (nonatomic, assign) NSUInteger countLimit;
+/** purge the cache when the app receives a memory warning (iOS only).  Default is \c YES. */
+@property (nonatomic, assign) BOOL purgesOnMemoryWarning;
+
+/** the sum of the costs of the entries */
+@property (nonatomic, readonly) NSUInteger totalCost;
+/** the number of entries */
+@property (nonatomic, readonly) NSUInteger count;
+/** the number of \c objectForKey: calls that found an entry */
+@property (nonatomic, readonly) uint64_t hitCount;
+/** the number of \c objectForKey: calls that did not find an entry */
+@property (nonatomic, readonly) uint64_t missCount;
+/** the number of entries evicted by the limits or by \c purge (not counting \c removeObjectForKey: and \c removeAllObjects) */
+@property (nonatomic, readonly) uint64_t evictionCount;
+
+- (id) objectForKey:(id)key;
+/**
+    Same as \c setObject:forKey:cost: with a cost of \c 0
+ */
+- (void) setObject:(id)object forKey:(id<NSCopying>)key;
+/**
+    Add or replace an entry, then evict entries until the cache is back under its limits.
+    @param cost the cost of the entry, i.e. the number of bytes \a object holds on to (see \c -[UIImage decodedByteCost])
+    @note an entry that costs more than \c totalCostLimit on its own is evicted right away
+ */
+- (void) setObject:(id)object forKey:(id<NSCopying>)key cost:(NSUInteger)cost;
+- (void) removeObjectForKey:(id)key;
+- (void) removeAllObjects;
+
+/**
+    Evict every entry.  For low memory situations, see \c purgesOnMemoryWarning.
+ */
+- (void) purge;
+/**
+    Evict entries until the cache is at or under \a totalCost and \a count.  Pass \c NSUIntegerMax to leave either unbounded.
+ */
+- (void) trimToCost:(NSUInteger)totalCost count:(NSUInteger)count;
+
+@end
@@ -0,0 +1,433 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBCache.h"
+#include <libkern/OSAtomic.h>
+
+#if TARGET_OS_IPHONE
+// NOBLib does not link UIKit, this is the value of UIApplicationDidReceiveMemoryWarningNotification
+static NSString* const kNOBCacheMemoryWarningNotification = @"UIApplicationDidReceiveMemoryWarningNotification";
+#endif
+
+typedef struct _NOBCacheEntry
+{
+    void*            key;        // retained copy
+    void*            object;     // retained
+    NSUInteger       cost;
+    NSUInteger       slot;       // index in the shard's clock
+    int32_t          referenced; // hit since the hand last went by
+} NOBCacheEntry;
+
+// Aligned so that locking one shard does not invalidate its neighbors
+typedef struct _NOBCacheShard
+{
+    OSSpinLock             lock;
+    CFMutableDictionaryRef map;     // key -> NOBCacheEntry*
+    NOBCacheEntry**        clock;   // the entries in the order the hand visits them
+    NSUInteger             clockCount;
+    NSUInteger             clockCapacity;
+    NSUInteger             hand;
+    uint64_t               hits;
+    uint64_t               misses;
+    uint64_t               evictions;
+} __attribute__((aligned(64))) NOBCacheShard;
+
+NS_INLINE NSUInteger NOBCacheShardIndex(id key);
+NS_INLINE NSUInteger NOBCacheShardIndex(id key)
+{
+    // many hash implementations leave the low bits poorly distributed (i.e. pointers), mix before masking
+    uint32_t h = (uint32_t)[key hash];
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h & (kNOBCacheShardCount - 1);
+}
+
+NS_INLINE void NOBCacheEntryFree(NOBCacheEntry* entry);
+NS_INLINE void NOBCacheEntryFree(NOBCacheEntry* entry)
+{
+    CFRelease(entry->key);
+    CFRelease(entry->object);
+    free(entry);
+}
+
+static void NOBCacheShardAppend(NOBCacheShard* shard, NOBCacheEntry* entry);
+static void NOBCacheShardRemove(NOBCacheShard* shard, NOBCacheEntry* entry);
+static NOBCacheEntry* NOBCacheShardNextVictim(NOBCacheShard* shard);
+
+@implementation NOBCache
+{
+@private
+    NOBCacheShard*   _shards;
+    volatile int64_t _totalCost;
+    volatile int64_t _count;
+    volatile int32_t _evictionCursor;
+}
+
+@synthesize totalCostLimit = _totalCostLimit;
+@synthesize countLimit = _countLimit;
+@synthesize purgesOnMemoryWarning = _purgesOnMemoryWarning;
+
+- (instancetype) init
+{
+    return [self initWithTotalCostLimit:0 countLimit:0];
+}
+
+- (instancetype) initWithTotalCostLimit:(NSUInteger)totalCostLimit countLimit:(NSUInteger)countLimit
+{
+    if (self = [super init])
+    {
+        _totalCostLimit = totalCostLimit;
+        _countLimit     = countLimit;
+
+        void* shards = NULL;
+        if (0 != posix_memalign(&shards, 64, sizeof(NOBCacheShard) * kNOBCacheShardCount))
+            @throw [NSException exceptionWithName:NSMallocException reason:@"NOBCache out of memory" userInfo:nil];
+        bzero(shards, sizeof(NOBCacheShard) * kNOBCacheShardCount);
+        _shards = (NOBCacheShard*)shards;
+        for (NSUInteger i = 0; i < kNOBCacheShardCount; i++)
+        {
+            _shards[i].lock = OS_SPINLOCK_INIT;
+            _shards[i].map  = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+        }
+
+        self.purgesOnMemoryWarning = YES;
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+#if TARGET_OS_IPHONE
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+#endif
+    for (NSUInteger i = 0; i < kNOBCacheShardCount; i++)
+    {
+        NOBCacheShard* shard = &_shards[i];
+        for (NSUInteger j = 0; j < shard->clockCount; j++)
+        {
+            NOBCacheEntryFree(shard->clock[j]);
+        }
+        free(shard->clock);
+        CFRelease(shard->map);
+    }
+    free(_shards);
+}
+
+#pragma mark - Properties
+
+- (void) setTotalCostLimit:(NSUInteger)totalCostLimit
+{
+    _totalCostLimit = totalCostLimit;
+    [self _trim];
+}
+
+- (void) setCountLimit:(NSUInteger)countLimit
+{
+    _countLimit = countLimit;
+    [self _trim];
+}
+
+- (void) setPurgesOnMemoryWarning:(BOOL)purgesOnMemoryWarning
+{
+#if TARGET_OS_IPHONE
+    if (purgesOnMemoryWarning != _purgesOnMemoryWarning)
+    {
+        if (purgesOnMemoryWarning)
+            [[NSNotificationCenter defaultCenter] addObserver:self selector:@selector(_memoryWarning:) name:kNOBCacheMemoryWarningNotification object:nil];
+        else
+            [[NSNotificationCenter defaultCenter] removeObserver:self name:kNOBCacheMemoryWarningNotification object:nil];
+    }
+#endif
+    _purgesOnMemoryWarning = purgesOnMemoryWarning;
+}
+
+- (NSUInteger) totalCost
+{
+    return (NSUInteger)MAX(_totalCost, 0);
+}
+
+- (NSUInteger) count
+{
+    return (NSUInteger)MAX(_count, 0);
+}
+
+- (uint64_t) hitCount
+{
+    return [self _sumStatistic:offsetof(NOBCacheShard, hits)];
+}
+
+- (uint64_t) missCount
+{
+    return [self _sumStatistic:offsetof(NOBCacheShard, misses)];
+}
+
+- (uint64_t) evictionCount
+{
+    return [self _sumStatistic:offsetof(NOBCacheShard, evictions)];
+}
+
+#pragma mark - Public
+
+- (id) objectForKey:(id)key
+{
+    if (!key)
+        return nil;
+
+    NOBCacheShard* shard = &_shards[NOBCacheShardIndex(key)];
+    id obj = nil;
+    OSSpinLockLock(&shard->lock);
+    NOBCacheEntry* entry = (NOBCacheEntry*)CFDictionaryGetValue(shard->map, (__bridge const void*)key);
+    if (entry)
+    {
+        entry->referenced = 1;
+        obj = (__bridge id)entry->object; // retained before the lock is released
+        shard->hits++;
+    }
+    else
+    {
+        shard->misses++;
+    }
+    OSSpinLockUnlock(&shard->lock);
+    return obj;
+}
+
+- (void) setObject:(id)object forKey:(id<NSCopying>)key
+{
+    [self setObject:object forKey:key cost:0];
+}
+
+- (void) setObject:(id)object forKey:(id<NSCopying>)key cost:(NSUInteger)cost
+{
+    if (!key || !object)
+    {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:[NSString stringWithFormat:@"%@ cannot be nil", (!key ? @"key" : @"object")]
+                                     userInfo:nil];
+    }
+
+    // prepare the entry outside of the lock
+    NOBCacheEntry* entry = (NOBCacheEntry*)malloc(sizeof(NOBCacheEntry));
+    if (!entry)
+        @throw [NSException exceptionWithName:NSMallocException reason:@"NOBCache out of memory" userInfo:nil];
+    entry->key        = (void*)CFBridgingRetain([(id<NSCopying>)key copyWithZone:NULL]);
+    entry->object     = (void*)CFBridgingRetain(object);
+    entry->cost       = cost;
+    entry->referenced = 0;
+
+    NOBCacheShard* shard = &_shards[NOBCacheShardIndex((__bridge id)entry->key)];
+    OSSpinLockLock(&shard->lock);
+    NOBCacheEntry* old = (NOBCacheEntry*)CFDictionaryGetValue(shard->map, entry->key);
+    if (old)
+    {
+        // a replacement takes over the old entry's place in the clock and its reference bit
+        entry->slot       = old->slot;
+        entry->referenced = old->referenced;
+        shard->clock[entry->slot] = entry;
+    }
+    else
+    {
+        NOBCacheShardAppend(shard, entry);
+    }
+    CFDictionarySetValue(shard->map, entry->key, entry);
+    OSAtomicAdd64Barrier((int64_t)cost - (old ? (int64_t)old->cost : 0), &_totalCost);
+    if (!old)
+        OSAtomicIncrement64Barrier(&_count);
+    OSSpinLockUnlock(&shard->lock);
+
+    if (old)
+        NOBCacheEntryFree(old);
+
+    [self _trim];
+}
+
+- (void) removeObjectForKey:(id)key
+{
+    if (!key)
+        return;
+
+    NOBCacheShard* shard = &_shards[NOBCacheShardIndex(key)];
+    OSSpinLockLock(&shard->lock);
+    NOBCacheEntry* entry = (NOBCacheEntry*)CFDictionaryGetValue(shard->map, (__bridge const void*)key);
+    if (entry)
+    {
+        [self _removeEntry:entry fromShard:shard];
+    }
+    OSSpinLockUnlock(&shard->lock);
+
+    if (entry)
+        NOBCacheEntryFree(entry);
+}
+
+- (void) removeAllObjects
+{
+    [self _removeAllCountingEvictions:NO];
+}
+
+- (void) purge
+{
+    [self _removeAllCountingEvictions:YES];
+}
+
+- (void) trimToCost:(NSUInteger)totalCost count:(NSUInteger)count
+{
+    // one shard gives up an entry at a time, the shards take turns so that each approximates LRU over its own entries
+    NSUInteger emptyShards = 0;
+    while ((uint64_t)MAX(_totalCost, 0) > totalCost || (uint64_t)MAX(_count, 0) > count)
+    {
+        NOBCacheShard* shard = &_shards[(NSUInteger)OSAtomicIncrement32(&_evictionCursor) & (kNOBCacheShardCount - 1)];
+        OSSpinLockLock(&shard->lock);
+        NOBCacheEntry* victim = NOBCacheShardNextVictim(shard);
+        if (victim)
+        {
+            [self _removeEntry:victim fromShard:shard];
+            shard->evictions++;
+        }
+        OSSpinLockUnlock(&shard->lock);
+
+        if (victim)
+        {
+            NOBCacheEntryFree(victim);
+            emptyShards = 0;
+        }
+        else if (++emptyShards >= kNOBCacheShardCount)
+        {
+            break; // every shard is empty, the remaining cost belongs to entries being added concurrently
+        }
+    }
+}
+
+#pragma mark - Private
+
+- (void) _trim
+{
+    NSUInteger totalCostLimit = _totalCostLimit;
+    NSUInteger countLimit     = _countLimit;
+    if (totalCostLimit || countLimit)
+        [self trimToCost:(totalCostLimit ?: NSUIntegerMax) count:(countLimit ?: NSUIntegerMax)];
+}
+
+// must hold the shard's lock
+- (void) _removeEntry:(NOBCacheEntry*)entry fromShard:(NOBCacheShard*)shard
+{
+    CFDictionaryRemoveValue(shard->map, entry->key);
+    NOBCacheShardRemove(shard, entry);
+    OSAtomicAdd64Barrier(-(int64_t)entry->cost, &_totalCost);
+    OSAtomicDecrement64Barrier(&_count);
+}
+
+- (void) _removeAllCountingEvictions:(BOOL)evictions
+{
+    for (NSUInteger i = 0; i < kNOBCacheShardCount; i++)
+    {
+        NOBCacheShard*         shard = &_shards[i];
+        CFMutableDictionaryRef fresh = CFDictionaryCreateMutable(kCFAllocatorDefault, 0, &kCFTypeDictionaryKeyCallBacks, NULL);
+
+        OSSpinLockLock(&shard->lock);
+        CFMutableDictionaryRef map        = shard->map;
+        NOBCacheEntry**        clock      = shard->clock;
+        NSUInteger             clockCount = shard->clockCount;
+        int64_t                cost       = 0;
+        for (NSUInteger j = 0; j < clockCount; j++)
+        {
+            cost += (int64_t)clock[j]->cost;
+        }
+        shard->map           = fresh;
+        shard->clock         = NULL;
+        shard->clockCount    = 0;
+        shard->clockCapacity = 0;
+        shard->hand          = 0;
+        if (evictions)
+            shard->evictions += clockCount;
+        OSAtomicAdd64Barrier(-cost, &_totalCost);
+        OSAtomicAdd64Barrier(-(int64_t)clockCount, &_count);
+        OSSpinLockUnlock(&shard->lock);
+
+        // the entries are released outside of the lock
+        CFRelease(map);
+        for (NSUInteger j = 0; j < clockCount; j++)
+        {
+            NOBCacheEntryFree(clock[j]);
+        }
+        free(clock);
+    }
+}
+
+- (uint64_t) _sumStatistic:(size_t)offset
+{
+    uint64_t sum = 0;
+    for (NSUInteger i = 0; i < kNOBCacheShardCount; i++)
+    {
+        NOBCacheShard* shard = &_shards[i];
+        OSSpinLockLock(&shard->lock);
+        sum += *(uint64_t*)((char*)shard + offset);
+        OSSpinLockUnlock(&shard->lock);
+    }
+    return sum;
+}
+
+#if TARGET_OS_IPHONE
+- (void) _memoryWarning:(NSNotification*)note
+{
+    [self purge];
+}
+#endif
+
+@end
+
+#pragma mark - Shard
+
+static void NOBCacheShardAppend(NOBCacheShard* shard, NOBCacheEntry* entry)
+{
+    if (shard->clockCount == shard->clockCapacity)
+    {
+        shard->clockCapacity = MAX(shard->clockCapacity * 2, (NSUInteger)16);
+        shard->clock         = (NOBCacheEntry**)realloc(shard->clock, sizeof(NOBCacheEntry*) * shard->clockCapacity);
+    }
+    entry->slot = shard->clockCount;
+    shard->clock[shard->clockCount++] = entry;
+}
+
+static void NOBCacheShardRemove(NOBCacheShard* shard, NOBCacheEntry* entry)
+{
+    // move the last entry into the hole, the order of the clock only matters to how fair the sweep is
+    NOBCacheEntry* last = shard->clock[--shard->clockCount];
+    last->slot = entry->slot;
+    shard->clock[entry->slot] = last;
+    if (shard->hand >= shard->clockCount)
+        shard->hand = 0;
+}
+
+static NOBCacheEntry* NOBCacheShardNextVictim(NOBCacheShard* shard)
+{
+    // CLOCK: clear reference bits until an entry that has not been hit since the last sweep comes up.
+    // Bounded by one full turn, after which every bit has been cleared.
+    if (!shard->clockCount)
+        return NULL;
+    for (NSUInteger i = 0; i <= shard->clockCount; i++)
+    {
+        NOBCacheEntry* entry = shard->clock[shard->hand];
+        if (!entry->referenced)
+            return entry;
+        entry->referenced = 0;
+        shard->hand = (shard->hand + 1) % shard->clockCount;
+    }
+    return NULL; // not reached
+}
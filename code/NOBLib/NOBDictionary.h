@@ -20,12 +20,111 @@
 
 #import <Foundation/Foundation.h>
 
+/**
+    @enum NOBThreadSafeDictionaryStorage
+    How a \c NOBThreadSafeMutableDictionary stores its entries
+ */
+typedef NS_ENUM(NSInteger, NOBThreadSafeDictionaryStorage)
+{
+    NOBThreadSafeDictionaryStorage_Queue = 0, /**< a dictionary behind a concurrent queue: reads are \c dispatch_sync, writes are asynchronous barriers */
+    NOBThreadSafeDictionaryStorage_Snapshot,  /**< an immutable \c NOBPersistentDictionary snapshot that is replaced on every write.  Reads and enumerations work on the current snapshot without ever waiting on a writer (or a writer on them), \c copy is O(1).  Writes are synchronous and copy O(log32 n) trie nodes. */
+    NOBThreadSafeDictionaryStorage_ReadWriteLock, /**< a dictionary behind an inline \c pthread_rwlock_t, no queue.  Reads run concurrently, writes are synchronous. */
+    NOBThreadSafeDictionaryStorage_AdaptiveLock,  /**< a dictionary behind an inline mutex that is spun on briefly before the thread parks, no queue.  Reads and writes are synchronous and exclusive.  The cheapest to create, for the many dictionaries that are rarely contended.  Using the dictionary from inside one of its own enumeration blocks deadlocks. */
+};
+
+/**
+    @enum NOBThreadSafeDictionaryOptions
+    Options for \c -[NOBThreadSafeMutableDictionary initWithStorage:options:]
+ */
+typedef NS_OPTIONS(NSUInteger, NOBThreadSafeDictionaryOptions)
+{
+    NOBThreadSafeDictionaryOption_None       = 0,
+    NOBThreadSafeDictionaryOption_Statistics = 1 << 0, /**< keep \c NOBThreadSafeDictionaryStatistics.  Costs a clock read and a few atomic adds per operation. */
+};
+
+/**
+    @struct NOBThreadSafeDictionaryStatistics
+    Counters of a \c NOBThreadSafeMutableDictionary created with \c NOBThreadSafeDictionaryOption_Statistics, for telling hot dictionaries from cold ones.
+    @par An operation is one call on the dictionary: an enumeration is one read, \c addEntriesFromDictionary: is one write.  The wait is the time from the call until the operation had the dictionary to itself (or to its readers): waiting on the lock, or on the queue until the block started.
+ */
+typedef struct _NOBThreadSafeDictionaryStatistics
+{
+    uint64_t       reads;       /**< number of read operations */
+    uint64_t       writes;      /**< number of write operations */
+    NSTimeInterval waitTime;    /**< total time operations waited */
+    NSTimeInterval longestWait; /**< the longest any single operation waited */
+} NOBThreadSafeDictionaryStatistics;
+
+/**
+    Error domain of the errors \c NOBThreadSafeMutableDictionary reports
+ */
+FOUNDATION_EXPORT NSString* const NOBDictionaryErrorDomain;
+/**
+    Key in the \c userInfo of a \c NOBDictionaryError_ComputeRaised error for the \c NSException that was raised
+ */
+FOUNDATION_EXPORT NSString* const NOBDictionaryExceptionKey;
+
+/**
+    @enum NOBDictionaryError
+    Error codes in \c NOBDictionaryErrorDomain
+ */
+typedef NS_ENUM(NSInteger, NOBDictionaryError)
+{
+    NOBDictionaryError_ComputeRaised = 1, /**< the compute block of \c objectForKey:orComputeWithBlock:error: raised, the exception is under \c NOBDictionaryExceptionKey */
+    NOBDictionaryError_CorruptSnapshot,   /**< the snapshot file of a \c NOBJournaledMutableDictionary could not be read */
+    NOBDictionaryError_JournalFailed,     /**< the journal file of a \c NOBJournaledMutableDictionary could not be created, the POSIX error is under \c NSUnderlyingErrorKey */
+};
+
+/**
+    @class NOBDictionaryTransaction
+    @discussion the mutable view of a \c NOBThreadSafeMutableDictionary handed to \c performTransaction:.  Only valid for the duration of the transaction block, raises an \c NSInternalInconsistencyException if used after.
+ */
+@interface NOBDictionaryTransaction : NSMutableDictionary
+
+/**
+    @see -[NOBThreadSafeMutableDictionary replaceObjectForKey:withObject:]
+ */
+- (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object;
+
+/**
+    @see -[NOBThreadSafeMutableDictionary exclusiveSetObject:forKey:]
+ */
+- (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key;
+
+@end
+
 /**
     @discussion NOBThreadSafeMutableDictionary provides a thread safe dictionary
     @note Though \c NOBThreadSafeMutableDictionary is optimized, it still enforces thread synchronization and is therefore vastly slower than a normal NSMutableDictionary
+    @note Writes with \c NOBThreadSafeDictionaryStorage_Queue are asynchronous, with every other storage they are synchronous.
  */
 @interface NOBThreadSafeMutableDictionary : NSMutableDictionary
 
+/**
+    @discussion initialize an empty dictionary with the given storage.  The other initializers use \c NOBThreadSafeDictionaryStorage_Queue.
+ */
+- (id) initWithStorage:(NOBThreadSafeDictionaryStorage)storage;
+
+/**
+    @discussion initialize an empty dictionary with the given storage and options.
+ */
+- (id) initWithStorage:(NOBThreadSafeDictionaryStorage)storage options:(NOBThreadSafeDictionaryOptions)options;
+
+/**
+    @return the storage the dictionary was initialized with
+ */
+@property (nonatomic, readonly) NOBThreadSafeDictionaryStorage storage;
+
+/**
+    @return the counters since the dictionary was created (or since \c resetStatistics).  All zero if the dictionary was not created with \c NOBThreadSafeDictionaryOption_Statistics.
+ */
+@property (nonatomic, readonly) NOBThreadSafeDictionaryStatistics statistics;
+
+/**
+    @discussion zero the counters of \c statistics
+ */
+- (void) resetStatistics;
+
 /**
     @discussion safely replace the object for a specified key.
     @param key the key to replace the object with.  Raises an \c NSInvalidArgumentException if \c nil.
@@ -42,4 +141,93 @@
  */
 - (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key;
 
+/**
+    @discussion get the object for a key, computing and storing it on a miss.  Single flight: while one caller computes the object for a key, concurrent callers for the same key wait for that computation instead of running their own.  The block runs without any of the dictionary's locks held.
+    @param key the key.  Raises an \c NSInvalidArgumentException if \c nil.
+    @param block computes the object for \a key.  Returns the object, or \c nil and an error on failure, or \c nil and no error to cancel.
+    @param error set if the computation failed
+    @return the object for \a key, \c nil if the computation failed or was cancelled.
+    @par On failure the caller and every waiter get \c nil and the error, nothing is stored, and the next call computes again.  On cancellation the caller gets \c nil and one of the waiters takes over the computation with its own block.  If \a block raises, waiters get a \c NOBDictionaryError_ComputeRaised error and the exception is rethrown to the caller whose block raised.
+    @par If an object for \a key was set while the block ran, that object wins and is returned.
+ */
+- (id) objectForKey:(id<NSCopying>)key orComputeWithBlock:(id (^)(NSError** error))block error:(NSError**)error;
+
+/**
+    @discussion \c objectForKey:orComputeWithBlock:error: without the error
+ */
+- (id) objectForKey:(id<NSCopying>)key orComputeWithBlock:(id (^)(NSError** error))block;
+
+/**
+    @discussion apply any number of reads and mutations as one atomic write.  Other threads see either none or all of the mutations, and readers are interrupted once (a single barrier) instead of once per mutation.
+    @param block called synchronously with a mutable view of the dictionary.  Read and mutate through \a transaction only: using the dictionary itself from \a block deadlocks (queue and lock storages) or is not part of the transaction (snapshot storage).
+    @note if \a block raises, none of the mutations are applied and the exception is rethrown once the transaction ends.  The queue and lock storages mutate in place and undo the mutations before other threads can see them.
+ */
+- (void) performTransaction:(void (^)(NOBDictionaryTransaction* transaction))block;
+
+@end
+
+/**
+    Number of lock stripes a \c NOBStripedMutableDictionary spreads its entries over
+ */
+#define kNOBStripedDictionaryStripeCount (64)
+
+/**
+    @discussion NOBStripedMutableDictionary provides a thread safe dictionary built for many threads doing mostly reads
+    @par Entries are spread over \c kNOBStripedDictionaryStripeCount stripes by key hash, each stripe being a dictionary behind its own spin lock.  A read holds its stripe's lock just for the lookup (no block, no queue), and a write only stalls readers of the same stripe.
+    @par Writes are synchronous: the change is visible to every thread once the method returns (unlike \c NOBThreadSafeMutableDictionary, which applies them asynchronously).
+    @note operations that span the whole dictionary (\c count, \c allKeys, enumeration, copies) visit the stripes one at a time, so they do not see concurrent writes atomically.  Enumeration blocks are called on a snapshot, never while a lock is held.
+ */
+@interface NOBStripedMutableDictionary : NSMutableDictionary
+
+/**
+    @see -[NOBThreadSafeMutableDictionary replaceObjectForKey:withObject:]
+ */
+- (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object;
+
+/**
+    @see -[NOBThreadSafeMutableDictionary exclusiveSetObject:forKey:]
+ */
+- (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key;
+
+@end
+
+/**
+    Journal size past which a \c NOBJournaledMutableDictionary compacts by default
+ */
+#define kNOBJournaledDictionaryDefaultCompactionThreshold (1024 * 1024)
+
+/**
+    @discussion NOBJournaledMutableDictionary is a thread safe dictionary that keeps itself on disk without ever rewriting all of its entries for a single change.
+    @par Every mutation appends a compact binary record to a journal file.  Records are encoded by the mutating thread, collected in memory and written in batches on a background queue, so a mutation costs neither a file write nor a full serialization.  Reads go straight to the in memory \c NOBThreadSafeMutableDictionary and never wait on the disk.
+    @par Once the journal grows past \c compactionThreshold, the background queue switches to a new journal and writes a snapshot of the entries.  The old journal is deleted once the snapshot is on disk.
+    @par On init, the snapshot is loaded and the journals written after it are replayed.  A record torn by a crash ends the replay.  Records that were not written yet when the process died are lost; call \c synchronize for a change that must survive.
+    @note keys and objects must be property list objects (\c NSString, \c NSNumber, \c NSData, \c NSDate, \c NSArray, \c NSDictionary), mutations raise an \c NSInvalidArgumentException otherwise.
+ */
+@interface NOBJournaledMutableDictionary : NSMutableDictionary
+
+/**
+    Designated initializer
+    @param path the snapshot file.  The journals are kept next to it.
+    @param storage the storage of the in memory dictionary.  \c NOBThreadSafeDictionaryStorage_Snapshot makes the copy taken for a compaction O(1).
+    @param error set on failure
+    @return the dictionary with the entries from disk, or \c nil if the snapshot is unreadable or the journal cannot be created
+ */
+- (instancetype) initWithPath:(NSString*)path storage:(NOBThreadSafeDictionaryStorage)storage error:(NSError**)error;
+
+/** the snapshot file */
+@property (nonatomic, readonly) NSString* path;
+/** the journal size that triggers a compaction.  Default is \c kNOBJournaledDictionaryDefaultCompactionThreshold. */
+@property (nonatomic, assign) unsigned long long compactionThreshold;
+
+/**
+    Write every pending record and wait for the journal to be on disk
+    @return \c NO if the journal could not be written, the records are retried on the next write
+ */
+- (BOOL) synchronize;
+
+/**
+    Compact now instead of waiting for \c compactionThreshold, in the background
+ */
+- (void) compact;
+
 @end
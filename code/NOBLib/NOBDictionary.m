@@ -19,34 +19,280 @@
  */
 
 #import "NOBDictionary.h"
+#import "NOBDictionaryJournal.h"
+#import "NOBPersistentDictionary.h"
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <mach/mach_time.h>
+#include <unistd.h>
+
+// Attempts to take an adaptive lock before parking the thread, enough to cover a short critical section on another core
+#define kNOBDictionaryAdaptiveSpinCount (100)
+
+NS_INLINE void NOBDictionaryValidate(id key, id object, SEL cmd, BOOL checkObject);
+NS_INLINE void NOBDictionaryValidate(id key, id object, SEL cmd, BOOL checkObject)
+{
+    // raise before any lock is taken, an exception must never leave a lock held
+    if (!key || (checkObject && !object))
+    {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:[NSString stringWithFormat:@"%@: %@ cannot be nil", NSStringFromSelector(cmd), (key ? @"object" : @"key")]
+                                     userInfo:nil];
+    }
+}
+
+
+// NOBThreadSafeDictionaryOption_Statistics, in mach absolute time units
+typedef struct _NOBDictionaryCounters
+{
+    volatile int64_t reads;
+    volatile int64_t writes;
+    volatile int64_t waitTicks;
+    volatile int64_t longestWaitTicks;
+} NOBDictionaryCounters;
+
+NS_INLINE void NOBDictionaryCountersNote(NOBDictionaryCounters* counters, BOOL write, uint64_t start);
+NS_INLINE void NOBDictionaryCountersNote(NOBDictionaryCounters* counters, BOOL write, uint64_t start)
+{
+    int64_t wait = (int64_t)(mach_absolute_time() - start);
+    OSAtomicIncrement64(write ? &counters->writes : &counters->reads);
+    OSAtomicAdd64(wait, &counters->waitTicks);
+    int64_t longest;
+    while (wait > (longest = counters->longestWaitTicks) && !OSAtomicCompareAndSwap64(longest, wait, &counters->longestWaitTicks))
+    {
+    }
+}
+
+NS_INLINE NSTimeInterval NOBDictionaryTicksToSeconds(int64_t ticks);
+NS_INLINE NSTimeInterval NOBDictionaryTicksToSeconds(int64_t ticks)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (!s_timebase.denom)
+        mach_timebase_info(&s_timebase); // idempotent, racing threads store the same values
+    return (double)ticks * s_timebase.numer / s_timebase.denom / NSEC_PER_SEC;
+}
+
+// Spin on the mutex briefly, most critical sections are over before parking would even complete
+NS_INLINE void NOBDictionaryAdaptiveLock(pthread_mutex_t* mutex);
+NS_INLINE void NOBDictionaryAdaptiveLock(pthread_mutex_t* mutex)
+{
+    for (NSUInteger i = 0; i < kNOBDictionaryAdaptiveSpinCount; i++)
+    {
+        if (0 == pthread_mutex_trylock(mutex))
+            return;
+    }
+    pthread_mutex_lock(mutex);
+}
+
+// NOBThreadSafeDictionaryStorage_Snapshot
+@interface NOBThreadSafeSnapshotMutableDictionary : NOBThreadSafeMutableDictionary
+@end
+
+// NOBThreadSafeDictionaryStorage_ReadWriteLock and NOBThreadSafeDictionaryStorage_AdaptiveLock, the queue storage with the queue swapped for a lock
+@interface NOBThreadSafeLockedMutableDictionary : NOBThreadSafeMutableDictionary
+@end
+@interface NOBThreadSafeReadWriteLockMutableDictionary : NOBThreadSafeLockedMutableDictionary
+@end
+@interface NOBThreadSafeAdaptiveLockMutableDictionary : NOBThreadSafeLockedMutableDictionary
+@end
+
+@interface NOBThreadSafeMutableDictionary ()
+{
+@protected
+    NSMutableDictionary*   _innerDictionary;
+    NOBDictionaryCounters* _counters; // NULL unless NOBThreadSafeDictionaryOption_Statistics
+}
+@end
+
+@interface NOBThreadSafeMutableDictionary (Private)
+- (id) _initWithoutQueue;
+- (void) _prepare;
+// the queue storage primitives, overridden by NOBThreadSafeLockedMutableDictionary
+- (void) _performRead:(dispatch_block_t)block;
+- (void) _performWrite:(dispatch_block_t)block;        // may return before block runs
+- (void) _performWriteAndWait:(dispatch_block_t)block;
+@end
+
+@interface NOBDictionaryTransaction (Private)
+- (id) _initWithDictionary:(NSMutableDictionary*)dictionary snapshot:(NOBPersistentDictionary*)snapshot;
+- (NOBPersistentDictionary*) _finish; // ends the transaction, returns the resulting snapshot
+- (void) _rollback;                     // undoes the in place mutations, call before _finish
+@end
+
+NSString* const NOBDictionaryErrorDomain  = @"NOBDictionaryErrorDomain";
+NSString* const NOBDictionaryExceptionKey = @"NOBDictionaryException";
+
+// A computation in progress for objectForKey:orComputeWithBlock:error:, waiters wait on the group
+@interface NOBDictionaryFlight : NSObject
+{
+    @public
+    dispatch_group_t  _group;
+    __strong id       _result;
+    __strong NSError* _error;
+}
+@end
+
+@implementation NOBDictionaryFlight
+
+- (id) init
+{
+    if (self = [super init])
+    {
+        _group = dispatch_group_create();
+        dispatch_group_enter(_group);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    dispatch_release(_group);
+}
+
+@end
 
-static volatile int32_t s_threadSafeDictionaryCount = 0;
 @implementation NOBThreadSafeMutableDictionary
 {
 @private
-    NSMutableDictionary* _innerDictionary;
     dispatch_queue_t _queue;
-    char* _queueName;
+
+    // single flight computations, shared by all storages
+    OSSpinLock                _flightLock;
+    __strong NSMutableDictionary* _flights; // key -> NOBDictionaryFlight
 }
 
 - (void) _prepare
 {
-    uint32_t count = OSAtomicIncrement32(&s_threadSafeDictionaryCount);
-    NSString* queueName = [NSString stringWithFormat:@"NOBThreadSafeMutableDictionaryQueue_%u", count];
-
-    _queueName = (char*)malloc(queueName.length);
-    _queueName = memcpy(_queueName, queueName.UTF8String, queueName.length);
-    _queue = dispatch_queue_create(_queueName, DISPATCH_QUEUE_CONCURRENT);
+    // one constant label for every instance, a per instance label cost a string format and a malloc for every dictionary
+    _queue = dispatch_queue_create("NOBThreadSafeMutableDictionaryQueue", DISPATCH_QUEUE_CONCURRENT);
 }
 
 - (void) dealloc
 {
-    dispatch_release(_queue);
-    free(_queueName);
+    if (_queue)
+        dispatch_release(_queue);
+    free(_counters);
+}
+
+- (void) _performRead:(dispatch_block_t)block
+{
+    if (!_counters)
+    {
+        dispatch_sync(_queue, block);
+        return;
+    }
+
+    uint64_t               start    = mach_absolute_time();
+    NOBDictionaryCounters* counters = _counters;
+    dispatch_sync(_queue, ^() {
+        NOBDictionaryCountersNote(counters, NO, start);
+        block();
+    });
+}
+
+- (void) _performWrite:(dispatch_block_t)block
+{
+    if (!_counters)
+    {
+        dispatch_barrier_async(_queue, block);
+        return;
+    }
+
+    // the wait of an asynchronous write is the time it spent queued.  block keeps self, and so counters, alive.
+    uint64_t               start    = mach_absolute_time();
+    NOBDictionaryCounters* counters = _counters;
+    dispatch_barrier_async(_queue, ^() {
+        NOBDictionaryCountersNote(counters, YES, start);
+        block();
+    });
+}
+
+- (void) _performWriteAndWait:(dispatch_block_t)block
+{
+    if (!_counters)
+    {
+        dispatch_barrier_sync(_queue, block);
+        return;
+    }
+
+    uint64_t               start    = mach_absolute_time();
+    NOBDictionaryCounters* counters = _counters;
+    dispatch_barrier_sync(_queue, ^() {
+        NOBDictionaryCountersNote(counters, YES, start);
+        block();
+    });
+}
+
+// for subclasses that do not use the queue
+- (id) _initWithoutQueue
+{
+    return [super init];
 }
 
 #pragma mark - init Overrides
 
+- (id) initWithStorage:(NOBThreadSafeDictionaryStorage)storage
+{
+    return [self initWithStorage:storage options:NOBThreadSafeDictionaryOption_None];
+}
+
+- (id) initWithStorage:(NOBThreadSafeDictionaryStorage)storage options:(NOBThreadSafeDictionaryOptions)options
+{
+    NOBThreadSafeMutableDictionary* dictionary;
+    switch (storage)
+    {
+        case NOBThreadSafeDictionaryStorage_Snapshot:
+            dictionary = [[NOBThreadSafeSnapshotMutableDictionary alloc] init];
+            break;
+        case NOBThreadSafeDictionaryStorage_ReadWriteLock:
+            dictionary = [[NOBThreadSafeReadWriteLockMutableDictionary alloc] init];
+            break;
+        case NOBThreadSafeDictionaryStorage_AdaptiveLock:
+            dictionary = [[NOBThreadSafeAdaptiveLockMutableDictionary alloc] init];
+            break;
+        case NOBThreadSafeDictionaryStorage_Queue:
+        default:
+            dictionary = [self init];
+            break;
+    }
+
+    if (dictionary && (options & NOBThreadSafeDictionaryOption_Statistics))
+    {
+        dictionary->_counters = (NOBDictionaryCounters*)calloc(1, sizeof(NOBDictionaryCounters));
+    }
+    return dictionary;
+}
+
+- (NOBThreadSafeDictionaryStorage) storage
+{
+    return NOBThreadSafeDictionaryStorage_Queue;
+}
+
+- (NOBThreadSafeDictionaryStatistics) statistics
+{
+    NOBThreadSafeDictionaryStatistics statistics = { 0, 0, 0, 0 };
+    if (_counters)
+    {
+        statistics.reads       = (uint64_t)_counters->reads;
+        statistics.writes      = (uint64_t)_counters->writes;
+        statistics.waitTime    = NOBDictionaryTicksToSeconds(_counters->waitTicks);
+        statistics.longestWait = NOBDictionaryTicksToSeconds(_counters->longestWaitTicks);
+    }
+    return statistics;
+}
+
+- (void) resetStatistics
+{
+    if (_counters)
+    {
+        _counters->reads            = 0;
+        _counters->writes           = 0;
+        _counters->waitTicks        = 0;
+        _counters->longestWaitTicks = 0;
+        OSMemoryBarrier();
+    }
+}
+
 - (id) init
 {
     if (self = [super init])
@@ -133,175 +379,175 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 - (NSArray*) allKeys
 {
     __block NSArray* allKeys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         allKeys = _innerDictionary.allKeys;
-    });
+    }];
     return allKeys;
 }
 
 - (NSArray*) allKeysForObject:(id)anObject
 {
     __block NSArray* allKeys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         allKeys = [_innerDictionary allKeysForObject:anObject];
-    });
+    }];
     return allKeys;
 }
 
 - (NSArray*) allValues
 {
     __block NSArray* allValues;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         allValues = _innerDictionary.allValues;
-    });
+    }];
     return allValues;
 }
 
 - (NSString*) descriptionInStringsFileFormat
 {
     __block NSString* description;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         description = _innerDictionary.descriptionInStringsFileFormat;
-    });
+    }];
     return description;
 }
 
 - (NSString*) descriptionWithLocale:(id)locale
 {
     __block NSString* description;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         description = [_innerDictionary descriptionWithLocale:locale];
-    });
+    }];
     return description;
 }
 
 - (NSString*) descriptionWithLocale:(id)locale indent:(NSUInteger)level
 {
     __block NSString* description;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         description = [_innerDictionary descriptionWithLocale:locale indent:level];
-    });
+    }];
     return description;
 }
 
 - (BOOL)isEqualToDictionary:(NSDictionary*)otherDictionary
 {
     __block BOOL isEqual;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         isEqual = [_innerDictionary isEqualToDictionary:otherDictionary];
-    });
+    }];
     return isEqual;
 }
 
 - (NSEnumerator*) objectEnumerator
 {
     __block NSEnumerator* enumerator;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         enumerator = _innerDictionary.objectEnumerator;
-    });
+    }];
     return enumerator;
 }
 
 - (NSArray*) objectsForKeys:(NSArray*)keys notFoundMarker:(id)marker
 {
     __block NSArray* objects;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         objects = [_innerDictionary objectsForKeys:keys notFoundMarker:marker];
-    });
+    }];
     return objects;
 }
 
 - (BOOL) writeToFile:(NSString*)path atomically:(BOOL)useAuxiliaryFile
 {
     __block BOOL success;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         success = [_innerDictionary writeToFile:path atomically:useAuxiliaryFile];
-    });
+    }];
     return success;
 }
 
 - (BOOL) writeToURL:(NSURL*)url atomically:(BOOL)atomically
 {
     __block BOOL success;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         success = [_innerDictionary writeToURL:url atomically:atomically];
-    });
+    }];
     return success;
 }
 
 - (NSArray*) keysSortedByValueUsingSelector:(SEL)comparator
 {
     __block NSArray* keys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         keys = [_innerDictionary keysSortedByValueUsingSelector:comparator];
-    });
+    }];
     return keys;
 }
 
 - (void)getObjects:(id __unsafe_unretained [])objects andKeys:(id __unsafe_unretained [])keys
 {
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         [_innerDictionary getObjects:objects andKeys:keys];
-    });
+    }];
 }
 
 - (id)objectForKeyedSubscript:(id)key
 {
     __block id obj;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         obj = [_innerDictionary objectForKeyedSubscript:key];
-    });
+    }];
     return obj;
 }
 
 #if NS_BLOCKS_AVAILABLE
 - (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
 {
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         [_innerDictionary enumerateKeysAndObjectsUsingBlock:block];
-    });
+    }];
 }
 
 - (void)enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block
 {
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         [_innerDictionary enumerateKeysAndObjectsWithOptions:opts usingBlock:block];
-    });
+    }];
 }
 
 - (NSArray*) keysSortedByValueUsingComparator:(NSComparator)cmptr
 {
     __block NSArray* keys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         keys = [_innerDictionary keysSortedByValueUsingComparator:cmptr];
-    });
+    }];
     return keys;
 }
 
 - (NSArray*) keysSortedByValueWithOptions:(NSSortOptions)opts usingComparator:(NSComparator)cmptr
 {
     __block NSArray* keys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         keys = [_innerDictionary keysSortedByValueWithOptions:opts usingComparator:cmptr];
-    });
+    }];
     return keys;
 }
 
 - (NSSet*) keysOfEntriesPassingTest:(BOOL (^)(id key, id obj, BOOL *stop))predicate
 {
     __block NSSet* keys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         keys = [_innerDictionary keysOfEntriesPassingTest:predicate];
-    });
+    }];
     return keys;
 }
 
 - (NSSet*) keysOfEntriesWithOptions:(NSEnumerationOptions)opts passingTest:(BOOL (^)(id key, id obj, BOOL *stop))predicate
 {
     __block NSSet* keys;
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         keys = [_innerDictionary keysOfEntriesWithOptions:opts passingTest:predicate];
-    });
+    }];
     return keys;
 }
 #endif
@@ -326,25 +572,29 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 
 - (void) setObject:(id)anObject forKey:(id <NSCopying>)aKey
 {
-    dispatch_barrier_async(_queue, ^() {
+    NOBDictionaryValidate(aKey, anObject, _cmd, YES);
+
+    [self _performWrite:^() {
         [_innerDictionary setObject:anObject forKey:aKey];
-    });
+    }];
 }
 
 - (void) removeObjectForKey:(id)aKey
 {
-    dispatch_barrier_async(_queue, ^() {
+    NOBDictionaryValidate(aKey, nil, _cmd, NO);
+
+    [self _performWrite:^() {
         [_innerDictionary removeObjectForKey:aKey];
-    });
+    }];
 }
 
 - (NSUInteger) count
 {
     __block NSUInteger count;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         count = _innerDictionary.count;
-    });
+    }];
     return count;
 }
 
@@ -352,9 +602,9 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 {
     __block id obj;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         obj = [_innerDictionary objectForKey:aKey];
-    });
+    }];
     return obj;
 }
 
@@ -362,9 +612,9 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 {
     __block NSEnumerator* enumerator;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         enumerator = _innerDictionary.keyEnumerator;
-    });
+    }];
     return enumerator;
 }
 
@@ -372,9 +622,9 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 {
     __block id copy;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         copy = [_innerDictionary copyWithZone:zone];
-    });
+    }];
     return copy;
 }
 
@@ -382,9 +632,9 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 {
     __block id copy;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         copy = [[[self class] allocWithZone:zone] initWithDictionary:_innerDictionary];
-    });
+    }];
     return copy;
 }
 
@@ -392,9 +642,9 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 {
     __block NSString* dscr;
 
-    dispatch_sync(_queue, ^() {
+    [self _performRead:^() {
         dscr = _innerDictionary.description;
-    });
+    }];
     return dscr;
 }
 
@@ -402,62 +652,1395 @@ static volatile int32_t s_threadSafeDictionaryCount = 0;
 
 - (void) addEntriesFromDictionary:(NSDictionary*)otherDictionary
 {
-    dispatch_barrier_async(_queue, ^() {
+    [self _performWrite:^() {
         [_innerDictionary addEntriesFromDictionary:otherDictionary];
-    });
+    }];
 }
 
 - (void) removeAllObjects
 {
-    dispatch_barrier_async(_queue, ^() {
+    [self _performWrite:^() {
         [_innerDictionary removeAllObjects];
-    });
+    }];
 }
 
 - (void) removeObjectsForKeys:(NSArray*)keyArray
 {
-    dispatch_barrier_async(_queue, ^() {
+    [self _performWrite:^() {
         [_innerDictionary removeObjectsForKeys:keyArray];
-    });
+    }];
 }
 
 - (void) setDictionary:(NSDictionary*)otherDictionary
 {
-    dispatch_barrier_async(_queue, ^() {
+    [self _performWrite:^() {
         [_innerDictionary setDictionary:otherDictionary];
-    });
+    }];
 }
 
 - (void) setObject:(id)obj forKeyedSubscript:(id<NSCopying>)key
 {
-    dispatch_barrier_async(_queue, ^() {
+    NOBDictionaryValidate(key, obj, _cmd, NO);
+
+    [self _performWrite:^() {
         [_innerDictionary setObject:obj forKeyedSubscript:key];
-    });
+    }];
 }
 
 #pragma mark - Enhancements
 
 - (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object
 {
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
     __block id obj;
 
-    dispatch_sync(_queue, ^() {
+    [self _performWriteAndWait:^() {
         obj = [_innerDictionary objectForKey:key];
         [_innerDictionary setObject:object forKey:key];
-    });
+    }];
     return obj;
 }
 
 - (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key
 {
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
     __block id obj;
 
-    dispatch_sync(_queue, ^() {
+    [self _performWriteAndWait:^() {
         obj = [_innerDictionary objectForKey:key];
         if (!obj)
             [_innerDictionary setObject:object forKey:key];
-    });
+    }];
+    return obj;
+}
+
+- (id) objectForKey:(id<NSCopying>)key orComputeWithBlock:(id (^)(NSError** error))block
+{
+    return [self objectForKey:key orComputeWithBlock:block error:NULL];
+}
+
+- (id) objectForKey:(id<NSCopying>)key orComputeWithBlock:(id (^)(NSError** error))block error:(NSError**)error
+{
+    NOBDictionaryValidate(key, block, _cmd, YES);
+
+    id obj = [self objectForKey:key];
+    while (!obj)
+    {
+        NOBDictionaryFlight* flight = nil;
+        BOOL                 leader = NO;
+
+        OSSpinLockLock(&_flightLock);
+        if (!_flights)
+            _flights = [[NSMutableDictionary alloc] init];
+        flight = [_flights objectForKey:key];
+        if (!flight)
+        {
+            flight = [[NOBDictionaryFlight alloc] init];
+            [_flights setObject:flight forKey:key];
+            leader = YES;
+        }
+        OSSpinLockUnlock(&_flightLock);
+
+        if (!leader)
+        {
+            dispatch_group_wait(flight->_group, DISPATCH_TIME_FOREVER);
+            if (flight->_result || flight->_error)
+            {
+                if (!flight->_result && error)
+                    *error = flight->_error;
+                return flight->_result;
+            }
+            continue; // the computation was cancelled, compute it ourselves
+        }
+
+        NSError*     computeError = nil;
+        NSException* exception    = nil;
+        @try {
+            // a finished flight stores its object before it is removed, checking again here cannot miss it
+            obj = [self objectForKey:key];
+            if (!obj)
+                obj = block(&computeError);
+        }
+        @catch (NSException* e) {
+            exception    = e;
+            obj          = nil;
+            computeError = [NSError errorWithDomain:NOBDictionaryErrorDomain
+                                               code:NOBDictionaryError_ComputeRaised
+                                           userInfo:@{ NOBDictionaryExceptionKey : e }];
+        }
+
+        if (obj)
+        {
+            id existing = [self exclusiveSetObject:obj forKey:key];
+            if (existing)
+                obj = existing;
+            computeError = nil;
+        }
+
+        OSSpinLockLock(&_flightLock);
+        [_flights removeObjectForKey:key];
+        OSSpinLockUnlock(&_flightLock);
+
+        flight->_result = obj;
+        flight->_error  = computeError;
+        dispatch_group_leave(flight->_group);
+
+        if (exception)
+            @throw exception;
+        if (!obj)
+        {
+            if (error)
+                *error = computeError;
+            return nil; // failed or cancelled
+        }
+    }
     return obj;
 }
 
+- (void) performTransaction:(void (^)(NOBDictionaryTransaction* transaction))block
+{
+    __block NSException* exception = nil;
+
+    // one barrier for the whole transaction, exceptions must not unwind through GCD or past a held lock
+    [self _performWriteAndWait:^() {
+        NOBDictionaryTransaction* transaction = [[NOBDictionaryTransaction alloc] _initWithDictionary:_innerDictionary snapshot:nil];
+        @try {
+            block(transaction);
+        }
+        @catch (NSException* e) {
+            exception = e;
+            [transaction _rollback]; // all or nothing, still under the barrier
+        }
+        [transaction _finish];
+    }];
+
+    if (exception)
+        @throw exception;
+}
+
+@end
+
+#pragma mark - NOBThreadSafeSnapshotMutableDictionary
+
+@implementation NOBThreadSafeSnapshotMutableDictionary
+{
+@private
+    OSSpinLock                        _snapshotLock; // only held to copy and retain _snapshot
+    __strong NOBPersistentDictionary* _snapshot;
+    pthread_mutex_t                   _writeLock;    // serializes writers, readers never take it
+}
+
+- (id) _initWithSnapshot:(NOBPersistentDictionary*)snapshot
+{
+    if (self = [super _initWithoutQueue])
+    {
+        _snapshotLock = OS_SPINLOCK_INIT;
+        _snapshot     = (snapshot ? snapshot : [[NOBPersistentDictionary alloc] init]);
+        pthread_mutex_init(&_writeLock, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    pthread_mutex_destroy(&_writeLock);
+}
+
+- (NOBPersistentDictionary*) _snapshot
+{
+    uint64_t start = (_counters ? mach_absolute_time() : 0);
+    OSSpinLockLock(&_snapshotLock);
+    NOBPersistentDictionary* snapshot = _snapshot; // retained before the lock is released
+    OSSpinLockUnlock(&_snapshotLock);
+    if (_counters)
+        NOBDictionaryCountersNote(_counters, NO, start);
+    return snapshot;
+}
+
+// Replace the snapshot with the one block derives from the current one.  Arguments must be validated before, block must not raise.
+- (void) _write:(NOBPersistentDictionary* (^)(NOBPersistentDictionary* current))block
+{
+    uint64_t start = (_counters ? mach_absolute_time() : 0);
+    pthread_mutex_lock(&_writeLock);
+    if (_counters)
+        NOBDictionaryCountersNote(_counters, YES, start);
+    NOBPersistentDictionary* old      = _snapshot;
+    NOBPersistentDictionary* snapshot = block(old);
+    if (snapshot != old)
+    {
+        OSSpinLockLock(&_snapshotLock);
+        _snapshot = snapshot;
+        OSSpinLockUnlock(&_snapshotLock);
+    }
+    pthread_mutex_unlock(&_writeLock);
+    // old is released here, outside of both locks
+}
+
+- (NOBThreadSafeDictionaryStorage) storage
+{
+    return NOBThreadSafeDictionaryStorage_Snapshot;
+}
+
+#pragma mark - init Overrides
+
+- (id) init
+{
+    return [self _initWithSnapshot:nil];
+}
+
+- (id) initWithCapacity:(NSUInteger)numItems
+{
+    return [self _initWithSnapshot:nil];
+}
+
+- (id) initWithObjects:(NSArray*)objects forKeys:(NSArray*)keys
+{
+    return [self _initWithSnapshot:[[NOBPersistentDictionary alloc] initWithObjects:objects forKeys:keys]];
+}
+
+- (id) initWithDictionary:(NSDictionary*)otherDictionary
+{
+    return [self _initWithSnapshot:[[NOBPersistentDictionary alloc] initWithDictionary:otherDictionary]];
+}
+
+- (id) initWithDictionary:(NSDictionary*)otherDictionary copyItems:(BOOL)flag
+{
+    return [self _initWithSnapshot:[[NOBPersistentDictionary alloc] initWithDictionary:otherDictionary copyItems:flag]];
+}
+
+- (id) initWithObjects:(const id [])objects forKeys:(const id<NSCopying> [])keys count:(NSUInteger)cnt
+{
+    return [self _initWithSnapshot:[[NOBPersistentDictionary alloc] initWithObjects:objects forKeys:keys count:cnt]];
+}
+
+- (id) initWithContentsOfFile:(NSString*)path
+{
+    NSDictionary* contents = [[NSDictionary alloc] initWithContentsOfFile:path];
+    return (contents ? [self initWithDictionary:contents] : nil);
+}
+
+- (id) initWithContentsOfURL:(NSURL*)url
+{
+    NSDictionary* contents = [[NSDictionary alloc] initWithContentsOfURL:url];
+    return (contents ? [self initWithDictionary:contents] : nil);
+}
+
+#pragma mark - Get Overrides
+
+- (NSArray*) allKeys
+{
+    return [self _snapshot].allKeys;
+}
+
+- (NSArray*) allKeysForObject:(id)anObject
+{
+    return [[self _snapshot] allKeysForObject:anObject];
+}
+
+- (NSArray*) allValues
+{
+    return [self _snapshot].allValues;
+}
+
+- (NSString*) descriptionInStringsFileFormat
+{
+    return [self _snapshot].descriptionInStringsFileFormat;
+}
+
+- (NSString*) descriptionWithLocale:(id)locale
+{
+    return [[self _snapshot] descriptionWithLocale:locale];
+}
+
+- (NSString*) descriptionWithLocale:(id)locale indent:(NSUInteger)level
+{
+    return [[self _snapshot] descriptionWithLocale:locale indent:level];
+}
+
+- (BOOL)isEqualToDictionary:(NSDictionary*)otherDictionary
+{
+    return [[self _snapshot] isEqualToDictionary:otherDictionary];
+}
+
+- (NSEnumerator*) objectEnumerator
+{
+    return [self _snapshot].objectEnumerator;
+}
+
+- (NSArray*) objectsForKeys:(NSArray*)keys notFoundMarker:(id)marker
+{
+    return [[self _snapshot] objectsForKeys:keys notFoundMarker:marker];
+}
+
+- (BOOL) writeToFile:(NSString*)path atomically:(BOOL)useAuxiliaryFile
+{
+    return [[self _snapshot] writeToFile:path atomically:useAuxiliaryFile];
+}
+
+- (BOOL) writeToURL:(NSURL*)url atomically:(BOOL)atomically
+{
+    return [[self _snapshot] writeToURL:url atomically:atomically];
+}
+
+- (NSArray*) keysSortedByValueUsingSelector:(SEL)comparator
+{
+    return [[self _snapshot] keysSortedByValueUsingSelector:comparator];
+}
+
+- (void)getObjects:(id __unsafe_unretained [])objects andKeys:(id __unsafe_unretained [])keys
+{
+    [[self _snapshot] getObjects:objects andKeys:keys];
+}
+
+- (id)objectForKeyedSubscript:(id)key
+{
+    return [self objectForKey:key];
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    // no lock is held while block runs, writers carry on with new snapshots
+    [[self _snapshot] enumerateKeysAndObjectsUsingBlock:block];
+}
+
+- (void)enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    [[self _snapshot] enumerateKeysAndObjectsWithOptions:opts usingBlock:block];
+}
+
+- (NSArray*) keysSortedByValueUsingComparator:(NSComparator)cmptr
+{
+    return [[self _snapshot] keysSortedByValueUsingComparator:cmptr];
+}
+
+- (NSArray*) keysSortedByValueWithOptions:(NSSortOptions)opts usingComparator:(NSComparator)cmptr
+{
+    return [[self _snapshot] keysSortedByValueWithOptions:opts usingComparator:cmptr];
+}
+
+- (NSSet*) keysOfEntriesPassingTest:(BOOL (^)(id key, id obj, BOOL *stop))predicate
+{
+    return [[self _snapshot] keysOfEntriesPassingTest:predicate];
+}
+
+- (NSSet*) keysOfEntriesWithOptions:(NSEnumerationOptions)opts passingTest:(BOOL (^)(id key, id obj, BOOL *stop))predicate
+{
+    return [[self _snapshot] keysOfEntriesWithOptions:opts passingTest:predicate];
+}
+#endif
+
+- (NSUInteger) count
+{
+    return [self _snapshot].count;
+}
+
+- (id) objectForKey:(id)aKey
+{
+    return [[self _snapshot] objectForKey:aKey];
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+    return [self _snapshot].keyEnumerator;
+}
+
+- (id) copyWithZone:(NSZone*)zone
+{
+    // the snapshot is immutable, sharing it is the copy
+    return [self _snapshot];
+}
+
+- (id) mutableCopyWithZone:(NSZone*)zone
+{
+    return [[[self class] allocWithZone:zone] _initWithSnapshot:[self _snapshot]];
+}
+
+- (NSString*) description
+{
+    return [self _snapshot].description;
+}
+
+#pragma mark - Set Overrides
+
+- (void) setObject:(id)anObject forKey:(id <NSCopying>)aKey
+{
+    NOBDictionaryValidate(aKey, anObject, _cmd, YES);
+
+    id key = [(id<NSCopying>)aKey copyWithZone:NULL];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        return [current dictionaryBySettingObject:anObject forKey:key];
+    }];
+}
+
+- (void) removeObjectForKey:(id)aKey
+{
+    NOBDictionaryValidate(aKey, nil, _cmd, NO);
+
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        return [current dictionaryByRemovingObjectForKey:aKey];
+    }];
+}
+
+#pragma mark - Extension Overrides
+
+- (void) addEntriesFromDictionary:(NSDictionary*)otherDictionary
+{
+    // copy first, otherDictionary could be mutated by another thread while the write lock is held
+    NSDictionary* entries = [otherDictionary copy];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        return [current dictionaryByAddingEntriesFromDictionary:entries];
+    }];
+}
+
+- (void) removeAllObjects
+{
+    NOBPersistentDictionary* empty = [[NOBPersistentDictionary alloc] init];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        return empty;
+    }];
+}
+
+- (void) removeObjectsForKeys:(NSArray*)keyArray
+{
+    NSArray* keys = [keyArray copy];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        for (id key in keys)
+        {
+            current = [current dictionaryByRemovingObjectForKey:key];
+        }
+        return current;
+    }];
+}
+
+- (void) setDictionary:(NSDictionary*)otherDictionary
+{
+    NOBPersistentDictionary* replacement = [[NOBPersistentDictionary alloc] initWithDictionary:otherDictionary];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        return replacement;
+    }];
+}
+
+- (void) setObject:(id)obj forKeyedSubscript:(id<NSCopying>)key
+{
+    if (obj)
+        [self setObject:obj forKey:key];
+    else
+        [self removeObjectForKey:key];
+}
+
+#pragma mark - Enhancements
+
+- (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object
+{
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
+    __block id obj;
+    id keyCopy = [key copyWithZone:NULL];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        obj = [current objectForKey:keyCopy];
+        return [current dictionaryBySettingObject:object forKey:keyCopy];
+    }];
+    return obj;
+}
+
+- (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key
+{
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
+    __block id obj;
+    id keyCopy = [key copyWithZone:NULL];
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        obj = [current objectForKey:keyCopy];
+        return (obj ? current : [current dictionaryBySettingObject:object forKey:keyCopy]);
+    }];
+    return obj;
+}
+
+- (void) performTransaction:(void (^)(NOBDictionaryTransaction* transaction))block
+{
+    __block NSException* exception = nil;
+
+    // the transaction works on its own snapshot, published once at the end
+    [self _write:^NOBPersistentDictionary*(NOBPersistentDictionary* current) {
+        NOBDictionaryTransaction* transaction = [[NOBDictionaryTransaction alloc] _initWithDictionary:nil snapshot:current];
+        @try {
+            block(transaction);
+        }
+        @catch (NSException* e) {
+            exception = e;
+        }
+        NOBPersistentDictionary* result = [transaction _finish];
+        return (exception ? current : result);
+    }];
+
+    if (exception)
+        @throw exception;
+}
+
+@end
+
+#pragma mark - NOBThreadSafeLockedMutableDictionary
+
+@implementation NOBThreadSafeLockedMutableDictionary
+{
+@private
+    BOOL             _readWrite;
+    pthread_rwlock_t _rwlock; // NOBThreadSafeDictionaryStorage_ReadWriteLock
+    pthread_mutex_t  _mutex;  // NOBThreadSafeDictionaryStorage_AdaptiveLock
+}
+
+// called by every initializer in place of creating the queue
+- (void) _prepare
+{
+    _readWrite = (NOBThreadSafeDictionaryStorage_ReadWriteLock == self.storage);
+    if (_readWrite)
+        pthread_rwlock_init(&_rwlock, NULL);
+    else
+        pthread_mutex_init(&_mutex, NULL);
+}
+
+- (void) dealloc
+{
+    if (_readWrite)
+        pthread_rwlock_destroy(&_rwlock);
+    else
+        pthread_mutex_destroy(&_mutex);
+}
+
+// Like the queue storage, block must not raise: arguments are validated before the lock is taken
+- (void) _performRead:(dispatch_block_t)block
+{
+    uint64_t start = (_counters ? mach_absolute_time() : 0);
+    if (_readWrite)
+        pthread_rwlock_rdlock(&_rwlock);
+    else
+        NOBDictionaryAdaptiveLock(&_mutex);
+    if (_counters)
+        NOBDictionaryCountersNote(_counters, NO, start);
+
+    block();
+
+    if (_readWrite)
+        pthread_rwlock_unlock(&_rwlock);
+    else
+        pthread_mutex_unlock(&_mutex);
+}
+
+- (void) _performWrite:(dispatch_block_t)block
+{
+    [self _performWriteAndWait:block];
+}
+
+- (void) _performWriteAndWait:(dispatch_block_t)block
+{
+    uint64_t start = (_counters ? mach_absolute_time() : 0);
+    if (_readWrite)
+        pthread_rwlock_wrlock(&_rwlock);
+    else
+        NOBDictionaryAdaptiveLock(&_mutex);
+    if (_counters)
+        NOBDictionaryCountersNote(_counters, YES, start);
+
+    block();
+
+    if (_readWrite)
+        pthread_rwlock_unlock(&_rwlock);
+    else
+        pthread_mutex_unlock(&_mutex);
+}
+
+@end
+
+@implementation NOBThreadSafeReadWriteLockMutableDictionary
+
+- (NOBThreadSafeDictionaryStorage) storage
+{
+    return NOBThreadSafeDictionaryStorage_ReadWriteLock;
+}
+
+@end
+
+@implementation NOBThreadSafeAdaptiveLockMutableDictionary
+
+- (NOBThreadSafeDictionaryStorage) storage
+{
+    return NOBThreadSafeDictionaryStorage_AdaptiveLock;
+}
+
+@end
+
+#pragma mark - NOBDictionaryTransaction
+
+@implementation NOBDictionaryTransaction
+{
+@private
+    __strong NSMutableDictionary*     _dictionary; // queue storage, mutated in place under the barrier
+    __strong NSMutableDictionary*     _undo;       // queue storage, the original object of each key mutated
+    __strong NSMutableSet*            _undoAdded;  // queue storage, the keys mutated that were not present
+    __strong NSDictionary*            _original;   // queue storage, the whole original dictionary once removeAllObjects was called
+    __strong NOBPersistentDictionary* _snapshot;   // snapshot storage, the working snapshot
+    BOOL                              _valid;
+}
+
+- (id) _initWithDictionary:(NSMutableDictionary*)dictionary snapshot:(NOBPersistentDictionary*)snapshot
+{
+    if (self = [super init])
+    {
+        _dictionary = dictionary;
+        _snapshot   = snapshot;
+        _valid      = YES;
+    }
+    return self;
+}
+
+- (NOBPersistentDictionary*) _finish
+{
+    _valid      = NO;
+    _dictionary = nil;
+    _undo       = nil;
+    _undoAdded  = nil;
+    _original   = nil;
+    return _snapshot;
+}
+
+- (void) _rollback
+{
+    if (!_dictionary)
+        return; // snapshot storage, the working snapshot is simply not published
+
+    if (_original)
+    {
+        [_dictionary setDictionary:_original];
+        return;
+    }
+
+    for (id key in _undoAdded)
+        [_dictionary removeObjectForKey:key];
+    [_dictionary addEntriesFromDictionary:_undo];
+}
+
+// record the original state of aKey the first time it is mutated
+- (void) _recordUndoForKey:(id)aKey
+{
+    if (_original || [_undo objectForKey:aKey] || [_undoAdded containsObject:aKey])
+        return;
+
+    id obj = [_dictionary objectForKey:aKey];
+    if (obj)
+    {
+        if (!_undo)
+            _undo = [[NSMutableDictionary alloc] init];
+        [_undo setObject:obj forKey:aKey];
+    }
+    else
+    {
+        if (!_undoAdded)
+            _undoAdded = [[NSMutableSet alloc] init];
+        [_undoAdded addObject:aKey];
+    }
+}
+
+- (void) _check:(SEL)cmd
+{
+    if (!_valid)
+    {
+        @throw [NSException exceptionWithName:NSInternalInconsistencyException
+                                       reason:[NSString stringWithFormat:@"%@ used outside of its transaction", NSStringFromSelector(cmd)]
+                                     userInfo:nil];
+    }
+}
+
+- (NSUInteger) count
+{
+    [self _check:_cmd];
+    return (_dictionary ? _dictionary.count : _snapshot.count);
+}
+
+- (id) objectForKey:(id)aKey
+{
+    [self _check:_cmd];
+    return (_dictionary ? [_dictionary objectForKey:aKey] : [_snapshot objectForKey:aKey]);
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+    [self _check:_cmd];
+    // a copy of the keys so that the transaction can be mutated while enumerating
+    return (_dictionary ? _dictionary.allKeys.objectEnumerator : _snapshot.keyEnumerator);
+}
+
+- (void) setObject:(id)anObject forKey:(id <NSCopying>)aKey
+{
+    [self _check:_cmd];
+    NOBDictionaryValidate(aKey, anObject, _cmd, YES);
+    if (_dictionary)
+    {
+        [self _recordUndoForKey:aKey];
+        [_dictionary setObject:anObject forKey:aKey];
+    }
+    else
+        _snapshot = [_snapshot dictionaryBySettingObject:anObject forKey:aKey];
+}
+
+- (void) removeObjectForKey:(id)aKey
+{
+    [self _check:_cmd];
+    NOBDictionaryValidate(aKey, nil, _cmd, NO);
+    if (_dictionary)
+    {
+        [self _recordUndoForKey:aKey];
+        [_dictionary removeObjectForKey:aKey];
+    }
+    else
+        _snapshot = [_snapshot dictionaryByRemovingObjectForKey:aKey];
+}
+
+- (void) removeAllObjects
+{
+    [self _check:_cmd];
+    if (_dictionary)
+    {
+        if (!_original)
+        {
+            // restoring the copy is all the undo needed from here on
+            [self _rollback];
+            _original = [_dictionary copy];
+            _undo      = nil;
+            _undoAdded = nil;
+        }
+        [_dictionary removeAllObjects];
+    }
+    else
+        _snapshot = [[NOBPersistentDictionary alloc] init];
+}
+
+- (void) setObject:(id)obj forKeyedSubscript:(id<NSCopying>)key
+{
+    if (obj)
+        [self setObject:obj forKey:key];
+    else
+        [self removeObjectForKey:key];
+}
+
+- (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object
+{
+    id obj = [self objectForKey:key];
+    [self setObject:object forKey:key];
+    return obj;
+}
+
+- (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key
+{
+    NOBDictionaryValidate(key, object, _cmd, YES);
+    id obj = [self objectForKey:key];
+    if (!obj)
+        [self setObject:object forKey:key];
+    return obj;
+}
+
+@end
+
+#pragma mark - NOBStripedMutableDictionary
+
+// One stripe per cache line so that locking one stripe does not invalidate its neighbors
+typedef struct _NOBDictionaryStripe
+{
+    OSSpinLock lock;
+    void*      dictionary; // retained NSMutableDictionary
+    char       padding[64 - sizeof(OSSpinLock) - sizeof(void*)];
+} NOBDictionaryStripe;
+
+NS_INLINE NSUInteger NOBDictionaryStripeIndex(id key);
+NS_INLINE NSUInteger NOBDictionaryStripeIndex(id key)
+{
+    // many hash implementations leave the low bits poorly distributed (i.e. pointers), mix before masking
+    uint32_t h = (uint32_t)[key hash];
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    return h & (kNOBStripedDictionaryStripeCount - 1);
+}
+
+NS_INLINE NSMutableDictionary* NOBDictionaryStripeDictionary(NOBDictionaryStripe* stripe);
+NS_INLINE NSMutableDictionary* NOBDictionaryStripeDictionary(NOBDictionaryStripe* stripe)
+{
+    return (__bridge NSMutableDictionary*)stripe->dictionary;
+}
+
+@implementation NOBStripedMutableDictionary
+{
+@private
+    NOBDictionaryStripe* _stripes;
+}
+
+- (void) _prepare:(NSUInteger)capacity
+{
+    NSUInteger stripeCapacity = capacity / kNOBStripedDictionaryStripeCount + 1;
+    void*      stripes        = NULL;
+    if (0 != posix_memalign(&stripes, 64, sizeof(NOBDictionaryStripe) * kNOBStripedDictionaryStripeCount))
+        @throw [NSException exceptionWithName:NSMallocException reason:@"NOBStripedMutableDictionary out of memory" userInfo:nil];
+    _stripes = (NOBDictionaryStripe*)stripes;
+    for (NSUInteger i = 0; i < kNOBStripedDictionaryStripeCount; i++)
+    {
+        _stripes[i].lock       = OS_SPINLOCK_INIT;
+        _stripes[i].dictionary = (void*)CFBridgingRetain([[NSMutableDictionary alloc] initWithCapacity:stripeCapacity]);
+    }
+}
+
+- (void) dealloc
+{
+    for (NSUInteger i = 0; i < kNOBStripedDictionaryStripeCount; i++)
+    {
+        CFRelease(_stripes[i].dictionary);
+    }
+    free(_stripes);
+}
+
+// Copy each stripe under its lock so that the caller can work on the entries without holding any lock
+- (void) _snapshotKeys:(NSMutableArray*)keys objects:(NSMutableArray*)objects
+{
+    for (NSUInteger i = 0; i < kNOBStripedDictionaryStripeCount; i++)
+    {
+        NOBDictionaryStripe* stripe = &_stripes[i];
+        OSSpinLockLock(&stripe->lock);
+        NSMutableDictionary* dictionary = NOBDictionaryStripeDictionary(stripe);
+        for (id key in dictionary)
+        {
+            [keys addObject:key];
+            if (objects)
+                [objects addObject:[dictionary objectForKey:key]];
+        }
+        OSSpinLockUnlock(&stripe->lock);
+    }
+}
+
+#pragma mark - init Overrides
+
+- (id) init
+{
+    return [self initWithCapacity:0];
+}
+
+- (id) initWithCapacity:(NSUInteger)numItems
+{
+    if (self = [super init])
+    {
+        [self _prepare:numItems];
+    }
+    return self;
+}
+
+- (id) initWithObjects:(const id [])objects forKeys:(const id<NSCopying> [])keys count:(NSUInteger)cnt
+{
+    if (self = [self initWithCapacity:cnt])
+    {
+        for (NSUInteger i = 0; i < cnt; i++)
+        {
+            [self setObject:objects[i] forKey:keys[i]];
+        }
+    }
+    return self;
+}
+
+#pragma mark - Primitive Overrides
+
+- (NSUInteger) count
+{
+    NSUInteger count = 0;
+    for (NSUInteger i = 0; i < kNOBStripedDictionaryStripeCount; i++)
+    {
+        NOBDictionaryStripe* stripe = &_stripes[i];
+        OSSpinLockLock(&stripe->lock);
+        count += NOBDictionaryStripeDictionary(stripe).count;
+        OSSpinLockUnlock(&stripe->lock);
+    }
+    return count;
+}
+
+- (id) objectForKey:(id)aKey
+{
+    if (!aKey)
+        return nil;
+
+    NOBDictionaryStripe* stripe = &_stripes[NOBDictionaryStripeIndex(aKey)];
+    OSSpinLockLock(&stripe->lock);
+    id obj = [NOBDictionaryStripeDictionary(stripe) objectForKey:aKey]; // retained before the lock is released
+    OSSpinLockUnlock(&stripe->lock);
+    return obj;
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+    NSMutableArray* keys = [NSMutableArray array];
+    [self _snapshotKeys:keys objects:nil];
+    return keys.objectEnumerator;
+}
+
+- (void) setObject:(id)anObject forKey:(id <NSCopying>)aKey
+{
+    NOBDictionaryValidate(aKey, anObject, _cmd, YES);
+
+    // copy the key (as NSMutableDictionary would) outside of the lock
+    id key = [(id<NSCopying>)aKey copyWithZone:NULL];
+    NOBDictionaryStripe* stripe = &_stripes[NOBDictionaryStripeIndex(key)];
+    OSSpinLockLock(&stripe->lock);
+    NSMutableDictionary* dictionary = NOBDictionaryStripeDictionary(stripe);
+    id old = [dictionary objectForKey:key]; // a replaced object is released outside of the lock
+    CFDictionarySetValue((__bridge CFMutableDictionaryRef)dictionary, (__bridge const void*)key, (__bridge const void*)anObject);
+    OSSpinLockUnlock(&stripe->lock);
+    old = nil;
+}
+
+- (void) removeObjectForKey:(id)aKey
+{
+    NOBDictionaryValidate(aKey, nil, _cmd, NO);
+
+    NOBDictionaryStripe* stripe = &_stripes[NOBDictionaryStripeIndex(aKey)];
+    OSSpinLockLock(&stripe->lock);
+    NSMutableDictionary* dictionary = NOBDictionaryStripeDictionary(stripe);
+    id old = [dictionary objectForKey:aKey]; // the last release happens outside of the lock
+    [dictionary removeObjectForKey:aKey];
+    OSSpinLockUnlock(&stripe->lock);
+    old = nil;
+}
+
+#pragma mark - Extension Overrides
+
+- (void) setObject:(id)obj forKeyedSubscript:(id<NSCopying>)key
+{
+    if (obj)
+        [self setObject:obj forKey:key];
+    else
+        [self removeObjectForKey:key];
+}
+
+- (id) objectForKeyedSubscript:(id)key
+{
+    return [self objectForKey:key];
+}
+
+- (void) removeAllObjects
+{
+    for (NSUInteger i = 0; i < kNOBStripedDictionaryStripeCount; i++)
+    {
+        NOBDictionaryStripe* stripe = &_stripes[i];
+        NSMutableDictionary* fresh  = [[NSMutableDictionary alloc] init];
+        OSSpinLockLock(&stripe->lock);
+        void* old = stripe->dictionary;
+        stripe->dictionary = (void*)CFBridgingRetain(fresh);
+        OSSpinLockUnlock(&stripe->lock);
+        CFRelease(old); // the entries are released outside of the lock
+    }
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void) enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    [self enumerateKeysAndObjectsWithOptions:0 usingBlock:block];
+}
+
+- (void) enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    NSMutableArray* keys    = [NSMutableArray array];
+    NSMutableArray* objects = [NSMutableArray array];
+    [self _snapshotKeys:keys objects:objects];
+    [keys enumerateObjectsWithOptions:opts usingBlock:^(id key, NSUInteger idx, BOOL* stop) {
+        block(key, [objects objectAtIndex:idx], stop);
+    }];
+}
+#endif
+
+- (id) copyWithZone:(NSZone*)zone
+{
+    NSMutableArray* keys    = [NSMutableArray array];
+    NSMutableArray* objects = [NSMutableArray array];
+    [self _snapshotKeys:keys objects:objects];
+    return [[NSDictionary allocWithZone:zone] initWithObjects:objects forKeys:keys];
+}
+
+- (id) mutableCopyWithZone:(NSZone*)zone
+{
+    NSMutableArray* keys    = [NSMutableArray array];
+    NSMutableArray* objects = [NSMutableArray array];
+    [self _snapshotKeys:keys objects:objects];
+    return [[[self class] allocWithZone:zone] initWithObjects:objects forKeys:keys];
+}
+
+#pragma mark - Enhancements
+
+- (id) replaceObjectForKey:(id<NSCopying>)key withObject:(id)object
+{
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
+    id keyCopy = [key copyWithZone:NULL];
+    NOBDictionaryStripe* stripe = &_stripes[NOBDictionaryStripeIndex(keyCopy)];
+    OSSpinLockLock(&stripe->lock);
+    NSMutableDictionary* dictionary = NOBDictionaryStripeDictionary(stripe);
+    id obj = [dictionary objectForKey:keyCopy];
+    CFDictionarySetValue((__bridge CFMutableDictionaryRef)dictionary, (__bridge const void*)keyCopy, (__bridge const void*)object);
+    OSSpinLockUnlock(&stripe->lock);
+    return obj;
+}
+
+- (id) exclusiveSetObject:(id)object forKey:(id<NSCopying>)key
+{
+    NOBDictionaryValidate(key, object, _cmd, YES);
+
+    id keyCopy = [key copyWithZone:NULL];
+    NOBDictionaryStripe* stripe = &_stripes[NOBDictionaryStripeIndex(keyCopy)];
+    OSSpinLockLock(&stripe->lock);
+    NSMutableDictionary* dictionary = NOBDictionaryStripeDictionary(stripe);
+    id obj = [dictionary objectForKey:keyCopy];
+    if (!obj)
+        CFDictionarySetValue((__bridge CFMutableDictionaryRef)dictionary, (__bridge const void*)keyCopy, (__bridge const void*)object);
+    OSSpinLockUnlock(&stripe->lock);
+    return obj;
+}
+
+@end
+
+#pragma mark - NOBJournaledMutableDictionary
+
+@implementation NOBJournaledMutableDictionary
+{
+@private
+    NOBThreadSafeMutableDictionary* _dictionary;
+    pthread_mutex_t                 _lock;           // orders mutations with their records
+    NSMutableData*                  _pending;        // records not handed to _journalQ yet
+    BOOL                            _flushScheduled;
+    dispatch_queue_t                _journalQ;       // writes, syncs and compactions
+
+    // only used on _journalQ
+    NOBDictionaryJournalRef         _journal;
+    uint64_t                        _generation;     // of _journal
+    NSMutableData*                  _unwritten;      // records a failed write left behind, retried first
+}
+
+@synthesize path = _path;
+@synthesize compactionThreshold = _compactionThreshold;
+
+- (instancetype) initWithPath:(NSString*)path storage:(NOBThreadSafeDictionaryStorage)storage error:(NSError**)error
+{
+    if (self = [super init])
+    {
+        pthread_mutex_init(&_lock, NULL);
+        _path                = [path copy];
+        _compactionThreshold = kNOBJournaledDictionaryDefaultCompactionThreshold;
+
+        uint64_t             snapshotGeneration = 0;
+        NSMutableDictionary* entries            = NOBDictionaryJournalReadSnapshot(_path.fileSystemRepresentation, &snapshotGeneration);
+        if (!entries)
+        {
+            if (error)
+                *error = [NSError errorWithDomain:NOBDictionaryErrorDomain code:NOBDictionaryError_CorruptSnapshot userInfo:@{ NSFilePathErrorKey : _path }];
+            return nil;
+        }
+
+        // replay the journals written since the snapshot, older ones are leftovers of an interrupted compaction
+        uint64_t   generation = snapshotGeneration;
+        NSUInteger replayed   = 0;
+        for (NSNumber* journalGeneration in [self _journalGenerations])
+        {
+            NSString* journalPath = [self _journalPathForGeneration:journalGeneration.unsignedLongLongValue];
+            uint64_t  headerGeneration;
+            if (journalGeneration.unsignedLongLongValue < snapshotGeneration)
+            {
+                unlink(journalPath.fileSystemRepresentation);
+            }
+            else
+            {
+                NSInteger records = NOBDictionaryJournalReplay(journalPath.fileSystemRepresentation, &headerGeneration, entries);
+                if (records > 0)
+                {
+                    generation = MAX(generation, journalGeneration.unsignedLongLongValue);
+                    replayed++;
+                }
+                else if (0 == records)
+                {
+                    // nothing to fold into the snapshot, no need to compact for it
+                    generation = MAX(generation, journalGeneration.unsignedLongLongValue);
+                    unlink(journalPath.fileSystemRepresentation);
+                }
+            }
+        }
+
+        // a fresh journal every launch, the replayed ones stay until the next compaction
+        _generation = generation + 1;
+        _journal    = NOBDictionaryJournalCreate([self _journalPathForGeneration:_generation].fileSystemRepresentation, _generation);
+        if (!_journal)
+        {
+            if (error)
+            {
+                *error = [NSError errorWithDomain:NOBDictionaryErrorDomain
+                                             code:NOBDictionaryError_JournalFailed
+                                         userInfo:@{ NSFilePathErrorKey : _path, NSUnderlyingErrorKey : [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil] }];
+            }
+            return nil;
+        }
+
+        _dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:storage];
+        [_dictionary addEntriesFromDictionary:entries];
+        _pending  = [[NSMutableData alloc] init];
+        _journalQ = dispatch_queue_create("NOBJournaledMutableDictionaryQueue", DISPATCH_QUEUE_SERIAL);
+
+        if (replayed)
+            [self compact];
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    // every mutation's flush retains self, only a failed write can be left
+    if (_journal && _unwritten.length)
+        NOBDictionaryJournalWrite(_journal, _unwritten.bytes, _unwritten.length);
+    NOBDictionaryJournalClose(_journal);
+    if (_journalQ)
+        dispatch_release(_journalQ);
+    pthread_mutex_destroy(&_lock);
+}
+
+#pragma mark - Primitive Overrides
+
+- (NSUInteger) count
+{
+    return _dictionary.count;
+}
+
+- (id) objectForKey:(id)aKey
+{
+    return [_dictionary objectForKey:aKey];
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+    return _dictionary.keyEnumerator;
+}
+
+- (void) setObject:(id)anObject forKey:(id <NSCopying>)aKey
+{
+    NOBDictionaryValidate(aKey, anObject, _cmd, YES);
+
+    NSMutableData* record = [[NSMutableData alloc] init];
+    if (!NOBDictionaryJournalAppendRecord(record, NOBDictionaryJournalOperation_Set, aKey, anObject))
+        [self _raiseNotPropertyList:_cmd];
+
+    [self _mutate:^() {
+        [_dictionary setObject:anObject forKey:aKey];
+    } record:record];
+}
+
+- (void) removeObjectForKey:(id)aKey
+{
+    NOBDictionaryValidate(aKey, nil, _cmd, NO);
+
+    NSMutableData* record = [[NSMutableData alloc] init];
+    if (!NOBDictionaryJournalAppendRecord(record, NOBDictionaryJournalOperation_Remove, aKey, nil))
+        return; // a key that cannot be journaled cannot be in the dictionary
+
+    [self _mutate:^() {
+        [_dictionary removeObjectForKey:aKey];
+    } record:record];
+}
+
+#pragma mark - Extension Overrides
+
+- (id) copyWithZone:(NSZone*)zone
+{
+    return [_dictionary copyWithZone:zone];
+}
+
+- (id) objectForKeyedSubscript:(id)key
+{
+    return [_dictionary objectForKey:key];
+}
+
+- (void) setObject:(id)obj forKeyedSubscript:(id<NSCopying>)key
+{
+    if (obj)
+        [self setObject:obj forKey:key];
+    else
+        [self removeObjectForKey:key];
+}
+
+- (void) addEntriesFromDictionary:(NSDictionary*)otherDictionary
+{
+    // copy first, otherDictionary could be mutated by another thread while it is journaled
+    NSDictionary*  entries = [otherDictionary copy];
+    NSMutableData* records = [[NSMutableData alloc] init];
+    for (id key in entries)
+    {
+        if (!NOBDictionaryJournalAppendRecord(records, NOBDictionaryJournalOperation_Set, key, [entries objectForKey:key]))
+            [self _raiseNotPropertyList:_cmd];
+    }
+
+    [self _mutate:^() {
+        [_dictionary addEntriesFromDictionary:entries];
+    } record:records];
+}
+
+- (void) removeAllObjects
+{
+    NSMutableData* record = [[NSMutableData alloc] init];
+    NOBDictionaryJournalAppendRecord(record, NOBDictionaryJournalOperation_RemoveAll, nil, nil);
+
+    [self _mutate:^() {
+        [_dictionary removeAllObjects];
+    } record:record];
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void) enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    [_dictionary enumerateKeysAndObjectsUsingBlock:block];
+}
+
+- (void) enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    [_dictionary enumerateKeysAndObjectsWithOptions:opts usingBlock:block];
+}
+#endif
+
+#pragma mark - Journal
+
+- (BOOL) synchronize
+{
+    __block BOOL success;
+    dispatch_sync(_journalQ, ^() {
+        success = [self _flush] && NOBDictionaryJournalSync(_journal);
+    });
+    return success;
+}
+
+- (void) compact
+{
+    dispatch_async(_journalQ, ^() {
+        [self _compact];
+    });
+}
+
+- (void) _raiseNotPropertyList:(SEL)cmd
+{
+    @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                   reason:[NSString stringWithFormat:@"%@: keys and objects must be property list objects", NSStringFromSelector(cmd)]
+                                 userInfo:nil];
+}
+
+// Apply a mutation and queue its records in the same order, mutation must not raise
+- (void) _mutate:(dispatch_block_t)mutation record:(NSData*)record
+{
+    pthread_mutex_lock(&_lock);
+    mutation();
+    [_pending appendData:record];
+    BOOL schedule   = !_flushScheduled;
+    _flushScheduled = YES;
+    pthread_mutex_unlock(&_lock);
+
+    if (schedule)
+    {
+        // mutations made while this waits to run are written in the same batch
+        dispatch_async(_journalQ, ^() {
+            [self _flush];
+        });
+    }
+}
+
+// Takes the pending records, prefixed by any a failed write left behind
+- (NSMutableData*) _takePending:(NSDictionary**)entries
+{
+    NSMutableData* fresh = [[NSMutableData alloc] init];
+    pthread_mutex_lock(&_lock);
+    NSMutableData* pending = _pending;
+    _pending        = fresh;
+    _flushScheduled = NO;
+    if (entries)
+        *entries = [_dictionary copy]; // exactly the state after the taken records
+    pthread_mutex_unlock(&_lock);
+
+    if (_unwritten)
+    {
+        [_unwritten appendData:pending];
+        pending    = _unwritten;
+        _unwritten = nil;
+    }
+    return pending;
+}
+
+// on _journalQ
+- (BOOL) _flush
+{
+    NSMutableData* pending = [self _takePending:NULL];
+    if (pending.length && !NOBDictionaryJournalWrite(_journal, pending.bytes, pending.length))
+    {
+        _unwritten = pending;
+        return NO;
+    }
+
+    if (NOBDictionaryJournalLength(_journal) > _compactionThreshold)
+        [self _compact];
+    return YES;
+}
+
+// on _journalQ
+- (void) _compact
+{
+    NSDictionary*  entries = nil;
+    NSMutableData* pending = [self _takePending:&entries];
+
+    uint64_t                generation = _generation + 1;
+    NOBDictionaryJournalRef journal    = NOBDictionaryJournalCreate([self _journalPathForGeneration:generation].fileSystemRepresentation, generation);
+    if (!journal)
+    {
+        _unwritten = pending; // stay on the current journal
+        return;
+    }
+    NOBDictionaryJournalClose(_journal);
+    _journal    = journal;
+    _generation = generation;
+
+    // The taken records start the new journal instead of ending the old one.  entries already has them, and replaying
+    // them on top of it changes nothing: each key ends up as the last of the records left it (and a remove all is replayed first).
+    // Should the snapshot fail, the previous snapshot, the old journal and the new one still add up to the current entries.
+    if (pending.length && !NOBDictionaryJournalWrite(_journal, pending.bytes, pending.length))
+        _unwritten = pending;
+
+    if (NOBDictionaryJournalWriteSnapshot(_path.fileSystemRepresentation, generation, entries))
+    {
+        for (NSNumber* journalGeneration in [self _journalGenerations])
+        {
+            if (journalGeneration.unsignedLongLongValue < generation)
+                unlink([self _journalPathForGeneration:journalGeneration.unsignedLongLongValue].fileSystemRepresentation);
+        }
+    }
+}
+
+- (NSString*) _journalPathForGeneration:(uint64_t)generation
+{
+    return [_path stringByAppendingFormat:@".%llu.%@", generation, kNOBDictionaryJournalFileExtension];
+}
+
+// the generations of the journal files next to the snapshot, oldest first
+- (NSArray*) _journalGenerations
+{
+    NSString*       directory   = _path.stringByDeletingLastPathComponent;
+    NSString*       prefix      = [_path.lastPathComponent stringByAppendingString:@"."];
+    NSString*       suffix      = [@"." stringByAppendingString:kNOBDictionaryJournalFileExtension];
+    NSCharacterSet* nonDigits   = [NSCharacterSet decimalDigitCharacterSet].invertedSet;
+    NSMutableArray* generations = [NSMutableArray array];
+    for (NSString* name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:(directory.length ? directory : @".") error:NULL])
+    {
+        if (name.length > prefix.length + suffix.length && [name hasPrefix:prefix] && [name hasSuffix:suffix])
+        {
+            NSString* generation = [name substringWithRange:NSMakeRange(prefix.length, name.length - prefix.length - suffix.length)];
+            if (NSNotFound == [generation rangeOfCharacterFromSet:nonDigits].location)
+                [generations addObject:@(strtoull(generation.UTF8String, NULL, 10))];
+        }
+    }
+    [generations sortUsingSelector:@selector(compare:)];
+    return generations;
+}
+
 @end
@@ -0,0 +1,108 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    File extension of the journal files next to the snapshot file of a \c NOBJournaledMutableDictionary
+ */
+#define kNOBDictionaryJournalFileExtension @"journal"
+
+#pragma mark - Encoding
+
+/**
+    Append the compact binary encoding of a property list object (\c NSString, \c NSNumber, \c NSData, \c NSDate, \c NSArray and \c NSDictionary of those).
+    @return \c NO if \a object is not a property list object, \a data is left with a partial encoding
+ */
+BOOL NOBDictionaryJournalEncodeObject(id object, NSMutableData* data);
+/**
+    Decode an object encoded with \c NOBDictionaryJournalEncodeObject.  Containers are decoded immutable.
+    @param cursor the first byte to decode, advanced past the object
+    @param end the end of the bytes that can be read
+    @return the object or \c nil if the bytes are malformed
+ */
+id NOBDictionaryJournalDecodeObject(const uint8_t** cursor, const uint8_t* end);
+
+#pragma mark - Records
+
+/**
+    @enum NOBDictionaryJournalOperation
+    The mutation a journal record replays
+ */
+typedef NS_ENUM(uint8_t, NOBDictionaryJournalOperation)
+{
+    NOBDictionaryJournalOperation_Set = 1,  /**< key, object */
+    NOBDictionaryJournalOperation_Remove,   /**< key */
+    NOBDictionaryJournalOperation_RemoveAll,/**< nothing */
+};
+
+/**
+    Append a record: a length, a checksum and the operation with its encoded key and object.
+    @return \c NO if \a key or \a object is not a property list object, \a buffer is left untouched
+ */
+BOOL NOBDictionaryJournalAppendRecord(NSMutableData* buffer, NOBDictionaryJournalOperation operation, id key, id object);
+
+#pragma mark - Files
+
+/**
+    @typedef NOBDictionaryJournalRef
+    An open journal file: a small header with the generation of the snapshot the journal follows, then records.
+    @par Appends are all or nothing, a failed append is truncated off so that the file never has a torn record in the middle.  A torn record at the end (the process died during an append) is ignored by \c NOBDictionaryJournalReplay.
+ */
+typedef struct _NOBDictionaryJournal* NOBDictionaryJournalRef;
+
+/**
+    Create a journal file, truncating any existing file at \a path
+    @return the journal or \c NULL on failure (\c errno is set)
+ */
+NOBDictionaryJournalRef NOBDictionaryJournalCreate(const char* path, uint64_t generation);
+void NOBDictionaryJournalClose(NOBDictionaryJournalRef journal);
+/**
+    Append records encoded with \c NOBDictionaryJournalAppendRecord
+    @return \c YES if every byte was written
+ */
+BOOL NOBDictionaryJournalWrite(NOBDictionaryJournalRef journal, const void* bytes, size_t length);
+/**
+    @return the size of the journal file
+ */
+unsigned long long NOBDictionaryJournalLength(NOBDictionaryJournalRef journal);
+/**
+    Wait for the journal to be on disk (\c fsync)
+ */
+BOOL NOBDictionaryJournalSync(NOBDictionaryJournalRef journal);
+
+/**
+    Apply the records of a journal file to \a dictionary, oldest first, stopping at the first torn or corrupt record.
+    @param generation set to the generation in the journal's header
+    @return the number of records applied, \c -1 if \a path is not a journal file
+ */
+NSInteger NOBDictionaryJournalReplay(const char* path, uint64_t* generation, NSMutableDictionary* dictionary);
+
+/**
+    Write a snapshot of \a dictionary, replacing the file at \a path atomically once it is on disk.
+    @return \c YES on success
+ */
+BOOL NOBDictionaryJournalWriteSnapshot(const char* path, uint64_t generation, NSDictionary* dictionary);
+/**
+    Read a snapshot file
+    @param generation set to the generation of the snapshot, \c 0 if there is no file at \a path
+    @return the entries, empty if there is no file at \a path, \c nil if the file is not a valid snapshot
+ */
+NSMutableDictionary* NOBDictionaryJournalReadSnapshot(const char* path, uint64_t* generation);
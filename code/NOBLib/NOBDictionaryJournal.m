@@ -0,0 +1,518 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBDictionaryJournal.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define kNOBDictionaryJournalMagic    (0x4A424F4E) // "NOBJ"
+#define kNOBDictionarySnapshotMagic   (0x44424F4E) // "NOBD"
+#define kNOBDictionaryJournalVersion  (1)
+#define kNOBDictionaryMaxDecodeDepth  (64)
+
+typedef NS_ENUM(uint8_t, NOBDictionaryJournalTag)
+{
+    NOBDictionaryJournalTag_String = 1,
+    NOBDictionaryJournalTag_Integer,    // zigzag varint
+    NOBDictionaryJournalTag_Unsigned,   // varint, for values past INT64_MAX
+    NOBDictionaryJournalTag_Double,
+    NOBDictionaryJournalTag_True,
+    NOBDictionaryJournalTag_False,
+    NOBDictionaryJournalTag_Data,
+    NOBDictionaryJournalTag_Date,
+    NOBDictionaryJournalTag_Array,
+    NOBDictionaryJournalTag_Dictionary,
+};
+
+typedef struct _NOBDictionaryJournalHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+} NOBDictionaryJournalHeader;
+
+typedef struct _NOBDictionaryJournalRecordHeader
+{
+    uint32_t length;    // of the payload: the operation byte, then the encoded key and object
+    uint32_t checksum;  // of the payload
+} NOBDictionaryJournalRecordHeader;
+
+typedef struct _NOBDictionarySnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t generation;
+    uint64_t length;    // of the encoded dictionary that follows
+    uint32_t checksum;  // of the encoded dictionary
+    uint32_t reserved;
+} NOBDictionarySnapshotHeader;
+
+struct _NOBDictionaryJournal
+{
+    int                fd;
+    unsigned long long length;
+};
+
+static id NOBDictionaryJournalDecode(const uint8_t** cursor, const uint8_t* end, NSUInteger depth);
+static BOOL NOBDictionaryJournalWriteFully(int fd, const void* bytes, size_t length);
+
+// FNV-1a, enough to tell a torn or garbled record from a good one
+NS_INLINE uint32_t NOBDictionaryJournalChecksum(const uint8_t* bytes, size_t length);
+NS_INLINE uint32_t NOBDictionaryJournalChecksum(const uint8_t* bytes, size_t length)
+{
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < length; i++)
+    {
+        h ^= bytes[i];
+        h *= 16777619U;
+    }
+    return h;
+}
+
+NS_INLINE void NOBDictionaryJournalAppendVarint(NSMutableData* data, uint64_t value);
+NS_INLINE void NOBDictionaryJournalAppendVarint(NSMutableData* data, uint64_t value)
+{
+    uint8_t bytes[10];
+    size_t  length = 0;
+    do
+    {
+        uint8_t byte = value & 0x7F;
+        value >>= 7;
+        bytes[length++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    [data appendBytes:bytes length:length];
+}
+
+NS_INLINE BOOL NOBDictionaryJournalReadVarint(const uint8_t** cursor, const uint8_t* end, uint64_t* value);
+NS_INLINE BOOL NOBDictionaryJournalReadVarint(const uint8_t** cursor, const uint8_t* end, uint64_t* value)
+{
+    uint64_t result = 0;
+    for (unsigned shift = 0; shift < 64 && *cursor < end; shift += 7)
+    {
+        uint8_t byte = *(*cursor)++;
+        result |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+        {
+            *value = result;
+            return YES;
+        }
+    }
+    return NO;
+}
+
+#pragma mark - Encoding
+
+BOOL NOBDictionaryJournalEncodeObject(id object, NSMutableData* data)
+{
+    uint8_t tag;
+    if ([object isKindOfClass:[NSString class]])
+    {
+        NSString*  string = object;
+        NSUInteger length = [string lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        tag = NOBDictionaryJournalTag_String;
+        [data appendBytes:&tag length:1];
+        NOBDictionaryJournalAppendVarint(data, length);
+        NSUInteger offset = data.length;
+        [data increaseLengthBy:length];
+        [string getBytes:(uint8_t*)data.mutableBytes + offset
+               maxLength:length
+              usedLength:NULL
+                encoding:NSUTF8StringEncoding
+                 options:0
+                   range:NSMakeRange(0, string.length)
+          remainingRange:NULL];
+    }
+    else if ([object isKindOfClass:[NSNumber class]])
+    {
+        NSNumber* number = object;
+        if ((__bridge CFBooleanRef)number == kCFBooleanTrue || (__bridge CFBooleanRef)number == kCFBooleanFalse)
+        {
+            tag = ((__bridge CFBooleanRef)number == kCFBooleanTrue ? NOBDictionaryJournalTag_True : NOBDictionaryJournalTag_False);
+            [data appendBytes:&tag length:1];
+        }
+        else if (CFNumberIsFloatType((__bridge CFNumberRef)number))
+        {
+            double value = number.doubleValue;
+            tag = NOBDictionaryJournalTag_Double;
+            [data appendBytes:&tag length:1];
+            [data appendBytes:&value length:sizeof(value)];
+        }
+        else if (0 == strcmp(number.objCType, @encode(unsigned long long)) && number.unsignedLongLongValue > INT64_MAX)
+        {
+            tag = NOBDictionaryJournalTag_Unsigned;
+            [data appendBytes:&tag length:1];
+            NOBDictionaryJournalAppendVarint(data, number.unsignedLongLongValue);
+        }
+        else
+        {
+            int64_t value = number.longLongValue;
+            tag = NOBDictionaryJournalTag_Integer;
+            [data appendBytes:&tag length:1];
+            NOBDictionaryJournalAppendVarint(data, ((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+        }
+    }
+    else if ([object isKindOfClass:[NSData class]])
+    {
+        NSData* bytes = object;
+        tag = NOBDictionaryJournalTag_Data;
+        [data appendBytes:&tag length:1];
+        NOBDictionaryJournalAppendVarint(data, bytes.length);
+        [data appendData:bytes];
+    }
+    else if ([object isKindOfClass:[NSDate class]])
+    {
+        NSTimeInterval value = [(NSDate*)object timeIntervalSinceReferenceDate];
+        tag = NOBDictionaryJournalTag_Date;
+        [data appendBytes:&tag length:1];
+        [data appendBytes:&value length:sizeof(value)];
+    }
+    else if ([object isKindOfClass:[NSArray class]])
+    {
+        NSArray* array = object;
+        tag = NOBDictionaryJournalTag_Array;
+        [data appendBytes:&tag length:1];
+        NOBDictionaryJournalAppendVarint(data, array.count);
+        for (id item in array)
+        {
+            if (!NOBDictionaryJournalEncodeObject(item, data))
+                return NO;
+        }
+    }
+    else if ([object isKindOfClass:[NSDictionary class]])
+    {
+        NSDictionary* dictionary = object;
+        __block BOOL  success    = YES;
+        tag = NOBDictionaryJournalTag_Dictionary;
+        [data appendBytes:&tag length:1];
+        NOBDictionaryJournalAppendVarint(data, dictionary.count);
+        [dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL* stop) {
+            if (!NOBDictionaryJournalEncodeObject(key, data) || !NOBDictionaryJournalEncodeObject(obj, data))
+            {
+                success = NO;
+                *stop   = YES;
+            }
+        }];
+        return success;
+    }
+    else
+    {
+        return NO;
+    }
+    return YES;
+}
+
+id NOBDictionaryJournalDecodeObject(const uint8_t** cursor, const uint8_t* end)
+{
+    return NOBDictionaryJournalDecode(cursor, end, 0);
+}
+
+static id NOBDictionaryJournalDecode(const uint8_t** cursor, const uint8_t* end, NSUInteger depth)
+{
+    if (*cursor >= end || depth > kNOBDictionaryMaxDecodeDepth)
+        return nil;
+
+    uint64_t length;
+    double   value;
+    uint8_t  tag = *(*cursor)++;
+    switch (tag)
+    {
+        case NOBDictionaryJournalTag_String:
+        case NOBDictionaryJournalTag_Data:
+        {
+            if (!NOBDictionaryJournalReadVarint(cursor, end, &length) || length > (uint64_t)(end - *cursor))
+                return nil;
+            const uint8_t* bytes = *cursor;
+            *cursor += length;
+            if (NOBDictionaryJournalTag_Data == tag)
+                return [NSData dataWithBytes:bytes length:(NSUInteger)length];
+            return [[NSString alloc] initWithBytes:bytes length:(NSUInteger)length encoding:NSUTF8StringEncoding];
+        }
+        case NOBDictionaryJournalTag_Integer:
+        {
+            if (!NOBDictionaryJournalReadVarint(cursor, end, &length))
+                return nil;
+            return @((int64_t)(length >> 1) ^ -(int64_t)(length & 1));
+        }
+        case NOBDictionaryJournalTag_Unsigned:
+        {
+            if (!NOBDictionaryJournalReadVarint(cursor, end, &length))
+                return nil;
+            return @(length);
+        }
+        case NOBDictionaryJournalTag_Double:
+        case NOBDictionaryJournalTag_Date:
+        {
+            if ((size_t)(end - *cursor) < sizeof(value))
+                return nil;
+            memcpy(&value, *cursor, sizeof(value));
+            *cursor += sizeof(value);
+            if (NOBDictionaryJournalTag_Date == tag)
+                return [NSDate dateWithTimeIntervalSinceReferenceDate:value];
+            return @(value);
+        }
+        case NOBDictionaryJournalTag_True:
+            return @YES;
+        case NOBDictionaryJournalTag_False:
+            return @NO;
+        case NOBDictionaryJournalTag_Array:
+        case NOBDictionaryJournalTag_Dictionary:
+        {
+            // every item takes at least a byte, a count past the remaining bytes is garbage
+            if (!NOBDictionaryJournalReadVarint(cursor, end, &length) || length > (uint64_t)(end - *cursor))
+                return nil;
+            BOOL         isArray = (NOBDictionaryJournalTag_Array == tag);
+            NSUInteger   count   = (NSUInteger)length;
+            NSUInteger   total   = (isArray ? count : count * 2);
+            __strong id* items   = (__strong id*)calloc(MAX(total, (NSUInteger)1), sizeof(id)); // dictionaries: keys, then objects
+            NSUInteger   decoded = 0;
+            for (; decoded < total; decoded++)
+            {
+                NSUInteger index = (isArray ? decoded : (decoded / 2) + (decoded % 2) * count);
+                items[index] = NOBDictionaryJournalDecode(cursor, end, depth + 1);
+                if (!items[index])
+                    break;
+            }
+            id container = nil;
+            if (decoded == total)
+            {
+                if (isArray)
+                    container = [NSArray arrayWithObjects:items count:count];
+                else
+                    container = [NSDictionary dictionaryWithObjects:items + count forKeys:items count:count];
+            }
+            for (NSUInteger i = 0; i < total; i++)
+            {
+                items[i] = nil;
+            }
+            free(items);
+            return container;
+        }
+        default:
+            return nil;
+    }
+}
+
+#pragma mark - Records
+
+BOOL NOBDictionaryJournalAppendRecord(NSMutableData* buffer, NOBDictionaryJournalOperation operation, id key, id object)
+{
+    NSUInteger                       start  = buffer.length;
+    NOBDictionaryJournalRecordHeader header = { 0, 0 };
+    uint8_t                          op     = operation;
+    [buffer appendBytes:&header length:sizeof(header)];
+    [buffer appendBytes:&op length:1];
+
+    BOOL success = YES;
+    if (NOBDictionaryJournalOperation_RemoveAll != operation)
+        success = NOBDictionaryJournalEncodeObject(key, buffer);
+    if (success && NOBDictionaryJournalOperation_Set == operation)
+        success = NOBDictionaryJournalEncodeObject(object, buffer);
+    if (!success)
+    {
+        buffer.length = start;
+        return NO;
+    }
+
+    uint8_t* bytes  = (uint8_t*)buffer.mutableBytes + start;
+    header.length   = (uint32_t)(buffer.length - start - sizeof(header));
+    header.checksum = NOBDictionaryJournalChecksum(bytes + sizeof(header), header.length);
+    memcpy(bytes, &header, sizeof(header));
+    return YES;
+}
+
+#pragma mark - Files
+
+NOBDictionaryJournalRef NOBDictionaryJournalCreate(const char* path, uint64_t generation)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0)
+        return NULL;
+
+    NOBDictionaryJournalHeader header = { kNOBDictionaryJournalMagic, kNOBDictionaryJournalVersion, generation };
+    if (!NOBDictionaryJournalWriteFully(fd, &header, sizeof(header)))
+    {
+        int error = errno;
+        close(fd);
+        unlink(path);
+        errno = error;
+        return NULL;
+    }
+
+    NOBDictionaryJournalRef journal = (NOBDictionaryJournalRef)malloc(sizeof(struct _NOBDictionaryJournal));
+    journal->fd     = fd;
+    journal->length = sizeof(header);
+    return journal;
+}
+
+void NOBDictionaryJournalClose(NOBDictionaryJournalRef journal)
+{
+    if (journal)
+    {
+        close(journal->fd);
+        free(journal);
+    }
+}
+
+BOOL NOBDictionaryJournalWrite(NOBDictionaryJournalRef journal, const void* bytes, size_t length)
+{
+    if (!NOBDictionaryJournalWriteFully(journal->fd, bytes, length))
+    {
+        // cut the partial write off so that later records do not follow a torn one
+        ftruncate(journal->fd, (off_t)journal->length);
+        return NO;
+    }
+    journal->length += length;
+    return YES;
+}
+
+unsigned long long NOBDictionaryJournalLength(NOBDictionaryJournalRef journal)
+{
+    return journal->length;
+}
+
+BOOL NOBDictionaryJournalSync(NOBDictionaryJournalRef journal)
+{
+    return 0 == fsync(journal->fd);
+}
+
+NSInteger NOBDictionaryJournalReplay(const char* path, uint64_t* generation, NSMutableDictionary* dictionary)
+{
+    NSData* contents = [NSData dataWithContentsOfFile:[NSString stringWithUTF8String:path] options:NSDataReadingMappedIfSafe error:NULL];
+    NOBDictionaryJournalHeader header;
+    if (contents.length < sizeof(header))
+        return -1;
+    memcpy(&header, contents.bytes, sizeof(header));
+    if (kNOBDictionaryJournalMagic != header.magic || kNOBDictionaryJournalVersion != header.version)
+        return -1;
+    *generation = header.generation;
+
+    const uint8_t* cursor = (const uint8_t*)contents.bytes + sizeof(header);
+    const uint8_t* end    = (const uint8_t*)contents.bytes + contents.length;
+    NSInteger      count  = 0;
+    while ((size_t)(end - cursor) >= sizeof(NOBDictionaryJournalRecordHeader))
+    {
+        NOBDictionaryJournalRecordHeader record;
+        memcpy(&record, cursor, sizeof(record));
+        const uint8_t* payload = cursor + sizeof(record);
+        if (record.length < 1 || record.length > (size_t)(end - payload) || record.checksum != NOBDictionaryJournalChecksum(payload, record.length))
+            break; // torn or corrupt, nothing after it can be trusted
+        const uint8_t* payloadEnd = payload + record.length;
+
+        @autoreleasepool {
+            NOBDictionaryJournalOperation operation = *payload++;
+            id key    = nil;
+            id object = nil;
+            if (NOBDictionaryJournalOperation_RemoveAll != operation)
+                key = NOBDictionaryJournalDecodeObject(&payload, payloadEnd);
+            if (NOBDictionaryJournalOperation_Set == operation)
+                object = NOBDictionaryJournalDecodeObject(&payload, payloadEnd);
+
+            if (NOBDictionaryJournalOperation_Set == operation && key && object)
+                [dictionary setObject:object forKey:key];
+            else if (NOBDictionaryJournalOperation_Remove == operation && key)
+                [dictionary removeObjectForKey:key];
+            else if (NOBDictionaryJournalOperation_RemoveAll == operation)
+                [dictionary removeAllObjects];
+            else
+                break;
+        }
+        cursor = payloadEnd;
+        count++;
+    }
+    return count;
+}
+
+BOOL NOBDictionaryJournalWriteSnapshot(const char* path, uint64_t generation, NSDictionary* dictionary)
+{
+    NSMutableData*              data   = [NSMutableData dataWithLength:sizeof(NOBDictionarySnapshotHeader)];
+    NOBDictionarySnapshotHeader header = { kNOBDictionarySnapshotMagic, kNOBDictionaryJournalVersion, generation, 0, 0, 0 };
+    if (!NOBDictionaryJournalEncodeObject(dictionary, data))
+        return NO;
+    header.length   = data.length - sizeof(header);
+    header.checksum = NOBDictionaryJournalChecksum((const uint8_t*)data.bytes + sizeof(header), (size_t)header.length);
+    memcpy(data.mutableBytes, &header, sizeof(header));
+
+    // write next to the old snapshot and swap it in once it is on disk
+    char tempPath[PATH_MAX];
+    if (snprintf(tempPath, sizeof(tempPath), "%s.tmp", path) >= (int)sizeof(tempPath))
+        return NO;
+    int fd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NO;
+    BOOL success = NOBDictionaryJournalWriteFully(fd, data.bytes, data.length) && 0 == fsync(fd);
+    close(fd);
+    if (success)
+        success = (0 == rename(tempPath, path));
+    if (!success)
+        unlink(tempPath);
+    return success;
+}
+
+NSMutableDictionary* NOBDictionaryJournalReadSnapshot(const char* path, uint64_t* generation)
+{
+    *generation = 0;
+    NSError* error    = nil;
+    NSData*  contents = [NSData dataWithContentsOfFile:[NSString stringWithUTF8String:path] options:NSDataReadingMappedIfSafe error:&error];
+    if (!contents)
+    {
+        if ([error.domain isEqualToString:NSCocoaErrorDomain] && NSFileReadNoSuchFileError == error.code)
+            return [NSMutableDictionary dictionary];
+        return nil;
+    }
+
+    NOBDictionarySnapshotHeader header;
+    if (contents.length < sizeof(header))
+        return nil;
+    memcpy(&header, contents.bytes, sizeof(header));
+    const uint8_t* cursor = (const uint8_t*)contents.bytes + sizeof(header);
+    const uint8_t* end    = cursor + header.length;
+    if (kNOBDictionarySnapshotMagic != header.magic ||
+        kNOBDictionaryJournalVersion != header.version ||
+        header.length != contents.length - sizeof(header) ||
+        header.checksum != NOBDictionaryJournalChecksum(cursor, (size_t)header.length))
+    {
+        return nil;
+    }
+
+    NSDictionary* entries = NOBDictionaryJournalDecodeObject(&cursor, end);
+    if (![entries isKindOfClass:[NSDictionary class]])
+        return nil;
+    *generation = header.generation;
+    return [entries mutableCopy];
+}
+
+static BOOL NOBDictionaryJournalWriteFully(int fd, const void* bytes, size_t length)
+{
+    const char* cursor = (const char*)bytes;
+    while (length)
+    {
+        ssize_t written = write(fd, cursor, length);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return NO;
+        }
+        cursor += written;
+        length -= (size_t)written;
+    }
+    return YES;
+}
@@ -0,0 +1,118 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @struct NOBIntegerMapKeyCallBacks
+    How a \c NOBIntegerMapRef treats its keys.  Pass \c NULL for integer keys (and pointer keys compared by identity): the key is its own hash and keys are compared with \c ==.
+ */
+typedef struct _NOBIntegerMapKeyCallBacks
+{
+    void       (*retain)(uintptr_t key);            /**< called when a key is added, can be \c NULL */
+    void       (*release)(uintptr_t key);           /**< called when a key is removed, can be \c NULL */
+    NSUInteger (*hash)(uintptr_t key);              /**< can be \c NULL to use the key itself */
+    BOOL       (*equal)(uintptr_t key1, uintptr_t key2); /**< only called for keys that are not \c ==, can be \c NULL to compare with \c == only */
+} NOBIntegerMapKeyCallBacks;
+
+/**
+    Callbacks for object keys that are retained, hashed with \c CFHash and compared with \c CFEqual (\c -hash and \c -isEqual:), like the keys of an \c NSDictionary (but never copied)
+ */
+FOUNDATION_EXPORT const NOBIntegerMapKeyCallBacks kNOBIntegerMapObjectKeyCallBacks;
+
+/**
+    @typedef NOBIntegerMapRef
+    @par A hash map from integer (or pointer) keys to integer values with no boxing: no \c NSNumber, no message sends and no key copies.
+    @par Open addressing with linear probing over a single flat array of key/value pairs, so a lookup is a multiply, a shift and (usually) one cache line.  Removal shifts the following entries back, there are no tombstones.
+    @par Not thread safe.
+ */
+typedef struct _NOBIntegerMap* NOBIntegerMapRef;
+
+/**
+    Create a map
+    @param capacity the number of entries to make room for up front
+    @param callBacks how to treat the keys, \c NULL for integer keys.  Must outlive the map.
+    @return a new map.  Destroy with \c NOBIntegerMapDestroy.
+ */
+NOBIntegerMapRef NOBIntegerMapCreate(NSUInteger capacity, const NOBIntegerMapKeyCallBacks* callBacks);
+void NOBIntegerMapDestroy(NOBIntegerMapRef map);
+
+/**
+    @return the number of entries
+ */
+NSUInteger NOBIntegerMapCount(NOBIntegerMapRef map);
+
+/**
+    Look up a key
+    @param value set to the value for \a key if found.  Can be \c NULL.
+    @return \c YES if \a key is in the map
+ */
+BOOL NOBIntegerMapGet(NOBIntegerMapRef map, uintptr_t key, intptr_t* value);
+/**
+    Set the value for a key, replacing any value it had
+    @return \c YES if \a key was added, \c NO if it was already in the map
+ */
+BOOL NOBIntegerMapSet(NOBIntegerMapRef map, uintptr_t key, intptr_t value);
+/**
+    Remove a key
+    @param value set to the value \a key had if found.  Can be \c NULL.
+    @return \c YES if \a key was in the map
+ */
+BOOL NOBIntegerMapRemove(NOBIntegerMapRef map, uintptr_t key, intptr_t* value);
+/**
+    Remove every entry, keeping the capacity
+ */
+void NOBIntegerMapRemoveAll(NOBIntegerMapRef map);
+
+/**
+    Call \a function for every entry, in no particular order.  The map must not be mutated during the enumeration.
+ */
+void NOBIntegerMapEnumerate(NOBIntegerMapRef map, void (*function)(uintptr_t key, intptr_t value, void* context), void* context);
+
+/**
+    @class NOBIntegerDictionary
+    The Objective-C face of a \c NOBIntegerMapRef with integer keys.  Use \c map to get at the C API on hot paths.
+ */
+@interface NOBIntegerDictionary : NSObject <NSCopying>
+
+- (id) initWithCapacity:(NSUInteger)capacity;
+
+/** the underlying map, owned by the dictionary */
+@property (nonatomic, readonly) NOBIntegerMapRef map;
+/** the number of entries */
+@property (nonatomic, readonly) NSUInteger count;
+
+/**
+    @return \c YES and the value in \a value if \a key is in the dictionary
+ */
+- (BOOL) getInteger:(NSInteger*)value forKey:(NSUInteger)key;
+/**
+    @return the value for \a key or \a defaultValue if \a key is not in the dictionary
+ */
+- (NSInteger) integerForKey:(NSUInteger)key defaultValue:(NSInteger)defaultValue;
+- (void) setInteger:(NSInteger)value forKey:(NSUInteger)key;
+- (void) removeIntegerForKey:(NSUInteger)key;
+- (void) removeAllIntegers;
+
+#if NS_BLOCKS_AVAILABLE
+- (void) enumerateKeysAndIntegersUsingBlock:(void (^)(NSUInteger key, NSInteger value, BOOL* stop))block;
+#endif
+
+@end
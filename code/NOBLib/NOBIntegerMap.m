@@ -0,0 +1,380 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBIntegerMap.h"
+
+// Marks an empty slot.  A key equal to it is kept out of the table, in emptyKeyValue.
+#define kNOBIntegerMapEmptyKey  (UINTPTR_MAX)
+#define kNOBIntegerMapMinCapacity (8)
+
+typedef struct _NOBIntegerMapEntry
+{
+    uintptr_t key;
+    intptr_t  value;
+} NOBIntegerMapEntry;
+
+struct _NOBIntegerMap
+{
+    NOBIntegerMapEntry*              entries;  // capacity entries in one allocation
+    NSUInteger                       capacity; // a power of 2
+    NSUInteger                       used;     // entries in the table
+    unsigned                         shift;    // bits of the multiplied hash to drop, leaving log2(capacity)
+    BOOL                             hasEmptyKey;
+    intptr_t                         emptyKeyValue;
+    const NOBIntegerMapKeyCallBacks* callBacks;
+};
+
+static void NOBIntegerMapObjectRetain(uintptr_t key);
+static void NOBIntegerMapObjectRelease(uintptr_t key);
+static NSUInteger NOBIntegerMapObjectHash(uintptr_t key);
+static BOOL NOBIntegerMapObjectEqual(uintptr_t key1, uintptr_t key2);
+
+const NOBIntegerMapKeyCallBacks kNOBIntegerMapObjectKeyCallBacks = { NOBIntegerMapObjectRetain, NOBIntegerMapObjectRelease, NOBIntegerMapObjectHash, NOBIntegerMapObjectEqual };
+
+static void NOBIntegerMapAllocate(NOBIntegerMapRef map, NSUInteger capacity);
+static void NOBIntegerMapGrow(NOBIntegerMapRef map);
+
+// Fibonacci hashing: the multiply spreads sequential integers and aligned pointers over the high bits, which are the ones kept
+NS_INLINE NSUInteger NOBIntegerMapIndex(NOBIntegerMapRef map, uintptr_t key);
+NS_INLINE NSUInteger NOBIntegerMapIndex(NOBIntegerMapRef map, uintptr_t key)
+{
+    uintptr_t hash = ((map->callBacks && map->callBacks->hash) ? map->callBacks->hash(key) : key);
+#if __LP64__
+    return (NSUInteger)((hash * 0x9E3779B97F4A7C15ULL) >> map->shift);
+#else
+    return (NSUInteger)((hash * 0x9E3779B9U) >> map->shift);
+#endif
+}
+
+NS_INLINE BOOL NOBIntegerMapKeysEqual(NOBIntegerMapRef map, uintptr_t key1, uintptr_t key2);
+NS_INLINE BOOL NOBIntegerMapKeysEqual(NOBIntegerMapRef map, uintptr_t key1, uintptr_t key2)
+{
+    return key1 == key2 || (map->callBacks && map->callBacks->equal && map->callBacks->equal(key1, key2));
+}
+
+// The slot holding key, or the empty slot where it would go
+NS_INLINE NSUInteger NOBIntegerMapFind(NOBIntegerMapRef map, uintptr_t key);
+NS_INLINE NSUInteger NOBIntegerMapFind(NOBIntegerMapRef map, uintptr_t key)
+{
+    NSUInteger mask = map->capacity - 1;
+    NSUInteger i    = NOBIntegerMapIndex(map, key);
+    while (map->entries[i].key != kNOBIntegerMapEmptyKey && !NOBIntegerMapKeysEqual(map, map->entries[i].key, key))
+    {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+#pragma mark - C API
+
+NOBIntegerMapRef NOBIntegerMapCreate(NSUInteger capacity, const NOBIntegerMapKeyCallBacks* callBacks)
+{
+    NOBIntegerMapRef map = (NOBIntegerMapRef)calloc(1, sizeof(struct _NOBIntegerMap));
+    map->callBacks = callBacks;
+
+    // keep the load under 3/4 without growing
+    NSUInteger slots = kNOBIntegerMapMinCapacity;
+    while (slots * 3 / 4 < capacity + 1)
+    {
+        slots <<= 1;
+    }
+    NOBIntegerMapAllocate(map, slots);
+    return map;
+}
+
+void NOBIntegerMapDestroy(NOBIntegerMapRef map)
+{
+    if (map)
+    {
+        NOBIntegerMapRemoveAll(map);
+        free(map->entries);
+        free(map);
+    }
+}
+
+NSUInteger NOBIntegerMapCount(NOBIntegerMapRef map)
+{
+    return map->used + (map->hasEmptyKey ? 1 : 0);
+}
+
+BOOL NOBIntegerMapGet(NOBIntegerMapRef map, uintptr_t key, intptr_t* value)
+{
+    if (kNOBIntegerMapEmptyKey == key)
+    {
+        if (map->hasEmptyKey && value)
+            *value = map->emptyKeyValue;
+        return map->hasEmptyKey;
+    }
+
+    NOBIntegerMapEntry* entry = &map->entries[NOBIntegerMapFind(map, key)];
+    if (kNOBIntegerMapEmptyKey == entry->key)
+        return NO;
+    if (value)
+        *value = entry->value;
+    return YES;
+}
+
+BOOL NOBIntegerMapSet(NOBIntegerMapRef map, uintptr_t key, intptr_t value)
+{
+    if (kNOBIntegerMapEmptyKey == key)
+    {
+        BOOL added = !map->hasEmptyKey;
+        if (added && map->callBacks && map->callBacks->retain)
+            map->callBacks->retain(key);
+        map->hasEmptyKey   = YES;
+        map->emptyKeyValue = value;
+        return added;
+    }
+
+    NOBIntegerMapEntry* entry = &map->entries[NOBIntegerMapFind(map, key)];
+    if (kNOBIntegerMapEmptyKey != entry->key)
+    {
+        entry->value = value;
+        return NO;
+    }
+
+    if ((map->used + 1) * 4 > map->capacity * 3)
+    {
+        NOBIntegerMapGrow(map);
+        entry = &map->entries[NOBIntegerMapFind(map, key)];
+    }
+    if (map->callBacks && map->callBacks->retain)
+        map->callBacks->retain(key);
+    entry->key   = key;
+    entry->value = value;
+    map->used++;
+    return YES;
+}
+
+BOOL NOBIntegerMapRemove(NOBIntegerMapRef map, uintptr_t key, intptr_t* value)
+{
+    if (kNOBIntegerMapEmptyKey == key)
+    {
+        if (!map->hasEmptyKey)
+            return NO;
+        if (value)
+            *value = map->emptyKeyValue;
+        map->hasEmptyKey = NO;
+        if (map->callBacks && map->callBacks->release)
+            map->callBacks->release(key);
+        return YES;
+    }
+
+    NSUInteger mask = map->capacity - 1;
+    NSUInteger i    = NOBIntegerMapFind(map, key);
+    if (kNOBIntegerMapEmptyKey == map->entries[i].key)
+        return NO;
+
+    uintptr_t removedKey = map->entries[i].key;
+    if (value)
+        *value = map->entries[i].value;
+
+    // shift back every following entry whose home slot is not between the hole and itself
+    for (NSUInteger j = (i + 1) & mask; map->entries[j].key != kNOBIntegerMapEmptyKey; j = (j + 1) & mask)
+    {
+        NSUInteger home = NOBIntegerMapIndex(map, map->entries[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask))
+        {
+            map->entries[i] = map->entries[j];
+            i = j;
+        }
+    }
+    map->entries[i].key = kNOBIntegerMapEmptyKey;
+    map->used--;
+
+    if (map->callBacks && map->callBacks->release)
+        map->callBacks->release(removedKey);
+    return YES;
+}
+
+void NOBIntegerMapRemoveAll(NOBIntegerMapRef map)
+{
+    if (map->callBacks && map->callBacks->release)
+    {
+        for (NSUInteger i = 0; i < map->capacity; i++)
+        {
+            if (kNOBIntegerMapEmptyKey != map->entries[i].key)
+                map->callBacks->release(map->entries[i].key);
+        }
+        if (map->hasEmptyKey)
+            map->callBacks->release(kNOBIntegerMapEmptyKey);
+    }
+    memset(map->entries, 0xFF, sizeof(NOBIntegerMapEntry) * map->capacity); // every key becomes kNOBIntegerMapEmptyKey
+    map->used        = 0;
+    map->hasEmptyKey = NO;
+}
+
+void NOBIntegerMapEnumerate(NOBIntegerMapRef map, void (*function)(uintptr_t key, intptr_t value, void* context), void* context)
+{
+    for (NSUInteger i = 0; i < map->capacity; i++)
+    {
+        if (kNOBIntegerMapEmptyKey != map->entries[i].key)
+            function(map->entries[i].key, map->entries[i].value, context);
+    }
+    if (map->hasEmptyKey)
+        function(kNOBIntegerMapEmptyKey, map->emptyKeyValue, context);
+}
+
+#pragma mark - Private
+
+static void NOBIntegerMapAllocate(NOBIntegerMapRef map, NSUInteger capacity)
+{
+    map->entries  = (NOBIntegerMapEntry*)malloc(sizeof(NOBIntegerMapEntry) * capacity);
+    map->capacity = capacity;
+    map->used     = 0;
+    map->shift    = (unsigned)(sizeof(uintptr_t) * 8 - __builtin_ctzl(capacity));
+    memset(map->entries, 0xFF, sizeof(NOBIntegerMapEntry) * capacity);
+}
+
+static void NOBIntegerMapGrow(NOBIntegerMapRef map)
+{
+    NOBIntegerMapEntry* old         = map->entries;
+    NSUInteger          oldCapacity = map->capacity;
+    NOBIntegerMapAllocate(map, oldCapacity * 2);
+    for (NSUInteger i = 0; i < oldCapacity; i++)
+    {
+        if (kNOBIntegerMapEmptyKey != old[i].key)
+        {
+            map->entries[NOBIntegerMapFind(map, old[i].key)] = old[i];
+            map->used++;
+        }
+    }
+    free(old);
+}
+
+static void NOBIntegerMapObjectRetain(uintptr_t key)
+{
+    CFRetain((CFTypeRef)key);
+}
+
+static void NOBIntegerMapObjectRelease(uintptr_t key)
+{
+    CFRelease((CFTypeRef)key);
+}
+
+static NSUInteger NOBIntegerMapObjectHash(uintptr_t key)
+{
+    return CFHash((CFTypeRef)key);
+}
+
+static BOOL NOBIntegerMapObjectEqual(uintptr_t key1, uintptr_t key2)
+{
+    return CFEqual((CFTypeRef)key1, (CFTypeRef)key2);
+}
+
+#pragma mark - NOBIntegerDictionary
+
+@interface NOBIntegerDictionary ()
+{
+    NOBIntegerMapRef _map;
+}
+@end
+
+@implementation NOBIntegerDictionary
+
+@synthesize map = _map;
+
+- (id) init
+{
+    return [self initWithCapacity:0];
+}
+
+- (id) initWithCapacity:(NSUInteger)capacity
+{
+    if (self = [super init])
+    {
+        _map = NOBIntegerMapCreate(capacity, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    NOBIntegerMapDestroy(_map);
+}
+
+- (id) copyWithZone:(NSZone*)zone
+{
+    NOBIntegerDictionary* copy = [[[self class] allocWithZone:zone] initWithCapacity:0];
+    NOBIntegerMapRef      map  = copy->_map;
+
+    // integer keys have no callbacks, the table can be copied as is
+    free(map->entries);
+    NOBIntegerMapAllocate(map, _map->capacity);
+    memcpy(map->entries, _map->entries, sizeof(NOBIntegerMapEntry) * _map->capacity);
+    map->used          = _map->used;
+    map->hasEmptyKey   = _map->hasEmptyKey;
+    map->emptyKeyValue = _map->emptyKeyValue;
+    return copy;
+}
+
+- (NSUInteger) count
+{
+    return NOBIntegerMapCount(_map);
+}
+
+- (BOOL) getInteger:(NSInteger*)value forKey:(NSUInteger)key
+{
+    // NSInteger and intptr_t are the same size but not the same type on 32 bit
+    intptr_t mapValue = 0;
+    if (!NOBIntegerMapGet(_map, key, &mapValue))
+        return NO;
+    if (value)
+        *value = mapValue;
+    return YES;
+}
+
+- (NSInteger) integerForKey:(NSUInteger)key defaultValue:(NSInteger)defaultValue
+{
+    intptr_t value = defaultValue;
+    NOBIntegerMapGet(_map, key, &value);
+    return value;
+}
+
+- (void) setInteger:(NSInteger)value forKey:(NSUInteger)key
+{
+    NOBIntegerMapSet(_map, key, value);
+}
+
+- (void) removeIntegerForKey:(NSUInteger)key
+{
+    NOBIntegerMapRemove(_map, key, NULL);
+}
+
+- (void) removeAllIntegers
+{
+    NOBIntegerMapRemoveAll(_map);
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void) enumerateKeysAndIntegersUsingBlock:(void (^)(NSUInteger key, NSInteger value, BOOL* stop))block
+{
+    BOOL stop = NO;
+    for (NSUInteger i = 0; i < _map->capacity && !stop; i++)
+    {
+        if (kNOBIntegerMapEmptyKey != _map->entries[i].key)
+            block(_map->entries[i].key, _map->entries[i].value, &stop);
+    }
+    if (!stop && _map->hasEmptyKey)
+        block(kNOBIntegerMapEmptyKey, _map->emptyKeyValue, &stop);
+}
+#endif
+
+@end
@@ -23,10 +23,13 @@
 
 #import "NOBCommon.h"
 
+#import "NOBCache.h"
 #import "NOBConversion.h"
 #import "NOBDictionary.h"
+#import "NOBIntegerMap.h"
 #import "NOBLibraryLoader.h"
 #import "NOBLogger.h"
+#import "NOBLogSink.h"
 #import "NOBStringUtils.h"
 #import "NOBTiming.h"
 #import "NOBVersion.h"
@@ -0,0 +1,159 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+#pragma mark - Text
+
+/**
+    The longest prefix \c NOBLogTextEncodePrefix can produce
+ */
+#define kNOBLogTextPrefixMaxLength (96)
+
+/**
+    @struct NOBLogTimestampCache
+    Caches the formatted text of the current second so that \c NSDateFormatter is only used once per second.  Zero it out before first use.
+ */
+typedef struct _NOBLogTimestampCache
+{
+    int64_t second;         /**< the cached second + 1 (so that a zeroed out cache is empty) */
+    char    prefix[32];     /**< "MM/dd/yy hh:mm:ss" */
+    char    suffix[32];     /**< " a z" */
+    uint8_t prefixLength;
+    uint8_t suffixLength;
+} NOBLogTimestampCache;
+
+/**
+    Encode the text that starts every log line: \c "[MM/dd/yy hh:mm:ss.mmm a z][LEVEL] : "
+    @param cache the cache to use, must only be used by one thread at a time
+    @param timestamp the time of the log line
+    @param level the \c NOBLogLevel of the log line
+    @param buffer at least \c kNOBLogTextPrefixMaxLength bytes
+    @return the number of bytes written to \a buffer
+ */
+size_t NOBLogTextEncodePrefix(NOBLogTimestampCache* cache, CFAbsoluteTime timestamp, uint32_t level, char* buffer);
+
+#pragma mark - Binary
+
+/**
+    File extension used for binary log files
+ */
+#define kNOBLogBinaryFileExtension @"blog"
+
+/**
+    Default number of records between sparse index entries
+ */
+#define kNOBLogBinaryDefaultIndexInterval (64)
+
+/**
+    @struct NOBLogBinaryRecordHeader
+    Every record in a binary log file is this header followed by \c length bytes of UTF8 payload.
+    @par A \c level of \c 0 (\c NOBLogLevel_Off) is a message from the \c NOBLogger itself (session start, rollover, purge).
+ */
+typedef struct _NOBLogBinaryRecordHeader
+{
+    CFAbsoluteTime timestamp;   /**< time the record was generated */
+    uint64_t       threadId;    /**< mach thread id of the thread that generated the record */
+    uint32_t       callSiteId;  /**< \c NOBLogCallSiteIdentifier of the \c LOG that generated the record, \c 0 if unknown */
+    uint32_t       length;      /**< number of payload bytes that follow the header */
+    uint8_t        level;       /**< the \c NOBLogLevel */
+    uint8_t        category;    /**< the \c NOBLogCategory, \c 0 if none */
+    uint8_t        reserved[6];
+} NOBLogBinaryRecordHeader;
+
+/**
+    Encode the header a binary log file starts with
+    @param buffer at least \c 16 bytes
+    @return the number of bytes written to \a buffer
+ */
+size_t NOBLogBinaryEncodeFileHeader(void* buffer, uint32_t indexInterval);
+
+/**
+    @typedef NOBLogBinaryIndexRef
+    Builds the sparse index (timestamp -> file offset every N records) that is appended to a binary log file when it is closed.
+ */
+typedef struct _NOBLogBinaryIndex* NOBLogBinaryIndexRef;
+
+NOBLogBinaryIndexRef NOBLogBinaryIndexCreate(uint32_t interval);
+void NOBLogBinaryIndexDestroy(NOBLogBinaryIndexRef index);
+/**
+    Forget all entries, for starting a new file
+ */
+void NOBLogBinaryIndexReset(NOBLogBinaryIndexRef index);
+/**
+    Note that a record was written at \a offset in the file.  Every \c interval records an index entry is made.
+ */
+void NOBLogBinaryIndexNoteRecord(NOBLogBinaryIndexRef index, CFAbsoluteTime timestamp, unsigned long long offset);
+/**
+    @return the number of bytes \c NOBLogBinaryIndexEncode will write
+ */
+size_t NOBLogBinaryIndexEncodedLength(NOBLogBinaryIndexRef index);
+/**
+    Encode the index block
+    @param indexOffset the file offset the index block will be written at (i.e. the end of the records)
+    @param buffer at least \c NOBLogBinaryIndexEncodedLength bytes
+ */
+void NOBLogBinaryIndexEncode(NOBLogBinaryIndexRef index, unsigned long long indexOffset, void* buffer);
+
+/**
+    @typedef NOBLogBinaryReaderRef
+    Reads a binary log file.  Files without an index block (still being written or the app crashed) are indexed by scanning the record headers on open.
+ */
+typedef struct _NOBLogBinaryReader* NOBLogBinaryReaderRef;
+
+/**
+    @return the reader or \c NULL if \a path is not a binary log file
+ */
+NOBLogBinaryReaderRef NOBLogBinaryReaderOpen(const char* path);
+void NOBLogBinaryReaderClose(NOBLogBinaryReaderRef reader);
+/**
+    @return the timestamp of the first record, or \c 0 if there are no records
+ */
+CFAbsoluteTime NOBLogBinaryReaderFirstTimestamp(NOBLogBinaryReaderRef reader);
+
+/**
+    Enumerate the records between \a start and \a end (inclusive) that are at least as important as \a level.  The sparse index is used to seek straight to the first candidate record.  Records from the \c NOBLogger itself (\c level \c 0) are always included.
+    @param block called for each matching record in file order.  \a payload is only valid for the duration of the call.
+    @return the number of records enumerated
+    @note records are in the order they were drained, which can be a few milliseconds out of timestamp order across threads
+ */
+NSUInteger NOBLogBinaryReaderEnumerate(NOBLogBinaryReaderRef reader,
+                                       CFAbsoluteTime start,
+                                       CFAbsoluteTime end,
+                                       uint32_t level,
+                                       void (^block)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop));
+
+/**
+    Export the matching records (see \c NOBLogBinaryReaderEnumerate) as text, in exactly the format of a text log file.
+    @param block called with chunks of text.  \a bytes is only valid for the duration of the call.
+    @return the number of records exported
+ */
+NSUInteger NOBLogBinaryReaderExportText(NOBLogBinaryReaderRef reader,
+                                        CFAbsoluteTime start,
+                                        CFAbsoluteTime end,
+                                        uint32_t level,
+                                        void (^block)(const char* bytes, size_t length));
+
+/**
+    Export the text of the last records at least as important as \a level (see \c NOBLogBinaryReaderExportText).  The sparse index is used to seek near the end of the file so that only about \a minLength bytes of records are rendered, whatever the size of the file.
+    @param minLength the minimum number of bytes of text wanted.  The text starts at a record boundary so it is usually a little longer.
+    @return the text, shorter than \a minLength only if the whole file was rendered
+ */
+NSData* NOBLogBinaryReaderTextTail(NOBLogBinaryReaderRef reader, uint32_t level, size_t minLength);
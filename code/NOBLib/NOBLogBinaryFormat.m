@@ -0,0 +1,522 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogBinaryFormat.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kNOBLogBinaryMagic        "NOBLBIN"
+#define kNOBLogBinaryIndexMagic   "NOBLIDX"
+#define kNOBLogBinaryVersion      (1)
+#define kNOBLogBinaryMaxPayload   (64 * 1024 * 1024) // anything bigger is corruption
+#define kNOBLogBinaryReadSize     (64 * 1024)
+#define kNOBLogBinaryTimeSlop     (1.0)              // records can be out of timestamp order by this much
+
+typedef struct _NOBLogBinaryFileHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t indexInterval;
+} NOBLogBinaryFileHeader;
+
+typedef struct _NOBLogBinaryIndexEntry
+{
+    CFAbsoluteTime timestamp;
+    uint64_t       offset;
+} NOBLogBinaryIndexEntry;
+
+typedef struct _NOBLogBinaryIndexFooter
+{
+    uint64_t indexOffset;
+    uint32_t count;
+    uint32_t reserved;
+    char     magic[8];
+} NOBLogBinaryIndexFooter;
+
+#pragma mark - Text
+
+size_t NOBLogTextEncodePrefix(NOBLogTimestampCache* cache, CFAbsoluteTime timestamp, uint32_t level, char* buffer)
+{
+    // Keep this in sync with log levels
+    static const char* s_logLevelNames[] =
+    {
+        "[OFF]  : ",
+        "[HIGH] : ",
+        "[MID]  : ",
+        "[LOW]  : "
+    };
+
+    int64_t second = (int64_t)floor(timestamp);
+
+    // NSDateFormatter is only consulted when the second changes
+    if (second + 1 != cache->second)
+    {
+        // Creating NSDateFormatters is slow, create a dedicated one for our NOBLogger(s)
+        static __strong NSDateFormatter* s_formatter = nil;
+        static dispatch_once_t onceToken;
+        dispatch_once(&onceToken, ^{
+                          s_formatter = [[NSDateFormatter alloc] init];
+                          s_formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+                          s_formatter.dateFormat = @"MM'/'dd'/'yy hh':'mm':'ss'|'a z";
+                          s_formatter.timeZone = [NSTimeZone localTimeZone];
+                      });
+
+        NSString* timeStamp = nil;
+        @synchronized(s_formatter) {
+            // NSDateFormatter is not thread safe on iOS 5 & 6 and each NOBLogger drains on its own queue
+            timeStamp = [s_formatter stringFromDate:[NSDate dateWithTimeIntervalSinceReferenceDate:(CFAbsoluteTime)second]];
+        }
+
+        char full[sizeof(cache->prefix) + sizeof(cache->suffix)];
+        if (![timeStamp getCString:full maxLength:sizeof(full) encoding:NSUTF8StringEncoding])
+            full[0] = '\0';
+
+        char*  split        = strchr(full, '|');
+        size_t prefixLength = (split ? (size_t)(split - full) : strlen(full));
+        size_t suffixLength = (split ? strlen(split + 1) : 0);
+        prefixLength = MIN(prefixLength, sizeof(cache->prefix));
+        suffixLength = MIN(suffixLength, sizeof(cache->suffix) - 1);
+
+        memcpy(cache->prefix, full, prefixLength);
+        cache->suffix[0] = ' ';
+        if (suffixLength)
+            memcpy(cache->suffix + 1, split + 1, suffixLength);
+        cache->prefixLength = (uint8_t)prefixLength;
+        cache->suffixLength = (uint8_t)(suffixLength ? suffixLength + 1 : 0);
+        cache->second       = second + 1;
+    }
+
+    unsigned int millis = (unsigned int)((timestamp - (CFAbsoluteTime)second) * 1000.0);
+    if (millis > 999)
+        millis = 999;
+    if (level > 3)
+        level = 0;
+
+    char* p = buffer;
+    *p++ = '[';
+    memcpy(p, cache->prefix, cache->prefixLength);
+    p += cache->prefixLength;
+    *p++ = '.';
+    *p++ = (char)('0' + millis / 100);
+    *p++ = (char)('0' + (millis / 10) % 10);
+    *p++ = (char)('0' + millis % 10);
+    memcpy(p, cache->suffix, cache->suffixLength);
+    p += cache->suffixLength;
+    *p++ = ']';
+    memcpy(p, s_logLevelNames[level], 9); // every level name is 9 chars
+    p += 9;
+    return (size_t)(p - buffer);
+}
+
+#pragma mark - Index
+
+struct _NOBLogBinaryIndex
+{
+    uint32_t                interval;
+    uint32_t                recordsSinceEntry;
+    NSUInteger              count;
+    NSUInteger              capacity;
+    NOBLogBinaryIndexEntry* entries;
+};
+
+size_t NOBLogBinaryEncodeFileHeader(void* buffer, uint32_t indexInterval)
+{
+    NOBLogBinaryFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kNOBLogBinaryMagic, sizeof(kNOBLogBinaryMagic));
+    header.version       = kNOBLogBinaryVersion;
+    header.indexInterval = indexInterval;
+    memcpy(buffer, &header, sizeof(header));
+    return sizeof(header);
+}
+
+NOBLogBinaryIndexRef NOBLogBinaryIndexCreate(uint32_t interval)
+{
+    NOBLogBinaryIndexRef index = (NOBLogBinaryIndexRef)calloc(1, sizeof(struct _NOBLogBinaryIndex));
+    index->interval = MAX(interval, (uint32_t)1);
+    return index;
+}
+
+void NOBLogBinaryIndexDestroy(NOBLogBinaryIndexRef index)
+{
+    if (index)
+    {
+        free(index->entries);
+        free(index);
+    }
+}
+
+void NOBLogBinaryIndexReset(NOBLogBinaryIndexRef index)
+{
+    index->count             = 0;
+    index->recordsSinceEntry = 0;
+}
+
+void NOBLogBinaryIndexNoteRecord(NOBLogBinaryIndexRef index, CFAbsoluteTime timestamp, unsigned long long offset)
+{
+    if (index->recordsSinceEntry++ % index->interval)
+        return;
+
+    if (index->count == index->capacity)
+    {
+        NSUInteger              capacity = MAX(index->capacity * 2, (NSUInteger)16);
+        NOBLogBinaryIndexEntry* entries  = (NOBLogBinaryIndexEntry*)realloc(index->entries, capacity * sizeof(NOBLogBinaryIndexEntry));
+        if (!entries)
+            return;
+        index->entries  = entries;
+        index->capacity = capacity;
+    }
+
+    index->entries[index->count].timestamp = timestamp;
+    index->entries[index->count].offset    = offset;
+    index->count++;
+}
+
+size_t NOBLogBinaryIndexEncodedLength(NOBLogBinaryIndexRef index)
+{
+    return index->count * sizeof(NOBLogBinaryIndexEntry) + sizeof(NOBLogBinaryIndexFooter);
+}
+
+void NOBLogBinaryIndexEncode(NOBLogBinaryIndexRef index, unsigned long long indexOffset, void* buffer)
+{
+    size_t entriesLength = index->count * sizeof(NOBLogBinaryIndexEntry);
+    if (entriesLength)
+        memcpy(buffer, index->entries, entriesLength);
+
+    NOBLogBinaryIndexFooter footer;
+    memset(&footer, 0, sizeof(footer));
+    footer.indexOffset = indexOffset;
+    footer.count       = (uint32_t)index->count;
+    memcpy(footer.magic, kNOBLogBinaryIndexMagic, sizeof(kNOBLogBinaryIndexMagic));
+    memcpy((char*)buffer + entriesLength, &footer, sizeof(footer));
+}
+
+#pragma mark - Reader
+
+struct _NOBLogBinaryReader
+{
+    int                     fd;
+    off_t                   dataStart;
+    off_t                   dataEnd;
+    NSUInteger              count;
+    NOBLogBinaryIndexEntry* entries;
+    CFAbsoluteTime          firstTimestamp;
+
+    // sequential read buffer
+    char*                   buffer;
+    size_t                  bufferCapacity;
+    off_t                   bufferOffset;
+    size_t                  bufferLength;
+};
+
+// Returns a pointer to length bytes at offset, reading through the buffer
+static const char* _NOBLogBinaryReaderFetch(NOBLogBinaryReaderRef reader, off_t offset, size_t length)
+{
+    if (offset >= reader->bufferOffset &&
+        offset + (off_t)length <= reader->bufferOffset + (off_t)reader->bufferLength)
+    {
+        return reader->buffer + (offset - reader->bufferOffset);
+    }
+
+    if (length > reader->bufferCapacity)
+    {
+        char* buffer = (char*)realloc(reader->buffer, length);
+        if (!buffer)
+            return NULL;
+        reader->buffer         = buffer;
+        reader->bufferCapacity = length;
+    }
+
+    size_t  toRead    = (size_t)MIN((off_t)reader->bufferCapacity, reader->dataEnd - offset);
+    ssize_t bytesRead = (toRead >= length ? pread(reader->fd, reader->buffer, toRead, offset) : -1);
+    if (bytesRead < (ssize_t)length)
+    {
+        reader->bufferLength = 0;
+        return NULL;
+    }
+
+    reader->bufferOffset = offset;
+    reader->bufferLength = (size_t)bytesRead;
+    return reader->buffer;
+}
+
+static const NOBLogBinaryRecordHeader* _NOBLogBinaryReaderRecordAt(NOBLogBinaryReaderRef reader, off_t offset, const char** pPayload)
+{
+    if (offset + (off_t)sizeof(NOBLogBinaryRecordHeader) > reader->dataEnd)
+        return NULL;
+
+    NOBLogBinaryRecordHeader header;
+    const char*              bytes = _NOBLogBinaryReaderFetch(reader, offset, sizeof(header));
+    if (!bytes)
+        return NULL;
+    memcpy(&header, bytes, sizeof(header));
+    if (header.length > kNOBLogBinaryMaxPayload ||
+        offset + (off_t)(sizeof(header) + header.length) > reader->dataEnd)
+    {
+        return NULL;
+    }
+
+    // header and payload together so that both pointers are valid at the same time
+    bytes = _NOBLogBinaryReaderFetch(reader, offset, sizeof(header) + header.length);
+    if (!bytes)
+        return NULL;
+    if (pPayload)
+        *pPayload = bytes + sizeof(header);
+    return (const NOBLogBinaryRecordHeader*)bytes;
+}
+
+static void _NOBLogBinaryReaderScan(NOBLogBinaryReaderRef reader, uint32_t interval)
+{
+    // no index block, rebuild the index from the record headers
+    NOBLogBinaryIndexRef index  = NOBLogBinaryIndexCreate(interval);
+    off_t                offset = reader->dataStart;
+    const NOBLogBinaryRecordHeader* header;
+    while ((header = _NOBLogBinaryReaderRecordAt(reader, offset, NULL)))
+    {
+        NOBLogBinaryIndexNoteRecord(index, header->timestamp, (unsigned long long)offset);
+        offset += sizeof(NOBLogBinaryRecordHeader) + header->length;
+    }
+
+    // anything past the last whole record is a partial write
+    reader->dataEnd = offset;
+    reader->count   = index->count;
+    reader->entries = index->entries;
+    index->entries  = NULL;
+    NOBLogBinaryIndexDestroy(index);
+}
+
+NOBLogBinaryReaderRef NOBLogBinaryReaderOpen(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat            info;
+    NOBLogBinaryFileHeader header;
+    if (0 != fstat(fd, &info) ||
+        pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        0 != memcmp(header.magic, kNOBLogBinaryMagic, sizeof(kNOBLogBinaryMagic)))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    NOBLogBinaryReaderRef reader = (NOBLogBinaryReaderRef)calloc(1, sizeof(struct _NOBLogBinaryReader));
+    reader->fd             = fd;
+    reader->dataStart      = sizeof(header);
+    reader->dataEnd        = info.st_size;
+    reader->bufferCapacity = kNOBLogBinaryReadSize;
+    reader->buffer         = (char*)malloc(reader->bufferCapacity);
+
+    NOBLogBinaryIndexFooter footer;
+    BOOL                    hasIndex = NO;
+    if (info.st_size >= (off_t)(sizeof(header) + sizeof(footer)) &&
+        pread(fd, &footer, sizeof(footer), info.st_size - sizeof(footer)) == sizeof(footer) &&
+        0 == memcmp(footer.magic, kNOBLogBinaryIndexMagic, sizeof(kNOBLogBinaryIndexMagic)) &&
+        (off_t)(footer.indexOffset + footer.count * sizeof(NOBLogBinaryIndexEntry) + sizeof(footer)) == info.st_size)
+    {
+        size_t entriesLength = footer.count * sizeof(NOBLogBinaryIndexEntry);
+        reader->entries = (NOBLogBinaryIndexEntry*)malloc(MAX(entriesLength, (size_t)1));
+        if (pread(fd, reader->entries, entriesLength, (off_t)footer.indexOffset) == (ssize_t)entriesLength)
+        {
+            reader->count   = footer.count;
+            reader->dataEnd = (off_t)footer.indexOffset;
+            hasIndex        = YES;
+        }
+        else
+        {
+            free(reader->entries);
+            reader->entries = NULL;
+        }
+    }
+
+    if (!hasIndex)
+    {
+        _NOBLogBinaryReaderScan(reader, header.indexInterval);
+    }
+
+    const NOBLogBinaryRecordHeader* first = _NOBLogBinaryReaderRecordAt(reader, reader->dataStart, NULL);
+    reader->firstTimestamp = (first ? first->timestamp : 0);
+
+    return reader;
+}
+
+void NOBLogBinaryReaderClose(NOBLogBinaryReaderRef reader)
+{
+    if (!reader)
+        return;
+
+    close(reader->fd);
+    free(reader->entries);
+    free(reader->buffer);
+    free(reader);
+}
+
+CFAbsoluteTime NOBLogBinaryReaderFirstTimestamp(NOBLogBinaryReaderRef reader)
+{
+    return reader->firstTimestamp;
+}
+
+// The offset of the last index entry that is safely before start
+static off_t _NOBLogBinaryReaderSeekTime(NOBLogBinaryReaderRef reader, CFAbsoluteTime start)
+{
+    off_t      offset = reader->dataStart;
+    NSUInteger lo     = 0;
+    NSUInteger hi     = reader->count;
+    while (lo < hi)
+    {
+        NSUInteger mid = (lo + hi) / 2;
+        if (reader->entries[mid].timestamp < start - kNOBLogBinaryTimeSlop)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > 0)
+        offset = (off_t)reader->entries[lo - 1].offset;
+    return offset;
+}
+
+// The offset of the last index entry with at least length bytes of records after it
+static off_t _NOBLogBinaryReaderSeekTail(NOBLogBinaryReaderRef reader, size_t length)
+{
+    NSUInteger lo = 0;
+    NSUInteger hi = reader->count;
+    while (lo < hi)
+    {
+        NSUInteger mid = (lo + hi) / 2;
+        if (reader->dataEnd - (off_t)reader->entries[mid].offset >= (off_t)length)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return (lo > 0 ? (off_t)reader->entries[lo - 1].offset : reader->dataStart);
+}
+
+static NSUInteger _NOBLogBinaryReaderEnumerateFrom(NOBLogBinaryReaderRef reader,
+                                                   off_t offset,
+                                                   CFAbsoluteTime start,
+                                                   CFAbsoluteTime end,
+                                                   uint32_t level,
+                                                   void (^block)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop))
+{
+    NSUInteger                      count = 0;
+    BOOL                            stop  = NO;
+    const char*                     payload;
+    const NOBLogBinaryRecordHeader* header;
+    while (!stop && (header = _NOBLogBinaryReaderRecordAt(reader, offset, &payload)))
+    {
+        if (header->timestamp > end + kNOBLogBinaryTimeSlop)
+            break;
+
+        if (header->timestamp >= start &&
+            header->timestamp <= end &&
+            header->level <= level)
+        {
+            block(header, payload, &stop);
+            count++;
+        }
+
+        offset += sizeof(NOBLogBinaryRecordHeader) + header->length;
+    }
+
+    return count;
+}
+
+NSUInteger NOBLogBinaryReaderEnumerate(NOBLogBinaryReaderRef reader,
+                                       CFAbsoluteTime start,
+                                       CFAbsoluteTime end,
+                                       uint32_t level,
+                                       void (^block)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop))
+{
+    return _NOBLogBinaryReaderEnumerateFrom(reader, _NOBLogBinaryReaderSeekTime(reader, start), start, end, level, block);
+}
+
+static NSUInteger _NOBLogBinaryReaderExportTextFrom(NOBLogBinaryReaderRef reader,
+                                                    off_t offset,
+                                                    CFAbsoluteTime start,
+                                                    CFAbsoluteTime end,
+                                                    uint32_t level,
+                                                    void (^block)(const char* bytes, size_t length))
+{
+    __block NOBLogTimestampCache cache;
+    char*                        output   = (char*)malloc(kNOBLogBinaryReadSize);
+    __block size_t               length   = 0;
+    memset(&cache, 0, sizeof(cache));
+
+    NSUInteger count = _NOBLogBinaryReaderEnumerateFrom(reader, offset, start, end, level, ^(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop) {
+        if (length + kNOBLogTextPrefixMaxLength + header->length + 1 > kNOBLogBinaryReadSize && length > 0)
+        {
+            block(output, length);
+            length = 0;
+        }
+
+        char   prefix[kNOBLogTextPrefixMaxLength];
+        size_t prefixLength = (header->level ? NOBLogTextEncodePrefix(&cache, header->timestamp, header->level, prefix) : 0);
+        if (prefixLength + header->length + 1 > kNOBLogBinaryReadSize)
+        {
+            // too big for the buffer, hand it over in pieces
+            block(prefix, prefixLength);
+            block(payload, header->length);
+            block("\n", 1);
+            return;
+        }
+
+        memcpy(output + length, prefix, prefixLength);
+        length += prefixLength;
+        memcpy(output + length, payload, header->length);
+        length += header->length;
+        output[length++] = '\n';
+    });
+
+    if (length > 0)
+        block(output, length);
+    free(output);
+
+    return count;
+}
+
+NSUInteger NOBLogBinaryReaderExportText(NOBLogBinaryReaderRef reader,
+                                        CFAbsoluteTime start,
+                                        CFAbsoluteTime end,
+                                        uint32_t level,
+                                        void (^block)(const char* bytes, size_t length))
+{
+    return _NOBLogBinaryReaderExportTextFrom(reader, _NOBLogBinaryReaderSeekTime(reader, start), start, end, level, block);
+}
+
+NSData* NOBLogBinaryReaderTextTail(NOBLogBinaryReaderRef reader, uint32_t level, size_t minLength)
+{
+    // text and records are about the same size, start that far back and go further back in the rare case it was not enough
+    NSMutableData* text   = [NSMutableData data];
+    size_t         length = minLength;
+    while (1)
+    {
+        off_t offset = _NOBLogBinaryReaderSeekTail(reader, length);
+        text.length  = 0;
+        _NOBLogBinaryReaderExportTextFrom(reader, offset, -DBL_MAX, DBL_MAX, level, ^(const char* bytes, size_t bytesLength) {
+            [text appendBytes:bytes length:bytesLength];
+        });
+        if (text.length >= minLength || offset <= reader->dataStart)
+            break;
+        length = (size_t)(reader->dataEnd - offset) * 2;
+    }
+    return text;
+}
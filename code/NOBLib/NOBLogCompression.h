@@ -0,0 +1,76 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    File extension used for compressed log files
+ */
+#define kNOBLogCompressedFileExtension @"lzlog"
+
+/**
+    Number of uncompressed bytes in each block of a compressed log file
+ */
+#define kNOBLogCompressionBlockSize (64 * 1024)
+
+/**
+    Compress a block with a small, self contained LZ77 compressor (LZ4 style sequences of literals and matches, no entropy coding).  Built for speed over ratio: text logs typically compress 4-8x.
+    @param src the bytes to compress, at most \c kNOBLogCompressionBlockSize
+    @param dst the buffer to compress into
+    @param dstCapacity the size of \a dst
+    @return the compressed length, or \c 0 if the compressed block would not fit in \a dstCapacity (i.e. store the block uncompressed)
+ */
+size_t NOBLogCompressBlock(const void* src, size_t srcLength, void* dst, size_t dstCapacity);
+/**
+    Decompress a block compressed with \c NOBLogCompressBlock.  Never reads or writes out of bounds, even for corrupt input.
+    @return the decompressed length, or \c SIZE_MAX if \a src is corrupt or does not fit in \a dstCapacity
+ */
+size_t NOBLogDecompressBlock(const void* src, size_t srcLength, void* dst, size_t dstCapacity);
+
+/**
+    Compress \a length bytes of \a fd starting at \a offset into a new compressed log file at \a path
+    @return \c YES on success.  On failure nothing is left at \a path.
+ */
+BOOL NOBLogCompressFile(int fd, off_t offset, unsigned long long length, const char* path);
+
+/**
+    @typedef NOBLogCompressedFileRef
+    A compressed log file opened for random access reads of its uncompressed bytes
+ */
+typedef struct _NOBLogCompressedFile* NOBLogCompressedFileRef;
+
+/**
+    Open a compressed log file.  Only the block headers are read.
+    @return the file or \c NULL if \a path is not a compressed log file
+ */
+NOBLogCompressedFileRef NOBLogCompressedFileOpen(const char* path);
+/**
+    Close a compressed log file
+ */
+void NOBLogCompressedFileClose(NOBLogCompressedFileRef file);
+/**
+    @return the uncompressed length of \a file
+ */
+unsigned long long NOBLogCompressedFileLength(NOBLogCompressedFileRef file);
+/**
+    Read uncompressed bytes like \c pread.  Only the blocks that overlap the range are decompressed.
+    @return the number of bytes read
+ */
+size_t NOBLogCompressedFileRead(NOBLogCompressedFileRef file, void* buffer, size_t length, unsigned long long offset);
@@ -0,0 +1,433 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogCompression.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define kNOBLogCompressedMagic   "NOBLZBK"
+#define kNOBLogCompressedVersion (1)
+
+#define kMinMatch       (4)
+#define kLastLiterals   (5)     // the last bytes of a block are always literals
+#define kMatchLimit     (12)    // no match can start in the last bytes of a block
+#define kHashLog        (12)
+#define kStoredFlag     (0x80000000u) // block header flag for an uncompressed block
+
+typedef struct _NOBLogCompressedHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t blockSize;
+    uint64_t length;    // uncompressed
+} NOBLogCompressedHeader;
+
+typedef struct _NOBLogBlockHeader
+{
+    uint32_t length;            // uncompressed
+    uint32_t compressedLength;  // kStoredFlag if stored uncompressed
+} NOBLogBlockHeader;
+
+#pragma mark - Block
+
+NS_INLINE uint32_t _Read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+NS_INLINE uint32_t _Hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - kHashLog);
+}
+
+NS_INLINE uint8_t* _WriteLength(uint8_t* op, size_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t)length;
+    return op;
+}
+
+size_t NOBLogCompressBlock(const void* src, size_t srcLength, void* dst, size_t dstCapacity)
+{
+    const uint8_t* const base   = (const uint8_t*)src;
+    const uint8_t* const end    = base + srcLength;
+    const uint8_t* const mLimit = (srcLength > kMatchLimit ? end - kMatchLimit : base);
+    const uint8_t* ip     = base;
+    const uint8_t* anchor = base;
+    uint8_t*       op     = (uint8_t*)dst;
+    uint8_t* const oEnd   = op + dstCapacity;
+    uint16_t       table[1 << kHashLog];
+
+    if (srcLength > kNOBLogCompressionBlockSize)
+        return 0;
+
+    memset(table, 0, sizeof(table));
+
+    while (ip < mLimit)
+    {
+        uint32_t       h     = _Hash(_Read32(ip));
+        const uint8_t* match = base + table[h];
+        table[h] = (uint16_t)(ip - base);
+
+        if (match >= ip || _Read32(match) != _Read32(ip))
+        {
+            ip++;
+            continue;
+        }
+
+        // extend the match
+        const uint8_t* mEnd  = end - kLastLiterals;
+        const uint8_t* mp    = ip + kMinMatch;
+        const uint8_t* ref   = match + kMinMatch;
+        while (mp < mEnd && *mp == *ref)
+        {
+            mp++;
+            ref++;
+        }
+
+        size_t literals = (size_t)(ip - anchor);
+        size_t matchLen = (size_t)(mp - ip) - kMinMatch;
+
+        // worst case for this sequence
+        if (op + 1 + literals + literals / 255 + 1 + 2 + matchLen / 255 + 1 > oEnd)
+            return 0;
+
+        uint8_t* token = op++;
+        *token = (uint8_t)((MIN(literals, (size_t)15) << 4) | MIN(matchLen, (size_t)15));
+        if (literals >= 15)
+            op = _WriteLength(op, literals - 15);
+        memcpy(op, anchor, literals);
+        op += literals;
+
+        uint16_t offset = (uint16_t)(ip - match);
+        *op++ = (uint8_t)(offset & 0xFF);
+        *op++ = (uint8_t)(offset >> 8);
+        if (matchLen >= 15)
+            op = _WriteLength(op, matchLen - 15);
+
+        ip     = mp;
+        anchor = ip;
+    }
+
+    // trailing literals
+    size_t literals = (size_t)(end - anchor);
+    if (op + 1 + literals + literals / 255 + 1 > oEnd)
+        return 0;
+    *op++ = (uint8_t)(MIN(literals, (size_t)15) << 4);
+    if (literals >= 15)
+        op = _WriteLength(op, literals - 15);
+    memcpy(op, anchor, literals);
+    op += literals;
+
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+size_t NOBLogDecompressBlock(const void* src, size_t srcLength, void* dst, size_t dstCapacity)
+{
+    const uint8_t*       ip   = (const uint8_t*)src;
+    const uint8_t* const iEnd = ip + srcLength;
+    uint8_t*             op   = (uint8_t*)dst;
+    uint8_t* const       oEnd = op + dstCapacity;
+
+    while (ip < iEnd)
+    {
+        uint8_t token    = *ip++;
+        size_t  literals = token >> 4;
+        if (15 == literals)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iEnd)
+                    return SIZE_MAX;
+                b = *ip++;
+                literals += b;
+            } while (255 == b);
+        }
+
+        if (literals > (size_t)(iEnd - ip) || literals > (size_t)(oEnd - op))
+            return SIZE_MAX;
+        memcpy(op, ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == iEnd)
+            break; // the last sequence is literals only
+
+        if (iEnd - ip < 2)
+            return SIZE_MAX;
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+
+        size_t matchLen = token & 0x0F;
+        if (15 == matchLen)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= iEnd)
+                    return SIZE_MAX;
+                b = *ip++;
+                matchLen += b;
+            } while (255 == b);
+        }
+        matchLen += kMinMatch;
+
+        if (0 == offset || offset > (size_t)(op - (uint8_t*)dst) || matchLen > (size_t)(oEnd - op))
+            return SIZE_MAX;
+
+        // byte by byte, matches can overlap what they copy
+        const uint8_t* ref = op - offset;
+        while (matchLen--)
+            *op++ = *ref++;
+    }
+
+    return (size_t)(op - (uint8_t*)dst);
+}
+
+#pragma mark - File
+
+NS_INLINE BOOL _WriteFully(int fd, const void* bytes, size_t length)
+{
+    const char* p = (const char*)bytes;
+    while (length > 0)
+    {
+        ssize_t written = write(fd, p, length);
+        if (written <= 0)
+            return NO;
+        p      += written;
+        length -= (size_t)written;
+    }
+    return YES;
+}
+
+BOOL NOBLogCompressFile(int fd, off_t offset, unsigned long long length, const char* path)
+{
+    int out = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+        return NO;
+
+    const size_t dstCapacity = kNOBLogCompressionBlockSize + kNOBLogCompressionBlockSize / 2;
+    uint8_t*     src         = (uint8_t*)malloc(kNOBLogCompressionBlockSize);
+    uint8_t*     dst         = (uint8_t*)malloc(dstCapacity);
+
+    NOBLogCompressedHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kNOBLogCompressedMagic, sizeof(kNOBLogCompressedMagic));
+    header.version   = kNOBLogCompressedVersion;
+    header.blockSize = kNOBLogCompressionBlockSize;
+    header.length    = length;
+
+    BOOL success = _WriteFully(out, &header, sizeof(header));
+    unsigned long long remaining = length;
+    while (success && remaining > 0)
+    {
+        size_t  toRead    = (size_t)MIN(remaining, (unsigned long long)kNOBLogCompressionBlockSize);
+        ssize_t bytesRead = pread(fd, src, toRead, offset);
+        if (bytesRead != (ssize_t)toRead)
+        {
+            success = NO;
+            break;
+        }
+        offset    += bytesRead;
+        remaining -= (unsigned long long)bytesRead;
+
+        NOBLogBlockHeader blockHeader;
+        size_t            compressedLength = NOBLogCompressBlock(src, toRead, dst, toRead);
+        blockHeader.length = (uint32_t)toRead;
+        if (compressedLength)
+        {
+            blockHeader.compressedLength = (uint32_t)compressedLength;
+            success = _WriteFully(out, &blockHeader, sizeof(blockHeader)) && _WriteFully(out, dst, compressedLength);
+        }
+        else
+        {
+            blockHeader.compressedLength = (uint32_t)toRead | kStoredFlag;
+            success = _WriteFully(out, &blockHeader, sizeof(blockHeader)) && _WriteFully(out, src, toRead);
+        }
+    }
+
+    free(src);
+    free(dst);
+    if (0 != close(out))
+        success = NO;
+    if (!success)
+        unlink(path);
+    return success;
+}
+
+typedef struct _NOBLogBlockInfo
+{
+    unsigned long long offset;           // uncompressed offset
+    off_t              fileOffset;       // offset of the block's data in the file
+    uint32_t           length;
+    uint32_t           compressedLength; // including kStoredFlag
+} NOBLogBlockInfo;
+
+struct _NOBLogCompressedFile
+{
+    int                fd;
+    unsigned long long length;
+    NSUInteger         blockCount;
+    NOBLogBlockInfo*   blocks;
+    uint8_t*           scratch;          // compressed bytes of the block being read
+    uint8_t*           cache;            // the last decompressed block
+    NSInteger          cachedBlock;
+};
+
+NOBLogCompressedFileRef NOBLogCompressedFileOpen(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    NOBLogCompressedHeader header;
+    if (pread(fd, &header, sizeof(header), 0) != sizeof(header) ||
+        0 != memcmp(header.magic, kNOBLogCompressedMagic, sizeof(kNOBLogCompressedMagic)) ||
+        header.blockSize != kNOBLogCompressionBlockSize)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    NOBLogCompressedFileRef file = (NOBLogCompressedFileRef)calloc(1, sizeof(struct _NOBLogCompressedFile));
+    file->fd          = fd;
+    file->cachedBlock = -1;
+
+    // walk the block headers to build the block table
+    NSUInteger         capacity   = (NSUInteger)(header.length / kNOBLogCompressionBlockSize) + 1;
+    off_t              fileOffset = sizeof(header);
+    unsigned long long offset     = 0;
+    file->blocks = (NOBLogBlockInfo*)malloc(capacity * sizeof(NOBLogBlockInfo));
+    while (offset < header.length && file->blockCount < capacity)
+    {
+        NOBLogBlockHeader blockHeader;
+        if (pread(fd, &blockHeader, sizeof(blockHeader), fileOffset) != sizeof(blockHeader) ||
+            blockHeader.length > kNOBLogCompressionBlockSize ||
+            (blockHeader.compressedLength & ~kStoredFlag) > kNOBLogCompressionBlockSize + kNOBLogCompressionBlockSize / 2)
+        {
+            break;
+        }
+
+        NOBLogBlockInfo* block = &file->blocks[file->blockCount++];
+        block->offset           = offset;
+        block->fileOffset       = fileOffset + sizeof(blockHeader);
+        block->length           = blockHeader.length;
+        block->compressedLength = blockHeader.compressedLength;
+
+        offset     += blockHeader.length;
+        fileOffset += sizeof(blockHeader) + (blockHeader.compressedLength & ~kStoredFlag);
+    }
+    file->length = offset;
+
+    return file;
+}
+
+void NOBLogCompressedFileClose(NOBLogCompressedFileRef file)
+{
+    if (!file)
+        return;
+
+    close(file->fd);
+    free(file->blocks);
+    free(file->scratch);
+    free(file->cache);
+    free(file);
+}
+
+unsigned long long NOBLogCompressedFileLength(NOBLogCompressedFileRef file)
+{
+    return file->length;
+}
+
+static const uint8_t* _NOBLogCompressedFileLoadBlock(NOBLogCompressedFileRef file, NSUInteger index)
+{
+    if ((NSInteger)index == file->cachedBlock)
+        return file->cache;
+
+    if (!file->cache)
+    {
+        file->cache   = (uint8_t*)malloc(kNOBLogCompressionBlockSize);
+        file->scratch = (uint8_t*)malloc(kNOBLogCompressionBlockSize + kNOBLogCompressionBlockSize / 2);
+    }
+
+    NOBLogBlockInfo* block            = &file->blocks[index];
+    size_t           compressedLength = block->compressedLength & ~kStoredFlag;
+    file->cachedBlock = -1;
+
+    if (block->compressedLength & kStoredFlag)
+    {
+        if (pread(file->fd, file->cache, compressedLength, block->fileOffset) != (ssize_t)compressedLength)
+            return NULL;
+    }
+    else
+    {
+        if (pread(file->fd, file->scratch, compressedLength, block->fileOffset) != (ssize_t)compressedLength ||
+            NOBLogDecompressBlock(file->scratch, compressedLength, file->cache, block->length) != block->length)
+        {
+            return NULL;
+        }
+    }
+
+    file->cachedBlock = (NSInteger)index;
+    return file->cache;
+}
+
+size_t NOBLogCompressedFileRead(NOBLogCompressedFileRef file, void* buffer, size_t length, unsigned long long offset)
+{
+    size_t total = 0;
+
+    if (offset >= file->length || 0 == file->blockCount)
+        return 0;
+
+    // binary search for the first block
+    NSUInteger lo = 0;
+    NSUInteger hi = file->blockCount - 1;
+    while (lo < hi)
+    {
+        NSUInteger mid = (lo + hi + 1) / 2;
+        if (file->blocks[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    for (NSUInteger i = lo; i < file->blockCount && total < length; i++)
+    {
+        const uint8_t* bytes = _NOBLogCompressedFileLoadBlock(file, i);
+        if (!bytes)
+            break;
+
+        NOBLogBlockInfo* block   = &file->blocks[i];
+        size_t           skip    = (size_t)(offset - block->offset);
+        size_t           toCopy  = MIN((size_t)block->length - skip, length - total);
+        memcpy((uint8_t*)buffer + total, bytes + skip, toCopy);
+        total  += toCopy;
+        offset += toCopy;
+    }
+
+    return total;
+}
@@ -0,0 +1,47 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @par Deferred formatting captures a \c printf style format and a compact binary copy of its arguments so that the (comparatively expensive) rendering of the text can happen later on another thread.
+    @par The \a format MUST have static storage duration (i.e. be a string literal), only its pointer is captured.
+    @par Supported conversions are the \c printf integer, floating point, \c %c, \c %s, \c %p conversions with all flags, widths, precisions (including \c *) and length modifiers.  \c %s strings are copied at capture time.  \c %\@ is supported by capturing the object's \c description at capture time.
+ */
+
+/**
+    Capture a deferred format
+    @param buffer the buffer to capture into.  Can be \c NULL if \a capacity is \c 0.
+    @param capacity the number of bytes available in \a buffer
+    @param format the static format string
+    @param args the arguments for \a format
+    @return the number of bytes the capture needs.  If larger than \a capacity, nothing useful was captured and the capture should be repeated with a larger buffer (and a copy of \a args).
+ */
+size_t NOBLogDeferredFormatCapture(void* buffer, size_t capacity, const char* format, va_list args);
+
+/**
+    Render a captured deferred format into text
+    @param output the buffer to render into.  Can be \c NULL if \a capacity is \c 0.
+    @param capacity the number of bytes available in \a output
+    @param capture the bytes filled in by \c NOBLogDeferredFormatCapture
+    @param captureLength the length of \a capture
+    @return the number of bytes the rendered text needs, not including a \c NULL terminator.  Like \c snprintf, if the return value is not less than \a capacity the output was truncated.
+ */
+size_t NOBLogDeferredFormatRender(char* output, size_t capacity, const void* capture, size_t captureLength);
@@ -0,0 +1,389 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogDeferredFormat.h"
+
+typedef NS_ENUM(char, NOBFormatArgKind)
+{
+    NOBFormatArgKind_None = 0, // literal text or "%%"
+    NOBFormatArgKind_Int,
+    NOBFormatArgKind_Long,
+    NOBFormatArgKind_LongLong,
+    NOBFormatArgKind_IntMax,
+    NOBFormatArgKind_Size,
+    NOBFormatArgKind_PtrDiff,
+    NOBFormatArgKind_Double,
+    NOBFormatArgKind_LongDouble,
+    NOBFormatArgKind_CString,
+    NOBFormatArgKind_Pointer,
+    NOBFormatArgKind_Object,
+    NOBFormatArgKind_Unsupported // consumes a pointer sized argument and renders nothing useful
+};
+
+typedef struct _NOBFormatSpec
+{
+    const char*      start;         // first character of the segment
+    size_t           length;        // length of the segment
+    NOBFormatArgKind kind;
+    BOOL             starWidth;
+    BOOL             starPrecision;
+    char             conversion;
+    char             modifier[3];
+} NOBFormatSpec;
+
+// Parses the next segment of the format (either a run of literal text or a single conversion)
+static BOOL _NextFormatSpec(const char** pCursor, NOBFormatSpec* spec)
+{
+    const char* p = *pCursor;
+    if (!*p)
+        return NO;
+
+    memset(spec, 0, sizeof(NOBFormatSpec));
+    spec->start = p;
+
+    if ('%' != *p || '%' == p[1])
+    {
+        if ('%' == *p)
+        {
+            p += 2;
+            spec->start++; // render a single '%'
+        }
+        else
+        {
+            while (*p && '%' != *p)
+                p++;
+        }
+        spec->length = (size_t)(p - spec->start);
+        *pCursor     = p;
+        return YES;
+    }
+
+    p++;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if ('*' == *p)
+    {
+        spec->starWidth = YES;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if ('.' == *p)
+    {
+        p++;
+        if ('*' == *p)
+        {
+            spec->starPrecision = YES;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+
+    size_t modifierLength = 0;
+    while (*p && strchr("hlLqjzt", *p) && modifierLength < 2)
+    {
+        spec->modifier[modifierLength++] = *p;
+        p++;
+    }
+
+    spec->conversion = *p;
+    switch (*p)
+    {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+        {
+            const char* m = spec->modifier;
+            if (0 == strcmp(m, "l"))
+                spec->kind = NOBFormatArgKind_Long;
+            else if (0 == strcmp(m, "ll") || 0 == strcmp(m, "q"))
+                spec->kind = NOBFormatArgKind_LongLong;
+            else if (0 == strcmp(m, "j"))
+                spec->kind = NOBFormatArgKind_IntMax;
+            else if (0 == strcmp(m, "z"))
+                spec->kind = NOBFormatArgKind_Size;
+            else if (0 == strcmp(m, "t"))
+                spec->kind = NOBFormatArgKind_PtrDiff;
+            else
+                spec->kind = NOBFormatArgKind_Int;
+            break;
+        }
+        case 'D': case 'O': case 'U':
+            spec->kind = NOBFormatArgKind_Long;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            spec->kind = (0 == strcmp(spec->modifier, "L") ? NOBFormatArgKind_LongDouble : NOBFormatArgKind_Double);
+            break;
+        case 's':
+            spec->kind = (spec->modifier[0] ? NOBFormatArgKind_Unsupported : NOBFormatArgKind_CString);
+            break;
+        case 'p':
+            spec->kind = NOBFormatArgKind_Pointer;
+            break;
+        case '@':
+            spec->kind = NOBFormatArgKind_Object;
+            break;
+        case '%':
+            // "%5%" and friends, just a '%'
+            spec->start  = p;
+            spec->length = 1;
+            *pCursor     = p + 1;
+            return YES;
+        case '\0':
+            // dangling conversion, treat as literal text
+            spec->length = (size_t)(p - spec->start);
+            *pCursor     = p;
+            return YES;
+        default: // 'n', 'C', 'S' and anything unknown
+            spec->kind = NOBFormatArgKind_Unsupported;
+            break;
+    }
+
+    p++;
+    spec->length = (size_t)(p - spec->start);
+    *pCursor     = p;
+    return YES;
+}
+
+#pragma mark - Capture
+
+typedef struct _NOBCaptureWriter
+{
+    char*  buffer;
+    size_t capacity;
+    size_t length;
+} NOBCaptureWriter;
+
+NS_INLINE void _CaptureBytes(NOBCaptureWriter* writer, const void* bytes, size_t length)
+{
+    if (writer->length + length <= writer->capacity)
+        memcpy(writer->buffer + writer->length, bytes, length);
+    writer->length += length;
+}
+
+#define _CaptureValue(writer, type, value) do { type v__ = (value); _CaptureBytes(writer, &v__, sizeof(type)); } while (0)
+
+static void _CaptureString(NOBCaptureWriter* writer, const char* string)
+{
+    if (!string)
+        string = "(null)";
+    uint32_t length = (uint32_t)strlen(string);
+    _CaptureValue(writer, uint32_t, length);
+    _CaptureBytes(writer, string, length + 1);
+}
+
+size_t NOBLogDeferredFormatCapture(void* buffer, size_t capacity, const char* format, va_list args)
+{
+    NOBCaptureWriter writer = { (char*)buffer, capacity, 0 };
+    NOBFormatSpec    spec;
+    const char*      cursor = format;
+
+    _CaptureValue(&writer, const char*, format);
+    while (_NextFormatSpec(&cursor, &spec))
+    {
+        if (NOBFormatArgKind_None == spec.kind)
+            continue;
+
+        if (spec.starWidth)
+            _CaptureValue(&writer, int, va_arg(args, int));
+        if (spec.starPrecision)
+            _CaptureValue(&writer, int, va_arg(args, int));
+
+        switch (spec.kind)
+        {
+            case NOBFormatArgKind_Int:
+                _CaptureValue(&writer, int, va_arg(args, int));
+                break;
+            case NOBFormatArgKind_Long:
+                _CaptureValue(&writer, long, va_arg(args, long));
+                break;
+            case NOBFormatArgKind_LongLong:
+                _CaptureValue(&writer, long long, va_arg(args, long long));
+                break;
+            case NOBFormatArgKind_IntMax:
+                _CaptureValue(&writer, intmax_t, va_arg(args, intmax_t));
+                break;
+            case NOBFormatArgKind_Size:
+                _CaptureValue(&writer, size_t, va_arg(args, size_t));
+                break;
+            case NOBFormatArgKind_PtrDiff:
+                _CaptureValue(&writer, ptrdiff_t, va_arg(args, ptrdiff_t));
+                break;
+            case NOBFormatArgKind_Double:
+                _CaptureValue(&writer, double, va_arg(args, double));
+                break;
+            case NOBFormatArgKind_LongDouble:
+                _CaptureValue(&writer, double, (double)va_arg(args, long double));
+                break;
+            case NOBFormatArgKind_CString:
+                _CaptureString(&writer, va_arg(args, const char*));
+                break;
+            case NOBFormatArgKind_Pointer:
+                _CaptureValue(&writer, void*, va_arg(args, void*));
+                break;
+            case NOBFormatArgKind_Object:
+            {
+                __unsafe_unretained id obj = va_arg(args, __unsafe_unretained id);
+                _CaptureString(&writer, (obj ? [obj description] : @"(null)").UTF8String);
+                break;
+            }
+            case NOBFormatArgKind_Unsupported:
+            case NOBFormatArgKind_None:
+                (void)va_arg(args, void*);
+                break;
+        }
+    }
+
+    return writer.length;
+}
+
+#pragma mark - Render
+
+typedef struct _NOBCaptureReader
+{
+    const char* bytes;
+    size_t      length;
+    size_t      offset;
+} NOBCaptureReader;
+
+NS_INLINE BOOL _ReadBytes(NOBCaptureReader* reader, void* bytes, size_t length)
+{
+    if (reader->offset + length > reader->length)
+        return NO;
+    memcpy(bytes, reader->bytes + reader->offset, length);
+    reader->offset += length;
+    return YES;
+}
+
+static const char* _ReadString(NOBCaptureReader* reader)
+{
+    uint32_t length = 0;
+    if (!_ReadBytes(reader, &length, sizeof(uint32_t)) ||
+        reader->offset + length + 1 > reader->length)
+    {
+        return "";
+    }
+    const char* string = reader->bytes + reader->offset;
+    reader->offset += length + 1;
+    return string;
+}
+
+#define _ReadValue(reader, type) ({ type v__ = 0; _ReadBytes(reader, &v__, sizeof(type)); v__; })
+
+// snprintf a single conversion with the right number of '*' arguments
+#define _RenderConversion(out, cap, spec, value) \
+    ((spec).starWidth && (spec).starPrecision) ? snprintf(out, cap, specString, width, precision, value) : \
+    ((spec).starWidth) ? snprintf(out, cap, specString, width, value) : \
+    ((spec).starPrecision) ? snprintf(out, cap, specString, precision, value) : \
+    snprintf(out, cap, specString, value)
+
+size_t NOBLogDeferredFormatRender(char* output, size_t capacity, const void* capture, size_t captureLength)
+{
+    NOBCaptureReader reader = { (const char*)capture, captureLength, 0 };
+    const char*      format = _ReadValue(&reader, const char*);
+    const char*      cursor = format;
+    NOBFormatSpec    spec;
+    size_t           length = 0;
+    char             specString[32];
+
+    if (!format)
+        return 0;
+
+    while (_NextFormatSpec(&cursor, &spec))
+    {
+        char*  out = (length < capacity ? output + length : NULL);
+        size_t cap = (length < capacity ? capacity - length : 0);
+
+        if (NOBFormatArgKind_None == spec.kind)
+        {
+            if (cap > 0)
+                memcpy(out, spec.start, MIN(cap, spec.length));
+            length += spec.length;
+            continue;
+        }
+
+        int width     = (spec.starWidth ? _ReadValue(&reader, int) : 0);
+        int precision = (spec.starPrecision ? _ReadValue(&reader, int) : 0);
+
+        // Rebuild the conversion, swapping in a conversion snprintf understands where needed
+        size_t specLength = MIN(spec.length, sizeof(specString) - 1);
+        memcpy(specString, spec.start, specLength);
+        specString[specLength] = '\0';
+        if (NOBFormatArgKind_Object == spec.kind ||
+            NOBFormatArgKind_Unsupported == spec.kind ||
+            NOBFormatArgKind_LongDouble == spec.kind)
+        {
+            // strip the length modifier
+            size_t modifierLength = strlen(spec.modifier);
+            char*  modifier       = specString + specLength - 1 - modifierLength;
+            memmove(modifier, modifier + modifierLength, modifierLength + 1);
+            specLength -= modifierLength;
+            if (NOBFormatArgKind_LongDouble != spec.kind)
+                specString[specLength - 1] = 's';
+        }
+
+        // snprintf NULL terminates, that terminator is either overwritten by the next segment or falls past the end of our text
+        char*  dst     = (cap > 0 ? out : NULL);
+        size_t dstCap  = cap;
+        int    written = 0;
+        switch (spec.kind)
+        {
+            case NOBFormatArgKind_Int:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, int));
+                break;
+            case NOBFormatArgKind_Long:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, long));
+                break;
+            case NOBFormatArgKind_LongLong:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, long long));
+                break;
+            case NOBFormatArgKind_IntMax:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, intmax_t));
+                break;
+            case NOBFormatArgKind_Size:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, size_t));
+                break;
+            case NOBFormatArgKind_PtrDiff:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, ptrdiff_t));
+                break;
+            case NOBFormatArgKind_Double:
+            case NOBFormatArgKind_LongDouble:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, double));
+                break;
+            case NOBFormatArgKind_CString:
+            case NOBFormatArgKind_Object:
+                written = _RenderConversion(dst, dstCap, spec, _ReadString(&reader));
+                break;
+            case NOBFormatArgKind_Pointer:
+                written = _RenderConversion(dst, dstCap, spec, _ReadValue(&reader, void*));
+                break;
+            case NOBFormatArgKind_Unsupported:
+                written = _RenderConversion(dst, dstCap, spec, "<?>");
+                break;
+            case NOBFormatArgKind_None:
+                break;
+        }
+
+        if (written < 0)
+            written = 0;
+        length += (size_t)written;
+    }
+
+    return length;
+}
@@ -0,0 +1,66 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @typedef NOBLogHistoryRef
+    @par A fixed size ring of the most recent log lines, kept in memory so that recent logs can be shown or shipped without reading the log files.
+    @par Built for a single writer (a \c NOBLogger object's drain context) and any number of readers, each with its own cursor.  Readers only hold the ring's lock while copying lines out, so a slow reader never holds up the writer for longer than a copy.
+    @par Lines are identified by a sequence number that starts at \c 0.  Once more than \c capacity lines have been appended the oldest are overwritten; a reader that falls that far behind is told how many lines it missed.
+ */
+typedef struct _NOBLogHistory* NOBLogHistoryRef;
+
+/**
+    Create a history
+    @param capacity the number of lines kept, minimum of \c 1
+    @return a new history.  Destroy with \c NOBLogHistoryDestroy.
+ */
+NOBLogHistoryRef NOBLogHistoryCreate(NSUInteger capacity);
+/**
+    Destroy a history
+ */
+void NOBLogHistoryDestroy(NOBLogHistoryRef history);
+
+/**
+    @return the number of lines the history keeps
+ */
+NSUInteger NOBLogHistoryCapacity(NOBLogHistoryRef history);
+/**
+    @return the sequence number the next line appended will get, which is also the number of lines ever appended
+ */
+int64_t NOBLogHistoryHead(NOBLogHistoryRef history);
+
+/**
+    Append a line made of \a prefix followed by \a message (no trailing newline)
+    @warning must only be called from a single writer at a time
+ */
+void NOBLogHistoryAppend(NOBLogHistoryRef history, const char* prefix, size_t prefixLength, const char* message, size_t length);
+
+/**
+    Copy lines out of the history, oldest first.  Each line is appended to \a lines followed by a newline, just like in a text log file.
+    @param cursor the sequence number of the first line wanted
+    @param maxLines the maximum number of lines to copy
+    @param lines the data to append the lines to
+    @param pLineCount set to the number of lines copied
+    @param pDropped set to the number of lines from \a cursor on that were already overwritten (and not copied).  Can be \c NULL.
+    @return the cursor to pass to the next copy
+ */
+int64_t NOBLogHistoryCopy(NOBLogHistoryRef history, int64_t cursor, NSUInteger maxLines, NSMutableData* lines, NSUInteger* pLineCount, NSUInteger* pDropped);
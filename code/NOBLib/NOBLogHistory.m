@@ -0,0 +1,163 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogHistory.h"
+#include <libkern/OSAtomic.h>
+
+typedef struct _NOBLogHistoryLine
+{
+    size_t length;
+    size_t capacity;
+    char*  bytes;
+} NOBLogHistoryLine;
+
+struct _NOBLogHistory
+{
+    OSSpinLock         lock;     // guards the lines, never held while allocating
+    volatile int64_t   head;
+    NSUInteger         capacity;
+    NOBLogHistoryLine* lines;
+};
+
+NOBLogHistoryRef NOBLogHistoryCreate(NSUInteger capacity)
+{
+    NOBLogHistoryRef history = (NOBLogHistoryRef)calloc(1, sizeof(struct _NOBLogHistory));
+    if (history)
+    {
+        history->lock     = OS_SPINLOCK_INIT;
+        history->capacity = MAX(capacity, (NSUInteger)1);
+        history->lines    = (NOBLogHistoryLine*)calloc(history->capacity, sizeof(NOBLogHistoryLine));
+        if (!history->lines)
+        {
+            free(history);
+            history = NULL;
+        }
+    }
+    return history;
+}
+
+void NOBLogHistoryDestroy(NOBLogHistoryRef history)
+{
+    if (history)
+    {
+        for (NSUInteger i = 0; i < history->capacity; i++)
+        {
+            free(history->lines[i].bytes);
+        }
+        free(history->lines);
+        free(history);
+    }
+}
+
+NSUInteger NOBLogHistoryCapacity(NOBLogHistoryRef history)
+{
+    return history->capacity;
+}
+
+int64_t NOBLogHistoryHead(NOBLogHistoryRef history)
+{
+    OSMemoryBarrier();
+    return history->head;
+}
+
+void NOBLogHistoryAppend(NOBLogHistoryRef history, const char* prefix, size_t prefixLength, const char* message, size_t length)
+{
+    NOBLogHistoryLine* line        = &history->lines[history->head % history->capacity];
+    size_t             totalLength = prefixLength + length;
+    char*              oldBytes    = NULL;
+    char*              newBytes    = NULL;
+
+    if (totalLength > line->capacity)
+    {
+        // only the writer changes a line's buffer, so allocate before taking the lock and swap under it
+        newBytes = (char*)malloc(totalLength);
+        if (!newBytes)
+            return;
+    }
+
+    OSSpinLockLock(&history->lock);
+    if (newBytes)
+    {
+        oldBytes       = line->bytes;
+        line->bytes    = newBytes;
+        line->capacity = totalLength;
+    }
+    memcpy(line->bytes, prefix, prefixLength);
+    memcpy(line->bytes + prefixLength, message, length);
+    line->length = totalLength;
+    history->head++;
+    OSSpinLockUnlock(&history->lock);
+
+    free(oldBytes);
+}
+
+int64_t NOBLogHistoryCopy(NOBLogHistoryRef history, int64_t cursor, NSUInteger maxLines, NSMutableData* lines, NSUInteger* pLineCount, NSUInteger* pDropped)
+{
+    NSUInteger count   = 0;
+    NSUInteger dropped = 0;
+    NSUInteger offset  = lines.length;
+    size_t     total   = 0;
+    int64_t    end     = cursor;
+
+    OSSpinLockLock(&history->lock);
+    while (true)
+    {
+        int64_t head   = history->head;
+        int64_t oldest = MAX(head - (int64_t)history->capacity, (int64_t)0);
+        if (cursor < oldest)
+        {
+            dropped += (NSUInteger)(oldest - cursor);
+            cursor   = oldest;
+        }
+
+        end   = MIN(head, cursor + (int64_t)MIN(maxLines, (NSUInteger)INT32_MAX));
+        total = 0;
+        for (int64_t seq = cursor; seq < end; seq++)
+        {
+            total += history->lines[seq % history->capacity].length + 1;
+        }
+
+        if (lines.length >= offset + total)
+            break;
+
+        // grow without holding the lock, the lines being copied can only change if the writer laps the cursor
+        OSSpinLockUnlock(&history->lock);
+        [lines setLength:offset + total];
+        OSSpinLockLock(&history->lock);
+    }
+
+    char* bytes = (char*)lines.mutableBytes + offset;
+    for (; cursor < end; cursor++, count++)
+    {
+        const NOBLogHistoryLine* line = &history->lines[cursor % history->capacity];
+        memcpy(bytes, line->bytes, line->length);
+        bytes += line->length;
+        *bytes++ = '\n';
+    }
+    OSSpinLockUnlock(&history->lock);
+
+    [lines setLength:offset + total]; // the data may have been grown for a larger copy on an earlier pass
+
+    if (pLineCount)
+        *pLineCount = count;
+    if (pDropped)
+        *pDropped = dropped;
+    return cursor;
+}
@@ -0,0 +1,80 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @struct NOBLogRateLimiter
+    Per call site state for rate limited and sampled logging.  Declare one \c static per call site, initialized with \c kNOBLogRateLimiterInit (the \c LOG_RATE_LIMITED and \c LOG_SAMPLED macros do this).
+    @par All fields are updated with lock-free atomics, the limiter can be hit from any number of threads.
+ */
+typedef struct _NOBLogRateLimiter
+{
+    volatile int64_t theoreticalArrival; /**< token bucket: when the bucket would next be empty, in nanoseconds */
+    volatile int64_t count;              /**< sampler: number of records seen */
+    volatile int64_t suppressed;         /**< number of records suppressed since the last summary */
+    volatile int64_t lastSummary;        /**< when the last summary was reported, in nanoseconds */
+
+    // set once by NOBLogRateLimiterSuppressed, for the periodic summaries
+    volatile int32_t                    registered;
+    NSUInteger                          level;
+    const char*                         file;
+    int                                 line;
+    struct _NOBLogRateLimiter* volatile next;
+} NOBLogRateLimiter;
+
+#define kNOBLogRateLimiterInit { 0, 0, 0, 0, 0, 0, NULL, 0, NULL }
+
+/**
+    Suppressed records are summarized at most this often (in seconds)
+ */
+#define kNOBLogRateLimiterSummaryInterval (1.0)
+
+/**
+    Token bucket check.  Decide if a record can be logged before it is formatted.
+    @param limiter the call site's limiter
+    @param perSecond the sustained number of records per second allowed
+    @param burst the number of records that can be logged back to back before \a perSecond applies.  Minimum of \c 1.
+    @param pSuppressed set to the number of suppressed records to summarize when the record is allowed and a summary is due, \c 0 otherwise
+    @return \c YES if the record should be logged
+ */
+BOOL NOBLogRateLimiterAllowRate(NOBLogRateLimiter* limiter, double perSecond, NSUInteger burst, int64_t* pSuppressed);
+/**
+    1 in N sampler.  Decide if a record can be logged before it is formatted.
+    @param limiter the call site's limiter
+    @param oneIn log the first record and then every \a oneIn records after it
+    @param pSuppressed same as \c NOBLogRateLimiterAllowRate
+    @return \c YES if the record should be logged
+ */
+BOOL NOBLogRateLimiterAllowSample(NOBLogRateLimiter* limiter, uint32_t oneIn, int64_t* pSuppressed);
+
+/**
+    Call when a record of a \c static limiter was not allowed.  The first call registers the call site so that its suppressed records are summarized every \c kNOBLogRateLimiterSummaryInterval to the \c sharedLog even if the call site does not log again.
+    @param limiter the call site's limiter, MUST have static storage duration
+    @param level the \c NOBLogLevel of the call site
+    @param file the call site's \c __FILE__
+    @param line the call site's \c __LINE__
+ */
+void NOBLogRateLimiterSuppressed(NOBLogRateLimiter* limiter, NSUInteger level, const char* file, int line);
+
+/**
+    @return the summary line for \a suppressed records, i.e. \c "suppressed 12,345 similar lines from file.m:42"
+ */
+NSString* NOBLogRateLimiterSummary(int64_t suppressed, const char* file, int line);
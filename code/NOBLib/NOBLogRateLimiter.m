@@ -0,0 +1,185 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogRateLimiter.h"
+#import "NOBLogger.h"
+#include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+
+#define kNOBLogRateLimiterSummaryIntervalNanoseconds ((int64_t)(kNOBLogRateLimiterSummaryInterval * NSEC_PER_SEC))
+
+static NOBLogRateLimiter* volatile s_registeredLimiters = NULL; // every registered call site, prepended to with a CAS, never removed
+static volatile int32_t            s_flushScheduled     = 0;
+
+static void NOBLogRateLimiterScheduleFlush(void);
+
+NS_INLINE int64_t NanosecondsNow(void);
+NS_INLINE int64_t NanosecondsNow(void)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (!s_timebase.denom)
+        mach_timebase_info(&s_timebase); // idempotent, racing threads store the same values
+    return (int64_t)(mach_absolute_time() * s_timebase.numer / s_timebase.denom);
+}
+
+// The suppressed count if a summary is due, 0 otherwise
+NS_INLINE int64_t CollectSummary(NOBLogRateLimiter* limiter, int64_t now);
+NS_INLINE int64_t CollectSummary(NOBLogRateLimiter* limiter, int64_t now)
+{
+    int64_t suppressed  = 0;
+    int64_t lastSummary = limiter->lastSummary;
+    if (now - lastSummary >= kNOBLogRateLimiterSummaryIntervalNanoseconds &&
+        OSAtomicCompareAndSwap64Barrier(lastSummary, now, &limiter->lastSummary))
+    {
+        // only the thread that won the summary slot collects the count
+        do
+        {
+            suppressed = limiter->suppressed;
+        } while (!OSAtomicCompareAndSwap64Barrier(suppressed, 0, &limiter->suppressed));
+    }
+    return suppressed;
+}
+
+// A suppressed record is counted, an allowed one collects the count if a summary is due
+NS_INLINE BOOL Decide(NOBLogRateLimiter* limiter, BOOL allow, int64_t now, int64_t* pSuppressed);
+NS_INLINE BOOL Decide(NOBLogRateLimiter* limiter, BOOL allow, int64_t now, int64_t* pSuppressed)
+{
+    *pSuppressed = 0;
+
+    if (!allow)
+    {
+        OSAtomicIncrement64Barrier(&limiter->suppressed);
+        return NO;
+    }
+
+    if (limiter->suppressed > 0)
+        *pSuppressed = CollectSummary(limiter, now);
+
+    return YES;
+}
+
+BOOL NOBLogRateLimiterAllowRate(NOBLogRateLimiter* limiter, double perSecond, NSUInteger burst, int64_t* pSuppressed)
+{
+    // GCRA: the bucket is a single timestamp, the theoretical arrival time of the next record
+    int64_t now       = NanosecondsNow();
+    int64_t interval  = (int64_t)(NSEC_PER_SEC / MAX(perSecond, 1e-9));
+    int64_t tolerance = interval * (int64_t)(MAX(burst, (NSUInteger)1) - 1);
+    BOOL    allow;
+
+    while (true)
+    {
+        int64_t old = limiter->theoreticalArrival;
+        int64_t tat = MAX(old, now);
+
+        allow = (tat - now <= tolerance);
+        if (!allow ||
+            OSAtomicCompareAndSwap64(old, tat + interval, &limiter->theoreticalArrival))
+        {
+            break;
+        }
+    }
+
+    return Decide(limiter, allow, now, pSuppressed);
+}
+
+BOOL NOBLogRateLimiterAllowSample(NOBLogRateLimiter* limiter, uint32_t oneIn, int64_t* pSuppressed)
+{
+    int64_t count = OSAtomicIncrement64(&limiter->count) - 1;
+    BOOL    allow = (oneIn <= 1 || 0 == count % oneIn);
+
+    // only pay for the clock when a summary could be due
+    int64_t now = ((allow && limiter->suppressed > 0) ? NanosecondsNow() : 0);
+    return Decide(limiter, allow, now, pSuppressed);
+}
+
+void NOBLogRateLimiterSuppressed(NOBLogRateLimiter* limiter, NSUInteger level, const char* file, int line)
+{
+    if (!limiter->registered && OSAtomicCompareAndSwap32(0, 1, &limiter->registered))
+    {
+        limiter->level = level;
+        limiter->file  = file;
+        limiter->line  = line;
+
+        // publish the call site once it is complete
+        NOBLogRateLimiter* head;
+        do
+        {
+            head          = s_registeredLimiters;
+            limiter->next = head;
+        } while (!OSAtomicCompareAndSwapPtrBarrier(head, limiter, (void* volatile*)&s_registeredLimiters));
+    }
+
+    // the count was incremented (with a barrier) before this, a flush that clears the flag after it will see the count
+    if (!s_flushScheduled && OSAtomicCompareAndSwap32Barrier(0, 1, &s_flushScheduled))
+        NOBLogRateLimiterScheduleFlush();
+}
+
+// Summarize the call sites that went quiet with records still suppressed
+static void NOBLogRateLimiterFlush(void)
+{
+    OSAtomicCompareAndSwap32Barrier(1, 0, &s_flushScheduled);
+
+    BOOL    pending = NO;
+    int64_t now     = NanosecondsNow();
+    for (NOBLogRateLimiter* limiter = s_registeredLimiters; limiter; limiter = limiter->next)
+    {
+        if (limiter->suppressed <= 0)
+            continue;
+
+        int64_t suppressed = CollectSummary(limiter, now);
+        if (suppressed > 0)
+        {
+            __unsafe_unretained NOBLogger* log = NOBLOG;
+            if (NOBLoggerIsLevelEnabled(log, limiter->level))
+            {
+                [log writeASync:NOBLogRateLimiterSummary(suppressed, limiter->file, limiter->line)
+                          level:limiter->level
+                     callSiteId:NOBLogCallSiteIdentifier(limiter->file, limiter->line)];
+            }
+        }
+        else
+        {
+            pending = YES; // summarized too recently, try again next interval
+        }
+    }
+
+    if (pending && OSAtomicCompareAndSwap32Barrier(0, 1, &s_flushScheduled))
+        NOBLogRateLimiterScheduleFlush();
+}
+
+static void NOBLogRateLimiterScheduleFlush(void)
+{
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, kNOBLogRateLimiterSummaryIntervalNanoseconds),
+                   dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_LOW, 0),
+                   ^() {
+                       @autoreleasepool {
+                           NOBLogRateLimiterFlush();
+                       }
+                   });
+}
+
+NSString* NOBLogRateLimiterSummary(int64_t suppressed, const char* file, int line)
+{
+    const char* name = (file ? strrchr(file, '/') : NULL);
+    name = (name ? name + 1 : (file ? file : ""));
+
+    NSString* count = [NSNumberFormatter localizedStringFromNumber:@(suppressed) numberStyle:NSNumberFormatterDecimalStyle];
+    return [NSString stringWithFormat:@"suppressed %@ similar line%s from %s:%d", count, (1 == suppressed ? "" : "s"), name, line];
+}
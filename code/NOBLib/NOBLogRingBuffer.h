@@ -0,0 +1,121 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @enum NOBLogOverflowPolicy
+    What a producer does when the \c NOBLogRingBuffer it is writing to is full
+ */
+typedef NS_ENUM(NSInteger, NOBLogOverflowPolicy)
+{
+    NOBLogOverflowPolicy_Block = 0, /**< wait for the drain to make room.  Nothing is lost, but the logging thread can stall. */
+    NOBLogOverflowPolicy_DropNewest,/**< drop the record being written */
+    NOBLogOverflowPolicy_DropOldest /**< drop the oldest record that has not been drained yet to make room */
+};
+
+/**
+    Number of bytes a record can hold without a heap allocation.  Larger records spill to the heap.
+ */
+#define kNOBLogRecordInlineCapacity (256)
+
+/**
+    @struct NOBLogRecord
+    A single log record as it sits in a \c NOBLogRingBuffer.
+    @par Producers fill in a reserved record directly (no intermediate copies) and the consumer reads it in place.
+ */
+typedef struct _NOBLogRecord
+{
+    CFAbsoluteTime timestamp;   /**< time the record was generated */
+    int64_t        position;    /**< position of the record in the ring's total order. Set by the ring. */
+    uint32_t       level;       /**< the \c NOBLogLevel of the record */
+    uint32_t       flags;       /**< free for use by the owner of the ring */
+    uint32_t       length;      /**< number of valid bytes in \c bytes */
+    uint32_t       capacity;    /**< number of bytes that can be written to \c bytes. Set by the ring. */
+    uint32_t       callSiteId;  /**< id of the statement that logged the record, \c 0 if unknown */
+    uint32_t       category;    /**< the \c NOBLogCategory of the record, \c 0 if none */
+    uint64_t       threadId;    /**< mach thread id of the thread that logged the record */
+    char*          bytes;       /**< the payload. Points to inline storage or a heap allocation owned by the ring. */
+} NOBLogRecord;
+
+/**
+    @typedef NOBLogRingBufferRef
+    @par A bounded, lock-free, multi-producer ring buffer of \c NOBLogRecord.
+    @par Built for many producers and a single draining consumer.  The only other consumer is a producer discarding the oldest record with \c NOBLogOverflowPolicy_DropOldest.
+    @par Based on Dmitry Vyukov's bounded queue: every slot carries a sequence number so that producers and the consumer only contend on a single CAS each.
+ */
+typedef struct _NOBLogRingBuffer* NOBLogRingBufferRef;
+
+/**
+    Create a ring buffer
+    @param capacity the number of records the ring can hold.  Rounded up to a power of 2, minimum of \c 2.
+    @return a new ring.  Destroy with \c NOBLogRingBufferDestroy.
+ */
+NOBLogRingBufferRef NOBLogRingBufferCreate(NSUInteger capacity);
+/**
+    Destroy a ring buffer, discarding any records that were not drained.
+ */
+void NOBLogRingBufferDestroy(NOBLogRingBufferRef ring);
+
+/**
+    @return the number of records the ring can hold
+ */
+NSUInteger NOBLogRingBufferCapacity(NOBLogRingBufferRef ring);
+/**
+    @return the number of records that have been dropped because the ring was full
+ */
+uint64_t NOBLogRingBufferDroppedCount(NOBLogRingBufferRef ring);
+/**
+    @return \c YES if there are no records to drain
+ */
+BOOL NOBLogRingBufferIsEmpty(NOBLogRingBufferRef ring);
+/**
+    @return the position of the next record to be drained.  Every record with a lower \c position has been drained (or dropped).
+ */
+int64_t NOBLogRingBufferReadPosition(NOBLogRingBufferRef ring);
+
+/**
+    Reserve a record in the ring.
+    @param ring the ring to write to
+    @param length the number of bytes the record's payload needs
+    @param policy what to do if the ring is full
+    @return the reserved record with \c capacity of at least \a length.  Returns \c NULL if the record was dropped.
+    @note every reserved record MUST be committed with \c NOBLogRingBufferCommit, the consumer will not go past an uncommitted record.
+ */
+NOBLogRecord* NOBLogRingBufferReserve(NOBLogRingBufferRef ring, size_t length, NOBLogOverflowPolicy policy);
+/**
+    Grow the payload capacity of a reserved record that has not been committed yet.  Existing payload bytes are preserved.
+    @return \c YES on success, \c NO if the memory could not be allocated (the record is left untouched).
+ */
+BOOL NOBLogRingBufferGrowRecord(NOBLogRingBufferRef ring, NOBLogRecord* record, size_t capacity);
+/**
+    Publish a record that was reserved with \c NOBLogRingBufferReserve so that it can be drained.
+ */
+void NOBLogRingBufferCommit(NOBLogRingBufferRef ring, NOBLogRecord* record);
+
+/**
+    Drain records from the ring, oldest first.
+    @param ring the ring to drain
+    @param maxRecords the maximum number of records to drain.  Pass \c NSUIntegerMax to drain until empty.
+    @param handler called for each record. The record is only valid for the duration of the call.
+    @return the number of records drained
+    @warning must only be called from a single consumer at a time
+ */
+NSUInteger NOBLogRingBufferDrain(NOBLogRingBufferRef ring, NSUInteger maxRecords, void (^handler)(const NOBLogRecord* record));
@@ -0,0 +1,277 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogRingBuffer.h"
+#include <stddef.h>
+
+typedef struct _NOBLogRingSlot
+{
+    volatile int64_t sequence;
+    NOBLogRecord     record;
+    char             inlineBytes[kNOBLogRecordInlineCapacity];
+} NOBLogRingSlot;
+
+struct _NOBLogRingBuffer
+{
+    // keep the producer and consumer positions on separate cache lines
+    volatile int64_t     enqueuePosition;
+    char                 padding0[64 - sizeof(int64_t)];
+    volatile int64_t     dequeuePosition;
+    char                 padding1[64 - sizeof(int64_t)];
+    volatile int64_t     droppedCount;
+    volatile int32_t     blockedProducers;
+    dispatch_semaphore_t spaceAvailable;
+    NSUInteger           capacity;
+    NSUInteger           mask;
+    NOBLogRingSlot*      slots;
+};
+
+NS_INLINE NOBLogRingSlot* _SlotForRecord(NOBLogRecord* record)
+{
+    return (NOBLogRingSlot*)((char*)record - offsetof(NOBLogRingSlot, record));
+}
+
+NS_INLINE void _ReleaseSlotBytes(NOBLogRingSlot* slot)
+{
+    if (slot->record.bytes != slot->inlineBytes)
+    {
+        free(slot->record.bytes);
+        slot->record.bytes    = slot->inlineBytes;
+        slot->record.capacity = kNOBLogRecordInlineCapacity;
+    }
+}
+
+NOBLogRingBufferRef NOBLogRingBufferCreate(NSUInteger capacity)
+{
+    NSUInteger realCapacity = 2;
+    while (realCapacity < capacity)
+        realCapacity <<= 1;
+
+    NOBLogRingBufferRef ring = (NOBLogRingBufferRef)calloc(1, sizeof(struct _NOBLogRingBuffer));
+    ring->capacity       = realCapacity;
+    ring->mask           = realCapacity - 1;
+    ring->spaceAvailable = dispatch_semaphore_create(0);
+    ring->slots          = (NOBLogRingSlot*)calloc(realCapacity, sizeof(NOBLogRingSlot));
+    for (NSUInteger i = 0; i < realCapacity; i++)
+    {
+        NOBLogRingSlot* slot  = &ring->slots[i];
+        slot->sequence        = (int64_t)i;
+        slot->record.bytes    = slot->inlineBytes;
+        slot->record.capacity = kNOBLogRecordInlineCapacity;
+    }
+    OSMemoryBarrier();
+    return ring;
+}
+
+void NOBLogRingBufferDestroy(NOBLogRingBufferRef ring)
+{
+    if (!ring)
+        return;
+
+    for (NSUInteger i = 0; i < ring->capacity; i++)
+    {
+        _ReleaseSlotBytes(&ring->slots[i]);
+    }
+    dispatch_release(ring->spaceAvailable);
+    free(ring->slots);
+    free(ring);
+}
+
+NSUInteger NOBLogRingBufferCapacity(NOBLogRingBufferRef ring)
+{
+    return ring->capacity;
+}
+
+uint64_t NOBLogRingBufferDroppedCount(NOBLogRingBufferRef ring)
+{
+    return (uint64_t)OSAtomicAdd64Barrier(0, &ring->droppedCount);
+}
+
+BOOL NOBLogRingBufferIsEmpty(NOBLogRingBufferRef ring)
+{
+    OSMemoryBarrier();
+    return ring->dequeuePosition == ring->enqueuePosition;
+}
+
+int64_t NOBLogRingBufferReadPosition(NOBLogRingBufferRef ring)
+{
+    return OSAtomicAdd64Barrier(0, &ring->dequeuePosition);
+}
+
+// Claims the oldest committed record and throws it away.  Returns NO if there was nothing to discard.
+static BOOL _DiscardOldest(NOBLogRingBufferRef ring)
+{
+    while (true)
+    {
+        int64_t         pos   = ring->dequeuePosition;
+        NOBLogRingSlot* slot  = &ring->slots[pos & ring->mask];
+        int64_t         seq   = slot->sequence;
+        int64_t         delta = seq - (pos + 1);
+
+        if (delta < 0)
+            return NO; // empty or the oldest record is still being written
+
+        if (0 == delta &&
+            OSAtomicCompareAndSwap64Barrier(pos, pos + 1, &ring->dequeuePosition))
+        {
+            _ReleaseSlotBytes(slot);
+            OSMemoryBarrier();
+            slot->sequence = pos + (int64_t)ring->mask + 1;
+            OSAtomicIncrement64Barrier(&ring->droppedCount);
+            return YES;
+        }
+    }
+}
+
+NOBLogRecord* NOBLogRingBufferReserve(NOBLogRingBufferRef ring, size_t length, NOBLogOverflowPolicy policy)
+{
+    NOBLogRingSlot* slot = NULL;
+    int64_t         pos  = 0;
+
+    while (!slot)
+    {
+        pos = ring->enqueuePosition;
+        NOBLogRingSlot* candidate = &ring->slots[pos & ring->mask];
+        int64_t         seq       = candidate->sequence;
+        int64_t         delta     = seq - pos;
+
+        if (0 == delta)
+        {
+            if (OSAtomicCompareAndSwap64Barrier(pos, pos + 1, &ring->enqueuePosition))
+                slot = candidate;
+        }
+        else if (delta < 0)
+        {
+            // Full
+            if (NOBLogOverflowPolicy_DropNewest == policy)
+            {
+                OSAtomicIncrement64Barrier(&ring->droppedCount);
+                return NULL;
+            }
+            else if (NOBLogOverflowPolicy_DropOldest == policy)
+            {
+                if (!_DiscardOldest(ring))
+                    sched_yield();
+            }
+            else
+            {
+                OSAtomicIncrement32Barrier(&ring->blockedProducers);
+                dispatch_semaphore_wait(ring->spaceAvailable, dispatch_time(DISPATCH_TIME_NOW, NSEC_PER_MSEC));
+                OSAtomicDecrement32Barrier(&ring->blockedProducers);
+            }
+        }
+        // else another producer won the slot, reload and try again
+    }
+
+    OSMemoryBarrier();
+    NOBLogRecord* record = &slot->record;
+    if (length > record->capacity)
+    {
+        char* bytes = (char*)malloc(length);
+        if (!bytes)
+        {
+            // Can't hold the payload, commit an empty record so the ring keeps moving
+            length = 0;
+        }
+        else
+        {
+            record->bytes    = bytes;
+            record->capacity = (uint32_t)length;
+        }
+    }
+    record->position   = pos;
+    record->length     = 0;
+    record->flags      = 0;
+    record->level      = 0;
+    record->timestamp  = 0;
+    record->callSiteId = 0;
+    record->category   = 0;
+    record->threadId   = 0;
+    return record;
+}
+
+BOOL NOBLogRingBufferGrowRecord(NOBLogRingBufferRef ring, NOBLogRecord* record, size_t capacity)
+{
+    if (capacity <= record->capacity)
+        return YES;
+
+    NOBLogRingSlot* slot  = _SlotForRecord(record);
+    char*           bytes = NULL;
+    if (record->bytes == slot->inlineBytes)
+    {
+        bytes = (char*)malloc(capacity);
+        if (bytes)
+            memcpy(bytes, record->bytes, record->length);
+    }
+    else
+    {
+        bytes = (char*)realloc(record->bytes, capacity);
+    }
+
+    if (!bytes)
+        return NO;
+
+    record->bytes    = bytes;
+    record->capacity = (uint32_t)capacity;
+    return YES;
+}
+
+void NOBLogRingBufferCommit(NOBLogRingBufferRef ring, NOBLogRecord* record)
+{
+    NOBLogRingSlot* slot = _SlotForRecord(record);
+
+    NOBCAssert(record->length <= record->capacity);
+    OSMemoryBarrier();
+    slot->sequence = record->position + 1;
+}
+
+NSUInteger NOBLogRingBufferDrain(NOBLogRingBufferRef ring, NSUInteger maxRecords, void (^handler)(const NOBLogRecord* record))
+{
+    NSUInteger drained = 0;
+
+    while (drained < maxRecords)
+    {
+        int64_t         pos   = ring->dequeuePosition;
+        NOBLogRingSlot* slot  = &ring->slots[pos & ring->mask];
+        int64_t         seq   = slot->sequence;
+        int64_t         delta = seq - (pos + 1);
+
+        if (delta < 0)
+            break; // empty or next record isn't committed yet
+
+        if (0 == delta &&
+            OSAtomicCompareAndSwap64Barrier(pos, pos + 1, &ring->dequeuePosition))
+        {
+            handler(&slot->record);
+            _ReleaseSlotBytes(slot);
+            OSMemoryBarrier();
+            slot->sequence = pos + (int64_t)ring->mask + 1;
+            drained++;
+        }
+        // else a producer discarded the record, reload and try again
+    }
+
+    if (drained > 0 && ring->blockedProducers > 0)
+    {
+        dispatch_semaphore_signal(ring->spaceAvailable);
+    }
+
+    return drained;
+}
@@ -0,0 +1,75 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    File extension used for log files written with a \c NOBLogSegmentRef
+ */
+#define kNOBLogSegmentFileExtension @"mlog"
+
+/**
+    @typedef NOBLogSegmentRef
+    @par An append only log file that is written through a shared memory map.
+    @par The file starts with a small binary header that holds the committed length of the data that follows.  The committed length is only advanced (atomically) after the appended bytes have been copied into the map.
+    @par Since the map is shared, the bytes are in the kernel's page cache as soon as they are copied, so every committed byte survives the process crashing without any \c fflush or \c msync.  \c NOBLogSegmentSync is only needed to survive the OS going down.
+    @par The file is pre-sized to the segment's capacity and grows (by remapping) if an append does not fit.  When a segment is closed it is truncated to its committed length.
+ */
+typedef struct _NOBLogSegment* NOBLogSegmentRef;
+
+/**
+    Create a new segment file, truncating any existing file at \a path.
+    @param path the file path
+    @param capacity the number of data bytes to pre-size the segment for
+    @return the new segment or \c NULL on failure (\c errno is set)
+ */
+NOBLogSegmentRef NOBLogSegmentCreate(const char* path, size_t capacity);
+/**
+    Close a segment, truncating the file to its committed length.
+ */
+void NOBLogSegmentClose(NOBLogSegmentRef segment);
+
+/**
+    Append bytes to the segment and commit them.
+    @return the number of bytes appended, \a length on success or \c 0 if the segment could not grow.
+ */
+size_t NOBLogSegmentAppend(NOBLogSegmentRef segment, const void* bytes, size_t length);
+/**
+    @return the committed length of the segment's data
+ */
+unsigned long long NOBLogSegmentLength(NOBLogSegmentRef segment);
+/**
+    Schedule (or wait for, with \a wait) the segment's dirty pages to be written to disk with \c msync.
+ */
+void NOBLogSegmentSync(NOBLogSegmentRef segment, BOOL wait);
+
+/**
+    Find the committed data in a segment file, written by this process or by a previous one that may have crashed.
+    @param path the segment file path
+    @param offset set to the file offset of the first data byte
+    @param length set to the committed number of data bytes
+    @return \c YES if \a path is a segment file
+ */
+BOOL NOBLogSegmentFileGetDataRange(const char* path, off_t* offset, unsigned long long* length);
+/**
+    Truncate a segment file left behind by a process that did not close it (i.e. crashed) down to its committed length.
+    @return the size of the file on disk after recovery, or \c 0 if \a path is not a segment file
+ */
+unsigned long long NOBLogSegmentFileRecover(const char* path);
@@ -0,0 +1,197 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogSegment.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define kNOBLogSegmentMagic   "NOBLSEG"
+#define kNOBLogSegmentVersion (1)
+
+typedef struct _NOBLogSegmentHeader
+{
+    char             magic[8];
+    uint32_t         headerSize;
+    uint32_t         version;
+    volatile int64_t committedLength; // only changed atomically
+} NOBLogSegmentHeader;
+
+struct _NOBLogSegment
+{
+    int                  fd;
+    size_t               mappedSize;
+    NOBLogSegmentHeader* header;
+    char*                data;
+};
+
+NS_INLINE size_t _PageRound(size_t size)
+{
+    size_t pageSize = (size_t)getpagesize();
+    return (size + pageSize - 1) & ~(pageSize - 1);
+}
+
+static BOOL _NOBLogSegmentMap(NOBLogSegmentRef segment, size_t mappedSize)
+{
+    if (0 != ftruncate(segment->fd, (off_t)mappedSize))
+        return NO;
+
+    void* map = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (MAP_FAILED == map)
+        return NO;
+
+    if (segment->header)
+        munmap(segment->header, segment->mappedSize);
+
+    segment->header     = (NOBLogSegmentHeader*)map;
+    segment->data       = (char*)map + sizeof(NOBLogSegmentHeader);
+    segment->mappedSize = mappedSize;
+    return YES;
+}
+
+NOBLogSegmentRef NOBLogSegmentCreate(const char* path, size_t capacity)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return NULL;
+
+    NOBLogSegmentRef segment = (NOBLogSegmentRef)calloc(1, sizeof(struct _NOBLogSegment));
+    segment->fd = fd;
+    if (!_NOBLogSegmentMap(segment, _PageRound(sizeof(NOBLogSegmentHeader) + capacity)))
+    {
+        int err = errno;
+        close(fd);
+        unlink(path);
+        free(segment);
+        errno = err;
+        return NULL;
+    }
+
+    memcpy(segment->header->magic, kNOBLogSegmentMagic, sizeof(kNOBLogSegmentMagic));
+    segment->header->headerSize      = sizeof(NOBLogSegmentHeader);
+    segment->header->version         = kNOBLogSegmentVersion;
+    segment->header->committedLength = 0;
+    OSMemoryBarrier();
+    return segment;
+}
+
+void NOBLogSegmentClose(NOBLogSegmentRef segment)
+{
+    if (!segment)
+        return;
+
+    off_t fileSize = (off_t)(sizeof(NOBLogSegmentHeader) + segment->header->committedLength);
+    munmap(segment->header, segment->mappedSize);
+    ftruncate(segment->fd, fileSize);
+    close(segment->fd);
+    free(segment);
+}
+
+size_t NOBLogSegmentAppend(NOBLogSegmentRef segment, const void* bytes, size_t length)
+{
+    size_t committed = (size_t)segment->header->committedLength;
+    size_t needed    = sizeof(NOBLogSegmentHeader) + committed + length;
+
+    if (needed > segment->mappedSize)
+    {
+        size_t mappedSize = segment->mappedSize * 2;
+        if (mappedSize < needed)
+            mappedSize = needed;
+        if (!_NOBLogSegmentMap(segment, _PageRound(mappedSize)))
+            return 0;
+    }
+
+    memcpy(segment->data + committed, bytes, length);
+    // the data must be in the map before the header says it is committed
+    OSAtomicAdd64Barrier((int64_t)length, &segment->header->committedLength);
+    return length;
+}
+
+unsigned long long NOBLogSegmentLength(NOBLogSegmentRef segment)
+{
+    return (unsigned long long)segment->header->committedLength;
+}
+
+void NOBLogSegmentSync(NOBLogSegmentRef segment, BOOL wait)
+{
+    size_t length = _PageRound(sizeof(NOBLogSegmentHeader) + (size_t)segment->header->committedLength);
+    msync(segment->header, MIN(length, segment->mappedSize), (wait ? MS_SYNC : MS_ASYNC));
+}
+
+NS_INLINE BOOL _ReadHeader(int fd, NOBLogSegmentHeader* header, off_t* fileSize)
+{
+    struct stat info;
+    if (0 != fstat(fd, &info))
+        return NO;
+
+    if (pread(fd, header, sizeof(NOBLogSegmentHeader), 0) != sizeof(NOBLogSegmentHeader) ||
+        0 != memcmp(header->magic, kNOBLogSegmentMagic, sizeof(kNOBLogSegmentMagic)) ||
+        header->headerSize < sizeof(NOBLogSegmentHeader) ||
+        header->committedLength < 0)
+    {
+        return NO;
+    }
+
+    // never trust the committed length past the end of the file
+    if ((off_t)header->headerSize + header->committedLength > info.st_size)
+        header->committedLength = MAX((int64_t)0, (int64_t)(info.st_size - (off_t)header->headerSize));
+    *fileSize = info.st_size;
+    return YES;
+}
+
+BOOL NOBLogSegmentFileGetDataRange(const char* path, off_t* offset, unsigned long long* length)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NO;
+
+    NOBLogSegmentHeader header;
+    off_t               fileSize = 0;
+    BOOL                isSegment = _ReadHeader(fd, &header, &fileSize);
+    close(fd);
+
+    if (isSegment)
+    {
+        *offset = header.headerSize;
+        *length = (unsigned long long)header.committedLength;
+    }
+    return isSegment;
+}
+
+unsigned long long NOBLogSegmentFileRecover(const char* path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0)
+        return 0;
+
+    NOBLogSegmentHeader header;
+    off_t               fileSize = 0;
+    unsigned long long  size     = 0;
+    if (_ReadHeader(fd, &header, &fileSize))
+    {
+        off_t committedSize = (off_t)header.headerSize + header.committedLength;
+        if (fileSize > committedSize)
+            ftruncate(fd, committedSize);
+        size = (unsigned long long)committedSize;
+    }
+    close(fd);
+    return size;
+}
@@ -0,0 +1,142 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogger.h"
+
+/**
+    Default bound on the bytes a \c NOBLogSink can have waiting to be written before its \c overflowPolicy kicks in
+ */
+FOUNDATION_EXPORT NSUInteger const kNOBLogSinkDefaultMaxPendingBytes; /*!< \c 256 KB */
+
+/**
+    @class NOBLogSinkBatch
+    The lines of one \c NOBLogger drain, encoded once as text (the format of a text log file) and shared by every sink.
+    @par Built by the \c NOBLogger drain context and immutable once handed to the sinks.
+ */
+@interface NOBLogSinkBatch : NSObject
+
+/** the number of lines in the batch */
+@property (nonatomic, readonly) NSUInteger lineCount;
+/** the number of bytes of text in the batch */
+@property (nonatomic, readonly) NSUInteger length;
+
+/**
+    Append a line made of \a prefix followed by \a message and a newline
+    @warning only valid before the batch is handed to a sink
+ */
+- (void) appendLineWithPrefix:(const char*)prefix
+                 prefixLength:(size_t)prefixLength
+                      message:(const char*)message
+                       length:(size_t)length
+                        level:(NOBLogLevel)level;
+
+@end
+
+/**
+    @class NOBLogSink
+    An output of a \c NOBLogger besides its log files, see \c -[NOBLogger addSink:].
+    @par Every sink has its own serial drain queue, its own level filter and its own bound on pending output.  A slow sink (the console, the network) never holds up the \c NOBLogger or the other sinks; once \c maxPendingBytes are waiting, \c overflowPolicy decides whether the \c NOBLogger drain waits or lines are dropped.
+    @par Subclass and override \c writeLines:length:lineCount: for a custom sink, or use \c NOBLogBlockSink.
+ */
+@interface NOBLogSink : NSObject
+
+/**
+    Designated initializer
+    @param level the least important level the sink writes.  Lines must also pass the \c NOBLogger object's \c logLevel (or their category's level) to reach a sink.
+    @param policy what to do with a new batch when \c maxPendingBytes are already waiting.  \c NOBLogOverflowPolicy_Block holds up the \c NOBLogger drain (and so eventually its producers) until the sink catches up.
+ */
+- (instancetype) initWithLevel:(NOBLogLevel)level overflowPolicy:(NOBLogOverflowPolicy)policy;
+
+/** the least important level the sink writes, can be changed at any time */
+@property (nonatomic, assign) NOBLogLevel level;
+/** what happens to new lines once \c maxPendingBytes are waiting to be written */
+@property (nonatomic, readonly) NOBLogOverflowPolicy overflowPolicy;
+/** the bound on bytes waiting to be written.  Default is \c kNOBLogSinkDefaultMaxPendingBytes.  A single batch larger than this is still accepted when nothing else is waiting. */
+@property (nonatomic, assign) NSUInteger maxPendingBytes;
+/** the number of lines dropped because of \c overflowPolicy */
+@property (nonatomic, readonly) uint64_t droppedLineCount;
+
+/**
+    Wait until every line handed to the sink has been written
+ */
+- (void) flush;
+
+/**
+    Hand a batch to the sink, returns as soon as the batch is queued (or dropped).  Called by \c NOBLogger.
+ */
+- (void) enqueueBatch:(NOBLogSinkBatch*)batch;
+
+/**
+    Write lines.  Override to implement a sink, the default implementation does nothing.
+    @param bytes newline terminated lines of text, only valid for the duration of the call
+    @param length the number of bytes
+    @param lineCount the number of lines
+    @note always called on the sink's own serial queue, never concurrently
+ */
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount;
+
+@end
+
+/**
+    @class NOBLogConsoleSink
+    Writes lines to \c stderr, where \c NSLog writes to.
+ */
+@interface NOBLogConsoleSink : NOBLogSink
+@end
+
+/**
+    @class NOBLogFileSink
+    Appends lines to a single file, i.e. a pipe or a file another process picks up.  There is no rollover, for a managed set of log files use a \c NOBLogger.
+ */
+@interface NOBLogFileSink : NOBLogSink
+/**
+    @return the sink or \c nil if \a path could not be opened for appending
+ */
+- (instancetype) initWithPath:(NSString*)path level:(NOBLogLevel)level overflowPolicy:(NOBLogOverflowPolicy)policy;
+@property (nonatomic, readonly) NSString* path;
+@end
+
+/**
+    @class NOBLogMemorySink
+    Keeps the most recent lines in memory.
+ */
+@interface NOBLogMemorySink : NOBLogSink
+/**
+    @param capacity the number of lines kept
+ */
+- (instancetype) initWithCapacity:(NSUInteger)capacity level:(NOBLogLevel)level;
+/**
+    @return up to \a maxLineCount of the most recent lines that have been written to the sink (call \c flush first to include everything handed to it)
+ */
+- (NSData*) mostRecentLines:(NSUInteger)maxLineCount;
+@end
+
+/**
+    @class NOBLogBlockSink
+    Calls a block with every batch of lines
+ */
+@interface NOBLogBlockSink : NOBLogSink
+/**
+    @param block called on the sink's queue.  \a lines is only valid for the duration of the call, copy it to keep it.
+ */
+- (instancetype) initWithLevel:(NOBLogLevel)level
+                overflowPolicy:(NOBLogOverflowPolicy)policy
+                         block:(void (^)(NSData* lines, NSUInteger lineCount))block;
+@end
@@ -0,0 +1,466 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBLogSink.h"
+#include <libkern/OSAtomic.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+NSUInteger const kNOBLogSinkDefaultMaxPendingBytes = 256 * 1024;
+
+typedef struct _NOBLogSinkLine
+{
+    uint32_t length; // including the newline
+    uint32_t level;
+} NOBLogSinkLine;
+
+static BOOL NOBLogSinkWriteFully(int fd, const char* bytes, size_t length);
+
+#pragma mark - NOBLogSinkBatch
+
+@implementation NOBLogSinkBatch
+{
+    @public
+    char*           _bytes;
+    size_t          _length;
+    size_t          _capacity;
+    NOBLogSinkLine* _lines;
+    NSUInteger      _lineCount;
+    NSUInteger      _lineCapacity;
+    NOBLogLevel     _minLevel; // the most important level in the batch
+    NOBLogLevel     _maxLevel; // the least important level in the batch
+}
+
+- (void) dealloc
+{
+    free(_bytes);
+    free(_lines);
+}
+
+- (NSUInteger) lineCount
+{
+    return _lineCount;
+}
+
+- (NSUInteger) length
+{
+    return _length;
+}
+
+- (void) appendLineWithPrefix:(const char*)prefix
+                 prefixLength:(size_t)prefixLength
+                      message:(const char*)message
+                       length:(size_t)length
+                        level:(NOBLogLevel)level
+{
+    size_t lineLength = prefixLength + length + 1;
+    if (_length + lineLength > _capacity)
+    {
+        size_t capacity = MAX(_capacity * 2, _length + lineLength);
+        capacity = MAX(capacity, (size_t)4096);
+        char*  bytes    = (char*)realloc(_bytes, capacity);
+        if (!bytes)
+            return;
+        _bytes    = bytes;
+        _capacity = capacity;
+    }
+    if (_lineCount == _lineCapacity)
+    {
+        NSUInteger      lineCapacity = MAX(_lineCapacity * 2, (NSUInteger)64);
+        NOBLogSinkLine* lines        = (NOBLogSinkLine*)realloc(_lines, lineCapacity * sizeof(NOBLogSinkLine));
+        if (!lines)
+            return;
+        _lines        = lines;
+        _lineCapacity = lineCapacity;
+    }
+
+    memcpy(_bytes + _length, prefix, prefixLength);
+    memcpy(_bytes + _length + prefixLength, message, length);
+    _bytes[_length + lineLength - 1] = '\n';
+    _length += lineLength;
+
+    _lines[_lineCount].length = (uint32_t)lineLength;
+    _lines[_lineCount].level  = (uint32_t)level;
+    if (!_lineCount || level < _minLevel)
+        _minLevel = level;
+    if (!_lineCount || level > _maxLevel)
+        _maxLevel = level;
+    _lineCount++;
+}
+
+@end
+
+#pragma mark - NOBLogSink
+
+@implementation NOBLogSink
+{
+    dispatch_queue_t      _queue;
+    volatile NOBLogLevel  _level;
+    volatile NSUInteger   _maxPendingBytes;
+    NOBLogOverflowPolicy  _overflowPolicy;
+    volatile int64_t      _droppedLineCount;
+    int64_t               _droppedLinesReported; // only touched on _queue
+
+    // batches waiting for _queue, the lock is never held while writing
+    pthread_mutex_t          _pendingLock;
+    pthread_cond_t           _pendingCond;
+    __strong NSMutableArray* _pending;
+    NSUInteger               _pendingBytes; // including the batch being written
+    BOOL                     _drainScheduled;
+
+    char*                 _filterBuffer; // only touched on _queue
+    size_t                _filterBufferCapacity;
+}
+
+- (instancetype) init
+{
+    return [self initWithLevel:NOBLogLevel_Low overflowPolicy:NOBLogOverflowPolicy_DropOldest];
+}
+
+- (instancetype) initWithLevel:(NOBLogLevel)level overflowPolicy:(NOBLogOverflowPolicy)policy
+{
+    if (self = [super init])
+    {
+        _queue           = dispatch_queue_create("NOBLogSinkQ", DISPATCH_QUEUE_SERIAL);
+        _level           = level;
+        _overflowPolicy  = policy;
+        _maxPendingBytes = kNOBLogSinkDefaultMaxPendingBytes;
+        _pending         = [[NSMutableArray alloc] init];
+        pthread_mutex_init(&_pendingLock, NULL);
+        pthread_cond_init(&_pendingCond, NULL);
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    // every drain block retains the sink, nothing can be pending
+    dispatch_release(_queue);
+    pthread_mutex_destroy(&_pendingLock);
+    pthread_cond_destroy(&_pendingCond);
+    free(_filterBuffer);
+}
+
+- (NOBLogLevel) level
+{
+    return _level;
+}
+
+- (void) setLevel:(NOBLogLevel)level
+{
+    _level = level;
+}
+
+- (NSUInteger) maxPendingBytes
+{
+    return _maxPendingBytes;
+}
+
+- (void) setMaxPendingBytes:(NSUInteger)maxPendingBytes
+{
+    pthread_mutex_lock(&_pendingLock);
+    _maxPendingBytes = maxPendingBytes;
+    pthread_cond_broadcast(&_pendingCond);
+    pthread_mutex_unlock(&_pendingLock);
+}
+
+- (NOBLogOverflowPolicy) overflowPolicy
+{
+    return _overflowPolicy;
+}
+
+- (uint64_t) droppedLineCount
+{
+    return (uint64_t)OSAtomicAdd64Barrier(0, &_droppedLineCount);
+}
+
+- (void) flush
+{
+    // the drain is always scheduled on _queue while batches are pending
+    dispatch_sync(_queue, ^() {});
+}
+
+- (void) enqueueBatch:(NOBLogSinkBatch*)batch
+{
+    if (!batch->_lineCount || batch->_minLevel > _level)
+        return; // nothing in the batch for us
+
+    BOOL schedule = NO;
+    pthread_mutex_lock(&_pendingLock);
+    while (_pendingBytes && _pendingBytes + batch->_length > _maxPendingBytes)
+    {
+        if (NOBLogOverflowPolicy_Block == _overflowPolicy)
+        {
+            pthread_cond_wait(&_pendingCond, &_pendingLock);
+        }
+        else if (NOBLogOverflowPolicy_DropOldest == _overflowPolicy && _pending.count)
+        {
+            NOBLogSinkBatch* oldest = [_pending objectAtIndex:0];
+            _pendingBytes -= oldest->_length;
+            OSAtomicAdd64Barrier((int64_t)oldest->_lineCount, &_droppedLineCount);
+            [_pending removeObjectAtIndex:0];
+        }
+        else
+        {
+            // NOBLogOverflowPolicy_DropNewest, or the only pending bytes are being written right now
+            OSAtomicAdd64Barrier((int64_t)batch->_lineCount, &_droppedLineCount);
+            pthread_mutex_unlock(&_pendingLock);
+            return;
+        }
+    }
+    [_pending addObject:batch];
+    _pendingBytes += batch->_length;
+    if (!_drainScheduled)
+    {
+        _drainScheduled = YES;
+        schedule        = YES;
+    }
+    pthread_mutex_unlock(&_pendingLock);
+
+    if (schedule)
+    {
+        dispatch_async(_queue, ^() {
+            [self _drain];
+        });
+    }
+}
+
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount
+{
+    // No-op
+}
+
+- (void) _drain
+{
+    pthread_mutex_lock(&_pendingLock);
+    while (_pending.count)
+    {
+        NOBLogSinkBatch* batch = [_pending objectAtIndex:0];
+        [_pending removeObjectAtIndex:0];
+        pthread_mutex_unlock(&_pendingLock);
+
+        @autoreleasepool {
+            [self _writeBatch:batch];
+        }
+
+        pthread_mutex_lock(&_pendingLock);
+        _pendingBytes -= batch->_length;
+        pthread_cond_broadcast(&_pendingCond);
+    }
+    _drainScheduled = NO;
+    pthread_mutex_unlock(&_pendingLock);
+}
+
+- (void) _writeBatch:(NOBLogSinkBatch*)batch
+{
+    int64_t dropped = (int64_t)self.droppedLineCount;
+    if (dropped != _droppedLinesReported)
+    {
+        char   notice[96];
+        size_t length = (size_t)snprintf(notice, sizeof(notice), "!!!!  %lld log lines were dropped, the sink fell behind  !!!!\n", dropped - _droppedLinesReported);
+        [self writeLines:notice length:MIN(length, sizeof(notice) - 1) lineCount:1];
+        _droppedLinesReported = dropped;
+    }
+
+    NOBLogLevel level = _level;
+    if (batch->_maxLevel <= level)
+    {
+        // the common case, every line passes and the shared text is written as is
+        [self writeLines:batch->_bytes length:batch->_length lineCount:batch->_lineCount];
+        return;
+    }
+
+    if (_filterBufferCapacity < batch->_length)
+    {
+        char* buffer = (char*)realloc(_filterBuffer, batch->_length);
+        if (!buffer)
+            return;
+        _filterBuffer         = buffer;
+        _filterBufferCapacity = batch->_length;
+    }
+
+    size_t      length    = 0;
+    NSUInteger  lineCount = 0;
+    const char* line      = batch->_bytes;
+    for (NSUInteger i = 0; i < batch->_lineCount; i++)
+    {
+        if (batch->_lines[i].level <= level)
+        {
+            memcpy(_filterBuffer + length, line, batch->_lines[i].length);
+            length += batch->_lines[i].length;
+            lineCount++;
+        }
+        line += batch->_lines[i].length;
+    }
+    if (lineCount)
+    {
+        [self writeLines:_filterBuffer length:length lineCount:lineCount];
+    }
+}
+
+@end
+
+#pragma mark - NOBLogConsoleSink
+
+@implementation NOBLogConsoleSink
+
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount
+{
+    NOBLogSinkWriteFully(STDERR_FILENO, bytes, length);
+}
+
+@end
+
+#pragma mark - NOBLogFileSink
+
+@implementation NOBLogFileSink
+{
+    int _fd;
+}
+
+@synthesize path = _path;
+
+- (instancetype) initWithPath:(NSString*)path level:(NOBLogLevel)level overflowPolicy:(NOBLogOverflowPolicy)policy
+{
+    if (self = [super initWithLevel:level overflowPolicy:policy])
+    {
+        _path = [path copy];
+        _fd   = (path ? open(path.fileSystemRepresentation, O_WRONLY | O_APPEND | O_CREAT, 0644) : -1);
+        if (_fd < 0)
+        {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    if (_fd >= 0)
+    {
+        close(_fd);
+    }
+}
+
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount
+{
+    NOBLogSinkWriteFully(_fd, bytes, length);
+}
+
+@end
+
+#pragma mark - NOBLogMemorySink
+
+@implementation NOBLogMemorySink
+{
+    NOBLogHistoryRef _history;
+}
+
+- (instancetype) initWithCapacity:(NSUInteger)capacity level:(NOBLogLevel)level
+{
+    if (self = [super initWithLevel:level overflowPolicy:NOBLogOverflowPolicy_DropOldest])
+    {
+        _history = NOBLogHistoryCreate(capacity);
+        if (!_history)
+        {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void) dealloc
+{
+    NOBLogHistoryDestroy(_history);
+}
+
+- (NSData*) mostRecentLines:(NSUInteger)maxLineCount
+{
+    maxLineCount = MIN(maxLineCount, NOBLogHistoryCapacity(_history));
+
+    NSMutableData* lines = [NSMutableData data];
+    NSUInteger     count = 0;
+    NOBLogHistoryCopy(_history, MAX(NOBLogHistoryHead(_history) - (int64_t)maxLineCount, 0), maxLineCount, lines, &count, NULL);
+    return lines;
+}
+
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount
+{
+    const char* end = bytes + length;
+    while (bytes < end)
+    {
+        const char* newline = (const char*)memchr(bytes, '\n', (size_t)(end - bytes));
+        if (!newline)
+            newline = end;
+        NOBLogHistoryAppend(_history, bytes, (size_t)(newline - bytes), newline, 0);
+        bytes = newline + 1;
+    }
+}
+
+@end
+
+#pragma mark - NOBLogBlockSink
+
+@implementation NOBLogBlockSink
+{
+    __strong void (^_block)(NSData* lines, NSUInteger lineCount);
+}
+
+- (instancetype) initWithLevel:(NOBLogLevel)level
+                overflowPolicy:(NOBLogOverflowPolicy)policy
+                         block:(void (^)(NSData* lines, NSUInteger lineCount))block
+{
+    if (self = [super initWithLevel:level overflowPolicy:policy])
+    {
+        _block = [block copy];
+    }
+    return self;
+}
+
+- (void) writeLines:(const char*)bytes length:(size_t)length lineCount:(NSUInteger)lineCount
+{
+    if (_block)
+    {
+        _block([NSData dataWithBytesNoCopy:(void*)bytes length:length freeWhenDone:NO], lineCount);
+    }
+}
+
+@end
+
+#pragma mark - Functions
+
+static BOOL NOBLogSinkWriteFully(int fd, const char* bytes, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0)
+        {
+            if (EINTR == errno)
+                continue;
+            return NO;
+        }
+        bytes  += written;
+        length -= (size_t)written;
+    }
+    return YES;
+}
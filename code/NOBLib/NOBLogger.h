@@ -19,6 +19,10 @@
  */
 
 #import <Foundation/Foundation.h>
+#import "NOBLogRingBuffer.h"
+#import "NOBLogBinaryFormat.h"
+#import "NOBLogRateLimiter.h"
+#import "NOBLogHistory.h"
 
 /**
     @def DLOG(format, ...)
@@ -33,8 +37,20 @@
 /**
     @def LOG(lvl, format, ...)
     Log by providing the \c NOBLogLevel. Provide a format string followed by any format arguments.
+    @par The level is checked before anything is formatted, so a filtered out \c LOG costs a load and a branch.
+    @par Each \c LOG statement tags its records with a call site id, see \c NOBLogCallSiteIdentifier.
  */
-#define LOG(lvl, format, ...) [NOBLOG writeASync:[NSString stringWithFormat:format, ##__VA_ARGS__] level:lvl]
+#define LOG(lvl, format, ...) \
+do { \
+    __unsafe_unretained NOBLogger* nobLogger__ = NOBLOG; \
+    if (NOBLoggerIsLevelEnabled(nobLogger__, lvl)) \
+    { \
+        static uint32_t nobCallSiteId__ = 0; \
+        if (!nobCallSiteId__) \
+            nobCallSiteId__ = NOBLogCallSiteIdentifier(__FILE__, __LINE__); \
+        [nobLogger__ writeASync:[NSString stringWithFormat:format, ##__VA_ARGS__] level:lvl callSiteId:nobCallSiteId__]; \
+    } \
+} while (0)
 
 /**
     @def LOG_HI(format, ...)
@@ -62,11 +78,121 @@
 #define LOG_DBG(format, ...) LOG(NOBLogLevel_Low, format,##__VA_ARGS__)
 #endif
 
+/**
+    @def LOG_DEFERRED(lvl, format, ...)
+    Same as \c LOG but the formatting is deferred to the \c NOBLogger object's drain context.  Only the \a format pointer and a compact binary copy of the arguments are captured by the caller.
+    @par \a format MUST be a \c C string literal (not an \c NSString) since only its pointer is kept.
+    @par The format is checked as a \c printf format, so \c %\@ is not accepted.  Log an object with \c %s and its \c description.UTF8String, the string is copied when the record is captured.
+    @see writeASyncWithLevel:deferredFormat:
+ */
+#define LOG_DEFERRED(lvl, format, ...) \
+do { \
+    __unsafe_unretained NOBLogger* nobLogger__ = NOBLOG; \
+    if (NOBLoggerIsLevelEnabled(nobLogger__, lvl)) \
+    { \
+        static uint32_t nobCallSiteId__ = 0; \
+        if (!nobCallSiteId__) \
+            nobCallSiteId__ = NOBLogCallSiteIdentifier(__FILE__, __LINE__); \
+        [nobLogger__ writeASyncWithLevel:lvl callSiteId:nobCallSiteId__ deferredFormat:"" format, ##__VA_ARGS__]; \
+    } \
+} while (0)
+
+/**
+    @def LOG_HI_DEFERRED(format, ...)
+    \c LOG_DEFERRED using \c NOBLogLevel_High.
+ */
+#define LOG_HI_DEFERRED(format, ...)  LOG_DEFERRED(NOBLogLevel_High, format,##__VA_ARGS__)
+/**
+    @def LOG_MID_DEFERRED(format, ...)
+    \c LOG_DEFERRED using \c NOBLogLevel_Mid.
+ */
+#define LOG_MID_DEFERRED(format, ...) LOG_DEFERRED(NOBLogLevel_Mid, format,##__VA_ARGS__)
+/**
+    @def LOG_LO_DEFERRED(format, ...)
+    \c LOG_DEFERRED using \c NOBLogLevel_Low.
+ */
+#define LOG_LO_DEFERRED(format, ...)  LOG_DEFERRED(NOBLogLevel_Low, format,##__VA_ARGS__)
+
+/**
+    @def LOG_RATE_LIMITED(lvl, perSecond, burst, format, ...)
+    Same as \c LOG but the call site logs at most \a perSecond lines per second after an initial \a burst.  For logs in loops and retry paths that could otherwise flood the logs.
+    @par The decision is made with lock-free atomics on a \c static \c NOBLogRateLimiter before anything is formatted or queued.
+    @par Suppressed lines are counted and reported at most once per \c kNOBLogRateLimiterSummaryInterval, i.e. \c "suppressed 12,345 similar lines from file.m:42".  The summary goes with the next line that is allowed, or is written on its own once the interval has passed if the call site went quiet.
+ */
+#define LOG_RATE_LIMITED(lvl, perSecond, burst, format, ...) \
+    LOG_LIMITED__(lvl, NOBLogRateLimiterAllowRate(&nobLimiter__, perSecond, burst, &nobSuppressed__), format, ##__VA_ARGS__)
+
+/**
+    @def LOG_SAMPLED(lvl, oneIn, format, ...)
+    Same as \c LOG but the call site only logs the first line and then \c 1 in every \a oneIn lines.  Suppressed lines are summarized like \c LOG_RATE_LIMITED.
+ */
+#define LOG_SAMPLED(lvl, oneIn, format, ...) \
+    LOG_LIMITED__(lvl, NOBLogRateLimiterAllowSample(&nobLimiter__, oneIn, &nobSuppressed__), format, ##__VA_ARGS__)
+
+// Shared by LOG_RATE_LIMITED and LOG_SAMPLED, do not use directly
+#define LOG_LIMITED__(lvl, allow, format, ...) \
+do { \
+    __unsafe_unretained NOBLogger* nobLogger__ = NOBLOG; \
+    if (NOBLoggerIsLevelEnabled(nobLogger__, lvl)) \
+    { \
+        static NOBLogRateLimiter nobLimiter__ = kNOBLogRateLimiterInit; \
+        int64_t nobSuppressed__ = 0; \
+        if (allow) \
+        { \
+            static uint32_t nobCallSiteId__ = 0; \
+            if (!nobCallSiteId__) \
+                nobCallSiteId__ = NOBLogCallSiteIdentifier(__FILE__, __LINE__); \
+            if (nobSuppressed__ > 0) \
+                [nobLogger__ writeASync:NOBLogRateLimiterSummary(nobSuppressed__, __FILE__, __LINE__) level:lvl callSiteId:nobCallSiteId__]; \
+            [nobLogger__ writeASync:[NSString stringWithFormat:format, ##__VA_ARGS__] level:lvl callSiteId:nobCallSiteId__]; \
+        } \
+        else \
+        { \
+            NOBLogRateLimiterSuppressed(&nobLimiter__, lvl, __FILE__, __LINE__); \
+        } \
+    } \
+} while (0)
+
+/**
+    @def LOGC(category, lvl, format, ...)
+    Same as \c LOG but filtered by the level of \a category (a \c NOBLogCategory) instead of the \c NOBLogger object's \c logLevel.
+    @par A filtered out \c LOGC is a single relaxed load of the category's level and a branch, the shared log is not even looked up.  \c kNOBLogCategory_None falls back to the shared log's \c logLevel.
+    @see NOBLogCategoryRegister
+ */
+#define LOGC(category, lvl, format, ...) \
+do { \
+    if (__builtin_expect(NOBLogCategoryIsLevelEnabled(category, lvl), 0)) \
+    { \
+        static uint32_t nobCallSiteId__ = 0; \
+        if (!nobCallSiteId__) \
+            nobCallSiteId__ = NOBLogCallSiteIdentifier(__FILE__, __LINE__); \
+        [NOBLOG writeASync:[NSString stringWithFormat:format, ##__VA_ARGS__] level:lvl category:category callSiteId:nobCallSiteId__]; \
+    } \
+} while (0)
+
+/**
+    @def LOGC_HI(category, format, ...)
+    \c LOGC using \c NOBLogLevel_High.
+ */
+#define LOGC_HI(category, format, ...)  LOGC(category, NOBLogLevel_High, format,##__VA_ARGS__)
+/**
+    @def LOGC_MID(category, format, ...)
+    \c LOGC using \c NOBLogLevel_Mid.
+ */
+#define LOGC_MID(category, format, ...) LOGC(category, NOBLogLevel_Mid, format,##__VA_ARGS__)
+/**
+    @def LOGC_LO(category, format, ...)
+    \c LOGC using \c NOBLogLevel_Low.
+ */
+#define LOGC_LO(category, format, ...)  LOGC(category, NOBLogLevel_Low, format,##__VA_ARGS__)
+
 /**
     @def NOBLOG
     Helper macro for easy access to the \c NOBLogger class' \c sharedLog
+    @par Costs a single acquire load and no message send.  The result is not retained, which is safe for the statement that uses it since a replaced shared log is only released after a grace period.  Use \c sharedLog to keep a reference for longer.
+    @see NOBLoggerSharedLogPointer
  */
-#define NOBLOG [NOBLogger sharedLog]
+#define NOBLOG ((__bridge NOBLogger*)NOBLoggerSharedLogPointer())
 
 /**
     @enum kNOBLoggerDefault Value Contants
@@ -74,11 +200,19 @@
     @constant kNOBLoggerDefaultMaxFiles
     @constant kNOBLoggerDefaultWritesPerFlush
     @constant kNOBLoggerDefaultFilePrefix
+    @constant kNOBLoggerDefaultRingBufferCapacity
+    @constant kNOBLoggerDefaultBytesBeforeRollover
+    @constant kNOBLoggerDefaultMaxTotalLogSize
+    @constant kNOBLoggerDefaultRecentLineCount
  */
-FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultRolloverSize;     /*!< \c 500 writes, not bytes */
-FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultMaxFiles;         /*!< \c 10 files */
-FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultWritesPerFlush;   /*!< \c 10 writes per flush */
-FOUNDATION_EXPORT NSString*  const kNOBLoggerDefaultFilePrefix;       /*!< \c \@"log." */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultRolloverSize;       /*!< \c 500 writes, not bytes */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultMaxFiles;           /*!< \c 10 files */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultWritesPerFlush;     /*!< \c 10 writes per flush */
+FOUNDATION_EXPORT NSString*  const kNOBLoggerDefaultFilePrefix;         /*!< \c \@"log." */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultRingBufferCapacity; /*!< \c 1024 records */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultBytesBeforeRollover; /*!< \c 512 KB */
+FOUNDATION_EXPORT unsigned long long const kNOBLoggerDefaultMaxTotalLogSize; /*!< \c 10 MB */
+FOUNDATION_EXPORT NSUInteger const kNOBLoggerDefaultRecentLineCount;   /*!< \c 1024 lines */
 
 /**
     @enum NOBLogLevel
@@ -92,23 +226,61 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
     NOBLogLevel_Low         /**< level for verbose logs that released builds will likely not log (debug logs) */
 };
 
+/**
+    @typedef NOBLogCategory
+    Id of a named log category.  Every category has its own \c NOBLogLevel so that one subsystem can log verbosely without turning up the whole process.
+    @par \c kNOBLogCategory_None (\c 0) is not a category: records without a category are filtered by the \c NOBLogger object's \c logLevel.
+    @see NOBLogCategoryRegister
+    @see LOGC
+ */
+typedef uint8_t NOBLogCategory;
+
+#define kNOBLogCategory_None     (0)
+#define kNOBLogCategoryMaxCount  (64) /**< the table of levels fits in a single cache line */
+
+/**
+    @enum NOBLoggerOptions
+    Options for how a \c NOBLogger writes its log files
+ */
+typedef NS_OPTIONS(NSUInteger, NOBLoggerOptions)
+{
+    NOBLoggerOption_None           = 0,      /**< plain text log files written with \c stdio, durable once flushed */
+    NOBLoggerOption_MappedSegments = 1 << 0, /**< log files are memory mapped segments (\c .mlog) that keep every written line if the app crashes, without flushing.  \c writesPerFlush has no effect on durability.  @see NOBLogSegment.h */
+    NOBLoggerOption_CompressRolledLogs = 1 << 1, /**< log files are compressed (\c .lzlog) on a background queue once they are rolled over.  \c logFiles, \c totalLogSize and \c mostRecentLogs: see the compressed files transparently.  @see NOBLogCompression.h */
+    NOBLoggerOption_BinaryRecords  = 1 << 2, /**< log files are indexed binary records (\c .blog) that can be queried by time range and level without parsing text.  Cannot be combined with \c NOBLoggerOption_MappedSegments or \c NOBLoggerOption_CompressRolledLogs.  \c mostRecentLogs: renders the records to text.  @see NOBLogBinaryFormat.h */
+    NOBLoggerOption_AsyncOpen      = 1 << 3, /**< the initializer returns immediately and the logs directory is created, listed, purged and the log file opened on the drain queue.  Records logged in the meantime wait in the ring buffer and are written once the file is open.  Failures cannot be thrown, they are reported with \c NSLog and the records are discarded.  Until the file is open \c logFiles is empty. */
+    NOBLoggerOption_RecentLinesInMemory = 1 << 4, /**< keep the last \c kNOBLoggerDefaultRecentLineCount lines in memory from the start, for \c mostRecentLogsInMemory: and tail observers.  Without it, the lines are only kept once the first tail observer is added. */
+};
+
 /**
     @class NOBLogger
  
     @par \c NOBLogger is used for logging to disk in a thread safe way.
     @par The \c NOBLogger also logs using a rolling log mechanism so that logging does not overtake the user's disk space.
+    @par Writes are copied into a bounded, lock-free ring buffer owned by the \c NOBLogger and a single drain context writes them to disk in batches.
+    @par The log files and their sizes are kept in an in memory manifest that is updated as logs are written.  The logs directory is only listed once, at init.
  */
+@class NOBLogSink;
+
 @interface NOBLogger : NSObject
+{
+    @public
+    // Exposed only so that NOBLoggerIsLevelEnabled can read it without a message send.  Use the logLevel property.
+    volatile NOBLogLevel _level;
+}
 
 /** 
     Accessor to the global shared log.
     @par The shared log should not only be used throughout an application but is what the \c NOBLib and \c NOBUILib use for logging.
     @return the globally shared log
+    @note Prefer \c NOBLOG, which avoids the message send.
     @see setSharedLog:
  */
 + (NOBLogger*) sharedLog;
 /**
-    Set the globally shared log.
+    Set the globally shared log.  The new log is published atomically, so threads that are logging never wait on it.
+    @par The replaced log is flushed and retired: since other threads may still be using it through \c NOBLOG without holding a reference, it is only released by a later \c setSharedLog: once 10 seconds have passed.
+    @note At most 8 replaced logs are kept, replacing the shared log more often than that within 10 seconds releases the oldest early.
     @param log the \c NOBLogger desired to be used globally as the shared log.
     @see sharedLog
  */
@@ -134,6 +306,17 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
                           logLevel:(NOBLogLevel)level
               writesBeforeRollover:(NSUInteger)writesBeforeRollover  // UINT32_MAX for unlimited
                       maxFileCount:(NSUInteger)fileCount;
+/**
+    Same as initWithDirectory:filePrefix:logLevel:writesBeforeRollover:maxFileCount: with \a options.
+    @param options the \c NOBLoggerOptions for how the log files are written
+    @note with \c NOBLoggerOption_AsyncOpen no exceptions are thrown
+ */
+- (instancetype) initWithDirectory:(NSString*)logsDirectory
+                        filePrefix:(NSString*)prefix
+                          logLevel:(NOBLogLevel)level
+              writesBeforeRollover:(NSUInteger)writesBeforeRollover  // UINT32_MAX for unlimited
+                      maxFileCount:(NSUInteger)fileCount
+                           options:(NOBLoggerOptions)options;
 
 /**
    Initialize the \c NOBLogger with a default \a path and the \a level set to \c NOBLogLevel_Low if \c DEBUG and NOBLogLevel_High otherwise.
@@ -156,11 +339,43 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
     @see logFiles
  */
 @property (nonatomic, assign) NSUInteger writesBeforeRollover;
+/**
+    The number of bytes written to a log file before the log file rolls over.  The log file rolls over when either \c writesBeforeRollover or \c bytesBeforeRollover is reached.
+    @param bytesBeforeRollover provide \c UINT32_MAX for no byte limit.  Provide \c 0 for \c kNOBLoggerDefaultBytesBeforeRollover.
+    @see writesBeforeRollover
+ */
+@property (nonatomic, assign) NSUInteger bytesBeforeRollover;
 /**
     The number of log files that can be written to disk before the eldest log file is purged.
     @see logFiles
  */
 @property (nonatomic, assign) NSUInteger maxFileCount;
+/**
+    The total number of bytes the log files can take up on disk before the eldest log files are purged.  The log file currently being written to is never purged.
+    @param maxTotalLogSize provide \c ULLONG_MAX for no limit.  Provide \c 0 for \c kNOBLoggerDefaultMaxTotalLogSize.
+    @see totalLogSize
+ */
+@property (nonatomic, assign) unsigned long long maxTotalLogSize;
+/**
+    The \c NOBLoggerOptions the \c NOBLogger was initialized with
+ */
+@property (nonatomic, readonly) NOBLoggerOptions options;
+/**
+    What \c writeASync:level: does when the ring buffer of pending records is full.  Default is \c NOBLogOverflowPolicy_Block.
+    @note \c writeSync:level: always blocks.
+    @see droppedRecordCount
+ */
+@property (nonatomic, assign) NOBLogOverflowPolicy overflowPolicy;
+/**
+    The number of records the ring buffer of pending records can hold.
+    @see kNOBLoggerDefaultRingBufferCapacity
+ */
+@property (nonatomic, readonly) NSUInteger ringBufferCapacity;
+/**
+    The number of records that were dropped because the ring buffer of pending records was full.
+    @see overflowPolicy
+ */
+@property (nonatomic, readonly) unsigned long long droppedRecordCount;
 
 /**
     flush the logs to disk.  It is recommended to flush the logs on app exit, either via normal termination or crash.
@@ -168,15 +383,41 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
 - (void) flush;
 
 /**
-    one of the two write methods for writing a log message.  Writes the log asynchronously.  This method is the default method and adds the provided log message to the \c NOBLogger object's writing queue.
+    one of the two write methods for writing a log message.  Writes the log asynchronously.  This method is the default method and copies the provided log message into the \c NOBLogger object's ring buffer.
     @note This is the default write method to use.
     @param message the string to write to disk.
     @param level the log level for the message.  The message will be filtered based on the \c NOBLogger object's \a logLevel.
     @see writeSync:level:
+    @see overflowPolicy
  */
 - (void) writeASync:(NSString*)message level:(NOBLogLevel)level;
 /**
-    one of the two write methods for writing a log message.  Writes the log synchronously.  This method adds the provided log message to the \c NOBLogger object's writing queue and wait until is finished being written.
+    Same as \c writeASync:level: but tags the record with a call site id.
+    @param callSiteId the id of the call site, see \c NOBLogCallSiteIdentifier.  Only kept by \c NOBLoggerOption_BinaryRecords logs.
+ */
+- (void) writeASync:(NSString*)message level:(NOBLogLevel)level callSiteId:(uint32_t)callSiteId;
+/**
+    Same as \c writeASync:level:callSiteId: for a record in \a category.
+    @param category the \c NOBLogCategory the record was logged in.  The caller has already checked the category's level so the record is not filtered by \c logLevel.  Pass \c kNOBLogCategory_None for a record without a category.
+    @see LOGC
+ */
+- (void) writeASync:(NSString*)message level:(NOBLogLevel)level category:(NOBLogCategory)category callSiteId:(uint32_t)callSiteId;
+/**
+    Same as \c writeASync:level: but with deferred formatting.  The arguments are captured in binary form and rendered to text on the drain context.
+    @param level the log level for the message.
+    @param format a \c printf style format \c C string that MUST have static storage duration (i.e. a string literal).
+    @see LOG_DEFERRED
+    @see NOBLogDeferredFormat.h
+ */
+- (void) writeASyncWithLevel:(NOBLogLevel)level deferredFormat:(const char*)format, ... __attribute__((format(printf, 2, 3)));
+/**
+    Same as \c writeASyncWithLevel:deferredFormat: but tags the record with a call site id.
+    @see writeASync:level:callSiteId:
+ */
+- (void) writeASyncWithLevel:(NOBLogLevel)level callSiteId:(uint32_t)callSiteId deferredFormat:(const char*)format, ... __attribute__((format(printf, 3, 4)));
+/**
+    one of the two write methods for writing a log message.  Writes the log synchronously.  This method adds the provided log message to the \c NOBLogger object's writing queue and wait until is finished being written to the log file.
+    @par Callers that arrive while a write is in progress are gathered into the next batch, which is written with a single write, so synchronous writes from many threads (i.e. a crash cascade) do not serialize on each other.
     @note It is recommended that any logging made at shutdown time use this method followed by \c flush.
     @param message the string to write to disk.
     @param level the log level for the message.  The message will be filtered based on the \c NOBLogger object's \a logLevel.
@@ -184,9 +425,14 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
     @see flush
  */
 - (void) writeSync:(NSString*)message level:(NOBLogLevel)level;  // best for writing out logs at shutdown time
+/**
+    When \c YES, \c writeSync:level: does not return until the message is on disk (\c fsync, or \c msync for \c NOBLoggerOption_MappedSegments) instead of handed to the OS.  Default is \c NO.
+    @note concurrent \c writeSync:level: calls are group committed: the callers waiting at the same time share a single write and a single \c fsync.
+ */
+@property (nonatomic, assign) BOOL syncWritesToDisk;
 
 /**
-    @return an array of all the current log file paths
+    @return an array of all the current log file names, eldest first.  Served from the in memory manifest.
  */
 - (NSArray*) logFiles;
 /**
@@ -196,11 +442,157 @@ typedef NS_ENUM(NSUInteger, NOBLogLevel)
 /**
     @param maxSizeInBytes minimum of \c 1024 and a maximum of \c UINT32_MAX
     @return the data contained in the tail of all the logs capped with \a maxSizeInBytes
+    @note Only the bytes returned are read, seeking back from the end of the newest log
  */
 - (NSData*) mostRecentLogs:(NSUInteger)maxSizeInBytes;
 /**
-    @return the total size of all the log files that this \c NOBLogger encompasses in bytes
+    Same as \c mostRecentLogs: but the tail is delivered in order, in chunks of up to 64 KB, so that the whole tail is never held in memory.
+    @param maxSizeInBytes minimum of \c 1024 and a maximum of \c UINT32_MAX
+    @param block called for each chunk on the calling thread.  \a chunk is only valid for the duration of the call (copy it to keep it).  Set \a stop to \c YES to stop early.
+    @see mostRecentLogs:
+ */
+- (void) streamMostRecentLogs:(NSUInteger)maxSizeInBytes usingBlock:(void (^)(NSData* chunk, BOOL* stop))block;
+/**
+    @return the most recent lines, formatted as in a text log file, without any disk I/O.  \c nil if no lines are kept in memory.
+    @param maxLineCount the maximum number of lines to return.  At most \c kNOBLoggerDefaultRecentLineCount lines are kept.
+    @see NOBLoggerOption_RecentLinesInMemory
+ */
+- (NSData*) mostRecentLogsInMemory:(NSUInteger)maxLineCount;
+/**
+    Observe lines as they are logged, i.e. for an in app log console or to ship logs as they are written.
+    @par Lines are delivered in batches from an in memory ring of recent lines.  Every observer has its own cursor into the ring, so a slow observer never blocks logging: if it falls behind by more than \c kNOBLoggerDefaultRecentLineCount lines, it is told how many it missed.
+    @param queue the queue \a block is called on.  Pass \c NULL for a default priority global queue.  Batches are delivered one at a time even on a concurrent queue.
+    @param includeRecent \c YES to start with the lines already in memory, \c NO to only see new lines
+    @param block called with newline terminated text \a lines (the format of a text log file), the number of lines and the number of lines missed since the last call.
+    @return an opaque observer to pass to \c removeTailObserver:
+ */
+- (id) addTailObserverOnQueue:(dispatch_queue_t)queue
+                includeRecent:(BOOL)includeRecent
+                   usingBlock:(void (^)(NSData* lines, NSUInteger lineCount, NSUInteger droppedCount))block;
+/**
+    Stop an observer added with \c addTailObserverOnQueue:includeRecent:usingBlock:.  A batch already being delivered finishes, no batch is started after this returns.
+ */
+- (void) removeTailObserver:(id)observer;
+/**
+    Add an output besides the log files.  Every record is encoded to text once per drain and the same text is handed to every sink, each of which writes it on its own queue.
+    @par In \c DEBUG builds every \c NOBLogger starts with a \c NOBLogConsoleSink.
+    @see NOBLogSink.h
+ */
+- (void) addSink:(NOBLogSink*)sink;
+/**
+    Stop handing records to \a sink.  Lines already handed to it are still written.
+ */
+- (void) removeSink:(NOBLogSink*)sink;
+/**
+    @return the \c NOBLogSink objects records are handed to
+ */
+- (NSArray*) sinks;
+/**
+    @return the total size of all the log files that this \c NOBLogger encompasses in bytes.  Served from the in memory manifest and includes bytes that have been written but not yet flushed.
 */
 - (unsigned long long) totalLogSize;
 
+/**
+    Enumerate the records of the logs between \a start and \a end that are at least as important as \a level, eldest first.  Only available with \c NOBLoggerOption_BinaryRecords.
+    @param start the earliest record to include.  Pass \c nil for no lower bound.
+    @param end the latest record to include.  Pass \c nil for no upper bound.
+    @param block called for each record on the calling thread.  \a payload is the UTF8 message (not \c NULL terminated) and is only valid for the duration of the call.  Set \a stop to \c YES to stop early.
+    @note Records the \c NOBLogger writes about itself (new session, rollover) have a \c level of \c NOBLogLevel_Off and are always included.
+    @see NOBLogBinaryReaderEnumerate
+ */
+- (void) enumerateRecordsFrom:(NSDate*)start
+                           to:(NSDate*)end
+                        level:(NOBLogLevel)level
+                   usingBlock:(void (^)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop))block;
+/**
+    Same as \c enumerateRecordsFrom:to:level:usingBlock: but the records are rendered to text in the same format as a text log.
+    @return the text of the matching records
+ */
+- (NSData*) exportLogsFrom:(NSDate*)start
+                        to:(NSDate*)end
+                     level:(NOBLogLevel)level;
+
 @end
+
+// Published by setSharedLog:, read it with NOBLOG or NOBLoggerSharedLogPointer
+FOUNDATION_EXPORT void* volatile g_NOBLoggerSharedLog;
+
+/**
+    @return the \c sharedLog as an unretained pointer with a single acquire load.  Use \c NOBLOG instead of calling this directly.
+ */
+NS_INLINE void* NOBLoggerSharedLogPointer(void)
+{
+    // acquire pairs with the release in setSharedLog: so the logger is fully initialized when seen
+    void* log = __atomic_load_n(&g_NOBLoggerSharedLog, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!log, 0))
+        log = (__bridge void*)[NOBLogger sharedLog]; // nothing published yet
+    return log;
+}
+
+/**
+    A stable id for a log call site, used to tag records so that they can be grouped by the statement that logged them.
+    @return a hash of the file name (without its directory) and \a line.  Never \c 0.
+ */
+uint32_t NOBLogCallSiteIdentifier(const char* file, int line);
+
+/**
+    Check if a log at \a level would be written by \a logger.  Used by the \c LOG macros to skip formatting for filtered out logs.
+    @return \c YES if \a level is enabled for \a logger
+ */
+NS_INLINE BOOL NOBLoggerIsLevelEnabled(__unsafe_unretained NOBLogger* logger, NOBLogLevel level)
+{
+    return (logger &&
+            NOBLogLevel_Off != level &&
+            level <= logger->_level);
+}
+
+#pragma mark - Log Categories
+
+// The level of each category, indexed by NOBLogCategory.  Read with NOBLogCategoryIsLevelEnabled, write with NOBLogCategorySetLevel.
+FOUNDATION_EXPORT volatile uint8_t g_NOBLogCategoryLevels[kNOBLogCategoryMaxCount];
+
+/**
+    Register a log category, or look up one that was already registered with the same \a name.
+    @param name the name of the category, copied.  Used by \c NOBLogCategorySetLevelForName so that levels can be driven by settings.
+    @param level the level the category starts with when it is first registered
+    @return the category, or \c kNOBLogCategory_None if all \c kNOBLogCategoryMaxCount categories are taken
+    @note takes a lock, register once and keep the result (e.g. in a \c static)
+ */
+NOBLogCategory NOBLogCategoryRegister(const char* name, NOBLogLevel level);
+/**
+    @return the category registered with \a name, \c kNOBLogCategory_None if there is none
+ */
+NOBLogCategory NOBLogCategoryNamed(const char* name);
+/**
+    @return the name of \a category, \c NULL if it was not registered
+ */
+const char* NOBLogCategoryName(NOBLogCategory category);
+/**
+    Change the level of a category at runtime, effective immediately for every thread.  Lock free.
+ */
+void NOBLogCategorySetLevel(NOBLogCategory category, NOBLogLevel level);
+/**
+    Same as \c NOBLogCategorySetLevel with the category's name.
+    @return \c NO if there is no category named \a name
+ */
+BOOL NOBLogCategorySetLevelForName(const char* name, NOBLogLevel level);
+
+/**
+    @return the current level of \a category
+ */
+NS_INLINE NOBLogLevel NOBLogCategoryGetLevel(NOBLogCategory category)
+{
+    // relaxed: a level change only needs to be seen eventually, not ordered with anything else
+    return (NOBLogLevel)__atomic_load_n(&g_NOBLogCategoryLevels[category % kNOBLogCategoryMaxCount], __ATOMIC_RELAXED);
+}
+
+/**
+    Check if a log at \a level in \a category would be written.  Used by the \c LOGC macros, a filtered out log costs one load and one branch.
+    @par \c kNOBLogCategory_None (including a category that could not be registered) is filtered by the shared \c NOBLogger object's \c logLevel.
+ */
+NS_INLINE BOOL NOBLogCategoryIsLevelEnabled(NOBLogCategory category, NOBLogLevel level)
+{
+    if (kNOBLogCategory_None == category)
+        return NOBLoggerIsLevelEnabled(NOBLOG, level);
+    return (level <= NOBLogCategoryGetLevel(category) && NOBLogLevel_Off != level);
+}
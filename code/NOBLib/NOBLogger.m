@@ -19,14 +19,112 @@
  */
 
 #import "NOBLogger.h"
+#import "NOBLogSink.h"
+#import "NOBLogDeferredFormat.h"
+#import "NOBLogSegment.h"
+#import "NOBLogCompression.h"
+#import "NOBLogBinaryFormat.h"
 #import "NOBConversion.h"
 #import "NSFileManager+Extensions.h"
 #import "NSString+Extensions.h"
+#include <libkern/OSAtomic.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <float.h>
 
 NSUInteger const kNOBLoggerDefaultRolloverSize   = 500;
 NSUInteger const kNOBLoggerDefaultMaxFiles       = 10;
 NSUInteger const kNOBLoggerDefaultWritesPerFlush = 10;
 NSString* const  kNOBLoggerDefaultFilePrefix     = @"log.";
+NSUInteger const kNOBLoggerDefaultRingBufferCapacity = 1024;
+NSUInteger const kNOBLoggerDefaultBytesBeforeRollover = 512 * 1024;
+unsigned long long const kNOBLoggerDefaultMaxTotalLogSize = 10 * 1024 * 1024;
+NSUInteger const kNOBLoggerDefaultRecentLineCount = 1024;
+
+// Key for identifying a NOBLogger's drain queue
+static const char s_drainQKey = 0;
+
+// Encoded output is committed to the log file once this many bytes are buffered (or at the end of a drain)
+#define kNOBLoggerOutputCommitThreshold (64 * 1024)
+
+// Size of the reusable buffer streamMostRecentLogs:usingBlock: delivers chunks in
+#define kNOBLoggerTailChunkSize (64 * 1024)
+
+// Maximum number of lines handed to a tail observer per call
+#define kNOBLoggerTailObserverBatchSize (512)
+
+// A replaced shared log is kept this long after it was replaced, a reader only holds NOBLOG for the statement it logs with
+#define kNOBLoggerSharedLogGracePeriod (10.0)
+
+// At most this many replaced shared logs are kept, the oldest is released early beyond it
+#define kNOBLoggerMaxRetiredSharedLogs (8)
+
+// Reads the text of any kind of log file (plain, segment or compressed) by logical offset
+typedef struct _NOBLogFileReader
+{
+    int                     fd;
+    NOBLogCompressedFileRef compressed;
+    off_t                   dataOffset; // where the text starts in fd
+    unsigned long long      length;     // length of the text
+} NOBLogFileReader;
+
+// A range of a log file that is part of the tail of the logs
+typedef struct _NOBLogTailPiece
+{
+    NOBLogFileReader   reader;
+    unsigned long long offset;
+    size_t             length;
+    BOOL               separatorBefore; // a '\n' goes between this piece and the one before it
+} NOBLogTailPiece;
+
+NS_INLINE size_t ReadFully(NOBLogFileReader* reader, char* buffer, size_t length, unsigned long long offset);
+NS_INLINE size_t ReadFully(NOBLogFileReader* reader, char* buffer, size_t length, unsigned long long offset)
+{
+    if (reader->compressed)
+        return NOBLogCompressedFileRead(reader->compressed, buffer, length, offset);
+
+    size_t total = 0;
+    while (total < length)
+    {
+        ssize_t bytesRead = pread(reader->fd, buffer + total, length - total, reader->dataOffset + (off_t)(offset + total));
+        if (bytesRead <= 0)
+            break;
+        total += (size_t)bytesRead;
+    }
+    return total;
+}
+
+NS_INLINE void CloseReader(NOBLogFileReader* reader);
+NS_INLINE void CloseReader(NOBLogFileReader* reader)
+{
+    if (reader->compressed)
+        NOBLogCompressedFileClose(reader->compressed);
+    else if (reader->fd >= 0)
+        close(reader->fd);
+    reader->compressed = NULL;
+    reader->fd         = -1;
+}
+
+static dispatch_queue_t NOBLoggerCompressionQueue(void);
+static dispatch_queue_t NOBLoggerCompressionQueue(void)
+{
+    // one low priority queue shared by all loggers, compression is never urgent
+    static dispatch_queue_t s_compressionQ = NULL;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        s_compressionQ = dispatch_queue_create("NOBLoggerCompressionQ", DISPATCH_QUEUE_SERIAL);
+        dispatch_set_target_queue(s_compressionQ, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+    return s_compressionQ;
+}
+
+// NOBLogRecord flags
+enum
+{
+    kNOBLogRecordFlag_DeferredFormat = 1 << 0,  // payload is a NOBLogDeferredFormatCapture, not text
+};
 
 NS_INLINE UInt64 GenerateLogFileId(void);
 NS_INLINE UInt64 GenerateLogFileId(void)
@@ -36,21 +134,96 @@ NS_INLINE UInt64 GenerateLogFileId(void)
     return (UInt64)ti;
 }
 
-NS_INLINE NSString* GenerateLogFileName(NSString* prefix, UInt64 fileId);
-NS_INLINE NSString* GenerateLogFileName(NSString* prefix, UInt64 fileId)
+NS_INLINE NSString* GenerateLogFileName(NSString* prefix, UInt64 fileId, NSString* extension);
+NS_INLINE NSString* GenerateLogFileName(NSString* prefix, UInt64 fileId, NSString* extension)
+{
+    return [NSString stringWithFormat:@"%@%qu.%@", prefix, fileId, extension];
+}
+
+// An entry in a NOBLogger's in memory manifest of log files
+@interface NOBLogFileInfo : NSObject
+{
+    @public
+    __strong NSString* _name;
+    unsigned long long _size;
+}
+@end
+
+@implementation NOBLogFileInfo
+@end
+
+// A subscriber to a NOBLogger's live tail, see addTailObserverOnQueue:includeRecent:usingBlock:
+@interface NOBLogTailObserver : NSObject
+{
+    @public
+    dispatch_queue_t _queue;
+    __strong void (^_block)(NSData* lines, NSUInteger lineCount, NSUInteger droppedCount);
+    int64_t          _cursor;    // only touched by the delivery that holds _scheduled
+    volatile int32_t _scheduled; // 1 while a delivery is pending or running, there is never more than one
+    volatile BOOL    _removed;
+}
+@end
+
+@implementation NOBLogTailObserver
+
+- (void) dealloc
 {
-    return [NSString stringWithFormat:@"%@%qu.log", prefix, fileId];
+    dispatch_release(_queue);
 }
 
+@end
+
 @interface NOBLogger (Private)
 
+- (void) _prepare;
+- (BOOL) _isDrainContext;
+- (BOOL) _enqueueMessage:(NSString*)message
+                   level:(NOBLogLevel)level
+                category:(NOBLogCategory)category
+              callSiteId:(uint32_t)callSiteId
+                  policy:(NOBLogOverflowPolicy)policy
+                position:(int64_t*)pPosition;
+- (BOOL) _enqueueDeferredFormat:(const char*)format
+                      arguments:(va_list)args
+                          level:(NOBLogLevel)level
+                     callSiteId:(uint32_t)callSiteId
+                         policy:(NOBLogOverflowPolicy)policy;
+- (void) _scheduleDrain;
+- (NSUInteger) _drain; // must ONLY be executed on the drain queue!
+- (void) _drainThroughPosition:(int64_t)position; // must ONLY be executed on the drain queue!
+- (void) _groupCommitThroughPosition:(int64_t)position;
+- (int64_t) _commitBatchThroughPosition:(int64_t)position; // must ONLY be executed on the drain queue!
+- (void) _writeRecord:(const NOBLogRecord*)record; // must ONLY be executed on the drain queue!
+- (void) _flushFile;
+- (void) _commitOutput;
+- (char*) _reserveOutput:(size_t)length;
+- (void) _appendOutput:(const void*)bytes length:(size_t)length;
+- (void) _writeBinaryRecordWithHeader:(NOBLogBinaryRecordHeader*)header payload:(const char*)payload;
+- (void) _writePendingLine;
+- (void) _startLogFile;
+- (void) _enumerateBinaryLogsFrom:(CFAbsoluteTime)start
+                               to:(CFAbsoluteTime)end
+                            level:(NOBLogLevel)level
+                       usingBlock:(void (^)(NOBLogBinaryReaderRef reader, BOOL* stop))block;
+- (NSException*) _openLogsInDirectory:(NSString*)root; // returns the exception to throw on failure
+- (void) _loadManifest:(NSString*)root;
+- (BOOL) _createLogFileAtPath:(NSString*)path file:(FILE**)pFile segment:(NOBLogSegmentRef*)pSegment;
+- (void) _closeLogFile;
+- (BOOL) _openLogFileForReading:(NSString*)path reader:(NOBLogFileReader*)reader;
+- (void) _compressLogFileNamed:(NSString*)fileName;
+- (void) _replaceLogFileNamed:(NSString*)fileName withCompressedFileAtPath:(NSString*)tempPath;
+- (NSUInteger) _planTail:(NSUInteger)maxSize pieces:(NOBLogTailPiece**)pPieces;
+- (NSData*) _binaryTail:(NSUInteger)maxSize;
+- (NOBLogHistoryRef) _tailHistory;
+- (void) _notifyTailObservers; // must ONLY be executed on the drain queue!
+- (void) _scheduleTailObserver:(NOBLogTailObserver*)observer;
+- (void) _deliverToTailObserver:(NOBLogTailObserver*)observer;
+- (void) _addFileToManifest:(NSString*)fileName;
+
 - (void) performMaintenance:(BOOL)didAddLine;
 - (BOOL) rolloverIfNeeded;
 - (BOOL) purgeOldLogsIfNeeded;
 
-- (void)    write:(NSString*)message
-            level:(NOBLogLevel)level
-    withTimestamp:(NSDate*)timestamp; // must ONLY be executed on s_logQ!
 - (void) writeBOM;
 - (void) writeByte:(const char)byte;
 - (void) writeBytes:(const char*)bytes length:(size_t)length;
@@ -70,53 +243,161 @@ NS_INLINE NSString* GenerateLogFileName(NSString* prefix, UInt64 fileId)
     NSUInteger         _newlinesWritten;
     NSUInteger         _writesBeforeRollover;
     NSUInteger         _maxFileCount;
-    NOBLogLevel        _level;
     FILE*              _logFile;
+    NOBLogSegmentRef   _logSegment;
+    NOBLoggerOptions   _options;
+    __strong NSString* _logFileExtension;
     __strong NSString* _logFilePath;
+    __strong NSString* _logDirectoryPath;
     __strong NSString* _logFileNamePrefix;
+    NSUInteger         _bytesBeforeRollover;
+    unsigned long long _maxTotalLogSize;
+
+    // The manifest is only mutated by the drain context (or init), the lock protects readers on other threads
+    OSSpinLock                  _manifestLock;
+    __strong NSMutableArray*    _manifest; // NOBLogFileInfo, oldest first, the current log file is last
+    unsigned long long          _manifestSize;
+    unsigned long long          _logFileBytes;
+    unsigned long long          _failedRolloverBytes; // file size when a rollover last failed, the next attempt waits for another bytesBeforeRollover
+
+    NOBLogRingBufferRef           _ring;
+    dispatch_queue_t              _drainQ;
+    volatile int32_t              _drainScheduled;
+    volatile NOBLogOverflowPolicy _overflowPolicy;
+    uint64_t                      _droppedRecordsReported;
+    char*                         _renderBuffer;
+    size_t                        _renderBufferCapacity;
+
+    // group commit of writeSync:level:, concurrent callers wait on a single write (and fsync)
+    pthread_mutex_t               _syncLock;
+    pthread_cond_t                _syncCond;
+    int64_t                       _syncedPosition; // every record before this position is written
+    BOOL                          _syncInProgress;
+    volatile BOOL                 _syncWritesToDisk;
+
+    char*                         _outputBuffer;
+    size_t                        _outputLength;
+    size_t                        _outputCapacity;
+    NOBLogTimestampCache          _timestampCache;
+
+    // binary records (NOBLoggerOption_BinaryRecords)
+    NOBLogBinaryIndexRef          _binaryIndex;
+    char*                         _pendingLine; // text written by the logger itself, becomes a record at '\n'
+    size_t                        _pendingLineLength;
+    size_t                        _pendingLineCapacity;
+
+    // live tail, the history is only appended to by the drain context and lives as long as the logger
+    NOBLogHistoryRef volatile     _history;
+    OSSpinLock                    _observersLock; // guards _tailObservers and _sinks
+    __strong NSArray*             _tailObservers; // NOBLogTailObserver, copy on write
+
+    // sinks, every drain encodes its records into one batch that all the sinks share
+    __strong NSArray*             _sinks; // NOBLogSink, copy on write
+    __strong NOBLogSinkBatch*     _sinkBatch; // only touched by the drain context
+
+    CFAbsoluteTime                _retiredTime; // when setSharedLog: replaced this log, guarded by @synchronized([NOBLogger class])
 }
 
-static __strong NOBConsoleLogger* s_cLog = nil;
-static __strong NOBLogger* s_log         = nil;
-static dispatch_queue_t    s_logSharingQ = 0;
-static dispatch_queue_t    s_logQ        = 0;
+void* volatile g_NOBLoggerSharedLog = NULL;
 
-+ (void) initialize
-{
-    s_logSharingQ = dispatch_queue_create("NOBLoggerSharingQ", DISPATCH_QUEUE_CONCURRENT);
-    s_logQ        = dispatch_queue_create("NOBLoggerQ", DISPATCH_QUEUE_SERIAL);
-}
+static __strong NOBConsoleLogger* s_cLog          = nil;
+static __strong NOBLogger*        s_publishedLog  = nil; // the published shared log, NOBLOG does not retain it
+static __strong NSMutableArray*   s_retiredLogs   = nil; // replaced shared logs, oldest first, released once kNOBLoggerSharedLogGracePeriod has passed
 
-+ (NOBLogger*) sharedLog
+NS_INLINE NOBConsoleLogger* NOBConsoleSharedLog(void);
+NS_INLINE NOBConsoleLogger* NOBConsoleSharedLog(void)
 {
     static dispatch_once_t onceToken;
     dispatch_once(&onceToken, ^{
         s_cLog = [[NOBConsoleLogger alloc] init];
     });
+    return s_cLog;
+}
 
-    __block NOBLogger* logger;
-    dispatch_sync(s_logSharingQ, ^() {
-            logger = (s_log ? s_log : s_cLog);
-                  });
-    return logger;
++ (NOBLogger*) sharedLog
+{
+    void* log = __atomic_load_n(&g_NOBLoggerSharedLog, __ATOMIC_ACQUIRE);
+    if (!log)
+    {
+        // Nothing was published, fall back to the console logger (kept alive by s_cLog)
+        void* cLog = (__bridge void*)NOBConsoleSharedLog();
+        if (__sync_bool_compare_and_swap(&g_NOBLoggerSharedLog, NULL, cLog))
+            log = cLog;
+        else
+            log = __atomic_load_n(&g_NOBLoggerSharedLog, __ATOMIC_ACQUIRE);
+    }
+    return (__bridge NOBLogger*)log;
 }
 
 + (void) setSharedLog:(NOBLogger*)log
 {
-    dispatch_barrier_async(s_logSharingQ, ^() {
-                               [s_log flush];
-                               s_log = log;
-                           });
+    if (!log)
+    {
+        log = NOBConsoleSharedLog();
+    }
+
+    NOBLogger* oldLog = nil;
+    @synchronized([NOBLogger class]) {
+        oldLog = (__bridge NOBLogger*)__atomic_exchange_n(&g_NOBLoggerSharedLog, (__bridge void*)log, __ATOMIC_ACQ_REL);
+        s_publishedLog = log;
+
+        // Readers load NOBLOG without a retain, so a replaced log is retired rather than released: it is kept until every reader that could have loaded it is done
+        if (!s_retiredLogs)
+        {
+            s_retiredLogs = [[NSMutableArray alloc] init];
+        }
+        [s_retiredLogs removeObjectIdenticalTo:log];
+        if (oldLog && oldLog != log && oldLog != s_cLog)
+        {
+            oldLog->_retiredTime = CFAbsoluteTimeGetCurrent();
+            [s_retiredLogs addObject:oldLog];
+        }
+
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        while (s_retiredLogs.count > 0)
+        {
+            NOBLogger* retired = [s_retiredLogs objectAtIndex:0];
+            if (s_retiredLogs.count <= kNOBLoggerMaxRetiredSharedLogs &&
+                now - retired->_retiredTime < kNOBLoggerSharedLogGracePeriod)
+            {
+                break;
+            }
+            [s_retiredLogs removeObjectAtIndex:0];
+        }
+    }
+
+    if (oldLog && oldLog != log)
+    {
+        [oldLog flush];
+    }
 }
 
 - (void) dealloc
 {
     [[NSNotificationCenter defaultCenter] removeObserver:self];
-    if (_logFile)
+    // deliveries retain the logger, none can be pending, and none may be scheduled from here on
+    _tailObservers = nil;
+    if (_ring)
+    {
+        // nothing else can be writing to us at this point
+        [self _drain];
+    }
+    if (_logFile || _logSegment)
 	{
-        [self flush];
-        fclose(_logFile);
+        [self _closeLogFile];
 	}
+    NOBLogRingBufferDestroy(_ring);
+    if (_drainQ)
+    {
+        dispatch_release(_drainQ);
+        pthread_mutex_destroy(&_syncLock);
+        pthread_cond_destroy(&_syncCond);
+    }
+    free(_renderBuffer);
+    free(_outputBuffer);
+    free(_pendingLine);
+    NOBLogBinaryIndexDestroy(_binaryIndex);
+    NOBLogHistoryDestroy(_history);
 }
 
 + (instancetype) logWithDefaultConfig
@@ -147,68 +428,74 @@ static dispatch_queue_t    s_logQ        = 0;
                           logLevel:(NOBLogLevel)level
               writesBeforeRollover:(NSUInteger)writesBeforeRollover
                       maxFileCount:(NSUInteger)fileCount
+{
+    return [self initWithDirectory:root
+                        filePrefix:prefix
+                          logLevel:level
+              writesBeforeRollover:writesBeforeRollover
+                      maxFileCount:fileCount
+                           options:NOBLoggerOption_None];
+}
+
+- (instancetype) initWithDirectory:(NSString*)root
+                        filePrefix:(NSString*)prefix
+                          logLevel:(NOBLogLevel)level
+              writesBeforeRollover:(NSUInteger)writesBeforeRollover
+                      maxFileCount:(NSUInteger)fileCount
+                           options:(NOBLoggerOptions)options
 {
     if (self = [super init])
     {
-        NSFileManager* fm = [NSFileManager defaultManager];
-        if (root)
-        {
-            [fm    createDirectoryAtPath:root
-             withIntermediateDirectories:YES
-                              attributes:nil
-                                   error:NULL];
-        }
-        BOOL isDir = NO;
-        if (![fm fileExistsAtPath:root isDirectory:&isDir] ||
-            !isDir)
-        {
-            @throw [NSException exceptionWithName:NSDestinationInvalidException
-                                           reason:@"InvalidPath: the root path provided does not exist!"
-                                         userInfo:(root ? @{ @"rootPath" : root } : nil)];
-        }
-
         if (!prefix)
         {
             prefix = kNOBLoggerDefaultFilePrefix;
         }
 
+        [self _prepare];
         self.logLevel             = level;
         self.writesPerFlush       = 0; // default;
         self.writesBeforeRollover = writesBeforeRollover;
         self.maxFileCount         = fileCount;
+        self.bytesBeforeRollover  = 0; // default
+        self.maxTotalLogSize      = 0; // default
         _logFileNamePrefix        = [prefix copy];
-
-        UInt64    fileId      = GenerateLogFileId();
-        NSString* logFilePath = [root stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId)];
-        // handle edge case of duplicate file
-        while ([fm fileExistsAtPath:logFilePath])
+        _logDirectoryPath         = [root copy];
+        if (options & NOBLoggerOption_BinaryRecords)
         {
-            fileId++;
-            logFilePath = [root stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId)];
+            NOBAssert(!(options & (NOBLoggerOption_MappedSegments | NOBLoggerOption_CompressRolledLogs)));
+            options &= ~(NOBLoggerOption_MappedSegments | NOBLoggerOption_CompressRolledLogs);
+            _binaryIndex      = NOBLogBinaryIndexCreate(kNOBLogBinaryDefaultIndexInterval);
+            _logFileExtension = kNOBLogBinaryFileExtension;
         }
-
-        FILE* file = fopen(logFilePath.UTF8String, "w");
-        if (!file)
+        else
         {
-            @throw [NSException exceptionWithName:NSObjectInaccessibleException
-                                           reason:@"Could not create file for logging to!"
-                                         userInfo:(logFilePath ? @{ @"filePath" : logFilePath } : nil)];
+            _logFileExtension = ((options & NOBLoggerOption_MappedSegments) ? kNOBLogSegmentFileExtension : @"log");
+        }
+        _options                  = options;
+        if (options & NOBLoggerOption_RecentLinesInMemory)
+        {
+            _history = NOBLogHistoryCreate(kNOBLoggerDefaultRecentLineCount);
         }
 
-        _logFile         = file;
-        _logFilePath     = [logFilePath copy];
-        _newlinesWritten = 0;
-        _logWritesMade   = 0;
-
-#ifdef START_LOG_WITH_BOM
-        [self writeBOM];
-#endif
-        [self purgeOldLogsIfNeeded];
-        [self writeString:@"New logging session started: "];
-        [self writeString:_logFileNamePrefix];
-        [self writeByte:'\n'];
-        _logWritesMade = _newlinesWritten; // will equal number of writeByte: with '\n' calls
-        [self performMaintenance:NO];
+        if (options & NOBLoggerOption_AsyncOpen)
+        {
+            // Anything logged before the file is open waits in the ring, the drain queue is serial so it is drained after this
+            dispatch_async(_drainQ, ^() {
+                NSException* exception = [self _openLogsInDirectory:root];
+                if (exception)
+                {
+                    NSLog(@"NOBLogger failed to open logs, records will be discarded: %@ %@", exception.reason, exception.userInfo);
+                }
+            });
+        }
+        else
+        {
+            NSException* exception = [self _openLogsInDirectory:root];
+            if (exception)
+            {
+                @throw exception;
+            }
+        }
     }
     return self;
 }
@@ -238,244 +525,1373 @@ static dispatch_queue_t    s_logQ        = 0;
     }
 }
 
-- (NSUInteger) writesBeforeRollover
-{
-    return _writesBeforeRollover;
-}
+- (NSUInteger) writesBeforeRollover
+{
+    return _writesBeforeRollover;
+}
+
+- (void) setMaxFileCount:(NSUInteger)fileCount
+{
+    if (fileCount < 1)
+    {
+        fileCount = kNOBLoggerDefaultMaxFiles;
+    }
+
+    if (_maxFileCount != fileCount)
+    {
+        KVO_BEGIN(maxFileCount);
+        _maxFileCount = fileCount;
+        KVO_END(maxFileCount);
+    }
+}
+
+- (NSUInteger) maxFileCount
+{
+    return _maxFileCount;
+}
+
+- (NOBLoggerOptions) options
+{
+    return _options;
+}
+
+- (void) setBytesBeforeRollover:(NSUInteger)bytesBeforeRollover
+{
+    if (bytesBeforeRollover < 1)
+    {
+        bytesBeforeRollover = kNOBLoggerDefaultBytesBeforeRollover;
+    }
+
+    if (_bytesBeforeRollover != bytesBeforeRollover)
+    {
+        KVO_BEGIN(bytesBeforeRollover);
+        _bytesBeforeRollover = bytesBeforeRollover;
+        KVO_END(bytesBeforeRollover);
+    }
+}
+
+- (NSUInteger) bytesBeforeRollover
+{
+    return _bytesBeforeRollover;
+}
+
+- (void) setMaxTotalLogSize:(unsigned long long)maxTotalLogSize
+{
+    if (maxTotalLogSize < 1)
+    {
+        maxTotalLogSize = kNOBLoggerDefaultMaxTotalLogSize;
+    }
+
+    if (_maxTotalLogSize != maxTotalLogSize)
+    {
+        KVO_BEGIN(maxTotalLogSize);
+        _maxTotalLogSize = maxTotalLogSize;
+        KVO_END(maxTotalLogSize);
+    }
+}
+
+- (unsigned long long) maxTotalLogSize
+{
+    return _maxTotalLogSize;
+}
+
+- (void) setWritesPerFlush:(NSUInteger)writesPerFlush
+{
+    if (writesPerFlush < 1)
+    {
+        writesPerFlush = kNOBLoggerDefaultWritesPerFlush;
+    }
+
+    if (!_writesPerFlush != writesPerFlush)
+    {
+        KVO_BEGIN(writesPerFlush);
+        _writesPerFlush = writesPerFlush;
+        KVO_END(writesPerFlush);
+    }
+}
+
+- (NSUInteger) writesPerFlush
+{
+    return _writesPerFlush;
+}
+
+- (NOBLogOverflowPolicy) overflowPolicy
+{
+    return _overflowPolicy;
+}
+
+- (void) setOverflowPolicy:(NOBLogOverflowPolicy)overflowPolicy
+{
+    _overflowPolicy = overflowPolicy;
+}
+
+- (NSUInteger) ringBufferCapacity
+{
+    return NOBLogRingBufferCapacity(_ring);
+}
+
+- (unsigned long long) droppedRecordCount
+{
+    return NOBLogRingBufferDroppedCount(_ring);
+}
+
+- (void) flush
+{
+    if ([self _isDrainContext])
+    {
+        [self _flushFile];
+        return;
+    }
+
+    dispatch_sync(_drainQ, ^() {
+        [self _drain];
+        [self _flushFile];
+        if (_logSegment)
+        {
+            // already safe from a crash, get it to the disk too
+            NOBLogSegmentSync(_logSegment, NO);
+        }
+    });
+
+    for (NOBLogSink* sink in self.sinks)
+    {
+        [sink flush];
+    }
+}
+
+- (void) writeSync:(NSString*)message level:(NOBLogLevel)level
+{
+    int64_t position = 0;
+
+    if ([self _enqueueMessage:message level:level category:kNOBLogCategory_None callSiteId:0 policy:NOBLogOverflowPolicy_Block position:&position])
+    {
+        if ([self _isDrainContext])
+        {
+            [self _commitBatchThroughPosition:position];
+        }
+        else
+        {
+            [self _groupCommitThroughPosition:position];
+        }
+    }
+}
+
+- (BOOL) syncWritesToDisk
+{
+    return _syncWritesToDisk;
+}
+
+- (void) setSyncWritesToDisk:(BOOL)syncWritesToDisk
+{
+    _syncWritesToDisk = syncWritesToDisk;
+}
+
+- (void) writeASync:(NSString*)message level:(NOBLogLevel)level
+{
+    [self writeASync:message level:level callSiteId:0];
+}
+
+- (void) writeASync:(NSString*)message level:(NOBLogLevel)level callSiteId:(uint32_t)callSiteId
+{
+    [self writeASync:message level:level category:kNOBLogCategory_None callSiteId:callSiteId];
+}
+
+- (void) writeASync:(NSString*)message level:(NOBLogLevel)level category:(NOBLogCategory)category callSiteId:(uint32_t)callSiteId
+{
+    if ([self _enqueueMessage:message level:level category:category callSiteId:callSiteId policy:_overflowPolicy position:NULL])
+    {
+        [self _scheduleDrain];
+    }
+}
+
+- (void) writeASyncWithLevel:(NOBLogLevel)level deferredFormat:(const char*)format, ...
+{
+    va_list args;
+    va_start(args, format);
+    BOOL enqueued = [self _enqueueDeferredFormat:format arguments:args level:level callSiteId:0 policy:_overflowPolicy];
+    va_end(args);
+
+    if (enqueued)
+    {
+        [self _scheduleDrain];
+    }
+}
+
+- (void) writeASyncWithLevel:(NOBLogLevel)level callSiteId:(uint32_t)callSiteId deferredFormat:(const char*)format, ...
+{
+    va_list args;
+    va_start(args, format);
+    BOOL enqueued = [self _enqueueDeferredFormat:format arguments:args level:level callSiteId:callSiteId policy:_overflowPolicy];
+    va_end(args);
+
+    if (enqueued)
+    {
+        [self _scheduleDrain];
+    }
+}
+
+- (NSArray*) logFiles
+{
+    NSMutableArray* logs = [NSMutableArray array];
+
+    OSSpinLockLock(&_manifestLock);
+    for (NOBLogFileInfo* info in _manifest)
+    {
+        [logs addObject:info->_name];
+    }
+    OSSpinLockUnlock(&_manifestLock);
+
+    return [logs copy];
+}
+
+- (NSString*) logDirectoryPath
+{
+    return _logDirectoryPath;
+}
+
+- (NSData*) mostRecentLogs:(NSUInteger)maxSize
+{
+    if (_binaryIndex)
+        return [self _binaryTail:maxSize];
+
+    NOBLogTailPiece* pieces = NULL;
+    NSUInteger       count  = [self _planTail:maxSize pieces:&pieces];
+
+    if (!count)
+        return nil;
+
+    size_t total = 0;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        total += pieces[i].length + (pieces[i].separatorBefore ? 1 : 0);
+    }
+
+    // one buffer, only the bytes being returned are read
+    char*  bytes  = (char*)malloc(MAX(total, (size_t)1));
+    size_t length = 0;
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        if (pieces[i].separatorBefore)
+            bytes[length++] = '\n';
+        length += ReadFully(&pieces[i].reader, bytes + length, pieces[i].length, pieces[i].offset);
+        CloseReader(&pieces[i].reader);
+    }
+    free(pieces);
+
+    return [NSData dataWithBytesNoCopy:bytes length:length freeWhenDone:YES];
+}
+
+- (void) streamMostRecentLogs:(NSUInteger)maxSize usingBlock:(void (^)(NSData* chunk, BOOL* stop))block
+{
+    if (_binaryIndex)
+    {
+        // the records have to be rendered to text anyway, chunk up the rendered tail
+        NSData* tail = [self _binaryTail:maxSize];
+        BOOL    stop = NO;
+        for (NSUInteger offset = 0; offset < tail.length && !stop; offset += kNOBLoggerTailChunkSize)
+        {
+            @autoreleasepool {
+                NSUInteger length = MIN(tail.length - offset, (NSUInteger)kNOBLoggerTailChunkSize);
+                block([NSData dataWithBytesNoCopy:(char*)tail.bytes + offset length:length freeWhenDone:NO], &stop);
+            }
+        }
+        return;
+    }
+
+    NOBLogTailPiece* pieces = NULL;
+    NSUInteger       count  = [self _planTail:maxSize pieces:&pieces];
+
+    if (!count)
+        return;
+
+    char*           buffer = (char*)malloc(kNOBLoggerTailChunkSize);
+    __block size_t  length = 0;
+    __block BOOL    stop   = NO;
+
+    void (^deliver)(void) = ^() {
+        @autoreleasepool {
+            block([NSData dataWithBytesNoCopy:buffer length:length freeWhenDone:NO], &stop);
+        }
+        length = 0;
+    };
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        if (!stop)
+        {
+            if (pieces[i].separatorBefore)
+            {
+                if (length == kNOBLoggerTailChunkSize)
+                    deliver();
+                buffer[length++] = '\n';
+            }
+
+            unsigned long long offset    = pieces[i].offset;
+            size_t             remaining = pieces[i].length;
+            while (remaining > 0 && !stop)
+            {
+                if (length == kNOBLoggerTailChunkSize)
+                    deliver();
+
+                size_t toRead    = MIN(remaining, kNOBLoggerTailChunkSize - length);
+                size_t bytesRead = ReadFully(&pieces[i].reader, buffer + length, toRead, offset);
+                length    += bytesRead;
+                offset    += bytesRead;
+                remaining -= toRead;
+                if (bytesRead < toRead)
+                    break; // the file was truncated under us
+            }
+        }
+        CloseReader(&pieces[i].reader);
+    }
+
+    if (length > 0 && !stop)
+        deliver();
+
+    free(buffer);
+    free(pieces);
+}
+
+- (NSData*) mostRecentLogsInMemory:(NSUInteger)maxLineCount
+{
+    NOBLogHistoryRef history = _history;
+    if (!history)
+        return nil;
+
+    maxLineCount = MIN(maxLineCount, NOBLogHistoryCapacity(history));
+
+    NSMutableData* lines = [NSMutableData data];
+    NSUInteger     count = 0;
+    NOBLogHistoryCopy(history, MAX(NOBLogHistoryHead(history) - (int64_t)maxLineCount, 0), maxLineCount, lines, &count, NULL);
+    return lines;
+}
+
+- (id) addTailObserverOnQueue:(dispatch_queue_t)queue
+                includeRecent:(BOOL)includeRecent
+                   usingBlock:(void (^)(NSData* lines, NSUInteger lineCount, NSUInteger droppedCount))block
+{
+    if (!block)
+        return nil;
+
+    NOBLogHistoryRef history = [self _tailHistory];
+    if (!history)
+        return nil;
+
+    NOBLogTailObserver* observer = [[NOBLogTailObserver alloc] init];
+    observer->_queue  = (queue ? queue : dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    observer->_block  = [block copy];
+    observer->_cursor = NOBLogHistoryHead(history);
+    dispatch_retain(observer->_queue);
+    if (includeRecent)
+    {
+        observer->_cursor = MAX(observer->_cursor - (int64_t)NOBLogHistoryCapacity(history), 0);
+    }
+
+    // copy on write so that the drain context can notify without holding the lock
+    OSSpinLockLock(&_observersLock);
+    _tailObservers = (_tailObservers ? [_tailObservers arrayByAddingObject:observer] : @[observer]);
+    OSSpinLockUnlock(&_observersLock);
+
+    if (includeRecent)
+    {
+        [self _scheduleTailObserver:observer];
+    }
+    return observer;
+}
+
+- (void) addSink:(NOBLogSink*)sink
+{
+    if (!sink)
+        return;
+
+    OSSpinLockLock(&_observersLock);
+    if (![_sinks containsObject:sink])
+    {
+        _sinks = (_sinks ? [_sinks arrayByAddingObject:sink] : @[sink]);
+    }
+    OSSpinLockUnlock(&_observersLock);
+}
+
+- (void) removeSink:(NOBLogSink*)sink
+{
+    OSSpinLockLock(&_observersLock);
+    NSMutableArray* sinks = [_sinks mutableCopy];
+    [sinks removeObjectIdenticalTo:sink];
+    _sinks = (sinks.count ? [sinks copy] : nil);
+    OSSpinLockUnlock(&_observersLock);
+}
+
+- (NSArray*) sinks
+{
+    OSSpinLockLock(&_observersLock);
+    NSArray* sinks = _sinks;
+    OSSpinLockUnlock(&_observersLock);
+    return (sinks ? sinks : @[]);
+}
+
+- (void) removeTailObserver:(id)observer
+{
+    if (![observer isKindOfClass:[NOBLogTailObserver class]])
+        return;
+
+    ((NOBLogTailObserver*)observer)->_removed = YES;
+    OSMemoryBarrier();
+
+    OSSpinLockLock(&_observersLock);
+    NSMutableArray* observers = [_tailObservers mutableCopy];
+    [observers removeObjectIdenticalTo:observer];
+    _tailObservers = (observers.count ? [observers copy] : nil);
+    OSSpinLockUnlock(&_observersLock);
+}
+
+- (unsigned long long) totalLogSize
+{
+    OSSpinLockLock(&_manifestLock);
+    unsigned long long size = _manifestSize;
+    OSSpinLockUnlock(&_manifestLock);
+    return size;
+}
+
+- (void) enumerateRecordsFrom:(NSDate*)start
+                           to:(NSDate*)end
+                        level:(NOBLogLevel)level
+                   usingBlock:(void (^)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop))block
+{
+    CFAbsoluteTime startTime = (start ? start.timeIntervalSinceReferenceDate : -DBL_MAX);
+    CFAbsoluteTime endTime   = (end ? end.timeIntervalSinceReferenceDate : DBL_MAX);
+
+    [self _enumerateBinaryLogsFrom:startTime
+                                to:endTime
+                             level:level
+                        usingBlock:^(NOBLogBinaryReaderRef reader, BOOL* stop) {
+        NOBLogBinaryReaderEnumerate(reader, startTime, endTime, (uint32_t)level, ^(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* recordStop) {
+            block(header, payload, recordStop);
+            if (*recordStop)
+                *stop = YES;
+        });
+    }];
+}
+
+- (NSData*) exportLogsFrom:(NSDate*)start
+                        to:(NSDate*)end
+                     level:(NOBLogLevel)level
+{
+    CFAbsoluteTime startTime = (start ? start.timeIntervalSinceReferenceDate : -DBL_MAX);
+    CFAbsoluteTime endTime   = (end ? end.timeIntervalSinceReferenceDate : DBL_MAX);
+    NSMutableData* text      = [NSMutableData data];
+
+    [self _enumerateBinaryLogsFrom:startTime
+                                to:endTime
+                             level:level
+                        usingBlock:^(NOBLogBinaryReaderRef reader, BOOL* stop) {
+        NOBLogBinaryReaderExportText(reader, startTime, endTime, (uint32_t)level, ^(const char* bytes, size_t length) {
+            [text appendBytes:bytes length:length];
+        });
+    }];
+
+    return text;
+}
+
+@end
+
+@implementation NOBLogger (Private)
+
+- (void) _prepare
+{
+    _ring   = NOBLogRingBufferCreate(kNOBLoggerDefaultRingBufferCapacity);
+    _drainQ = dispatch_queue_create("NOBLoggerDrainQ", DISPATCH_QUEUE_SERIAL);
+    dispatch_queue_set_specific(_drainQ, &s_drainQKey, (__bridge void*)self, NULL);
+    pthread_mutex_init(&_syncLock, NULL);
+    pthread_cond_init(&_syncCond, NULL);
+#ifdef DEBUG
+    [self addSink:[[NOBLogConsoleSink alloc] init]];
+#endif
+}
+
+- (BOOL) _isDrainContext
+{
+    return dispatch_get_specific(&s_drainQKey) == (__bridge void*)self;
+}
+
+- (BOOL) _enqueueMessage:(NSString*)message
+                   level:(NOBLogLevel)level
+                category:(NOBLogCategory)category
+              callSiteId:(uint32_t)callSiteId
+                  policy:(NOBLogOverflowPolicy)policy
+                position:(int64_t*)pPosition
+{
+    CFAbsoluteTime timestamp = CFAbsoluteTimeGetCurrent();
+
+    if (NOBLogOverflowPolicy_Block == policy &&
+        [self _isDrainContext])
+    {
+        // Blocking on our own drain would deadlock
+        policy = NOBLogOverflowPolicy_DropNewest;
+    }
+
+    // Avoid the O(n) exact length computation when the message will obviously fit inline
+    NSUInteger length = message.length;
+    NSUInteger maxBytes = [message maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    if (maxBytes > kNOBLogRecordInlineCapacity)
+        maxBytes = [message lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+
+    NOBLogRecord* record = NOBLogRingBufferReserve(_ring, maxBytes, policy);
+    if (!record)
+        return NO;
+
+    NSUInteger usedLength = 0;
+    [message getBytes:record->bytes
+            maxLength:record->capacity
+           usedLength:&usedLength
+             encoding:NSUTF8StringEncoding
+              options:0
+                range:NSMakeRange(0, length)
+       remainingRange:NULL];
+    record->length     = (uint32_t)usedLength;
+    record->level      = (uint32_t)level;
+    record->timestamp  = timestamp;
+    record->callSiteId = callSiteId;
+    record->category   = category;
+    record->threadId   = pthread_mach_thread_np(pthread_self());
+    if (pPosition)
+        *pPosition = record->position;
+    NOBLogRingBufferCommit(_ring, record);
+    return YES;
+}
+
+- (BOOL) _enqueueDeferredFormat:(const char*)format
+                      arguments:(va_list)args
+                          level:(NOBLogLevel)level
+                     callSiteId:(uint32_t)callSiteId
+                         policy:(NOBLogOverflowPolicy)policy
+{
+    CFAbsoluteTime timestamp = CFAbsoluteTimeGetCurrent();
+
+    if (!format)
+        return NO;
+
+    if (NOBLogOverflowPolicy_Block == policy &&
+        [self _isDrainContext])
+    {
+        policy = NOBLogOverflowPolicy_DropNewest;
+    }
+
+    // Capture straight into the record, most captures fit the inline capacity
+    NOBLogRecord* record = NOBLogRingBufferReserve(_ring, kNOBLogRecordInlineCapacity, policy);
+    if (!record)
+        return NO;
+
+    va_list argsCopy;
+    va_copy(argsCopy, args);
+    size_t length = NOBLogDeferredFormatCapture(record->bytes, record->capacity, format, args);
+    if (length > record->capacity)
+    {
+        if (NOBLogRingBufferGrowRecord(_ring, record, length))
+            NOBLogDeferredFormatCapture(record->bytes, record->capacity, format, argsCopy);
+        else
+            length = 0;
+    }
+    va_end(argsCopy);
+
+    record->length     = (uint32_t)length;
+    record->level      = (uint32_t)level;
+    record->flags      = kNOBLogRecordFlag_DeferredFormat;
+    record->timestamp  = timestamp;
+    record->callSiteId = callSiteId;
+    record->threadId   = pthread_mach_thread_np(pthread_self());
+    NOBLogRingBufferCommit(_ring, record);
+    return YES;
+}
+
+- (void) _scheduleDrain
+{
+    if (OSAtomicCompareAndSwap32Barrier(0, 1, &_drainScheduled))
+    {
+        dispatch_async(_drainQ, ^() {
+            if ([self _drain] > 0 && !NOBLogRingBufferIsEmpty(_ring))
+            {
+                // more records arrived while draining, give other work on the queue a turn
+                [self _scheduleDrain];
+            }
+        });
+    }
+}
+
+- (NSUInteger) _drain
+{
+    OSAtomicCompareAndSwap32Barrier(1, 0, &_drainScheduled);
+
+    // self is captured unretained since this can run from dealloc
+    __unsafe_unretained NOBLogger* unsafeSelf = self;
+    NSUInteger drained = NOBLogRingBufferDrain(_ring, NOBLogRingBufferCapacity(_ring), ^(const NOBLogRecord* record) {
+        [unsafeSelf _writeRecord:record];
+    });
+
+    uint64_t dropped = NOBLogRingBufferDroppedCount(_ring);
+    if (dropped != _droppedRecordsReported)
+    {
+        [self writeString:[NSString stringWithFormat:@"!!!!  %llu log records were dropped, the ring buffer was full  !!!!", dropped - _droppedRecordsReported]];
+        [self writeByte:'\n'];
+        _droppedRecordsReported = dropped;
+    }
+
+    // one write for the whole batch
+    [self _commitOutput];
+
+    if (drained && _tailObservers)
+    {
+        [self _notifyTailObservers];
+    }
+
+    if (_sinkBatch)
+    {
+        OSSpinLockLock(&_observersLock);
+        NSArray* sinks = _sinks;
+        OSSpinLockUnlock(&_observersLock);
+
+        for (NOBLogSink* sink in sinks)
+        {
+            [sink enqueueBatch:_sinkBatch];
+        }
+        _sinkBatch = nil;
+    }
+
+    return drained;
+}
+
+- (void) _drainThroughPosition:(int64_t)position
+{
+    while (NOBLogRingBufferReadPosition(_ring) <= position)
+    {
+        if (![self _drain])
+        {
+            // a record ahead of ours is still being written
+            sched_yield();
+        }
+    }
+}
+
+- (void) _groupCommitThroughPosition:(int64_t)position
+{
+    pthread_mutex_lock(&_syncLock);
+    while (_syncedPosition <= position)
+    {
+        if (_syncInProgress)
+        {
+            // a batch is being written, it will include our record if it was enqueued in time
+            pthread_cond_wait(&_syncCond, &_syncLock);
+            continue;
+        }
+
+        // lead the next batch: everything enqueued so far goes out with one write
+        _syncInProgress = YES;
+        pthread_mutex_unlock(&_syncLock);
+
+        __block int64_t synced = 0;
+        dispatch_sync(_drainQ, ^() {
+            synced = [self _commitBatchThroughPosition:position];
+        });
+
+        pthread_mutex_lock(&_syncLock);
+        _syncInProgress = NO;
+        if (synced > _syncedPosition)
+            _syncedPosition = synced;
+        pthread_cond_broadcast(&_syncCond);
+    }
+    pthread_mutex_unlock(&_syncLock);
+}
+
+- (int64_t) _commitBatchThroughPosition:(int64_t)position
+{
+    [self _drainThroughPosition:position];
+    [self _drain]; // pick up the rest of the batch that was enqueued behind us
+    [self _flushFile];
+
+    if (_syncWritesToDisk)
+    {
+        if (_logSegment)
+            NOBLogSegmentSync(_logSegment, YES);
+        else if (_logFile)
+            fsync(fileno(_logFile));
+    }
+
+    return NOBLogRingBufferReadPosition(_ring);
+}
+
+- (void) _flushFile
+{
+    [self _commitOutput];
+    if (_logFile)
+        fflush(_logFile);
+    _logWritesMade = 0;
+}
+
+- (void) _commitOutput
+{
+    if (_outputLength > 0)
+    {
+        if (_logFile || _logSegment)
+        {
+            size_t written = (_logSegment ?
+                              NOBLogSegmentAppend(_logSegment, _outputBuffer, _outputLength) :
+                              fwrite(_outputBuffer, 1, _outputLength, _logFile));
+            _logFileBytes += written;
+
+            OSSpinLockLock(&_manifestLock);
+            ((NOBLogFileInfo*)_manifest.lastObject)->_size += written;
+            _manifestSize += written;
+            OSSpinLockUnlock(&_manifestLock);
+        }
+        _outputLength = 0;
+    }
+}
+
+- (void) _loadManifest:(NSString*)root
+{
+    NSFileManager*  fm    = [NSFileManager defaultManager];
+    NSMutableArray* logs  = [[fm contentsOfDirectoryAtPath:root error:NULL] mutableCopy];
+
+    for (NSInteger i = 0; i < logs.count; i++)
+    {
+        NSString* logName = [logs objectAtIndex:i];
+        if ([logName hasPrefix:@"."] && [logName.pathExtension isEqualToString:@"tmp"])
+        {
+            // left over from compressing a log when the app was killed
+            [fm removeItemAtPath:[root stringByAppendingPathComponent:logName] error:NULL];
+        }
+        if (![logName hasPrefix:_logFileNamePrefix] ||
+            [logName.pathExtension isEqualToString:@"tmp"])
+        {
+            [logs removeObjectAtIndex:i];
+            i--;
+        }
+    }
+
+    @autoreleasepool {
+        NSUInteger prefixLength = _logFileNamePrefix.length;
+        [logs sortUsingComparator:^NSComparisonResult (id obj1, id obj2) {
+             NSString* logFile1 = [obj1 stringByDeletingPathExtension];
+             NSString* logFile2 = [obj2 stringByDeletingPathExtension];
+
+             if (logFile1.length <= prefixLength ||
+                 logFile2.length <= prefixLength)
+             {
+                 return [logFile1 compare:logFile2];
+             }
+
+             logFile1 = [logFile1 substringFromIndex:prefixLength];
+             logFile2 = [logFile2 substringFromIndex:prefixLength];
+
+             unsigned long long stamp1 = logFile1.unsignedLongLongValue;
+             unsigned long long stamp2 = logFile2.unsignedLongLongValue;
+
+             if (stamp1 < stamp2)
+             {
+                 return NSOrderedAscending;
+             }
+             else if (stamp1 > stamp2)
+             {
+                 return NSOrderedDescending;
+             }
+
+             return NSOrderedSame;
+         }];
+    }
+
+    NSMutableArray*    manifest = [NSMutableArray arrayWithCapacity:logs.count + 1];
+    unsigned long long size     = 0;
+    for (NSString* logName in logs)
+    {
+        NSString*       logPath = [root stringByAppendingPathComponent:logName];
+        NOBLogFileInfo* info    = [[NOBLogFileInfo alloc] init];
+        info->_name = logName;
+        if ([logName.pathExtension isEqualToString:kNOBLogSegmentFileExtension])
+        {
+            // a segment that was not closed (crash) is still pre-sized, trim it to what was committed
+            info->_size = NOBLogSegmentFileRecover(logPath.UTF8String);
+        }
+        else
+        {
+            info->_size = [fm fileSize:logPath];
+        }
+        size += info->_size;
+        [manifest addObject:info];
+    }
+
+    OSSpinLockLock(&_manifestLock);
+    _manifest     = manifest;
+    _manifestSize = size;
+    OSSpinLockUnlock(&_manifestLock);
+}
+
+- (NSException*) _openLogsInDirectory:(NSString*)root
+{
+    NSFileManager* fm = [NSFileManager defaultManager];
+    if (root)
+    {
+        [fm    createDirectoryAtPath:root
+         withIntermediateDirectories:YES
+                          attributes:nil
+                               error:NULL];
+    }
+    BOOL isDir = NO;
+    if (![fm fileExistsAtPath:root isDirectory:&isDir] ||
+        !isDir)
+    {
+        return [NSException exceptionWithName:NSDestinationInvalidException
+                                       reason:@"InvalidPath: the root path provided does not exist!"
+                                     userInfo:(root ? @{ @"rootPath" : root } : nil)];
+    }
+
+    // The only directory listing the logger makes, from here on the manifest is kept up to date as we go
+    [self _loadManifest:root];
+
+    UInt64    fileId      = GenerateLogFileId();
+    NSString* logFilePath = [root stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId, _logFileExtension)];
+    // handle edge case of duplicate file
+    while ([fm fileExistsAtPath:logFilePath])
+    {
+        fileId++;
+        logFilePath = [root stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId, _logFileExtension)];
+    }
+
+    if (![self _createLogFileAtPath:logFilePath file:&_logFile segment:&_logSegment])
+    {
+        return [NSException exceptionWithName:NSObjectInaccessibleException
+                                       reason:@"Could not create file for logging to!"
+                                     userInfo:(logFilePath ? @{ @"filePath" : logFilePath } : nil)];
+    }
+
+    _logFilePath     = [logFilePath copy];
+    _newlinesWritten     = 0;
+    _logWritesMade       = 0;
+    _logFileBytes        = 0;
+    _failedRolloverBytes = 0;
+    [self _addFileToManifest:_logFilePath.lastPathComponent];
+
+    [self _startLogFile];
+    [self purgeOldLogsIfNeeded];
+    if (_options & NOBLoggerOption_CompressRolledLogs)
+    {
+        // logs from previous sessions that did not get compressed, scheduled from the drain queue once the purge is done with them
+        dispatch_async(_drainQ, ^() {
+            NSArray* logs = self.logFiles;
+            for (NSUInteger i = 0; i + 1 < logs.count; i++)
+            {
+                NSString* logName = [logs objectAtIndex:i];
+                if (![logName.pathExtension isEqualToString:kNOBLogCompressedFileExtension])
+                    [self _compressLogFileNamed:logName];
+            }
+        });
+    }
+    [self writeString:@"New logging session started: "];
+    [self writeString:_logFileNamePrefix];
+    [self writeByte:'\n'];
+    _logWritesMade = _newlinesWritten; // will equal number of writeByte: with '\n' calls
+    [self performMaintenance:NO];
+    return nil;
+}
+
+- (BOOL) _createLogFileAtPath:(NSString*)path file:(FILE**)pFile segment:(NOBLogSegmentRef*)pSegment
+{
+    if (_options & NOBLoggerOption_MappedSegments)
+    {
+        size_t capacity = MIN(_bytesBeforeRollover, (NSUInteger)(4 * 1024 * 1024)) + kNOBLoggerOutputCommitThreshold;
+        *pSegment = NOBLogSegmentCreate(path.UTF8String, capacity);
+        return (NULL != *pSegment);
+    }
+
+    *pFile = fopen(path.UTF8String, "w");
+    return (NULL != *pFile);
+}
+
+- (void) _closeLogFile
+{
+    if (_binaryIndex)
+    {
+        if (_pendingLineLength)
+            [self _writePendingLine];
+
+        size_t indexLength = NOBLogBinaryIndexEncodedLength(_binaryIndex);
+        char*  index       = [self _reserveOutput:indexLength];
+        if (index)
+        {
+            // _reserveOutput may have committed, so the offset is computed after
+            NOBLogBinaryIndexEncode(_binaryIndex, _logFileBytes + _outputLength - indexLength, index);
+        }
+    }
+    [self _flushFile];
+    if (_logSegment)
+    {
+        NOBLogSegmentClose(_logSegment);
+        _logSegment = NULL;
+    }
+    if (_logFile)
+    {
+        fclose(_logFile);
+        _logFile = NULL;
+    }
+}
+
+- (BOOL) _openLogFileForReading:(NSString*)path reader:(NOBLogFileReader*)reader
+{
+    memset(reader, 0, sizeof(NOBLogFileReader));
+    reader->fd = -1;
+
+    if ([path.pathExtension isEqualToString:kNOBLogCompressedFileExtension])
+    {
+        reader->compressed = NOBLogCompressedFileOpen(path.UTF8String);
+        if (!reader->compressed)
+            return NO;
+        reader->length = NOBLogCompressedFileLength(reader->compressed);
+        return YES;
+    }
+
+    reader->fd = open(path.UTF8String, O_RDONLY);
+    if (reader->fd < 0)
+    {
+        // may have just been replaced by its compressed version
+        if (_options & NOBLoggerOption_CompressRolledLogs)
+        {
+            NSString* compressedPath = [path.stringByDeletingPathExtension stringByAppendingPathExtension:kNOBLogCompressedFileExtension];
+            return [self _openLogFileForReading:compressedPath reader:reader];
+        }
+        return NO;
+    }
+
+    if ([path.pathExtension isEqualToString:kNOBLogSegmentFileExtension] &&
+        NOBLogSegmentFileGetDataRange(path.UTF8String, &reader->dataOffset, &reader->length))
+    {
+        // only the committed data of a segment, no header
+        return YES;
+    }
+
+    struct stat info;
+    if (0 != fstat(reader->fd, &info))
+    {
+        CloseReader(reader);
+        return NO;
+    }
+
+    reader->length = (unsigned long long)info.st_size;
+    return YES;
+}
+
+- (void) _compressLogFileNamed:(NSString*)fileName
+{
+    NSString*         root     = self.logDirectoryPath;
+    __weak NOBLogger* weakSelf = self;
+
+    dispatch_async(NOBLoggerCompressionQueue(), ^() {
+        NOBLogger* strongSelf = weakSelf;
+        if (!strongSelf)
+            return;
+
+        // compress to a temp file (that will never match the prefix) and swap it in from the drain queue
+        NSString*        path     = [root stringByAppendingPathComponent:fileName];
+        NSString*        tempPath = [root stringByAppendingPathComponent:[NSString stringWithFormat:@".%@.tmp", fileName]];
+        NOBLogFileReader reader;
+        if (![strongSelf _openLogFileForReading:path reader:&reader])
+            return;
+
+        BOOL compressed = (!reader.compressed &&
+                           NOBLogCompressFile(reader.fd, reader.dataOffset, reader.length, tempPath.UTF8String));
+        CloseReader(&reader);
+
+        if (compressed)
+        {
+            dispatch_async(strongSelf->_drainQ, ^() {
+                [strongSelf _replaceLogFileNamed:fileName withCompressedFileAtPath:tempPath];
+            });
+        }
+    });
+}
+
+- (void) _replaceLogFileNamed:(NSString*)fileName withCompressedFileAtPath:(NSString*)tempPath
+{
+    NSString* root = self.logDirectoryPath;
+
+    OSSpinLockLock(&_manifestLock);
+    NSArray* manifest = [_manifest copy];
+    OSSpinLockUnlock(&_manifestLock);
+
+    NOBLogFileInfo* info = nil;
+    for (NOBLogFileInfo* nextInfo in manifest)
+    {
+        if ([nextInfo->_name isEqualToString:fileName])
+        {
+            info = nextInfo;
+            break;
+        }
+    }
+
+    NSString* compressedName = [fileName.stringByDeletingPathExtension stringByAppendingPathExtension:kNOBLogCompressedFileExtension];
+    NSString* compressedPath = [root stringByAppendingPathComponent:compressedName];
+    if (!info ||
+        0 != rename(tempPath.UTF8String, compressedPath.UTF8String))
+    {
+        // purged while we were compressing
+        unlink(tempPath.UTF8String);
+        return;
+    }
+
+    unlink([root stringByAppendingPathComponent:fileName].UTF8String);
+    unsigned long long size = [[NSFileManager defaultManager] fileSize:compressedPath];
+
+    OSSpinLockLock(&_manifestLock);
+    _manifestSize = _manifestSize - info->_size + size;
+    info->_name   = compressedName;
+    info->_size   = size;
+    OSSpinLockUnlock(&_manifestLock);
+}
+
+- (NSUInteger) _planTail:(NSUInteger)maxSize pieces:(NOBLogTailPiece**)pPieces
+{
+    if (maxSize < kMAGNITUDE_BYTES)
+        maxSize = kMAGNITUDE_BYTES;
+
+    [self flush];
+    NSArray*         logs             = self.logFiles;
+    NSString*        logDirectoryPath = self.logDirectoryPath;
+    NOBLogTailPiece* pieces           = (NOBLogTailPiece*)calloc(MAX(logs.count, (NSUInteger)1), sizeof(NOBLogTailPiece));
+    NSUInteger       count            = 0;
+    size_t           remaining        = maxSize;
+
+    // walk from the newest log backwards, seeking to only the bytes that fit
+    for (NSUInteger i = 0; i < logs.count && remaining > 0; i++)
+    {
+        @autoreleasepool {
+            NSString*          logPath = [logDirectoryPath stringByAppendingPathComponent:[logs objectAtIndex:logs.count - 1 - i]];
+            NOBLogFileReader   reader;
+            if (![self _openLogFileForReading:logPath reader:&reader])
+                continue; // purged out from under us
+            unsigned long long length  = reader.length;
+
+            if (count > 0)
+            {
+                // logs are separated by a newline
+                pieces[count - 1].separatorBefore = YES;
+                remaining--;
+            }
+
+            size_t pieceLength = (size_t)MIN(length, (unsigned long long)remaining);
+            pieces[count].reader = reader;
+            pieces[count].offset = length - pieceLength;
+            pieces[count].length = pieceLength;
+            remaining -= pieceLength;
+            count++;
+        }
+    }
 
-- (void) setMaxFileCount:(NSUInteger)fileCount
-{
-    if (fileCount < 1)
+    // chronological order
+    for (NSUInteger i = 0; i < count / 2; i++)
     {
-        fileCount = kNOBLoggerDefaultMaxFiles;
+        NOBLogTailPiece piece    = pieces[i];
+        pieces[i]                = pieces[count - 1 - i];
+        pieces[count - 1 - i]    = piece;
     }
 
-    if (_maxFileCount != fileCount)
+    *pPieces = pieces;
+    if (!count)
     {
-        KVO_BEGIN(maxFileCount);
-        _maxFileCount = fileCount;
-        KVO_END(maxFileCount);
+        free(pieces);
+        *pPieces = NULL;
     }
+    return count;
 }
 
-- (NSUInteger) maxFileCount
+- (NSData*) _binaryTail:(NSUInteger)maxSize
 {
-    return _maxFileCount;
-}
+    if (maxSize < kMAGNITUDE_BYTES)
+        maxSize = kMAGNITUDE_BYTES;
 
-- (void) setWritesPerFlush:(NSUInteger)writesPerFlush
-{
-    if (writesPerFlush < 1)
+    [self flush];
+    NSArray*        logs             = self.logFiles;
+    NSString*       logDirectoryPath = self.logDirectoryPath;
+    NSMutableArray* texts            = [NSMutableArray array];
+    NSUInteger      total            = 0;
+
+    // render from the newest log backwards until there is enough text
+    for (NSUInteger i = 0; i < logs.count && total < maxSize; i++)
     {
-        writesPerFlush = kNOBLoggerDefaultWritesPerFlush;
+        @autoreleasepool {
+            NSString*             logPath = [logDirectoryPath stringByAppendingPathComponent:[logs objectAtIndex:logs.count - 1 - i]];
+            NOBLogBinaryReaderRef reader  = NOBLogBinaryReaderOpen(logPath.fileSystemRepresentation);
+            if (!reader)
+                continue; // purged out from under us
+
+            // only the end of the file is rendered
+            NSData* text = NOBLogBinaryReaderTextTail(reader, NOBLogLevel_Low, maxSize - total);
+            NOBLogBinaryReaderClose(reader);
+
+            if (texts.count > 0)
+                total++; // logs are separated by a newline
+            total += text.length;
+            [texts insertObject:text atIndex:0];
+        }
     }
 
-    if (!_writesPerFlush != writesPerFlush)
+    if (!texts.count)
+        return nil;
+
+    NSMutableData* tail = [NSMutableData dataWithCapacity:total];
+    for (NSUInteger i = 0; i < texts.count; i++)
     {
-        KVO_BEGIN(writesPerFlush);
-        _writesPerFlush = writesPerFlush;
-        KVO_END(writesPerFlush);
+        if (i > 0)
+            [tail appendBytes:"\n" length:1];
+        [tail appendData:[texts objectAtIndex:i]];
     }
-}
 
-- (NSUInteger) writesPerFlush
-{
-    return _writesPerFlush;
+    if (tail.length > maxSize)
+        return [tail subdataWithRange:NSMakeRange(tail.length - maxSize, maxSize)];
+    return tail;
 }
 
-- (void) flush
+- (void) _enumerateBinaryLogsFrom:(CFAbsoluteTime)start
+                               to:(CFAbsoluteTime)end
+                            level:(NOBLogLevel)level
+                       usingBlock:(void (^)(NOBLogBinaryReaderRef reader, BOOL* stop))block
 {
-    if (_logFile)
-        fflush(_logFile);
-    _logWritesMade = 0;
-}
+    NOBAssert(_binaryIndex != NULL && "Only NOBLoggerOption_BinaryRecords logs can be queried");
+    if (!_binaryIndex)
+        return;
 
-- (void) writeSync:(NSString*)message level:(NOBLogLevel)level
-{
-    NSDate* date = [NSDate date];
+    [self flush];
+    NSArray*  logs             = self.logFiles;
+    NSString* logDirectoryPath = self.logDirectoryPath;
+    BOOL      stop             = NO;
 
-    dispatch_sync(s_logQ, ^() {
-                      [self write:message level:level withTimestamp:date];
-                  });
+    // eldest first, logs that end before start are cheap since the index seeks straight past them
+    for (NSUInteger i = 0; i < logs.count && !stop; i++)
+    {
+        @autoreleasepool {
+            NSString*             logPath = [logDirectoryPath stringByAppendingPathComponent:[logs objectAtIndex:i]];
+            NOBLogBinaryReaderRef reader  = NOBLogBinaryReaderOpen(logPath.fileSystemRepresentation);
+            if (!reader)
+                continue; // purged out from under us
+
+            // records can be drained slightly out of timestamp order, allow a second of slop
+            if (NOBLogBinaryReaderFirstTimestamp(reader) > end + 1.0)
+                stop = YES; // this log and every newer log is past the range
+            else
+                block(reader, &stop);
+            NOBLogBinaryReaderClose(reader);
+        }
+    }
 }
 
-- (void) writeASync:(NSString*)message level:(NOBLogLevel)level
+- (void) _addFileToManifest:(NSString*)fileName
 {
-    NSDate* date = [NSDate date];
+    NOBLogFileInfo* info = [[NOBLogFileInfo alloc] init];
+    info->_name = [fileName copy];
 
-    dispatch_async(s_logQ, ^() {
-                       dispatch_async(s_logQ, ^() {
-                                          [self write:message level:level withTimestamp:date];
-                                      });
-                   });
+    OSSpinLockLock(&_manifestLock);
+    [_manifest addObject:info];
+    OSSpinLockUnlock(&_manifestLock);
 }
 
-- (NSArray*) logFiles
+- (char*) _reserveOutput:(size_t)length
 {
-    NSError*        err  = nil;
-    NSMutableArray* logs = [[[NSFileManager defaultManager] contentsOfDirectoryAtPath:self.logDirectoryPath
-                                                                                error:&err] mutableCopy];
-
-    if (err)
-    {
-        [self writeString:err.description];
-        [self writeByte:'\n'];
-        return nil;
-    }
-
-    for (NSInteger i = 0; i < logs.count; i++)
+    if (_outputLength + length > _outputCapacity)
     {
-        NSString* logName = [logs objectAtIndex:i];
-        if (![logName hasPrefix:_logFileNamePrefix])
+        if (_outputLength > 0 && _outputLength + length > kNOBLoggerOutputCommitThreshold)
         {
-            [logs removeObjectAtIndex:i];
-            i--;
+            [self _commitOutput];
         }
-    }
-
-    @autoreleasepool {
-        NSUInteger prefixLength = _logFileNamePrefix.length;
-        [logs sortUsingComparator:^NSComparisonResult (id obj1, id obj2) {
-             NSString* logFile1 = [obj1 stringByDeletingPathExtension];
-             NSString* logFile2 = [obj2 stringByDeletingPathExtension];
-
-             if (logFile1.length <= prefixLength ||
-                 logFile2.length <= prefixLength)
-             {
-                 return [logFile1 compare:logFile2];
-             }
-
-             logFile1 = [logFile1 substringFromIndex:prefixLength];
-             logFile2 = [logFile2 substringFromIndex:prefixLength];
-
-             unsigned long long stamp1 = logFile1.unsignedLongLongValue;
-             unsigned long long stamp2 = logFile2.unsignedLongLongValue;
-
-             if (stamp1 < stamp2)
-             {
-                 return NSOrderedAscending;
-             }
-             else if (stamp1 > stamp2)
-             {
-                 return NSOrderedDescending;
-             }
 
-             return NSOrderedSame;
-         }];
+        if (length > _outputCapacity)
+        {
+            size_t capacity = MAX(length, (size_t)kNOBLoggerOutputCommitThreshold);
+            char*  buffer   = (char*)realloc(_outputBuffer, capacity);
+            if (!buffer)
+                return NULL;
+            _outputBuffer   = buffer;
+            _outputCapacity = capacity;
+        }
     }
 
-    return [logs copy];
+    char* reserved = _outputBuffer + _outputLength;
+    _outputLength += length;
+    return reserved;
 }
 
-- (NSString*) logDirectoryPath
+- (void) _writeRecord:(const NOBLogRecord*)record
 {
-    return _logFilePath.stringByDeletingLastPathComponent;
-}
+    NOBLogLevel level = (NOBLogLevel)record->level;
 
-- (NSData*) mostRecentLogs:(NSUInteger)maxSize
-{
-    if (maxSize < kMAGNITUDE_BYTES)
-        maxSize = kMAGNITUDE_BYTES;
+    if (!level ||
+        (level > _level && !record->category)) // the level of a category was checked by the caller
+    {
+        return;
+    }
 
-    [self flush];
-    NSArray*       logs             = self.logFiles;
-    NSString*      logDirectoryPath = self.logDirectoryPath;
-    NSMutableData* data             = nil;
+    const char* message   = record->bytes;
+    size_t      length    = record->length;
 
-    if (logs.count > 0)
+    if (record->flags & kNOBLogRecordFlag_DeferredFormat)
     {
-        char n = '\n';
-        for (NSUInteger i = 0; i < logs.count && data.length < maxSize; i++)
+        length = NOBLogDeferredFormatRender(_renderBuffer, _renderBufferCapacity, record->bytes, record->length);
+        if (length >= _renderBufferCapacity)
         {
-            @autoreleasepool {
-                // keep this loop tight with an autorelease pool
-                NSString* logPath = [logs objectAtIndex:logs.count - 1 - i];
-                logPath = [logDirectoryPath stringByAppendingPathComponent:logPath];
-                NSMutableData* fileData = [NSMutableData dataWithContentsOfFile:logPath];
-                if (data)
-                {
-                    [fileData appendBytes:&n length:1];
-                    [fileData appendData:data];
-                }
-                data = fileData;
+            size_t capacity = MAX(length + 1, (size_t)kNOBLogRecordInlineCapacity);
+            char*  buffer   = (char*)realloc(_renderBuffer, capacity);
+            if (buffer)
+            {
+                _renderBuffer         = buffer;
+                _renderBufferCapacity = capacity;
+                length = NOBLogDeferredFormatRender(_renderBuffer, _renderBufferCapacity, record->bytes, record->length);
+            }
+            else
+            {
+                length = 0;
             }
         }
+        message = _renderBuffer;
+    }
+
+    // "[" timestamp "]" level name
+    NOBLogHistoryRef history = _history;
+    char             header[kNOBLogTextPrefixMaxLength];
+    size_t           headerLength = 0;
+    if (!_binaryIndex || history || _sinks)
+    {
+        headerLength = NOBLogTextEncodePrefix(&_timestampCache, record->timestamp, (uint32_t)level, header);
+    }
+
+    if (history)
+    {
+        NOBLogHistoryAppend(history, header, headerLength, message, length);
+    }
 
-        if (data.length > 5)
+    if (_sinks)
+    {
+        if (!_sinkBatch)
         {
-            if (data.length > maxSize)
-            {
-                [data replaceBytesInRange:NSMakeRange(0, data.length - maxSize)
-                                withBytes:NULL
-                                   length:0];
-            }
+            _sinkBatch = [[NOBLogSinkBatch alloc] init];
         }
+        [_sinkBatch appendLineWithPrefix:header prefixLength:headerLength message:message length:length level:level];
     }
 
-    return [data copy];
+    if (_binaryIndex)
+    {
+        NOBLogBinaryRecordHeader binaryHeader;
+        memset(&binaryHeader, 0, sizeof(binaryHeader));
+        binaryHeader.timestamp  = record->timestamp;
+        binaryHeader.threadId   = record->threadId;
+        binaryHeader.callSiteId = record->callSiteId;
+        binaryHeader.length     = (uint32_t)length;
+        binaryHeader.level      = (uint8_t)level;
+        binaryHeader.category   = (uint8_t)record->category;
+        [self _writeBinaryRecordWithHeader:&binaryHeader payload:message];
+    }
+    else
+    {
+        [self writeBytes:header length:headerLength];
+        [self writeBytes:message length:length];
+        [self writeByte:'\n'];
+    }
+    [self performMaintenance:YES];
 }
 
-- (unsigned long long) totalLogSize
+- (NOBLogHistoryRef) _tailHistory
 {
-    unsigned long long size = 0;
-    NSFileManager*     fm   = [NSFileManager defaultManager];
-
-    for (NSString* item in self.logFiles)
+    NOBLogHistoryRef history = _history;
+    if (!history)
     {
-        size += [fm fileSize:item];
+        // the first observer starts the history, whoever loses the race throws theirs away
+        history = NOBLogHistoryCreate(kNOBLoggerDefaultRecentLineCount);
+        if (!OSAtomicCompareAndSwapPtrBarrier(NULL, history, (void* volatile*)&_history))
+        {
+            NOBLogHistoryDestroy(history);
+            history = _history;
+        }
     }
-    return size;
+    return history;
 }
 
-@end
+- (void) _notifyTailObservers
+{
+    OSSpinLockLock(&_observersLock);
+    NSArray* observers = _tailObservers;
+    OSSpinLockUnlock(&_observersLock);
 
-@implementation NOBLogger (Private)
+    for (NOBLogTailObserver* observer in observers)
+    {
+        [self _scheduleTailObserver:observer];
+    }
+}
 
-- (void) write:(NSString*)message level:(NOBLogLevel)level withTimestamp:(NSDate*)timestamp
+- (void) _scheduleTailObserver:(NOBLogTailObserver*)observer
 {
-    if (!timestamp)
-        timestamp = [NSDate date];
+    // coalesce: an observer that already has a delivery pending picks the new lines up with it
+    if (OSAtomicCompareAndSwap32Barrier(0, 1, &observer->_scheduled))
+    {
+        dispatch_async(observer->_queue, ^() {
+            [self _deliverToTailObserver:observer];
+        });
+    }
+}
 
-    // Keep this in sync with log levels
-    static const char* s_logLevelNames[] =
+- (void) _deliverToTailObserver:(NOBLogTailObserver*)observer
+{
+    NOBLogHistoryRef history = _history;
+    do
     {
-        "[OFF]  : ",
-        "[HIGH] : ",
-        "[MID]  : ",
-        "[LOW]  : "
-    };
+        while (!observer->_removed)
+        {
+            @autoreleasepool {
+                NSMutableData* lines   = [NSMutableData data];
+                NSUInteger     count   = 0;
+                NSUInteger     dropped = 0;
+                observer->_cursor = NOBLogHistoryCopy(history, observer->_cursor, kNOBLoggerTailObserverBatchSize, lines, &count, &dropped);
+                if (!count && !dropped)
+                    break;
+                observer->_block(lines, count, dropped);
+            }
+        }
+        OSAtomicCompareAndSwap32Barrier(1, 0, &observer->_scheduled);
 
-    // Creating NSDateFormatters is slow, create a dedicated one for our NOBLogger(s)
-    static __strong NSDateFormatter* s_formatter = nil;
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-                      s_formatter = [[NSDateFormatter alloc] init];
-                      s_formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
-                      s_formatter.dateFormat = @"MM'/'dd'/'yy hh':'mm':'ss a z";
-                      s_formatter.timeZone = [NSTimeZone localTimeZone];
-                  });
+        // lines appended after the last copy but before _scheduled was cleared did not schedule a delivery
+    } while (!observer->_removed &&
+             NOBLogHistoryHead(history) > observer->_cursor &&
+             OSAtomicCompareAndSwap32Barrier(0, 1, &observer->_scheduled));
+}
+
+- (void) _writeBinaryRecordWithHeader:(NOBLogBinaryRecordHeader*)header payload:(const char*)payload
+{
+    NOBLogBinaryIndexNoteRecord(_binaryIndex, header->timestamp, _logFileBytes + _outputLength);
+    [self _appendOutput:header length:sizeof(NOBLogBinaryRecordHeader)];
+    [self _appendOutput:payload length:header->length];
+    _newlinesWritten++;
+}
 
-    const char* levelName = s_logLevelNames[level];
-    NSString*   timeStamp = [s_formatter stringFromDate:timestamp];
+- (void) _writePendingLine
+{
+    NOBLogBinaryRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp = CFAbsoluteTimeGetCurrent();
+    header.threadId  = pthread_mach_thread_np(pthread_self());
+    header.length    = (uint32_t)_pendingLineLength;
+    header.level     = NOBLogLevel_Off; // from the logger itself
+    [self _writeBinaryRecordWithHeader:&header payload:_pendingLine];
+    _pendingLineLength = 0;
+}
 
-    if (level &&
-        level <= _level)
+- (void) _startLogFile
+{
+    // every new log file starts with this
+    if (_binaryIndex)
     {
-        @synchronized(self)
-        {
-            [self writeByte:'['];
-            [self writeString:timeStamp];
-            [self writeByte:']'];
-            [self writeBytes:levelName length:strlen(levelName)];
-            [self writeString:message];
-            [self writeByte:'\n'];
-            [self performMaintenance:YES];
+        char   header[16];
+        size_t headerLength = NOBLogBinaryEncodeFileHeader(header, kNOBLogBinaryDefaultIndexInterval);
+        NOBLogBinaryIndexReset(_binaryIndex);
+        [self _appendOutput:header length:headerLength];
+        return;
+    }
 
-#ifdef DEBUG
-            NSLog(@"%s%@", levelName, message);
+#ifdef START_LOG_WITH_BOM
+    [self writeBOM];
 #endif
-        }
-    }
 }
 
 - (void) performMaintenance:(BOOL)didAddLine
@@ -499,8 +1915,7 @@ static dispatch_queue_t    s_logQ        = 0;
     }
 
     // Delete all old log files
-    if ((didAddLog || 0 == _newlinesWritten) &&
-        _maxFileCount < UINT32_MAX)
+    if (didAddLog || 0 == _newlinesWritten)
     {
         [self purgeOldLogsIfNeeded];
     }
@@ -508,7 +1923,7 @@ static dispatch_queue_t    s_logQ        = 0;
     // Lastly, flush if necessary
     if (doFlush)
     {
-        [self flush];
+        [self _flushFile];
     }
 }
 
@@ -519,9 +1934,22 @@ static dispatch_queue_t    s_logQ        = 0;
     [self writeBytes:s_BOM length:3];
 }
 
+// All writes are encoded into the output buffer and committed to the log file in one fwrite per drain (see _commitOutput)
+
 - (void) writeByte:(const char)byte
 {
-    fwrite(&byte, 1, 1, _logFile);
+    if (_binaryIndex)
+    {
+        if (byte == '\n')
+            [self _writePendingLine];
+        else
+            [self writeBytes:&byte length:1];
+        return;
+    }
+
+    char* output = [self _reserveOutput:1];
+    if (output)
+        *output = byte;
     if (byte == '\n')
     {
         _newlinesWritten++;
@@ -530,7 +1958,33 @@ static dispatch_queue_t    s_logQ        = 0;
 
 - (void) writeBytes:(const char*)bytes length:(size_t)length
 {
-    fwrite(bytes, 1, length, _logFile);
+    if (_binaryIndex)
+    {
+        if (_pendingLineLength + length > _pendingLineCapacity)
+        {
+            size_t capacity = MAX(_pendingLineLength + length, _pendingLineCapacity * 2);
+            char*  buffer   = (char*)realloc(_pendingLine, capacity);
+            if (!buffer)
+                return;
+            _pendingLine         = buffer;
+            _pendingLineCapacity = capacity;
+        }
+        memcpy(_pendingLine + _pendingLineLength, bytes, length);
+        _pendingLineLength += length;
+        return;
+    }
+
+    [self _appendOutput:bytes length:length];
+}
+
+- (void) _appendOutput:(const void*)bytes length:(size_t)length
+{
+    if (length)
+    {
+        char* output = [self _reserveOutput:length];
+        if (output)
+            memcpy(output, bytes, length);
+    }
 }
 
 - (void) writeData:(NSData*)data
@@ -540,65 +1994,110 @@ static dispatch_queue_t    s_logQ        = 0;
 
 - (void) writeString:(NSString*)string
 {
-    [self writeData:[string dataUsingEncoding:NSUTF8StringEncoding]];
+    const char* cString = CFStringGetCStringPtr((__bridge CFStringRef)string, kCFStringEncodingUTF8);
+    if (!cString && _binaryIndex)
+        cString = string.UTF8String; // only the logger's own messages, not worth optimizing
+    if (cString)
+    {
+        [self writeBytes:cString length:strlen(cString)];
+        return;
+    }
+
+    // Encode straight into the output buffer, no intermediate NSData
+    NSUInteger length   = string.length;
+    NSUInteger maxBytes = [string maximumLengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+    char*      output   = [self _reserveOutput:maxBytes];
+    if (output)
+    {
+        NSUInteger usedLength = 0;
+        [string getBytes:output
+               maxLength:maxBytes
+              usedLength:&usedLength
+                encoding:NSUTF8StringEncoding
+                 options:0
+                   range:NSMakeRange(0, length)
+          remainingRange:NULL];
+        _outputLength -= (maxBytes - usedLength);
+    }
 }
 
 - (BOOL) rolloverIfNeeded
 {
     BOOL didAddLog = NO;
 
-    if (_writesBeforeRollover < UINT32_MAX &&
-        _writesBeforeRollover < _newlinesWritten)
+    if (!_logFile && !_logSegment)
+    {
+        return NO; // the logs failed to open
+    }
+
+    BOOL linesReached = (_writesBeforeRollover < UINT32_MAX &&
+                         _writesBeforeRollover < _newlinesWritten);
+    BOOL bytesReached = (_bytesBeforeRollover < UINT32_MAX &&
+                         _bytesBeforeRollover <= _logFileBytes + _outputLength - _failedRolloverBytes);
+
+    if (linesReached || bytesReached)
     {
         NOBAssert(_writesBeforeRollover > 0);
+        NOBAssert(_bytesBeforeRollover > 0);
         [self writeByte:'\n'];
         [self writeString:@"Single log limit reached..."];
 
         NSString*      oldFilePath = _logFilePath;
         NSString*      oldFileDir  = oldFilePath.stringByDeletingLastPathComponent;
         UInt64         fileId      = GenerateLogFileId();
-        NSString*      newFilePath = [oldFileDir stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId)];
+        NSString*      newFilePath = [oldFileDir stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId, _logFileExtension)];
         NSFileManager* fm = [NSFileManager defaultManager];
 
         // fileId is based on the current second, here's code to handle super edge case of resusing the same file id.
         while ([fm fileExistsAtPath:newFilePath])
         {
             fileId++;
-            newFilePath = [oldFileDir stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId)];
+            newFilePath = [oldFileDir stringByAppendingPathComponent:GenerateLogFileName(_logFileNamePrefix, fileId, _logFileExtension)];
         }
 
-        FILE* newLogFile = fopen(newFilePath.UTF8String, "w");
+        FILE*            newLogFile    = NULL;
+        NOBLogSegmentRef newLogSegment = NULL;
+        BOOL             created       = [self _createLogFileAtPath:newFilePath file:&newLogFile segment:&newLogSegment];
 
         NOBAssert(![newFilePath isEqualToString:oldFilePath]);
 
         _newlinesWritten = _logWritesMade = 0;
 
-        if (!newLogFile)
+        if (!created)
         {
             [self writeByte:'\n'];
             [self writeString:@"!!!!  Log could not be rolled over  !!!!"];
             [self writeByte:'\n'];
+
+            // _logFileBytes still places binary index entries, so back off from where the file is now instead of resetting it
+            _failedRolloverBytes = _logFileBytes + _outputLength;
         }
         else
         {
             [self writeString:@"moving to "];
             [self writeString:newFilePath];
             [self writeByte:'\n'];
-            [self flush];
+            [self _closeLogFile];
 
-            _logFilePath = [newFilePath copy];
-            fclose(_logFile);
+            _logFilePath     = [newFilePath copy];
             _logFile         = newLogFile;
-            _newlinesWritten = 0;
+            _logSegment      = newLogSegment;
+            _newlinesWritten     = 0;
+            _logFileBytes        = 0;
+            _failedRolloverBytes = 0;
+            [self _addFileToManifest:_logFilePath.lastPathComponent];
 
-#ifdef START_LOG_WITH_BOM
-            [self writeBOM];
-#endif
+            [self _startLogFile];
             [self writeString:@"... continuing log from "];
             [self writeString:oldFilePath];
             [self writeByte:'\n'];
             [self writeByte:'\n'];
 
+            if (_options & NOBLoggerOption_CompressRolledLogs)
+            {
+                [self _compressLogFileNamed:oldFilePath.lastPathComponent];
+            }
+
             didAddLog = YES;
         }
 
@@ -610,48 +2109,59 @@ static dispatch_queue_t    s_logQ        = 0;
 
 - (BOOL) purgeOldLogsIfNeeded
 {
-    NSArray* logs      = self.logFiles;
-    BOOL     purgeMade = NO;
+    BOOL purgeMade = NO;
 
-    if (logs.count > _maxFileCount &&
-        _maxFileCount < UINT32_MAX)
+    // Cheap checks against the manifest, nothing touches the disk unless a limit was reached
+    BOOL countExceeded = (_maxFileCount < UINT32_MAX && _manifest.count > _maxFileCount);
+    BOOL sizeExceeded  = (_maxTotalLogSize < ULLONG_MAX && self.totalLogSize > _maxTotalLogSize);
+
+    if (countExceeded || sizeExceeded)
     {
         NOBAssert(_maxFileCount > 0);
 
         [self writeByte:'\n'];
-        [self writeString:[NSString stringWithFormat:@"Reached log file limit of %d.  Need to purge old log files...\n", _maxFileCount]];
+        if (countExceeded)
+            [self writeString:[NSString stringWithFormat:@"Reached log file limit of %lu.  Need to purge old log files...\n", (unsigned long)_maxFileCount]];
+        else
+            [self writeString:[NSString stringWithFormat:@"Reached log size limit of %llu bytes.  Need to purge old log files...\n", _maxTotalLogSize]];
 
         NSFileManager* fm   = [NSFileManager defaultManager];
         NSString*      root = self.logDirectoryPath;
-        NSUInteger     filesToDelete = logs.count - _maxFileCount;
-        for (NSUInteger i = 0; i < logs.count && 0 != filesToDelete; i++)
+        NSUInteger     i    = 0;
+        while (countExceeded || sizeExceeded)
         {
-            NSString* nextLog = [root stringByAppendingPathComponent:[logs objectAtIndex:i]];
-            if ([nextLog isEqualToString:_logFilePath])
+            if (i + 1 >= _manifest.count)
             {
+                // only the current log file is left
                 [self writeString:@"Ran out of logs to purge.\n"];
+                [self writeString:@"Could not purge enough log files to reach log limits.\n"];
                 break;
             }
 
-            NSString* msg = nil;
-            NSError*  err = nil;
-            if ([fm removeItemAtPath:nextLog error:&err])
+            NOBLogFileInfo* info    = [_manifest objectAtIndex:i];
+            NSString*       nextLog = [root stringByAppendingPathComponent:info->_name];
+            NSString*       msg     = nil;
+            NSError*        err     = nil;
+            if ([fm removeItemAtPath:nextLog error:&err] ||
+                ![fm fileExistsAtPath:nextLog])
             {
                 msg = [NSString stringWithFormat:@"Purged old log file: %@", nextLog];
-                filesToDelete--;
+                OSSpinLockLock(&_manifestLock);
+                _manifestSize -= info->_size;
+                [_manifest removeObjectAtIndex:i];
+                OSSpinLockUnlock(&_manifestLock);
                 purgeMade = YES;
             }
             else
             {
                 msg = [NSString stringWithFormat:@"Failed to purge old log file: %@\n%@", nextLog, err];
+                i++;
             }
             [self writeString:msg];
             [self writeByte:'\n'];
-        }
 
-        if (filesToDelete > 0)
-        {
-            [self writeString:@"Could not purge enough log files to reach log file limit.\n"];
+            countExceeded = (_maxFileCount < UINT32_MAX && _manifest.count > _maxFileCount);
+            sizeExceeded  = (_maxTotalLogSize < ULLONG_MAX && self.totalLogSize > _maxTotalLogSize);
         }
 
         [self writeByte:'\n'];
@@ -684,6 +2194,7 @@ static dispatch_queue_t    s_logQ        = 0;
 {
     if (self = [super init])
     {
+        [self _prepare];
 #ifndef RELEASE
         self.logLevel = NOBLogLevel_Low;
 #else
@@ -710,11 +2221,31 @@ static dispatch_queue_t    s_logQ        = 0;
     return nil;
 }
 
+- (void) streamMostRecentLogs:(NSUInteger)maxSize usingBlock:(void (^)(NSData* chunk, BOOL* stop))block
+{
+    // No-op
+}
+
 - (unsigned long long) totalLogSize
 {
     return 0;
 }
 
+- (void) enumerateRecordsFrom:(NSDate*)start
+                           to:(NSDate*)end
+                        level:(NOBLogLevel)level
+                   usingBlock:(void (^)(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop))block
+{
+    // No-op
+}
+
+- (NSData*) exportLogsFrom:(NSDate*)start
+                        to:(NSDate*)end
+                     level:(NOBLogLevel)level
+{
+    return nil;
+}
+
 - (void) performMaintenance:(BOOL)didAddLine
 {
     // No-op
@@ -730,6 +2261,11 @@ static dispatch_queue_t    s_logQ        = 0;
     // No-op
 }
 
+- (void) writeString:(NSString*)string
+{
+    // No-op
+}
+
 - (BOOL) rolloverIfNeeded
 {
     return NO;
@@ -741,3 +2277,110 @@ static dispatch_queue_t    s_logQ        = 0;
 }
 
 @end
+
+uint32_t NOBLogCallSiteIdentifier(const char* file, int line)
+{
+    // FNV-1a of the file name and line.  The directory is skipped so ids are stable across build machines.
+    const char* name = (file ? strrchr(file, '/') : NULL);
+    name = (name ? name + 1 : (file ? file : ""));
+
+    uint32_t hash = 2166136261U;
+    for (; *name; name++)
+    {
+        hash = (hash ^ (uint8_t)*name) * 16777619U;
+    }
+    for (size_t i = 0; i < sizeof(line); i++)
+    {
+        hash = (hash ^ (uint8_t)(line >> (i * 8))) * 16777619U;
+    }
+    return (hash ? hash : 1);
+}
+
+#pragma mark - Log Categories
+
+volatile uint8_t g_NOBLogCategoryLevels[kNOBLogCategoryMaxCount];
+
+static const char* s_logCategoryNames[kNOBLogCategoryMaxCount];
+static OSSpinLock  s_logCategoryLock = OS_SPINLOCK_INIT; // only for registration, levels are never locked
+
+NS_INLINE NOBLogCategory FindLogCategory(const char* name);
+NS_INLINE NOBLogCategory FindLogCategory(const char* name)
+{
+    for (NOBLogCategory category = 1; category < kNOBLogCategoryMaxCount; category++)
+    {
+        if (!s_logCategoryNames[category])
+            break;
+        if (0 == strcmp(s_logCategoryNames[category], name))
+            return category;
+    }
+    return kNOBLogCategory_None;
+}
+
+NOBLogCategory NOBLogCategoryRegister(const char* name, NOBLogLevel level)
+{
+    if (!name)
+        return kNOBLogCategory_None;
+
+    OSSpinLockLock(&s_logCategoryLock);
+    NOBLogCategory category = FindLogCategory(name);
+    if (kNOBLogCategory_None == category)
+    {
+        category = 1;
+        while (category < kNOBLogCategoryMaxCount && s_logCategoryNames[category])
+            category++;
+
+        if (category < kNOBLogCategoryMaxCount)
+        {
+            NOBLogCategorySetLevel(category, level);
+            s_logCategoryNames[category] = strdup(name); // never freed, categories live as long as the process
+        }
+        else
+        {
+            category = kNOBLogCategory_None;
+        }
+    }
+    OSSpinLockUnlock(&s_logCategoryLock);
+
+    NOBCAssert(kNOBLogCategory_None != category && "Too many log categories");
+    return category;
+}
+
+NOBLogCategory NOBLogCategoryNamed(const char* name)
+{
+    if (!name)
+        return kNOBLogCategory_None;
+
+    OSSpinLockLock(&s_logCategoryLock);
+    NOBLogCategory category = FindLogCategory(name);
+    OSSpinLockUnlock(&s_logCategoryLock);
+    return category;
+}
+
+const char* NOBLogCategoryName(NOBLogCategory category)
+{
+    if (category >= kNOBLogCategoryMaxCount)
+        return NULL;
+
+    OSSpinLockLock(&s_logCategoryLock);
+    const char* name = s_logCategoryNames[category];
+    OSSpinLockUnlock(&s_logCategoryLock);
+    return name;
+}
+
+void NOBLogCategorySetLevel(NOBLogCategory category, NOBLogLevel level)
+{
+    if (kNOBLogCategory_None == category || category >= kNOBLogCategoryMaxCount)
+        return;
+
+    __atomic_store_n(&g_NOBLogCategoryLevels[category], (uint8_t)level, __ATOMIC_RELAXED);
+}
+
+BOOL NOBLogCategorySetLevelForName(const char* name, NOBLogLevel level)
+{
+    NOBLogCategory category = NOBLogCategoryNamed(name);
+    if (kNOBLogCategory_None == category)
+        return NO;
+
+    NOBLogCategorySetLevel(category, level);
+    return YES;
+}
@@ -0,0 +1,44 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import <Foundation/Foundation.h>
+
+/**
+    @class NOBPersistentDictionary
+    @par An immutable dictionary that shares structure with the dictionaries derived from it.
+    @par Entries live in a hash array mapped trie (32 way branching on the key hash), so \c dictionaryBySettingObject:forKey: and \c dictionaryByRemovingObjectForKey: copy only the O(log32 n) nodes on the path to the key and share everything else.  \c copy is free.
+    @par Immutable, so any number of threads can read and enumerate it without synchronization.
+ */
+@interface NOBPersistentDictionary : NSDictionary
+
+/**
+    @return a dictionary with the entries of the receiver plus \a object for \a key.  The receiver is not changed.  Raises an \c NSInvalidArgumentException if \a object or \a key is \c nil.
+ */
+- (instancetype) dictionaryBySettingObject:(id)object forKey:(id<NSCopying>)key;
+/**
+    @return a dictionary with the entries of the receiver without \a key.  Returns the receiver if it has no entry for \a key.
+ */
+- (instancetype) dictionaryByRemovingObjectForKey:(id)key;
+/**
+    @return a dictionary with the entries of the receiver overridden by those of \a otherDictionary
+ */
+- (instancetype) dictionaryByAddingEntriesFromDictionary:(NSDictionary*)otherDictionary;
+
+@end
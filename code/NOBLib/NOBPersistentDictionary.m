@@ -0,0 +1,583 @@
+/*
+ 
+ Copyright (C) 2013 Nolan O'Brien
+ 
+ Permission is hereby granted, free of charge, to any person obtaining a copy of this software and
+ associated documentation files (the "Software"), to deal in the Software without restriction,
+ including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so,
+ subject to the following conditions:
+ 
+ The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+ 
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT
+ LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+ IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ 
+ */
+
+#import "NOBPersistentDictionary.h"
+#include <libkern/OSAtomic.h>
+
+#pragma mark - Trie
+
+#define kNOBHAMTBitsPerLevel (5)
+#define kNOBHAMTLevelMask    (31)
+#define kNOBHAMTMaxShift     (30) // deeper than this the whole hash is used up, equal hashes go in a collision node
+#define kNOBHAMTMaxDepth     (8)
+
+typedef struct _NOBHAMTNode NOBHAMTNode;
+
+// A slot is either an entry (retained key and value) or a child node
+typedef struct _NOBHAMTSlot
+{
+    const void*  key;
+    const void*  value;
+    NOBHAMTNode* child;
+    uint32_t     hash;
+} NOBHAMTSlot;
+
+// Nodes are immutable once shared and reference counted, a derived trie retains the nodes it shares
+struct _NOBHAMTNode
+{
+    volatile int32_t refCount;
+    uint32_t         bitmap;    // which of the 32 children of this level are present, 0 for collision nodes
+    uint32_t         count;     // number of slots
+    BOOL             collision; // every slot is an entry with the same hash
+    NOBHAMTSlot      slots[1];
+};
+
+NS_INLINE uint32_t NOBHAMTHash(const void* key)
+{
+    return (uint32_t)CFHash(key);
+}
+
+NS_INLINE BOOL NOBHAMTSlotMatches(const NOBHAMTSlot* slot, const void* key, uint32_t hash)
+{
+    return !slot->child && slot->hash == hash && (slot->key == key || CFEqual(slot->key, key));
+}
+
+NS_INLINE uint32_t NOBHAMTBit(uint32_t hash, uint32_t shift)
+{
+    return 1U << ((hash >> shift) & kNOBHAMTLevelMask);
+}
+
+NS_INLINE uint32_t NOBHAMTIndex(uint32_t bitmap, uint32_t bit)
+{
+    return (uint32_t)__builtin_popcount(bitmap & (bit - 1));
+}
+
+static NOBHAMTNode* NOBHAMTNodeAlloc(uint32_t count)
+{
+    NOBHAMTNode* node = (NOBHAMTNode*)calloc(1, offsetof(NOBHAMTNode, slots) + MAX(count, 1U) * sizeof(NOBHAMTSlot));
+    if (!node)
+        @throw [NSException exceptionWithName:NSMallocException reason:@"NOBPersistentDictionary out of memory" userInfo:nil];
+    node->refCount = 1;
+    node->count    = count;
+    return node;
+}
+
+NS_INLINE NOBHAMTNode* NOBHAMTNodeRetain(NOBHAMTNode* node)
+{
+    if (node)
+        OSAtomicIncrement32Barrier(&node->refCount);
+    return node;
+}
+
+static void NOBHAMTNodeRelease(NOBHAMTNode* node);
+
+NS_INLINE void NOBHAMTSlotRetain(const NOBHAMTSlot* slot)
+{
+    if (slot->child)
+    {
+        NOBHAMTNodeRetain(slot->child);
+    }
+    else
+    {
+        CFRetain(slot->key);
+        CFRetain(slot->value);
+    }
+}
+
+NS_INLINE void NOBHAMTSlotRelease(const NOBHAMTSlot* slot)
+{
+    if (slot->child)
+    {
+        NOBHAMTNodeRelease(slot->child);
+    }
+    else
+    {
+        CFRelease(slot->key);
+        CFRelease(slot->value);
+    }
+}
+
+static void NOBHAMTNodeRelease(NOBHAMTNode* node)
+{
+    if (node && 0 == OSAtomicDecrement32Barrier(&node->refCount))
+    {
+        for (uint32_t i = 0; i < node->count; i++)
+        {
+            NOBHAMTSlotRelease(&node->slots[i]);
+        }
+        free(node);
+    }
+}
+
+NS_INLINE NOBHAMTSlot NOBHAMTChildSlot(NOBHAMTNode* child)
+{
+    NOBHAMTSlot slot = { NULL, NULL, child, 0 };
+    return slot;
+}
+
+// Copy of node with slots[index] replaced by an owned slot
+static NOBHAMTNode* NOBHAMTNodeCopyReplacing(const NOBHAMTNode* node, uint32_t index, NOBHAMTSlot slot)
+{
+    NOBHAMTNode* copy = NOBHAMTNodeAlloc(node->count);
+    copy->bitmap    = node->bitmap;
+    copy->collision = node->collision;
+    memcpy(copy->slots, node->slots, node->count * sizeof(NOBHAMTSlot));
+    for (uint32_t i = 0; i < node->count; i++)
+    {
+        if (i != index)
+            NOBHAMTSlotRetain(&copy->slots[i]);
+    }
+    copy->slots[index] = slot;
+    return copy;
+}
+
+// Copy of node with an owned slot inserted at index
+static NOBHAMTNode* NOBHAMTNodeCopyInserting(const NOBHAMTNode* node, uint32_t index, uint32_t bit, NOBHAMTSlot slot)
+{
+    NOBHAMTNode* copy = NOBHAMTNodeAlloc(node->count + 1);
+    copy->bitmap    = node->bitmap | bit;
+    copy->collision = node->collision;
+    memcpy(copy->slots, node->slots, index * sizeof(NOBHAMTSlot));
+    memcpy(copy->slots + index + 1, node->slots + index, (node->count - index) * sizeof(NOBHAMTSlot));
+    for (uint32_t i = 0; i < copy->count; i++)
+    {
+        if (i != index)
+            NOBHAMTSlotRetain(&copy->slots[i]);
+    }
+    copy->slots[index] = slot;
+    return copy;
+}
+
+// Copy of node without slots[index], NULL if that leaves it empty
+static NOBHAMTNode* NOBHAMTNodeCopyRemoving(const NOBHAMTNode* node, uint32_t index, uint32_t bit)
+{
+    if (1 == node->count)
+        return NULL;
+
+    NOBHAMTNode* copy = NOBHAMTNodeAlloc(node->count - 1);
+    copy->bitmap    = node->bitmap & ~bit;
+    copy->collision = node->collision;
+    memcpy(copy->slots, node->slots, index * sizeof(NOBHAMTSlot));
+    memcpy(copy->slots + index, node->slots + index + 1, (node->count - index - 1) * sizeof(NOBHAMTSlot));
+    for (uint32_t i = 0; i < copy->count; i++)
+    {
+        NOBHAMTSlotRetain(&copy->slots[i]);
+    }
+    return copy;
+}
+
+// A node holding two owned entries whose hashes agree below shift
+static NOBHAMTNode* NOBHAMTNodeMerge(NOBHAMTSlot a, NOBHAMTSlot b, uint32_t shift)
+{
+    NOBHAMTNode* node;
+    if (shift > kNOBHAMTMaxShift)
+    {
+        node = NOBHAMTNodeAlloc(2);
+        node->collision = YES;
+        node->slots[0]  = a;
+        node->slots[1]  = b;
+        return node;
+    }
+
+    uint32_t bitA = NOBHAMTBit(a.hash, shift);
+    uint32_t bitB = NOBHAMTBit(b.hash, shift);
+    if (bitA == bitB)
+    {
+        node = NOBHAMTNodeAlloc(1);
+        node->bitmap   = bitA;
+        node->slots[0] = NOBHAMTChildSlot(NOBHAMTNodeMerge(a, b, shift + kNOBHAMTBitsPerLevel));
+        return node;
+    }
+
+    node = NOBHAMTNodeAlloc(2);
+    node->bitmap   = bitA | bitB;
+    node->slots[0] = (bitA < bitB ? a : b);
+    node->slots[1] = (bitA < bitB ? b : a);
+    return node;
+}
+
+static const void* NOBHAMTFind(const NOBHAMTNode* node, const void* key, uint32_t hash)
+{
+    uint32_t shift = 0;
+    while (node)
+    {
+        if (node->collision)
+        {
+            for (uint32_t i = 0; i < node->count; i++)
+            {
+                if (NOBHAMTSlotMatches(&node->slots[i], key, hash))
+                    return node->slots[i].value;
+            }
+            return NULL;
+        }
+
+        uint32_t bit = NOBHAMTBit(hash, shift);
+        if (!(node->bitmap & bit))
+            return NULL;
+
+        const NOBHAMTSlot* slot = &node->slots[NOBHAMTIndex(node->bitmap, bit)];
+        if (!slot->child)
+            return (NOBHAMTSlotMatches(slot, key, hash) ? slot->value : NULL);
+
+        node   = slot->child;
+        shift += kNOBHAMTBitsPerLevel;
+    }
+    return NULL;
+}
+
+// Returns the new trie (owned).  Borrows key and value.
+static NOBHAMTNode* NOBHAMTInsert(const NOBHAMTNode* node, const void* key, const void* value, uint32_t hash, uint32_t shift, BOOL* pAdded)
+{
+    NOBHAMTSlot entry = { key, value, NULL, hash };
+
+    if (!node)
+    {
+        NOBHAMTNode* root = NOBHAMTNodeAlloc(1);
+        root->bitmap   = NOBHAMTBit(hash, shift);
+        root->slots[0] = entry;
+        NOBHAMTSlotRetain(&entry);
+        *pAdded = YES;
+        return root;
+    }
+
+    if (node->collision)
+    {
+        NOBHAMTSlotRetain(&entry);
+        for (uint32_t i = 0; i < node->count; i++)
+        {
+            if (NOBHAMTSlotMatches(&node->slots[i], key, hash))
+            {
+                *pAdded = NO;
+                return NOBHAMTNodeCopyReplacing(node, i, entry);
+            }
+        }
+        *pAdded = YES;
+        return NOBHAMTNodeCopyInserting(node, node->count, 0, entry);
+    }
+
+    uint32_t bit   = NOBHAMTBit(hash, shift);
+    uint32_t index = NOBHAMTIndex(node->bitmap, bit);
+    if (!(node->bitmap & bit))
+    {
+        NOBHAMTSlotRetain(&entry);
+        *pAdded = YES;
+        return NOBHAMTNodeCopyInserting(node, index, bit, entry);
+    }
+
+    const NOBHAMTSlot* slot = &node->slots[index];
+    if (slot->child)
+    {
+        NOBHAMTNode* child = NOBHAMTInsert(slot->child, key, value, hash, shift + kNOBHAMTBitsPerLevel, pAdded);
+        return NOBHAMTNodeCopyReplacing(node, index, NOBHAMTChildSlot(child));
+    }
+
+    NOBHAMTSlotRetain(&entry);
+    if (NOBHAMTSlotMatches(slot, key, hash))
+    {
+        *pAdded = NO;
+        return NOBHAMTNodeCopyReplacing(node, index, entry);
+    }
+
+    // two entries share this position, push both down a level
+    NOBHAMTSlot existing = *slot;
+    NOBHAMTSlotRetain(&existing);
+    *pAdded = YES;
+    return NOBHAMTNodeCopyReplacing(node, index, NOBHAMTChildSlot(NOBHAMTNodeMerge(existing, entry, shift + kNOBHAMTBitsPerLevel)));
+}
+
+// Returns the new trie (owned, NULL if empty).  If key is not found, returns node retained and *pRemoved is NO.
+static NOBHAMTNode* NOBHAMTRemove(NOBHAMTNode* node, const void* key, uint32_t hash, uint32_t shift, BOOL* pRemoved)
+{
+    *pRemoved = NO;
+    if (!node)
+        return NULL;
+
+    if (node->collision)
+    {
+        for (uint32_t i = 0; i < node->count; i++)
+        {
+            if (NOBHAMTSlotMatches(&node->slots[i], key, hash))
+            {
+                *pRemoved = YES;
+                return NOBHAMTNodeCopyRemoving(node, i, 0);
+            }
+        }
+        return NOBHAMTNodeRetain(node);
+    }
+
+    uint32_t bit = NOBHAMTBit(hash, shift);
+    if (!(node->bitmap & bit))
+        return NOBHAMTNodeRetain(node);
+
+    uint32_t           index = NOBHAMTIndex(node->bitmap, bit);
+    const NOBHAMTSlot* slot  = &node->slots[index];
+    if (!slot->child)
+    {
+        if (!NOBHAMTSlotMatches(slot, key, hash))
+            return NOBHAMTNodeRetain(node);
+        *pRemoved = YES;
+        return NOBHAMTNodeCopyRemoving(node, index, bit);
+    }
+
+    NOBHAMTNode* child = NOBHAMTRemove(slot->child, key, hash, shift + kNOBHAMTBitsPerLevel, pRemoved);
+    if (!*pRemoved)
+    {
+        NOBHAMTNodeRelease(child);
+        return NOBHAMTNodeRetain(node);
+    }
+    if (!child)
+        return NOBHAMTNodeCopyRemoving(node, index, bit);
+    if (1 == child->count && !child->slots[0].child)
+    {
+        // a lone entry moves back up so that lookups stay short
+        NOBHAMTSlot entry = child->slots[0];
+        NOBHAMTSlotRetain(&entry);
+        NOBHAMTNodeRelease(child);
+        return NOBHAMTNodeCopyReplacing(node, index, entry);
+    }
+    return NOBHAMTNodeCopyReplacing(node, index, NOBHAMTChildSlot(child));
+}
+
+static BOOL NOBHAMTEnumerate(const NOBHAMTNode* node, void (^block)(const void* key, const void* value, BOOL* stop))
+{
+    BOOL stop = NO;
+    for (uint32_t i = 0; node && i < node->count && !stop; i++)
+    {
+        const NOBHAMTSlot* slot = &node->slots[i];
+        if (slot->child)
+            stop = NOBHAMTEnumerate(slot->child, block);
+        else
+            block(slot->key, slot->value, &stop);
+    }
+    return stop;
+}
+
+#pragma mark - NOBPersistentDictionaryEnumerator
+
+@interface NOBPersistentDictionary ()
+- (instancetype) _initWithRoot:(NOBHAMTNode*)root count:(NSUInteger)count; // takes ownership of root
+- (NOBHAMTNode*) _root;
+@end
+
+// Walks the trie depth first with an explicit stack
+@interface NOBPersistentDictionaryEnumerator : NSEnumerator
+{
+    @public
+    __strong NOBPersistentDictionary* _dictionary; // keeps the trie alive
+    BOOL                              _values;
+    const NOBHAMTNode*                _nodes[kNOBHAMTMaxDepth + 1];
+    uint32_t                          _indexes[kNOBHAMTMaxDepth + 1];
+    int                               _depth;
+}
+@end
+
+@implementation NOBPersistentDictionaryEnumerator
+
+- (id) nextObject
+{
+    while (_depth >= 0)
+    {
+        const NOBHAMTNode* node = _nodes[_depth];
+        if (!node || _indexes[_depth] >= node->count)
+        {
+            _depth--;
+            continue;
+        }
+
+        const NOBHAMTSlot* slot = &node->slots[_indexes[_depth]++];
+        if (slot->child)
+        {
+            _depth++;
+            _nodes[_depth]   = slot->child;
+            _indexes[_depth] = 0;
+            continue;
+        }
+        return (__bridge id)(_values ? slot->value : slot->key);
+    }
+    _dictionary = nil;
+    return nil;
+}
+
+@end
+
+#pragma mark - NOBPersistentDictionary
+
+@implementation NOBPersistentDictionary
+{
+    NOBHAMTNode* _root;
+    NSUInteger   _count;
+}
+
+- (instancetype) _initWithRoot:(NOBHAMTNode*)root count:(NSUInteger)count
+{
+    if (self = [super init])
+    {
+        _root  = root;
+        _count = count;
+    }
+    else
+    {
+        NOBHAMTNodeRelease(root);
+    }
+    return self;
+}
+
+- (NOBHAMTNode*) _root
+{
+    return _root;
+}
+
+- (id) init
+{
+    return [self _initWithRoot:NULL count:0];
+}
+
+- (id) initWithObjects:(const id [])objects forKeys:(const id<NSCopying> [])keys count:(NSUInteger)cnt
+{
+    NOBHAMTNode* root  = NULL;
+    NSUInteger   count = 0;
+    for (NSUInteger i = 0; i < cnt; i++)
+    {
+        if (!objects[i] || !keys[i])
+        {
+            NOBHAMTNodeRelease(root);
+            @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                           reason:[NSString stringWithFormat:@"%@: nil %@ at index %lu", NSStringFromSelector(_cmd), (keys[i] ? @"object" : @"key"), (unsigned long)i]
+                                         userInfo:nil];
+        }
+
+        id           key   = [keys[i] copyWithZone:NULL];
+        BOOL         added = NO;
+        NOBHAMTNode* next  = NOBHAMTInsert(root, (__bridge const void*)key, (__bridge const void*)objects[i], NOBHAMTHash((__bridge const void*)key), 0, &added);
+        NOBHAMTNodeRelease(root);
+        root = next;
+        if (added)
+            count++;
+    }
+    return [self _initWithRoot:root count:count];
+}
+
+- (void) dealloc
+{
+    NOBHAMTNodeRelease(_root);
+}
+
+- (NSUInteger) count
+{
+    return _count;
+}
+
+- (id) objectForKey:(id)aKey
+{
+    if (!aKey || !_root)
+        return nil;
+    return (__bridge id)NOBHAMTFind(_root, (__bridge const void*)aKey, NOBHAMTHash((__bridge const void*)aKey));
+}
+
+- (NSEnumerator*) _enumerator:(BOOL)values
+{
+    NOBPersistentDictionaryEnumerator* enumerator = [[NOBPersistentDictionaryEnumerator alloc] init];
+    enumerator->_dictionary = self;
+    enumerator->_values     = values;
+    enumerator->_nodes[0]   = _root;
+    return enumerator;
+}
+
+- (NSEnumerator*) keyEnumerator
+{
+    return [self _enumerator:NO];
+}
+
+- (NSEnumerator*) objectEnumerator
+{
+    return [self _enumerator:YES];
+}
+
+#if NS_BLOCKS_AVAILABLE
+- (void) enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    NOBHAMTEnumerate(_root, ^(const void* key, const void* value, BOOL* stop) {
+        block((__bridge id)key, (__bridge id)value, stop);
+    });
+}
+
+- (void) enumerateKeysAndObjectsWithOptions:(NSEnumerationOptions)opts usingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    if (opts & NSEnumerationConcurrent)
+    {
+        [super enumerateKeysAndObjectsWithOptions:opts usingBlock:block];
+        return;
+    }
+    [self enumerateKeysAndObjectsUsingBlock:block];
+}
+#endif
+
+- (id) copyWithZone:(NSZone*)zone
+{
+    return self;
+}
+
+- (instancetype) dictionaryBySettingObject:(id)object forKey:(id<NSCopying>)key
+{
+    if (!object || !key)
+    {
+        @throw [NSException exceptionWithName:NSInvalidArgumentException
+                                       reason:[NSString stringWithFormat:@"%@: %@ cannot be nil", NSStringFromSelector(_cmd), (key ? @"object" : @"key")]
+                                     userInfo:nil];
+    }
+
+    id           keyCopy = [key copyWithZone:NULL];
+    BOOL         added   = NO;
+    NOBHAMTNode* root    = NOBHAMTInsert(_root, (__bridge const void*)keyCopy, (__bridge const void*)object, NOBHAMTHash((__bridge const void*)keyCopy), 0, &added);
+    return [[[self class] alloc] _initWithRoot:root count:_count + (added ? 1 : 0)];
+}
+
+- (instancetype) dictionaryByRemovingObjectForKey:(id)key
+{
+    if (!key || !_root)
+        return self;
+
+    BOOL         removed = NO;
+    NOBHAMTNode* root    = NOBHAMTRemove(_root, (__bridge const void*)key, NOBHAMTHash((__bridge const void*)key), 0, &removed);
+    if (!removed)
+    {
+        NOBHAMTNodeRelease(root);
+        return self;
+    }
+    return [[[self class] alloc] _initWithRoot:root count:_count - 1];
+}
+
+- (instancetype) dictionaryByAddingEntriesFromDictionary:(NSDictionary*)otherDictionary
+{
+    __block NOBHAMTNode* root  = NOBHAMTNodeRetain(_root);
+    __block NSUInteger   count = _count;
+    [otherDictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL* stop) {
+        id           keyCopy = [key copyWithZone:NULL];
+        BOOL         added   = NO;
+        NOBHAMTNode* next    = NOBHAMTInsert(root, (__bridge const void*)keyCopy, (__bridge const void*)obj, NOBHAMTHash((__bridge const void*)keyCopy), 0, &added);
+        NOBHAMTNodeRelease(root);
+        root = next;
+        if (added)
+            count++;
+    }];
+    return [[[self class] alloc] _initWithRoot:root count:count];
+}
+
+@end
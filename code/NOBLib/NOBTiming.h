@@ -21,15 +21,46 @@
 #import <Foundation/Foundation.h>
 
 #define NSTimeIntervalUnknown NSTimeIntervalSince1970
+#define kNOBTimingUnknown     UINT64_MAX
 
-BOOL StartTiming(NSString* timingId); // returns false if already started
+/**
+    @return monotonic time in nanoseconds.  Unlike \c NSDate it never jumps with clock changes (it does stop while the device sleeps).
+ */
+uint64_t NOBTimingNanoseconds(void);
+
+/*
+    Timings are kept in a table owned by the thread that starts them, so starting and stopping a timing on the same thread takes no global lock and does not allocate.
+    A timing can still be checked or stopped from another thread, which searches every thread's table.
+ */
+
+BOOL StartTiming(NSString* timingId); // returns false if already started on this thread
 NSTimeInterval CheckTimeElapsed(NSString* timingId);
 NSTimeInterval StopTiming(NSString* timingId);
 NSTimeInterval ExecuteTimedBlock(GenericBlock block);
 
+uint64_t CheckTimeElapsedNanoseconds(NSString* timingId); // returns kNOBTimingUnknown if not started
+uint64_t StopTimingNanoseconds(NSString* timingId);       // returns kNOBTimingUnknown if not started
+
+/*
+    Aggregation: while aggregating, every timing that is stopped (and every named timed block) is recorded into a log-linear latency histogram for its timingId.
+    Recording only touches histograms owned by the recording thread.  NOBTimingSnapshot merges every thread's histograms.
+ */
+
+void NOBTimingSetAggregating(BOOL aggregating); // off by default
+BOOL NOBTimingIsAggregating(void);
+void NOBTimingRecord(NSString* timingId, uint64_t nanoseconds); // records even when not aggregating
+NSTimeInterval ExecuteNamedTimedBlock(NSString* timingId, GenericBlock block);
+
+/**
+    Merge every thread's histograms
+    @param reset \c YES to empty the histograms of everything that was reported.  Records that race with the snapshot are kept for the next one.
+    @return a dictionary of timingId to \c NOBTimingStatistics
+ */
+NSDictionary* NOBTimingSnapshot(BOOL reset);
+
 #define LogStart(logLevel, timingId)      do { BOOL start__ = StartTiming(timingId); LOG(logLevel, @"%@ %@", (start__ ? @"STARTED" : @"DUPE START"), timingId); } while (0)
 #define LogFinish(logLevel, timingId)     do { NSTimeInterval ti__ = StopTiming(timingId); LOG(logLevel, @"FINISHED %@: %.4f seconds", timingId, ti__); } while (0)
-#define LogBlock(logLevel, name, block)   do { NSTimeInterval ti__ = ExecuteTimedBlock(block); LOG(logLevel, @"FINISHED %@: %.4f seconds", name, ti__); } while (0)
+#define LogBlock(logLevel, name, block)   do { NSTimeInterval ti__ = ExecuteNamedTimedBlock(name, block); LOG(logLevel, @"FINISHED %@: %.4f seconds", name, ti__); } while (0)
 
 #ifndef RELEASE
 #define LogStartDebug(timingId)           LogStart(NOBLogLevel_Low, timingId)
@@ -48,4 +79,20 @@ NSTimeInterval ExecuteTimedBlock(GenericBlock block);
 @property (nonatomic, readonly) NSString* timingId;
 - (instancetype) initWithTimingId:(NSString*)timingId;
 - (NSTimeInterval) timeElapsed;
-@end
\ No newline at end of file
+@end
+
+/**
+    @class NOBTimingStatistics
+    The latency distribution of one timingId, all values in nanoseconds.  Percentiles are accurate to about 1.6%.
+ */
+@interface NOBTimingStatistics : NSObject
+@property (nonatomic, readonly) NSString* timingId;
+@property (nonatomic, readonly) uint64_t count;
+@property (nonatomic, readonly) uint64_t minimum;
+@property (nonatomic, readonly) uint64_t maximum;
+@property (nonatomic, readonly) double mean;
+@property (nonatomic, readonly) uint64_t p50;
+@property (nonatomic, readonly) uint64_t p90;
+@property (nonatomic, readonly) uint64_t p99;
+@property (nonatomic, readonly) uint64_t p999;
+@end
@@ -19,77 +19,545 @@
  */
 
 #import "NOBTiming.h"
+#import "NOBIntegerMap.h"
+#include <libkern/OSAtomic.h>
+#include <mach/mach_time.h>
+#include <pthread.h>
 
-static NSMutableDictionary* s_times = nil;
-static dispatch_queue_t s_timesQueue = 0;
-static const char s_timesName[] = "NOBTimingQueue";
+#define kNOBTimingTableInitialCapacity (8)
+#define kNOBTimingSnapshotTableCapacity (64) // tables a snapshot collects without allocating
 
-BOOL StartTiming(NSString* timingId)
+// Log-linear buckets: values below 2^kNOBTimingHistogramSubBucketBits get a bucket each, every power of 2 above is split into that many buckets (about 1.6% relative error).
+#define kNOBTimingHistogramSubBucketBits (6)
+#define kNOBTimingHistogramSubBucketMask ((1ULL << kNOBTimingHistogramSubBucketBits) - 1)
+#define kNOBTimingHistogramMaxExponent   (40) // ~18 minutes, longer timings land in the last bucket
+#define kNOBTimingHistogramBucketCount   ((kNOBTimingHistogramMaxExponent - kNOBTimingHistogramSubBucketBits + 1) << kNOBTimingHistogramSubBucketBits)
+
+// One thread's histogram of one timingId.  Only the owning thread records into it, readers merge and reset it with atomics.
+typedef struct _NOBTimingHistogram
+{
+    uintptr_t                   timingId; // retained by the map the histogram is in
+    volatile int64_t            sum;
+    volatile int64_t            minimum;
+    volatile int64_t            maximum;
+    struct _NOBTimingHistogram* next;
+    volatile int64_t            buckets[kNOBTimingHistogramBucketCount];
+} NOBTimingHistogram;
+
+// The timings started on one thread.  Only the owning thread adds to it, so its lock is uncontended unless another thread checks or stops one of its timings.
+typedef struct _NOBTimingTable
+{
+    OSSpinLock              lock;
+    NOBIntegerMapRef        indexes;  // timingId -> index into ids and starts, retains the ids
+    uintptr_t*              ids;
+    uint64_t*               starts;   // nanoseconds
+    NSUInteger              count;
+    NSUInteger              capacity;
+    BOOL                    orphaned; // the owning thread exited with timings still running
+    NOBIntegerMapRef        histogramsById; // timingId -> NOBTimingHistogram*, only used by the owning thread
+    NOBTimingHistogram*     histograms;     // the same histograms for readers, prepended to with a barrier
+    struct _NOBTimingTable* next;
+} NOBTimingTable;
+
+// Lock order: s_histogramsLock, then s_tablesLock, then a table's lock
+static pthread_key_t    s_tableKey;
+static OSSpinLock       s_tablesLock        = OS_SPINLOCK_INIT;
+static NOBTimingTable*  s_tables            = NULL; // every table, guarded by s_tablesLock
+static pthread_mutex_t  s_histogramsLock    = PTHREAD_MUTEX_INITIALIZER; // held while histograms are merged (long) or freed, keeps s_tablesLock short
+static NOBIntegerMapRef s_retiredHistograms = NULL; // timingId -> NOBTimingHistogram* of exited threads, guarded by s_histogramsLock
+static volatile BOOL    s_aggregating       = NO;
+
+@interface NOBTimingStatistics (Private)
+- (id) initWithTimingId:(NSString*)timingId histogram:(const NOBTimingHistogram*)histogram;
+@end
+
+static void NOBTimingTableThreadExit(void* context);
+static void NOBTimingHistogramMerge(NOBTimingHistogram* into, NOBTimingHistogram* from, BOOL reset);
+
+__attribute__((constructor)) static void NOBTimingCreateTableKey(void)
+{
+    pthread_key_create(&s_tableKey, NOBTimingTableThreadExit);
+}
+
+NS_INLINE NSTimeInterval NOBTimingSeconds(uint64_t nanoseconds);
+NS_INLINE NSTimeInterval NOBTimingSeconds(uint64_t nanoseconds)
 {
-    static dispatch_once_t onceToken;
-    dispatch_once(&onceToken, ^{
-        s_times = [[NSMutableDictionary alloc] init];
-        s_timesQueue = dispatch_queue_create(s_timesName, DISPATCH_QUEUE_CONCURRENT);
-    });
+    return (kNOBTimingUnknown == nanoseconds ? NSTimeIntervalUnknown : (NSTimeInterval)nanoseconds / NSEC_PER_SEC);
+}
 
+NS_INLINE void NOBTimingValidateId(NSString* timingId);
+NS_INLINE void NOBTimingValidateId(NSString* timingId)
+{
     if (!timingId)
     {
         @throw [NSException exceptionWithName:NSInvalidArgumentException
                                        reason:@"timingId cannot be nil"
                                      userInfo:nil];
     }
+}
+
+#pragma mark - Tables
 
-    NSDate* date = [NSDate date];
-    __block NSDate* otherDate;
-    dispatch_barrier_sync(s_timesQueue, ^() {
-        otherDate = [s_times objectForKey:timingId];
-        if (!otherDate)
-            [s_times setObject:date forKey:timingId];
-    });
-    return !otherDate;
+static NOBTimingTable* NOBTimingTableCreate(void)
+{
+    NOBTimingTable* table = (NOBTimingTable*)calloc(1, sizeof(NOBTimingTable));
+    table->lock     = OS_SPINLOCK_INIT;
+    table->indexes  = NOBIntegerMapCreate(kNOBTimingTableInitialCapacity, &kNOBIntegerMapObjectKeyCallBacks);
+    table->capacity = kNOBTimingTableInitialCapacity;
+    table->ids      = (uintptr_t*)malloc(sizeof(uintptr_t) * table->capacity);
+    table->starts   = (uint64_t*)malloc(sizeof(uint64_t) * table->capacity);
+    return table;
 }
 
-NSTimeInterval CheckTimeElapsed(NSString* timingId)
+static void NOBTimingTableDestroy(NOBTimingTable* table)
 {
-    if (!timingId)
+    for (NOBTimingHistogram* histogram = table->histograms; histogram; )
     {
-        @throw [NSException exceptionWithName:NSInvalidArgumentException
-                                       reason:@"timingId cannot be nil"
-                                     userInfo:nil];
+        NOBTimingHistogram* next = histogram->next;
+        free(histogram);
+        histogram = next;
     }
-    
-    __block NSDate* date;
-    dispatch_sync(s_timesQueue, ^() {
-        date = [s_times objectForKey:timingId];
-    });
-    return (date ? [[NSDate date] timeIntervalSinceDate:date] : NSTimeIntervalUnknown);
+    NOBIntegerMapDestroy(table->histogramsById);
+    NOBIntegerMapDestroy(table->indexes);
+    free(table->ids);
+    free(table->starts);
+    free(table);
 }
 
-NSTimeInterval StopTiming(NSString* timingId)
+// must hold s_tablesLock
+static void NOBTimingTableUnlink(NOBTimingTable* table)
 {
-    if (!timingId)
+    for (NOBTimingTable** pTable = &s_tables; *pTable; pTable = &(*pTable)->next)
     {
-        @throw [NSException exceptionWithName:NSInvalidArgumentException
-                                       reason:@"timingId cannot be nil"
-                                     userInfo:nil];
+        if (*pTable == table)
+        {
+            *pTable = table->next;
+            break;
+        }
+    }
+}
+
+// The calling thread's table, created on first use
+NS_INLINE NOBTimingTable* NOBTimingCurrentTable(BOOL create);
+NS_INLINE NOBTimingTable* NOBTimingCurrentTable(BOOL create)
+{
+    NOBTimingTable* table = (NOBTimingTable*)pthread_getspecific(s_tableKey);
+    if (!table && create)
+    {
+        table = NOBTimingTableCreate();
+        OSSpinLockLock(&s_tablesLock);
+        table->next = s_tables;
+        s_tables    = table;
+        OSSpinLockUnlock(&s_tablesLock);
+        pthread_setspecific(s_tableKey, table);
+    }
+    return table;
+}
+
+// A table outlives its thread only as long as other threads still have its timings to stop
+static void NOBTimingTableThreadExit(void* context)
+{
+    NOBTimingTable* table = (NOBTimingTable*)context;
+
+    // fold the thread's histograms into the retired ones so they survive the thread
+    if (table->histograms)
+    {
+        pthread_mutex_lock(&s_histogramsLock);
+        if (!s_retiredHistograms)
+            s_retiredHistograms = NOBIntegerMapCreate(0, &kNOBIntegerMapObjectKeyCallBacks);
+        for (NOBTimingHistogram* histogram = table->histograms; histogram; )
+        {
+            NOBTimingHistogram* next    = histogram->next;
+            intptr_t            retired = 0;
+            if (NOBIntegerMapGet(s_retiredHistograms, histogram->timingId, &retired))
+            {
+                NOBTimingHistogramMerge((NOBTimingHistogram*)retired, histogram, NO);
+                free(histogram);
+            }
+            else
+            {
+                histogram->next = NULL;
+                NOBIntegerMapSet(s_retiredHistograms, histogram->timingId, (intptr_t)histogram);
+            }
+            histogram = next;
+        }
+        table->histograms = NULL;
+        NOBIntegerMapDestroy(table->histogramsById);
+        table->histogramsById = NULL;
+        pthread_mutex_unlock(&s_histogramsLock);
+    }
+
+    OSSpinLockLock(&s_tablesLock);
+    OSSpinLockLock(&table->lock);
+    BOOL empty = (0 == table->count);
+    table->orphaned = YES;
+    OSSpinLockUnlock(&table->lock);
+    if (empty)
+    {
+        NOBTimingTableUnlink(table);
+        NOBTimingTableDestroy(table);
+    }
+    OSSpinLockUnlock(&s_tablesLock);
+}
+
+// must hold table->lock
+static BOOL NOBTimingTableAdd(NOBTimingTable* table, uintptr_t timingId, uint64_t start)
+{
+    if (NOBIntegerMapGet(table->indexes, timingId, NULL))
+        return NO;
+
+    if (table->count == table->capacity)
+    {
+        table->capacity *= 2;
+        table->ids       = (uintptr_t*)realloc(table->ids, sizeof(uintptr_t) * table->capacity);
+        table->starts    = (uint64_t*)realloc(table->starts, sizeof(uint64_t) * table->capacity);
+    }
+    NOBIntegerMapSet(table->indexes, timingId, (intptr_t)table->count);
+    table->ids[table->count]    = timingId;
+    table->starts[table->count] = start;
+    table->count++;
+    return YES;
+}
+
+// must hold table->lock
+static BOOL NOBTimingTableFind(NOBTimingTable* table, uintptr_t timingId, BOOL remove, uint64_t* pStart)
+{
+    intptr_t index;
+    if (!(remove ? NOBIntegerMapRemove(table->indexes, timingId, &index) : NOBIntegerMapGet(table->indexes, timingId, &index)))
+        return NO;
+
+    *pStart = table->starts[index];
+    if (remove)
+    {
+        // keep the arrays dense by moving the last timing into the hole
+        NSUInteger last = table->count - 1;
+        if ((NSUInteger)index != last)
+        {
+            table->ids[index]    = table->ids[last];
+            table->starts[index] = table->starts[last];
+            NOBIntegerMapSet(table->indexes, table->ids[index], index);
+        }
+        table->count--;
+    }
+    return YES;
+}
+
+// Look in the calling thread's table first, then (rarely) in every other thread's
+static uint64_t NOBTimingElapsed(NSString* timingId, BOOL remove)
+{
+    uint64_t  now   = NOBTimingNanoseconds();
+    uint64_t  start = 0;
+    uintptr_t key   = (uintptr_t)(__bridge void*)timingId;
+    BOOL      found = NO;
+
+    NOBTimingTable* current = NOBTimingCurrentTable(NO);
+    if (current)
+    {
+        OSSpinLockLock(&current->lock);
+        found = NOBTimingTableFind(current, key, remove, &start);
+        OSSpinLockUnlock(&current->lock);
+    }
+
+    if (!found)
+    {
+        OSSpinLockLock(&s_tablesLock);
+        for (NOBTimingTable* table = s_tables; table && !found; table = table->next)
+        {
+            if (table == current)
+                continue;
+
+            OSSpinLockLock(&table->lock);
+            found = NOBTimingTableFind(table, key, remove, &start);
+            BOOL discard = (table->orphaned && 0 == table->count);
+            OSSpinLockUnlock(&table->lock);
+            if (discard)
+            {
+                NOBTimingTableUnlink(table);
+                NOBTimingTableDestroy(table);
+                break;
+            }
+        }
+        OSSpinLockUnlock(&s_tablesLock);
+    }
+
+    return (found ? now - start : kNOBTimingUnknown);
+}
+
+#pragma mark - Histograms
+
+NS_INLINE NSUInteger NOBTimingHistogramIndex(uint64_t nanoseconds);
+NS_INLINE NSUInteger NOBTimingHistogramIndex(uint64_t nanoseconds)
+{
+    if (nanoseconds <= kNOBTimingHistogramSubBucketMask)
+        return (NSUInteger)nanoseconds;
+    if (nanoseconds >= (1ULL << kNOBTimingHistogramMaxExponent))
+        return kNOBTimingHistogramBucketCount - 1;
+
+    unsigned exponent = 63 - __builtin_clzll(nanoseconds);
+    unsigned shift    = exponent - kNOBTimingHistogramSubBucketBits;
+    return (NSUInteger)(((uint64_t)(shift + 1) << kNOBTimingHistogramSubBucketBits) | ((nanoseconds >> shift) & kNOBTimingHistogramSubBucketMask));
+}
+
+// The largest value that lands in the bucket
+NS_INLINE uint64_t NOBTimingHistogramBucketValue(NSUInteger index);
+NS_INLINE uint64_t NOBTimingHistogramBucketValue(NSUInteger index)
+{
+    if (index <= kNOBTimingHistogramSubBucketMask)
+        return index;
+
+    unsigned shift = (unsigned)(index >> kNOBTimingHistogramSubBucketBits) - 1;
+    uint64_t lower = ((1ULL << kNOBTimingHistogramSubBucketBits) | (index & kNOBTimingHistogramSubBucketMask)) << shift;
+    return lower + (1ULL << shift) - 1;
+}
+
+// 64 bit loads are not atomic on 32 bit devices
+NS_INLINE int64_t NOBTimingAtomicRead(volatile int64_t* value);
+NS_INLINE int64_t NOBTimingAtomicRead(volatile int64_t* value)
+{
+    return OSAtomicAdd64(0, value);
+}
+
+static NOBTimingHistogram* NOBTimingHistogramCreate(uintptr_t timingId)
+{
+    NOBTimingHistogram* histogram = (NOBTimingHistogram*)calloc(1, sizeof(NOBTimingHistogram));
+    histogram->timingId = timingId;
+    histogram->minimum  = INT64_MAX;
+    return histogram;
+}
+
+// Add from into a histogram no one else can see.  With reset, exactly what was added is taken back out of from, so concurrent records are not lost.
+static void NOBTimingHistogramMerge(NOBTimingHistogram* into, NOBTimingHistogram* from, BOOL reset)
+{
+    for (NSUInteger i = 0; i < kNOBTimingHistogramBucketCount; i++)
+    {
+        int64_t count = NOBTimingAtomicRead(&from->buckets[i]);
+        if (count)
+        {
+            into->buckets[i] += count;
+            if (reset)
+                OSAtomicAdd64(-count, &from->buckets[i]);
+        }
+    }
+
+    int64_t sum     = NOBTimingAtomicRead(&from->sum);
+    int64_t minimum = NOBTimingAtomicRead(&from->minimum);
+    int64_t maximum = NOBTimingAtomicRead(&from->maximum);
+    into->sum    += sum;
+    into->minimum = MIN(into->minimum, minimum);
+    into->maximum = MAX(into->maximum, maximum);
+    if (reset)
+    {
+        OSAtomicAdd64(-sum, &from->sum);
+        OSAtomicCompareAndSwap64(minimum, INT64_MAX, &from->minimum); // a lost race means a new record is already the extreme
+        OSAtomicCompareAndSwap64(maximum, 0, &from->maximum);
     }
+}
+
+static void NOBTimingHistogramRecord(NOBTimingHistogram* histogram, uint64_t nanoseconds)
+{
+    int64_t value = (int64_t)MIN(nanoseconds, (uint64_t)INT64_MAX);
+    OSAtomicIncrement64(&histogram->buckets[NOBTimingHistogramIndex(nanoseconds)]);
+    OSAtomicAdd64(value, &histogram->sum);
+
+    int64_t extreme;
+    while (value < (extreme = histogram->minimum) && !OSAtomicCompareAndSwap64(extreme, value, &histogram->minimum))
+    {
+    }
+    while (value > (extreme = histogram->maximum) && !OSAtomicCompareAndSwap64(extreme, value, &histogram->maximum))
+    {
+    }
+}
+
+static void NOBTimingMergeHistogramIntoSnapshot(uintptr_t timingId, intptr_t value, void* context)
+{
+    NOBIntegerMapRef    snapshot = (NOBIntegerMapRef)context;
+    intptr_t            merged   = 0;
+    if (!NOBIntegerMapGet(snapshot, timingId, &merged))
+    {
+        merged = (intptr_t)NOBTimingHistogramCreate(timingId);
+        NOBIntegerMapSet(snapshot, timingId, merged);
+    }
+    NOBTimingHistogramMerge((NOBTimingHistogram*)merged, (NOBTimingHistogram*)value, NO);
+}
+
+static void NOBTimingResetRetiredHistogram(uintptr_t timingId, intptr_t value, void* context)
+{
+    NOBTimingHistogram* histogram = (NOBTimingHistogram*)value;
+    memset((void*)histogram->buckets, 0, sizeof(histogram->buckets));
+    histogram->sum     = 0;
+    histogram->minimum = INT64_MAX;
+    histogram->maximum = 0;
+}
+
+static void NOBTimingCollectStatistics(uintptr_t timingId, intptr_t value, void* context)
+{
+    NSMutableDictionary* statistics = (__bridge NSMutableDictionary*)context;
+    NSString*            key        = (__bridge NSString*)(void*)timingId;
+    NOBTimingHistogram*  histogram  = (NOBTimingHistogram*)value;
+    NOBTimingStatistics* entry      = [[NOBTimingStatistics alloc] initWithTimingId:key histogram:histogram];
+    if (entry.count)
+        statistics[key] = entry;
+    free(histogram);
+}
+
+#pragma mark - Timing
+
+uint64_t NOBTimingNanoseconds(void)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (!s_timebase.denom)
+        mach_timebase_info(&s_timebase); // idempotent, racing threads store the same values
+    return mach_absolute_time() * s_timebase.numer / s_timebase.denom;
+}
+
+BOOL StartTiming(NSString* timingId)
+{
+    NOBTimingValidateId(timingId);
+
+    timingId = [timingId copy]; // just a retain unless the id is mutable
+    NOBTimingTable* table = NOBTimingCurrentTable(YES);
+    OSSpinLockLock(&table->lock);
+    BOOL started = NOBTimingTableAdd(table, (uintptr_t)(__bridge void*)timingId, NOBTimingNanoseconds());
+    OSSpinLockUnlock(&table->lock);
+    return started;
+}
+
+uint64_t CheckTimeElapsedNanoseconds(NSString* timingId)
+{
+    NOBTimingValidateId(timingId);
+    return NOBTimingElapsed(timingId, NO);
+}
+
+uint64_t StopTimingNanoseconds(NSString* timingId)
+{
+    NOBTimingValidateId(timingId);
+    uint64_t elapsed = NOBTimingElapsed(timingId, YES);
+    if (s_aggregating && kNOBTimingUnknown != elapsed)
+        NOBTimingRecord(timingId, elapsed);
+    return elapsed;
+}
 
-    __block NSDate* date;
-    dispatch_barrier_sync(s_timesQueue, ^() {
-        date = [s_times objectForKey:timingId];
-        if (date)
-            [s_times removeObjectForKey:timingId];
-    });
-    return (date ? [[NSDate date] timeIntervalSinceDate:date] : NSTimeIntervalUnknown);
+NSTimeInterval CheckTimeElapsed(NSString* timingId)
+{
+    return NOBTimingSeconds(CheckTimeElapsedNanoseconds(timingId));
+}
+
+NSTimeInterval StopTiming(NSString* timingId)
+{
+    return NOBTimingSeconds(StopTimingNanoseconds(timingId));
 }
 
 NSTimeInterval ExecuteTimedBlock(GenericBlock block)
 {
-    NSDate* date = [NSDate date];
+    uint64_t start = NOBTimingNanoseconds();
+    block();
+    return NOBTimingSeconds(NOBTimingNanoseconds() - start);
+}
+
+NSTimeInterval ExecuteNamedTimedBlock(NSString* timingId, GenericBlock block)
+{
+    uint64_t start = NOBTimingNanoseconds();
     block();
-    return [[NSDate date] timeIntervalSinceDate:date];
+    uint64_t elapsed = NOBTimingNanoseconds() - start;
+    if (s_aggregating && timingId)
+        NOBTimingRecord(timingId, elapsed);
+    return NOBTimingSeconds(elapsed);
+}
+
+#pragma mark - Aggregation
+
+void NOBTimingSetAggregating(BOOL aggregating)
+{
+    s_aggregating = aggregating;
+}
+
+BOOL NOBTimingIsAggregating(void)
+{
+    return s_aggregating;
+}
+
+void NOBTimingRecord(NSString* timingId, uint64_t nanoseconds)
+{
+    NOBTimingValidateId(timingId);
+
+    NOBTimingTable* table     = NOBTimingCurrentTable(YES);
+    intptr_t        histogram = 0;
+    if (!table->histogramsById)
+        table->histogramsById = NOBIntegerMapCreate(0, &kNOBIntegerMapObjectKeyCallBacks);
+    if (!NOBIntegerMapGet(table->histogramsById, (uintptr_t)(__bridge void*)timingId, &histogram))
+    {
+        timingId = [timingId copy];
+        histogram = (intptr_t)NOBTimingHistogramCreate((uintptr_t)(__bridge void*)timingId);
+        NOBIntegerMapSet(table->histogramsById, (uintptr_t)(__bridge void*)timingId, histogram);
+
+        // publish the histogram to readers only once it is complete
+        ((NOBTimingHistogram*)histogram)->next = table->histograms;
+        OSMemoryBarrier();
+        table->histograms = (NOBTimingHistogram*)histogram;
+    }
+    NOBTimingHistogramRecord((NOBTimingHistogram*)histogram, nanoseconds);
 }
 
+NSDictionary* NOBTimingSnapshot(BOOL reset)
+{
+    NOBIntegerMapRef snapshot = NOBIntegerMapCreate(0, &kNOBIntegerMapObjectKeyCallBacks);
+
+    // histograms are only freed under s_histogramsLock and lists are only prepended to, so the heads taken under the short s_tablesLock stay valid while merging
+    pthread_mutex_lock(&s_histogramsLock);
+    NOBTimingHistogram*  stackHeads[kNOBTimingSnapshotTableCapacity];
+    NOBTimingHistogram** heapHeads = NULL;
+    NOBTimingHistogram** heads     = stackHeads;
+    NSUInteger           capacity  = kNOBTimingSnapshotTableCapacity;
+    NSUInteger           count;
+    while (1)
+    {
+        count = 0;
+        OSSpinLockLock(&s_tablesLock);
+        for (NOBTimingTable* table = s_tables; table; table = table->next)
+        {
+            if (count < capacity)
+                heads[count] = table->histograms;
+            count++;
+        }
+        OSSpinLockUnlock(&s_tablesLock);
+        if (count <= capacity)
+            break;
+
+        // more threads than room, grow outside the lock and collect again
+        free(heapHeads);
+        capacity  = count * 2;
+        heapHeads = (NOBTimingHistogram**)malloc(sizeof(NOBTimingHistogram*) * capacity);
+        heads     = heapHeads;
+    }
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        for (NOBTimingHistogram* histogram = heads[i]; histogram; histogram = histogram->next)
+        {
+            intptr_t merged = 0;
+            if (!NOBIntegerMapGet(snapshot, histogram->timingId, &merged))
+            {
+                merged = (intptr_t)NOBTimingHistogramCreate(histogram->timingId);
+                NOBIntegerMapSet(snapshot, histogram->timingId, merged);
+            }
+            NOBTimingHistogramMerge((NOBTimingHistogram*)merged, histogram, reset);
+        }
+    }
+    free(heapHeads);
+
+    if (s_retiredHistograms)
+    {
+        NOBIntegerMapEnumerate(s_retiredHistograms, NOBTimingMergeHistogramIntoSnapshot, snapshot);
+        if (reset)
+            NOBIntegerMapEnumerate(s_retiredHistograms, NOBTimingResetRetiredHistogram, NULL);
+    }
+    pthread_mutex_unlock(&s_histogramsLock);
+
+    NSMutableDictionary* statistics = [NSMutableDictionary dictionaryWithCapacity:NOBIntegerMapCount(snapshot)];
+    NOBIntegerMapEnumerate(snapshot, NOBTimingCollectStatistics, (__bridge void*)statistics);
+    NOBIntegerMapDestroy(snapshot);
+    return statistics;
+}
 @implementation NOBTimingObject
 
 - (instancetype) initWithTimingId:(NSString *)timingId
@@ -113,3 +581,66 @@ NSTimeInterval ExecuteTimedBlock(GenericBlock block)
 }
 
 @end
+
+@implementation NOBTimingStatistics
+
+@synthesize timingId = _timingId;
+@synthesize count = _count;
+@synthesize minimum = _minimum;
+@synthesize maximum = _maximum;
+@synthesize mean = _mean;
+@synthesize p50 = _p50;
+@synthesize p90 = _p90;
+@synthesize p99 = _p99;
+@synthesize p999 = _p999;
+
+- (id) initWithTimingId:(NSString*)timingId histogram:(const NOBTimingHistogram*)histogram
+{
+    if (self = [super init])
+    {
+        _timingId = timingId;
+        for (NSUInteger i = 0; i < kNOBTimingHistogramBucketCount; i++)
+        {
+            _count += (uint64_t)histogram->buckets[i];
+        }
+        if (_count)
+        {
+            _minimum = (uint64_t)histogram->minimum;
+            _maximum = (uint64_t)histogram->maximum;
+            _mean    = (double)histogram->sum / _count;
+
+            // a single pass over the buckets, each percentile is the largest value of the bucket its rank falls in
+            const double percentiles[] = { 50.0, 90.0, 99.0, 99.9 };
+            uint64_t*    results[]     = { &_p50, &_p90, &_p99, &_p999 };
+            NSUInteger   next          = 0;
+            uint64_t     seen          = 0;
+            for (NSUInteger i = 0; i < kNOBTimingHistogramBucketCount && next < 4; i++)
+            {
+                seen += (uint64_t)histogram->buckets[i];
+                while (next < 4 && seen >= (uint64_t)ceil(percentiles[next] / 100.0 * _count))
+                {
+                    *results[next++] = MAX(_minimum, MIN(_maximum, NOBTimingHistogramBucketValue(i)));
+                }
+            }
+        }
+    }
+    return self;
+}
+
+- (NSString*) description
+{
+    return [NSString stringWithFormat:@"<%@: %p; timingId = %@, count = %llu, min = %.3fms, mean = %.3fms, max = %.3fms, p50 = %.3fms, p90 = %.3fms, p99 = %.3fms, p99.9 = %.3fms>",
+            NSStringFromClass([self class]),
+            self,
+            _timingId,
+            _count,
+            _minimum / (double)NSEC_PER_MSEC,
+            _mean / NSEC_PER_MSEC,
+            _maximum / (double)NSEC_PER_MSEC,
+            _p50 / (double)NSEC_PER_MSEC,
+            _p90 / (double)NSEC_PER_MSEC,
+            _p99 / (double)NSEC_PER_MSEC,
+            _p999 / (double)NSEC_PER_MSEC];
+}
+
+@end
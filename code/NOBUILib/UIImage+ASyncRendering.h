@@ -50,4 +50,9 @@ typedef NS_ENUM(NSInteger, NOBUIImageType)
 + (void) imageByRenderingData:(NSData*)imageData
                    completion:(UIImageASyncRenderingCompletionBlock)block;
 
+/**
+    The number of bytes the image's decoded bitmap holds on to, the cost to use when keeping rendered images in a \c NOBCache.
+ */
+- (NSUInteger) decodedByteCost;
+
 @end
@@ -114,4 +114,12 @@ NS_INLINE NOBUIImageType _DetectDataImageType(NSData* imageData)
     });
 }
 
+- (NSUInteger) decodedByteCost
+{
+    CGImageRef image = self.CGImage;
+    if (!image)
+        return 0;
+    return CGImageGetBytesPerRow(image) * CGImageGetHeight(image);
+}
+
 @end
@@ -37,6 +37,7 @@
     When there is a move detected among rows in a section, that section is reloaded.
     Also, \c updateData is only for table views where each section and row is unique.  
     Repeated entries, determined by \c tableView:keyForObject: will result in \a reloadData being called.
+    @par Logs to the \c "UITableView+Updating" log category (\c NOBLogLevel_High by default).  Use \c NOBLogCategorySetLevelForName to see why updates fall back to \a reloadData.
  */
 - (void) updateData;
 
@@ -32,10 +32,17 @@
 
     FUTURE OPTIMIZATIONS (if we want to go crazy):
 
-    1) move memory allocation off the heap onto the stack (use c or c++ data structures instead of Obj-C ones)
+    1) move the remaining memory allocation off the heap onto the stack (the key maps are already unboxed NOBIntegerMapRefs)
     2) there's a non-trivial amount of time wasted on dealloc'ing NSIndexPath objects due to some thread safety issues of these objects
 */
 
+static NOBLogCategory s_updatingLogCategory = kNOBLogCategory_None;
+
+__attribute__((constructor)) static void UITableViewUpdatingRegisterLogCategory(void)
+{
+    s_updatingLogCategory = NOBLogCategoryRegister("UITableView+Updating", NOBLogLevel_High);
+}
+
 @interface UITableViewUpdates : NSObject
 @property (nonatomic, readonly) NSMutableIndexSet* deleteSections;
 @property (nonatomic, readonly) NSMutableIndexSet* reloadSections;
@@ -77,37 +84,6 @@ typedef struct _UITableViewUpdatingDataSourceRuntimeInfo {
     isPreviousRowObjectEqualToRowObjectFunctionPtr isPreviousRowObjectEqualToRowObjectFP;
 } UITableViewUpdatingDataSourceRuntimeInfo;
 
-// This struct will store some method implementations of our mutable dictionaries to help optimize our loop
-typedef struct _NSMutableDictionaryRuntimeInfo {
-    SEL objectForKeySEL;
-    IMP objectForKeyIMP;
-
-    SEL setObjectForKeySEL;
-    IMP setObjectForKeyIMP;
-} NSMutableDictionaryRuntimeInfo;
-
-@interface NSMutableDictionary (RuntimeInfo)
-- (NSMutableDictionaryRuntimeInfo) runtimeInfo;
-@end
-
-@implementation NSMutableDictionary (RuntimeInfo)
-
-- (NSMutableDictionaryRuntimeInfo) runtimeInfo
-{
-    NSMutableDictionaryRuntimeInfo runtimeInfo;
-
-    Class theClass = [self class];
-    runtimeInfo.objectForKeySEL = @selector(objectForKey:);
-    runtimeInfo.objectForKeyIMP = class_getMethodImplementation(theClass, runtimeInfo.objectForKeySEL);
-
-    runtimeInfo.setObjectForKeySEL = @selector(setObject:forKey:);
-    runtimeInfo.setObjectForKeyIMP = class_getMethodImplementation(theClass, runtimeInfo.setObjectForKeySEL);
-
-    return runtimeInfo;
-}
-
-@end
-
 @implementation UITableViewUpdates
 
 - (instancetype) init
@@ -198,35 +174,43 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
         }
 
         BOOL reload = !self.window;
-        if (!reload)
+        if (reload)
+        {
+            LOGC_LO(s_updatingLogCategory, @"%@ reloading, not in a window", self);
+        }
+        else
         {
             NSInteger oldSectionCount = [updatingDataSource numberOfPreviousSectionsInTableView:self];
-            NSMutableDictionary* oldSectionMap = [[NSMutableDictionary alloc] initWithCapacity:oldSectionCount];
-            NSMutableDictionaryRuntimeInfo oldSectionMapRuntimeInfo = oldSectionMap.runtimeInfo;
+            NOBIntegerMapRef oldSectionMap = NOBIntegerMapCreate(oldSectionCount, &kNOBIntegerMapObjectKeyCallBacks);
 
             for (NSInteger i = 0; i < oldSectionCount; i++)
             {
                 NSObject* obj = pRuntimeInfo->objectForPreviousSectionIMP(updatingDataSource, pRuntimeInfo->objectForPreviousSectionSEL, self, i);
                 NSObject<NSCopying>* key = pRuntimeInfo->keyForSectionObjectIMP(updatingDataSource, pRuntimeInfo->keyForSectionObjectSEL, self, obj);
-                oldSectionMapRuntimeInfo.setObjectForKeyIMP(oldSectionMap, oldSectionMapRuntimeInfo.setObjectForKeySEL, @(i), key);
+                NOBIntegerMapSet(oldSectionMap, (uintptr_t)(__bridge void*)key, i);
             }
-            if (oldSectionCount != oldSectionMap.count)
+            if (oldSectionCount != NOBIntegerMapCount(oldSectionMap))
+            {
+                LOGC_MID(s_updatingLogCategory, @"%@ reloading, %ld previous sections only have %lu unique keys", self, (long)oldSectionCount, (unsigned long)NOBIntegerMapCount(oldSectionMap));
                 reload = YES;
+            }
             
             if (!reload)
             {
                 NSInteger newSectionCount = [updatingDataSource numberOfSectionsInTableView:self];
-                NSMutableDictionary* newSectionMap = [[NSMutableDictionary alloc] initWithCapacity:newSectionCount];
-                NSMutableDictionaryRuntimeInfo newSectionMapRuntimeInfo = newSectionMap.runtimeInfo;
+                NOBIntegerMapRef newSectionMap = NOBIntegerMapCreate(newSectionCount, &kNOBIntegerMapObjectKeyCallBacks);
 
                 for (NSInteger i = 0; i < newSectionCount; i++)
                 {
                     NSObject* obj = pRuntimeInfo->objectForSectionIMP(updatingDataSource, pRuntimeInfo->objectForSectionSEL, self, i);
                     NSObject<NSCopying>* key = pRuntimeInfo->keyForSectionObjectIMP(updatingDataSource, pRuntimeInfo->keyForSectionObjectSEL, self, obj);
-                    newSectionMapRuntimeInfo.setObjectForKeyIMP(newSectionMap, newSectionMapRuntimeInfo.setObjectForKeySEL, @(i), key);
+                    NOBIntegerMapSet(newSectionMap, (uintptr_t)(__bridge void*)key, i);
                 }
-                if (newSectionCount != newSectionMap.count)
+                if (newSectionCount != NOBIntegerMapCount(newSectionMap))
+                {
+                    LOGC_MID(s_updatingLogCategory, @"%@ reloading, %ld sections only have %lu unique keys", self, (long)newSectionCount, (unsigned long)NOBIntegerMapCount(newSectionMap));
                     reload = YES;
+                }
 
                 if (!reload)
                 {
@@ -236,25 +220,27 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
                                   withUpdatingDataSource:updatingDataSource
                                 dataSourceRuntimeInfoRef:pRuntimeInfo
                                            oldSectionMap:oldSectionMap
-                             oldSectionMapRuntimeInfoRef:&oldSectionMapRuntimeInfo
-                                           newSectionMap:newSectionMap
-                             newSectionMapRuntimeInfoRef:&newSectionMapRuntimeInfo];
+                                           newSectionMap:newSectionMap];
 
                     if (!reload)
                     {
                         @try
                         {
-                            // NSLog(@"%@", updates);
+                            LOGC_LO(s_updatingLogCategory, @"%@ applying updates: %@", self, updates);
                             [self _applyUpdates:updates];
                         }
                         @catch (NSException *exception)
                         {
-                            LOG_HI(@"Exception: %@", exception);
+                            LOGC_HI(s_updatingLogCategory, @"Exception: %@", exception);
                             reload = YES;
                         }
                     }
                 }
+
+                NOBIntegerMapDestroy(newSectionMap);
             }
+
+            NOBIntegerMapDestroy(oldSectionMap);
         }
 
         if (reload)
@@ -272,13 +258,9 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
 - (BOOL) _detectSectionUpdates:(UITableViewUpdates*)updates
         withUpdatingDataSource:(id<UITableViewUpdatingDataSource>)updatingDataSource
       dataSourceRuntimeInfoRef:(UITableViewUpdatingDataSourceRuntimeInfo*)pRuntimeInfo
-                 oldSectionMap:(NSDictionary*)oldSectionMap
-   oldSectionMapRuntimeInfoRef:(NSMutableDictionaryRuntimeInfo*)pOldSectionMapRuntimeInfo
-                 newSectionMap:(NSDictionary*)newSectionMap
-   newSectionMapRuntimeInfoRef:(NSMutableDictionaryRuntimeInfo*)pNewSectionMapRuntimeInfo
+                 oldSectionMap:(NOBIntegerMapRef)oldSectionMap
+                 newSectionMap:(NOBIntegerMapRef)newSectionMap
 {
-    NOBAssert(pOldSectionMapRuntimeInfo);
-    NOBAssert(pNewSectionMapRuntimeInfo);
     NOBAssert(pRuntimeInfo);
     NOBAssert(oldSectionMap);
     NOBAssert(newSectionMap);
@@ -286,8 +268,8 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
     NOBAssert(updatingDataSource);
 
     BOOL reload = NO;
-    NSUInteger oldSectionCount = oldSectionMap.count;
-    NSUInteger newSectionCount = newSectionMap.count;
+    NSUInteger oldSectionCount = NOBIntegerMapCount(oldSectionMap);
+    NSUInteger newSectionCount = NOBIntegerMapCount(newSectionMap);
     NSInteger oldIndex = 0;
     NSInteger newIndex = 0;
     NSObject* oldObj, *newObj;
@@ -319,8 +301,7 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
 
         if (oldKey)
         {
-            NSNumber* newIndexToMatchOldId = pNewSectionMapRuntimeInfo->objectForKeyIMP(newSectionMap, pNewSectionMapRuntimeInfo->objectForKeySEL, oldKey);
-            if (!newIndexToMatchOldId)
+            if (!NOBIntegerMapGet(newSectionMap, (uintptr_t)(__bridge void*)oldKey, NULL))
             {
                 [updates.deleteSections addIndex:oldIndex];
                 oldIndex++;
@@ -331,8 +312,7 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
         
         if (newKey)
         {
-            NSNumber* oldIndexToMatchNewId = pOldSectionMapRuntimeInfo->objectForKeyIMP(oldSectionMap, pOldSectionMapRuntimeInfo->objectForKeySEL, newKey);
-            if (!oldIndexToMatchNewId)
+            if (!NOBIntegerMapGet(oldSectionMap, (uintptr_t)(__bridge void*)newKey, NULL))
             {
                 [updates.insertSections addIndex:newIndex];
                 newIndex++;
@@ -438,8 +418,7 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
     @autoreleasepool
     {
         NSInteger oldRowCount = [updatingDataSource tableView:self numberOfRowsInPreviousSection:oldSection];
-        NSMutableDictionary* oldRowMap = [[NSMutableDictionary alloc] initWithCapacity:oldRowCount];
-        NSMutableDictionaryRuntimeInfo oldRowMapRuntimeInfo = oldRowMap.runtimeInfo;
+        NOBIntegerMapRef oldRowMap = NOBIntegerMapCreate(oldRowCount, &kNOBIntegerMapObjectKeyCallBacks);
         
         for (NSInteger i = 0; i < oldRowCount; i++)
         {
@@ -448,16 +427,15 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
                                                                        self,
                                                                        [NSIndexPath indexPathForRow:i inSection:oldSection]);
             NSObject<NSCopying>* key = pRuntimeInfo->keyForRowObjectIMP(updatingDataSource, pRuntimeInfo->keyForRowObjectSEL, self, obj);
-            oldRowMapRuntimeInfo.setObjectForKeyIMP(oldRowMap, oldRowMapRuntimeInfo.setObjectForKeySEL, @(i), key);
+            NOBIntegerMapSet(oldRowMap, (uintptr_t)(__bridge void*)key, i);
         }
-        if (oldRowCount != oldRowMap.count)
+        if (oldRowCount != NOBIntegerMapCount(oldRowMap))
             reload = YES;
 
         if (!reload)
         {
             NSInteger newRowCount = [updatingDataSource tableView:self numberOfRowsInSection:newSection];
-            NSMutableDictionary* newRowMap = [[NSMutableDictionary alloc] initWithCapacity:newRowCount];
-            NSMutableDictionaryRuntimeInfo newRowMapRuntimeInfo = newRowMap.runtimeInfo;
+            NOBIntegerMapRef newRowMap = NOBIntegerMapCreate(newRowCount, &kNOBIntegerMapObjectKeyCallBacks);
 
             for (NSInteger i = 0; i < newRowCount; i++)
             {
@@ -466,9 +444,9 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
                                                                    self,
                                                                    [NSIndexPath indexPathForRow:i inSection:newSection]);
                 NSObject<NSCopying>* key = pRuntimeInfo->keyForRowObjectIMP(updatingDataSource, pRuntimeInfo->keyForRowObjectSEL, self, obj);
-                newRowMapRuntimeInfo.setObjectForKeyIMP(newRowMap, newRowMapRuntimeInfo.setObjectForKeySEL, @(i), key);
+                NOBIntegerMapSet(newRowMap, (uintptr_t)(__bridge void*)key, i);
             }
-            if (newRowCount != newRowMap.count)
+            if (newRowCount != NOBIntegerMapCount(newRowMap))
                 reload = YES;
 
             if (!reload)
@@ -520,8 +498,7 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
                     
                     if (oldKey)
                     {
-                        NSNumber* newIndexToMatchOldId = newRowMapRuntimeInfo.objectForKeyIMP(newRowMap, newRowMapRuntimeInfo.objectForKeySEL, oldKey);
-                        if (!newIndexToMatchOldId)
+                        if (!NOBIntegerMapGet(newRowMap, (uintptr_t)(__bridge void*)oldKey, NULL))
                         {
                             [updates.deleteRows addObject:oldPath];
                             oldIndex++;
@@ -533,8 +510,7 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
 
                     if (newKey)
                     {
-                        NSNumber* oldIndexToMatchNewId = oldRowMapRuntimeInfo.objectForKeyIMP(oldRowMap, oldRowMapRuntimeInfo.objectForKeySEL, newKey);
-                        if (!oldIndexToMatchNewId)
+                        if (!NOBIntegerMapGet(oldRowMap, (uintptr_t)(__bridge void*)newKey, NULL))
                         {
                             [updates.insertRows addObject:newPath];
                             newIndex++;
@@ -579,7 +555,11 @@ typedef struct _NSMutableDictionaryRuntimeInfo {
                     newIndex++;
                 }
             }
+
+            NOBIntegerMapDestroy(newRowMap);
         }
+
+        NOBIntegerMapDestroy(oldRowMap);
     }
 
     if (reload)
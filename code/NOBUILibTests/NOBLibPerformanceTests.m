@@ -0,0 +1,1203 @@
+//
+//  NOBLibPerformanceTests.m
+//  NOBUILibTests
+//
+//  Created by Nolan O'Brien on 11/23/13.
+//  Copyright (c) 2013 NSProgrammer.com. All rights reserved.
+//
+
+#import <XCTest/XCTest.h>
+#include <mach/mach_time.h>
+#include <fcntl.h>
+#include <pthread.h>
+#import "NOBLib.h"
+#import "NOBLogBinaryFormat.h"
+#import "NOBLogCompression.h"
+
+#define kLinesPerRun (20000)
+
+NS_INLINE double NanosecondsSince(uint64_t start)
+{
+    static mach_timebase_info_data_t s_timebase;
+    if (!s_timebase.denom)
+        mach_timebase_info(&s_timebase);
+    return (double)(mach_absolute_time() - start) * s_timebase.numer / s_timebase.denom;
+}
+
+@interface NOBLibPerformanceTests : XCTestCase
+@end
+
+@implementation NOBLibPerformanceTests
+{
+    NSString* _directory;
+}
+
+- (void) setUp
+{
+    [super setUp];
+    _directory = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSProcessInfo processInfo] globallyUniqueString]];
+    [[NSFileManager defaultManager] createDirectoryAtPath:_directory withIntermediateDirectories:YES attributes:nil error:NULL];
+}
+
+- (void) tearDown
+{
+    [[NSFileManager defaultManager] removeItemAtPath:_directory error:NULL];
+    [super tearDown];
+}
+
+#pragma mark NOBLogger
+
+// The per line encoding NOBLogger used before records were encoded into a reusable buffer
+- (double) legacyEncodingNanosecondsPerLine
+{
+    NSDateFormatter* formatter = [[NSDateFormatter alloc] init];
+    formatter.locale = [[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"];
+    formatter.dateFormat = @"MM'/'dd'/'yy hh':'mm':'ss a z";
+    formatter.timeZone = [NSTimeZone localTimeZone];
+
+    FILE*       file      = fopen([_directory stringByAppendingPathComponent:@"legacy.log"].UTF8String, "w");
+    const char* levelName = "[MID]  : ";
+    char        b;
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kLinesPerRun; i++)
+    {
+        @autoreleasepool {
+            NSString* message   = [NSString stringWithFormat:@"benchmark line %lu of %lu", (unsigned long)i, (unsigned long)kLinesPerRun];
+            NSData*   timeStamp = [[formatter stringFromDate:[NSDate date]] dataUsingEncoding:NSUTF8StringEncoding];
+            NSData*   bytes     = [message dataUsingEncoding:NSUTF8StringEncoding];
+            b = '[';
+            fwrite(&b, 1, 1, file);
+            fwrite(timeStamp.bytes, 1, timeStamp.length, file);
+            b = ']';
+            fwrite(&b, 1, 1, file);
+            fwrite(levelName, 1, strlen(levelName), file);
+            fwrite(bytes.bytes, 1, bytes.length, file);
+            b = '\n';
+            fwrite(&b, 1, 1, file);
+        }
+    }
+    fflush(file);
+    double ns = NanosecondsSince(start) / kLinesPerRun;
+    fclose(file);
+    return ns;
+}
+
+- (double) loggerNanosecondsPerLine:(BOOL)deferred
+{
+    NOBLogger* logger = [[NOBLogger alloc] initWithDirectory:_directory
+                                                  filePrefix:(deferred ? @"deferred." : @"bench.")
+                                                    logLevel:NOBLogLevel_Low
+                                        writesBeforeRollover:kLinesPerRun * 2
+                                                maxFileCount:0];
+    logger.overflowPolicy = NOBLogOverflowPolicy_Block;
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kLinesPerRun; i++)
+    {
+        @autoreleasepool {
+            if (deferred)
+                [logger writeASyncWithLevel:NOBLogLevel_Mid deferredFormat:"benchmark line %lu of %lu", (unsigned long)i, (unsigned long)kLinesPerRun];
+            else
+                [logger writeASync:[NSString stringWithFormat:@"benchmark line %lu of %lu", (unsigned long)i, (unsigned long)kLinesPerRun] level:NOBLogLevel_Mid];
+        }
+    }
+    [logger flush];
+    return NanosecondsSince(start) / kLinesPerRun;
+}
+
+- (void) testLoggerLineEncoding
+{
+    double legacy   = [self legacyEncodingNanosecondsPerLine];
+    double logger   = [self loggerNanosecondsPerLine:NO];
+    double deferred = [self loggerNanosecondsPerLine:YES];
+
+    NSLog(@"NOBLogger line cost: legacy encoding %.0fns, NOBLogger %.0fns (%.1fx), deferred format %.0fns (%.1fx)",
+          legacy,
+          logger, legacy / logger,
+          deferred, legacy / deferred);
+
+    NOBLogger* check = [[NOBLogger alloc] initWithDirectory:_directory
+                                                 filePrefix:@"deferred."
+                                                   logLevel:NOBLogLevel_Low
+                                       writesBeforeRollover:0
+                                               maxFileCount:0];
+    NSString*  tail  = [[NSString alloc] initWithData:[check mostRecentLogs:1024] encoding:NSUTF8StringEncoding];
+    XCTAssertTrue([tail rangeOfString:[NSString stringWithFormat:@"benchmark line %lu of %lu", (unsigned long)kLinesPerRun - 1, (unsigned long)kLinesPerRun]].location != NSNotFound, @"");
+}
+
+#pragma mark NOBLogger startup
+
+#define kStartupLogFileCount (40)
+#define kStartupRuns         (10)
+
+// Logs left over from previous sessions, more than maxFileCount so that the logger has to purge on open
+- (void) populateStartupLogs:(NSString*)directory
+{
+    [[NSFileManager defaultManager] createDirectoryAtPath:directory withIntermediateDirectories:YES attributes:nil error:NULL];
+    NSData* contents = [[@"" stringByPaddingToLength:16 * 1024 withString:@"previous session " startingAtIndex:0] dataUsingEncoding:NSUTF8StringEncoding];
+    for (NSUInteger i = 0; i < kStartupLogFileCount; i++)
+    {
+        NSString* name = [NSString stringWithFormat:@"%@%lu.log", kNOBLoggerDefaultFilePrefix, (unsigned long)(1000 + i)];
+        [contents writeToFile:[directory stringByAppendingPathComponent:name] atomically:NO];
+    }
+}
+
+// Time from calling the initializer until the first LOG returns, what the launch path pays
+- (double) startupNanoseconds:(NOBLoggerOptions)options
+{
+    double total = 0;
+    for (NSUInteger run = 0; run < kStartupRuns; run++)
+    {
+        @autoreleasepool {
+            NSString* directory = [_directory stringByAppendingPathComponent:[NSString stringWithFormat:@"startup%lu", (unsigned long)run]];
+            [self populateStartupLogs:directory];
+
+            uint64_t   start  = mach_absolute_time();
+            NOBLogger* logger = [[NOBLogger alloc] initWithDirectory:directory
+                                                          filePrefix:nil
+                                                            logLevel:NOBLogLevel_Low
+                                                writesBeforeRollover:0
+                                                        maxFileCount:0
+                                                             options:options];
+            [logger writeASync:@"application did finish launching" level:NOBLogLevel_High];
+            total += NanosecondsSince(start);
+
+            [logger flush];
+            XCTAssertTrue(logger.logFiles.count <= kNOBLoggerDefaultMaxFiles, @"");
+            NSString* tail = [[NSString alloc] initWithData:[logger mostRecentLogs:1024] encoding:NSUTF8StringEncoding];
+            XCTAssertTrue([tail rangeOfString:@"application did finish launching"].location != NSNotFound, @"");
+            [[NSFileManager defaultManager] removeItemAtPath:directory error:NULL];
+        }
+    }
+    return total / kStartupRuns;
+}
+
+- (void) testLoggerStartup
+{
+    double sync  = [self startupNanoseconds:NOBLoggerOption_None];
+    double async = [self startupNanoseconds:NOBLoggerOption_AsyncOpen];
+
+    NSLog(@"NOBLogger startup with %lu old logs: synchronous open %.0fus, async open %.0fus (%.1fx)",
+          (unsigned long)kStartupLogFileCount, sync / 1000.0, async / 1000.0, sync / async);
+}
+
+#pragma mark NOBLogger sharedLog
+
+#define kLookupsPerThread (200000)
+
+// How sharedLog was read before it was atomically published: a dispatch_sync on a concurrent queue
+- (double) legacySharedLogNanosecondsPerLookup:(NSUInteger)threadCount
+{
+    dispatch_queue_t sharingQ = dispatch_queue_create("NOBLibPerformanceTests.sharingQ", DISPATCH_QUEUE_CONCURRENT);
+    NOBLogger*       shared   = NOBLOG;
+
+    double ns = [self nanosecondsPerLookup:threadCount block:^NOBLogger*() {
+        __block NOBLogger* logger;
+        dispatch_sync(sharingQ, ^() {
+            logger = shared;
+        });
+        return logger;
+    }];
+    return ns;
+}
+
+- (double) nanosecondsPerLookup:(NSUInteger)threadCount block:(NOBLogger* (^)(void))lookup
+{
+    dispatch_group_t group = dispatch_group_create();
+    dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger t = 0; t < threadCount; t++)
+    {
+        dispatch_group_async(group, queue, ^() {
+            NSUInteger found = 0;
+            for (NSUInteger i = 0; i < kLookupsPerThread; i++)
+            {
+                if (lookup ? lookup() : NOBLOG)
+                    found++;
+            }
+            NSCAssert(found == kLookupsPerThread, @"lookup failed");
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    double ns = NanosecondsSince(start) / ((double)kLookupsPerThread * threadCount);
+    return ns;
+}
+
+- (void) testSharedLogLookup
+{
+    NOBLogger* logger = [[NOBLogger alloc] initWithDirectory:_directory logLevel:NOBLogLevel_Low];
+    [NOBLogger setSharedLog:logger];
+    XCTAssertEqual(NOBLOG, logger, @"");
+
+    for (NSUInteger threads = 1; threads <= 16; threads *= 2)
+    {
+        double legacy = [self legacySharedLogNanosecondsPerLookup:threads];
+        double atomic = [self nanosecondsPerLookup:threads block:nil];
+        NSLog(@"NOBLOG lookup with %2lu threads: dispatch_sync %.1fns, atomic %.2fns (%.0fx)",
+              (unsigned long)threads, legacy, atomic, legacy / atomic);
+    }
+
+    [NOBLogger setSharedLog:nil];
+    XCTAssertTrue(NOBLOG != logger, @"");
+    XCTAssertNotNil(NOBLOG, @"");
+}
+
+#pragma mark NOBStripedMutableDictionary
+
+#define kDictionaryKeyCount       (1024)
+#define kDictionaryOpsPerThread   (100000)
+#define kDictionaryWritePercent   (5)
+#define kDictionarySampleInterval (8) // every Nth operation is timed for the latency percentiles
+
+// A mix of 95% reads and 5% writes of a shared dictionary from threadCount threads
+- (double) dictionaryNanosecondsPerOperation:(NSMutableDictionary*)dictionary threads:(NSUInteger)threadCount p99:(double*)pP99
+{
+    NSMutableArray* keys = [NSMutableArray arrayWithCapacity:kDictionaryKeyCount];
+    for (NSUInteger i = 0; i < kDictionaryKeyCount; i++)
+    {
+        NSString* key = [NSString stringWithFormat:@"cache.key.%lu", (unsigned long)i];
+        [keys addObject:key];
+        [dictionary setObject:@(i) forKey:key];
+    }
+
+    NSUInteger       samplesPerThread = kDictionaryOpsPerThread / kDictionarySampleInterval;
+    double*          samples          = (double*)malloc(sizeof(double) * samplesPerThread * threadCount);
+    dispatch_group_t group            = dispatch_group_create();
+    dispatch_queue_t queue            = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger t = 0; t < threadCount; t++)
+    {
+        dispatch_group_async(group, queue, ^() {
+            double*  threadSamples = samples + t * samplesPerThread;
+            uint32_t random        = (uint32_t)(t + 1) * 2654435761U;
+            for (NSUInteger i = 0; i < kDictionaryOpsPerThread; i++)
+            {
+                // xorshift, cheap enough not to dominate the measurement
+                random ^= random << 13;
+                random ^= random >> 17;
+                random ^= random << 5;
+                NSString* key     = [keys objectAtIndex:random % kDictionaryKeyCount];
+                BOOL      write   = (random >> 16) % 100 < kDictionaryWritePercent;
+                BOOL      sample  = (i % kDictionarySampleInterval) == 0;
+                uint64_t  opStart = (sample ? mach_absolute_time() : 0);
+                if (write)
+                    [dictionary setObject:@(i) forKey:key];
+                else
+                    [dictionary objectForKey:key];
+                if (sample)
+                    threadSamples[i / kDictionarySampleInterval] = NanosecondsSince(opStart);
+            }
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual(dictionary.count, (NSUInteger)kDictionaryKeyCount, @""); // also waits for asynchronous writes
+    double ns = NanosecondsSince(start) / ((double)kDictionaryOpsPerThread * threadCount);
+
+    NSUInteger sampleCount = samplesPerThread * threadCount;
+    qsort_b(samples, sampleCount, sizeof(double), ^int(const void* a, const void* b) {
+        double da = *(const double*)a, db = *(const double*)b;
+        return (da < db) ? -1 : (da > db);
+    });
+    *pP99 = samples[(NSUInteger)(sampleCount * 0.99)];
+    free(samples);
+    return ns;
+}
+
+- (void) testStripedDictionary
+{
+    for (NSUInteger threads = 1; threads <= 16; threads *= 2)
+    {
+        double queueP99, stripedP99;
+        double queue   = [self dictionaryNanosecondsPerOperation:[[NOBThreadSafeMutableDictionary alloc] init] threads:threads p99:&queueP99];
+        double striped = [self dictionaryNanosecondsPerOperation:[[NOBStripedMutableDictionary alloc] init] threads:threads p99:&stripedP99];
+        NSLog(@"Dictionary 95%% reads with %2lu threads: queue %.0fns/op (%.1fM ops/s, p99 %.0fns), striped %.0fns/op (%.1fM ops/s, p99 %.0fns)",
+              (unsigned long)threads,
+              queue, 1000.0 / queue, queueP99,
+              striped, 1000.0 / striped, stripedP99);
+    }
+
+    NOBStripedMutableDictionary* dictionary = [[NOBStripedMutableDictionary alloc] init];
+    XCTAssertNil([dictionary exclusiveSetObject:@1 forKey:@"a"], @"");
+    XCTAssertEqualObjects([dictionary exclusiveSetObject:@2 forKey:@"a"], @1, @"");
+    XCTAssertEqualObjects([dictionary replaceObjectForKey:@"a" withObject:@3], @1, @"");
+    dictionary[@"b"] = @4;
+    XCTAssertEqualObjects(([dictionary copy]), (@{ @"a" : @3, @"b" : @4 }), @"");
+    [dictionary removeObjectForKey:@"a"];
+    XCTAssertEqual(dictionary.count, (NSUInteger)1, @"");
+}
+
+
+#pragma mark NOBThreadSafeMutableDictionary snapshot storage
+
+#define kSnapshotEntryCount (10000)
+#define kSnapshotCopies     (1000)
+#define kSnapshotWrites     (2000)
+
+// Cost of a copy, and of a write while another thread keeps enumerating
+- (void) measureStorage:(NOBThreadSafeDictionaryStorage)storage copy:(double*)pCopy write:(double*)pWrite
+{
+    NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:storage];
+    XCTAssertEqual(dictionary.storage, storage, @"");
+    for (NSUInteger i = 0; i < kSnapshotEntryCount; i++)
+    {
+        [dictionary setObject:@(i) forKey:@(i)];
+    }
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kSnapshotCopies; i++)
+    {
+        @autoreleasepool {
+            NSDictionary* copy = [dictionary copy];
+            XCTAssertEqual(copy.count, (NSUInteger)kSnapshotEntryCount, @"");
+        }
+    }
+    *pCopy = NanosecondsSince(start) / kSnapshotCopies;
+
+    __block volatile BOOL done  = NO;
+    dispatch_group_t      group = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^() {
+        while (!done)
+        {
+            __block NSUInteger seen = 0;
+            [dictionary enumerateKeysAndObjectsUsingBlock:^(id key, id obj, BOOL* stop) {
+                seen++;
+            }];
+        }
+    });
+
+    start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kSnapshotWrites; i++)
+    {
+        [dictionary replaceObjectForKey:@(i) withObject:@(i + 1)];
+    }
+    *pWrite = NanosecondsSince(start) / kSnapshotWrites;
+    done = YES;
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    XCTAssertEqualObjects([dictionary objectForKey:@0], @1, @"");
+}
+
+- (void) testSnapshotDictionary
+{
+    double queueCopy, queueWrite, snapshotCopy, snapshotWrite;
+    [self measureStorage:NOBThreadSafeDictionaryStorage_Queue copy:&queueCopy write:&queueWrite];
+    [self measureStorage:NOBThreadSafeDictionaryStorage_Snapshot copy:&snapshotCopy write:&snapshotWrite];
+    NSLog(@"Dictionary of %lu entries: copy queue %.0fns snapshot %.0fns (%.0fx), write during enumeration queue %.0fns snapshot %.0fns (%.1fx)",
+          (unsigned long)kSnapshotEntryCount,
+          queueCopy, snapshotCopy, queueCopy / snapshotCopy,
+          queueWrite, snapshotWrite, queueWrite / snapshotWrite);
+
+    NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:NOBThreadSafeDictionaryStorage_Snapshot];
+    dictionary[@"a"] = @1;
+    NSDictionary* before = [dictionary copy];
+    dictionary[@"a"] = @2;
+    [dictionary removeObjectForKey:@"missing"];
+    XCTAssertEqualObjects(before[@"a"], @1, @"");
+    XCTAssertEqualObjects(dictionary[@"a"], @2, @"");
+    [dictionary removeAllObjects];
+    XCTAssertEqual(dictionary.count, (NSUInteger)0, @"");
+    XCTAssertEqual(before.count, (NSUInteger)1, @"");
+}
+
+
+#pragma mark NOBThreadSafeMutableDictionary transactions
+
+#define kTransactionEntryCount (10000)
+
+// Load entries while another thread keeps reading, until every entry is visible
+- (double) loadNanosecondsPerEntry:(NOBThreadSafeDictionaryStorage)storage transaction:(BOOL)transaction
+{
+    NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:storage];
+    __block volatile BOOL           done       = NO;
+    dispatch_group_t                group      = dispatch_group_create();
+    dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^() {
+        while (!done)
+        {
+            [dictionary objectForKey:@0];
+        }
+    });
+
+    uint64_t start = mach_absolute_time();
+    if (transaction)
+    {
+        [dictionary performTransaction:^(NOBDictionaryTransaction* entries) {
+            for (NSUInteger i = 0; i < kTransactionEntryCount; i++)
+            {
+                [entries setObject:@(i) forKey:@(i)];
+            }
+        }];
+    }
+    else
+    {
+        for (NSUInteger i = 0; i < kTransactionEntryCount; i++)
+        {
+            [dictionary setObject:@(i) forKey:@(i)];
+        }
+    }
+    XCTAssertEqual(dictionary.count, (NSUInteger)kTransactionEntryCount, @""); // waits for asynchronous writes
+    double ns = NanosecondsSince(start) / kTransactionEntryCount;
+
+    done = YES;
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    return ns;
+}
+
+- (void) testDictionaryTransactions
+{
+    NSLog(@"Dictionary load of %lu entries: queue %.0fns/entry, queue transaction %.0fns/entry, snapshot %.0fns/entry, snapshot transaction %.0fns/entry",
+          (unsigned long)kTransactionEntryCount,
+          [self loadNanosecondsPerEntry:NOBThreadSafeDictionaryStorage_Queue transaction:NO],
+          [self loadNanosecondsPerEntry:NOBThreadSafeDictionaryStorage_Queue transaction:YES],
+          [self loadNanosecondsPerEntry:NOBThreadSafeDictionaryStorage_Snapshot transaction:NO],
+          [self loadNanosecondsPerEntry:NOBThreadSafeDictionaryStorage_Snapshot transaction:YES]);
+
+    for (NOBThreadSafeDictionaryStorage storage = NOBThreadSafeDictionaryStorage_Queue; storage <= NOBThreadSafeDictionaryStorage_AdaptiveLock; storage++)
+    {
+        NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:storage];
+        dictionary[@"a"] = @1;
+        [dictionary performTransaction:^(NOBDictionaryTransaction* transaction) {
+            XCTAssertEqualObjects([transaction exclusiveSetObject:@2 forKey:@"a"], @1, @"");
+            XCTAssertNil([transaction exclusiveSetObject:@3 forKey:@"b"], @"");
+            [transaction removeObjectForKey:@"a"];
+        }];
+        XCTAssertEqualObjects(([dictionary copy]), (@{ @"b" : @3 }), @"");
+
+        // a transaction that raises leaves nothing behind
+        XCTAssertThrows([dictionary performTransaction:^(NOBDictionaryTransaction* transaction) {
+            transaction[@"c"] = @4;
+            transaction[@"b"] = @5;
+            transaction[@"b"] = @6;
+            [transaction removeObjectForKey:@"c"];
+            transaction[@"e"] = @7;
+            [transaction setObject:nil forKey:@"d"];
+        }], @"");
+        XCTAssertEqualObjects(([dictionary copy]), (@{ @"b" : @3 }), @"");
+
+        XCTAssertThrows([dictionary performTransaction:^(NOBDictionaryTransaction* transaction) {
+            transaction[@"c"] = @4;
+            [transaction removeAllObjects];
+            transaction[@"f"] = @8;
+            [transaction setObject:nil forKey:@"d"];
+        }], @"");
+        XCTAssertEqualObjects(([dictionary copy]), (@{ @"b" : @3 }), @"");
+    }
+}
+
+
+#pragma mark NOBThreadSafeMutableDictionary single flight
+
+- (void) testDictionaryComputeSingleFlight
+{
+    NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] init];
+    __block volatile int32_t        computes   = 0;
+    dispatch_group_t                group      = dispatch_group_create();
+    for (NSUInteger t = 0; t < 8; t++)
+    {
+        dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^() {
+            id obj = [dictionary objectForKey:@"expensive" orComputeWithBlock:^id(NSError** error) {
+                OSAtomicIncrement32(&computes);
+                usleep(50000);
+                return @42;
+            }];
+            NSCAssert([obj isEqual:@42], @"waiters get the computed object");
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    XCTAssertEqual(computes, (int32_t)1, @"");
+
+    NSError* error  = nil;
+    id       failed = [dictionary objectForKey:@"broken" orComputeWithBlock:^id(NSError** pError) {
+        *pError = [NSError errorWithDomain:NSCocoaErrorDomain code:1 userInfo:nil];
+        return nil;
+    } error:&error];
+    XCTAssertNil(failed, @"");
+    XCTAssertEqual(error.code, (NSInteger)1, @"");
+    XCTAssertNil(dictionary[@"broken"], @"");
+    XCTAssertThrows([dictionary objectForKey:@"raises" orComputeWithBlock:^id(NSError** pError) {
+        @throw [NSException exceptionWithName:NSGenericException reason:@"compute failed" userInfo:nil];
+    }], @"");
+    XCTAssertEqualObjects([dictionary objectForKey:@"raises" orComputeWithBlock:^id(NSError** pError) { return @1; }], @1, @"");
+}
+
+
+#pragma mark NOBCache
+
+#define kCacheHitsPerThread (200000)
+
+- (void) testCache
+{
+    NOBCache* cache = [[NOBCache alloc] initWithTotalCostLimit:20000 countLimit:1024];
+    for (NSUInteger i = 0; i < 1024; i++)
+    {
+        [cache setObject:@(i) forKey:@(i) cost:10];
+    }
+    XCTAssertEqual(cache.count, (NSUInteger)1024, @"");
+    XCTAssertEqual(cache.totalCost, (NSUInteger)10240, @"");
+
+    // the hot entry gets a second chance every time the hand goes by
+    for (NSUInteger i = 1024; i < 4096; i++)
+    {
+        XCTAssertNotNil([cache objectForKey:@0], @"");
+        [cache setObject:@(i) forKey:@(i) cost:10];
+    }
+    XCTAssertEqual(cache.count, (NSUInteger)1024, @"");
+    XCTAssertEqual(cache.evictionCount, (uint64_t)3072, @"");
+    XCTAssertEqual(cache.hitCount, (uint64_t)3072, @"");
+    XCTAssertEqual(cache.missCount, (uint64_t)0, @"");
+
+    [cache setObject:@"big" forKey:@"big" cost:15000];
+    XCTAssertTrue(cache.totalCost <= 20000, @"");
+    cache.countLimit = 8;
+    XCTAssertTrue(cache.count <= 8, @"");
+    [cache purge];
+    XCTAssertEqual(cache.count, (NSUInteger)0, @"");
+    XCTAssertEqual(cache.totalCost, (NSUInteger)0, @"");
+
+    // hit throughput, a hit never takes more than its shard's lock
+    for (NSUInteger i = 0; i < 1024; i++)
+    {
+        [cache setObject:@(i) forKey:@(i)];
+    }
+    cache.countLimit = 0;
+    for (NSUInteger threads = 1; threads <= 16; threads *= 2)
+    {
+        dispatch_group_t group = dispatch_group_create();
+        uint64_t         start = mach_absolute_time();
+        for (NSUInteger t = 0; t < threads; t++)
+        {
+            dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^() {
+                for (NSUInteger i = 0; i < kCacheHitsPerThread; i++)
+                {
+                    @autoreleasepool {
+                        [cache objectForKey:@((i * 31 + t) & 1023)];
+                    }
+                }
+            });
+        }
+        dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+        double ns = NanosecondsSince(start) / (kCacheHitsPerThread * threads);
+        NSLog(@"NOBCache hits with %2lu threads: %.0fns/op (%.1fM ops/s)", (unsigned long)threads, ns, 1000.0 / ns);
+    }
+}
+
+
+#pragma mark NOBThreadSafeMutableDictionary lock storages
+
+#define kDictionaryCreations (10000)
+
+- (void) testDictionaryLockStorages
+{
+    NOBThreadSafeDictionaryStorage storages[] = { NOBThreadSafeDictionaryStorage_Queue, NOBThreadSafeDictionaryStorage_Snapshot, NOBThreadSafeDictionaryStorage_ReadWriteLock, NOBThreadSafeDictionaryStorage_AdaptiveLock };
+    const char*                    names[]    = { "queue", "snapshot", "rwlock", "adaptive" };
+
+    // the cost of the short lived dictionary per model object
+    for (NSUInteger s = 0; s < sizeof(storages) / sizeof(storages[0]); s++)
+    {
+        uint64_t start = mach_absolute_time();
+        for (NSUInteger i = 0; i < kDictionaryCreations; i++)
+        {
+            @autoreleasepool {
+                NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:storages[s]];
+                [dictionary setObject:@(i) forKey:@"id"];
+                XCTAssertEqual(dictionary.storage, storages[s], @"");
+            }
+        }
+        NSLog(@"Dictionary %s create, set and destroy: %.0fns", names[s], NanosecondsSince(start) / kDictionaryCreations);
+    }
+
+    for (NSUInteger threads = 1; threads <= 16; threads *= 4)
+    {
+        for (NSUInteger s = 0; s < sizeof(storages) / sizeof(storages[0]); s++)
+        {
+            double p99;
+            double ns = [self dictionaryNanosecondsPerOperation:[[NOBThreadSafeMutableDictionary alloc] initWithStorage:storages[s]] threads:threads p99:&p99];
+            NSLog(@"Dictionary 95%% reads with %2lu threads: %s %.0fns/op (%.1fM ops/s, p99 %.0fns)", (unsigned long)threads, names[s], ns, 1000.0 / ns, p99);
+        }
+    }
+
+    NOBThreadSafeMutableDictionary* dictionary = [[NOBThreadSafeMutableDictionary alloc] initWithStorage:NOBThreadSafeDictionaryStorage_AdaptiveLock
+                                                                                                 options:NOBThreadSafeDictionaryOption_Statistics];
+    [dictionary setObject:@1 forKey:@"a"];
+    XCTAssertEqualObjects([dictionary objectForKey:@"a"], @1, @"");
+    XCTAssertEqual(dictionary.count, (NSUInteger)1, @"");
+    NOBThreadSafeDictionaryStatistics statistics = dictionary.statistics;
+    XCTAssertEqual(statistics.reads, (uint64_t)2, @"");
+    XCTAssertEqual(statistics.writes, (uint64_t)1, @"");
+    XCTAssertTrue(statistics.longestWait <= statistics.waitTime, @"");
+    [dictionary resetStatistics];
+    XCTAssertEqual(dictionary.statistics.reads, (uint64_t)0, @"");
+    XCTAssertEqual([[NOBThreadSafeMutableDictionary alloc] init].statistics.reads, (uint64_t)0, @"");
+}
+
+
+#pragma mark NOBJournaledMutableDictionary
+
+#define kJournalEntryCount (20000)
+#define kJournalChanges    (200)
+
+- (void) testJournaledDictionary
+{
+    NSString*                     path       = [_directory stringByAppendingPathComponent:@"settings"];
+    NSError*                      error      = nil;
+    NOBJournaledMutableDictionary* dictionary = [[NOBJournaledMutableDictionary alloc] initWithPath:path storage:NOBThreadSafeDictionaryStorage_Snapshot error:&error];
+    XCTAssertNotNil(dictionary, @"%@", error);
+
+    NSMutableDictionary* settings = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < kJournalEntryCount; i++)
+    {
+        settings[[NSString stringWithFormat:@"setting.%lu", (unsigned long)i]] = @{ @"value" : @(i), @"enabled" : @(i % 2 == 0), @"name" : @"a setting" };
+    }
+    [dictionary addEntriesFromDictionary:settings];
+    XCTAssertTrue([dictionary synchronize], @"");
+
+    // a change, then the whole store on disk, the way it was done before
+    NSString* plistPath = [_directory stringByAppendingPathComponent:@"settings.plist"];
+    uint64_t  start     = mach_absolute_time();
+    for (NSUInteger i = 0; i < kJournalChanges; i++)
+    {
+        settings[@"setting.0"] = @{ @"value" : @(i) };
+        [settings writeToFile:plistPath atomically:YES];
+    }
+    double plist = NanosecondsSince(start) / kJournalChanges;
+
+    start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kJournalChanges; i++)
+    {
+        dictionary[@"setting.0"] = @{ @"value" : @(i) };
+    }
+    XCTAssertTrue([dictionary synchronize], @"");
+    double journal = NanosecondsSince(start) / kJournalChanges;
+    NSLog(@"Persisting a change to %lu settings: plist %.0fns, journal %.0fns (%.0fx)", (unsigned long)kJournalEntryCount, plist, journal, plist / journal);
+
+    [dictionary removeObjectForKey:@"setting.1"];
+    dictionary[@"date"] = [NSDate dateWithTimeIntervalSinceReferenceDate:1000];
+    dictionary[@"data"] = [@"bytes" dataUsingEncoding:NSUTF8StringEncoding];
+    dictionary[@"big"]  = @(UINT64_MAX);
+    XCTAssertThrows([dictionary setObject:[NSNull null] forKey:@"null"], @"");
+    XCTAssertTrue([dictionary synchronize], @"");
+    NSDictionary* expected = [dictionary copy];
+    dictionary = nil;
+
+    // a crash in the middle of an append leaves a torn record at the end of the journal
+    for (NSString* name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directory error:NULL])
+    {
+        if ([name hasSuffix:@".journal"])
+        {
+            NSFileHandle* handle = [NSFileHandle fileHandleForWritingAtPath:[_directory stringByAppendingPathComponent:name]];
+            [handle seekToEndOfFile];
+            [handle writeData:[NSData dataWithBytes:"\x40\0\0\0torn" length:8]];
+            [handle closeFile];
+        }
+    }
+
+    start = mach_absolute_time();
+    dictionary = [[NOBJournaledMutableDictionary alloc] initWithPath:path storage:NOBThreadSafeDictionaryStorage_Snapshot error:&error];
+    NSLog(@"Recovering %lu settings: %.1fms", (unsigned long)kJournalEntryCount, NanosecondsSince(start) / NSEC_PER_MSEC);
+    XCTAssertEqualObjects([dictionary copy], expected, @"");
+
+    // compaction folds the journal into the snapshot
+    dictionary.compactionThreshold = 1;
+    [dictionary removeAllObjects];
+    dictionary[@"after"] = @"compaction";
+    XCTAssertTrue([dictionary synchronize], @"");
+    dictionary = nil;
+    dictionary = [[NOBJournaledMutableDictionary alloc] initWithPath:path storage:NOBThreadSafeDictionaryStorage_Queue error:&error];
+    XCTAssertEqualObjects([dictionary copy], (@{ @"after" : @"compaction" }), @"");
+
+    // a session without changes leaves an empty journal, which is dropped without rewriting the snapshot
+    XCTAssertTrue([dictionary synchronize], @""); // waits for the compaction of the replayed journal
+    dictionary = nil;
+    id snapshotFile = [[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL][NSFileSystemFileNumber];
+    dictionary = [[NOBJournaledMutableDictionary alloc] initWithPath:path storage:NOBThreadSafeDictionaryStorage_Queue error:&error];
+    XCTAssertEqualObjects([dictionary copy], (@{ @"after" : @"compaction" }), @"");
+    XCTAssertEqualObjects([[NSFileManager defaultManager] attributesOfItemAtPath:path error:NULL][NSFileSystemFileNumber], snapshotFile, @"");
+    NSUInteger journals = 0;
+    for (NSString* name in [[NSFileManager defaultManager] contentsOfDirectoryAtPath:_directory error:NULL])
+    {
+        journals += [name hasSuffix:@".journal"];
+    }
+    XCTAssertEqual(journals, (NSUInteger)1, @"");
+}
+
+
+#pragma mark NOBIntegerMap
+
+#define kIntegerMapEntryCount (10000)
+#define kIntegerMapLookups    (1000000)
+
+- (void) testIntegerMap
+{
+    // integer keys: a boxed NSMutableDictionary vs the unboxed map
+    NSMutableDictionary*  boxed = [NSMutableDictionary dictionaryWithCapacity:kIntegerMapEntryCount];
+    NOBIntegerDictionary* map   = [[NOBIntegerDictionary alloc] initWithCapacity:kIntegerMapEntryCount];
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i++)
+    {
+        boxed[@(i * 64)] = @(i);
+        [map setInteger:i forKey:i * 64];
+    }
+    XCTAssertEqual(map.count, (NSUInteger)kIntegerMapEntryCount, @"");
+
+    NSInteger sum   = 0;
+    uint64_t  start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kIntegerMapLookups; i++)
+    {
+        sum += [boxed[@((i % kIntegerMapEntryCount) * 64)] integerValue];
+    }
+    double boxedNs = NanosecondsSince(start) / kIntegerMapLookups;
+
+    NSInteger        mapSum = 0;
+    NOBIntegerMapRef ref    = map.map;
+    start = mach_absolute_time();
+    for (NSUInteger i = 0; i < kIntegerMapLookups; i++)
+    {
+        intptr_t value = 0;
+        NOBIntegerMapGet(ref, (i % kIntegerMapEntryCount) * 64, &value);
+        mapSum += value;
+    }
+    double mapNs = NanosecondsSince(start) / kIntegerMapLookups;
+    XCTAssertEqual(sum, mapSum, @"");
+    NSLog(@"Integer key lookup in %lu entries: NSMutableDictionary %.1fns, NOBIntegerMap %.1fns (%.1fx)", (unsigned long)kIntegerMapEntryCount, boxedNs, mapNs, boxedNs / mapNs);
+
+    // object keys with an integer value, the way UITableView+Updating maps keys to indexes
+    NSMutableArray* keys = [NSMutableArray arrayWithCapacity:kIntegerMapEntryCount];
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i++)
+    {
+        [keys addObject:[NSString stringWithFormat:@"row.%lu", (unsigned long)i]];
+    }
+    start = mach_absolute_time();
+    NSMutableDictionary* keyMap = [NSMutableDictionary dictionaryWithCapacity:kIntegerMapEntryCount];
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i++)
+    {
+        keyMap[keys[i]] = @(i);
+    }
+    for (NSString* key in keys)
+    {
+        XCTAssertNotNil(keyMap[key], @"");
+    }
+    keyMap = nil;
+    boxedNs = NanosecondsSince(start) / kIntegerMapEntryCount;
+
+    start = mach_absolute_time();
+    NOBIntegerMapRef objectMap = NOBIntegerMapCreate(kIntegerMapEntryCount, &kNOBIntegerMapObjectKeyCallBacks);
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i++)
+    {
+        NOBIntegerMapSet(objectMap, (uintptr_t)(__bridge void*)keys[i], i);
+    }
+    for (NSString* key in keys)
+    {
+        XCTAssertTrue(NOBIntegerMapGet(objectMap, (uintptr_t)(__bridge void*)[key mutableCopy], NULL), @"");
+    }
+    NOBIntegerMapDestroy(objectMap);
+    mapNs = NanosecondsSince(start) / kIntegerMapEntryCount;
+    NSLog(@"Object key build and lookup of %lu entries: NSMutableDictionary %.0fns/key, NOBIntegerMap %.0fns/key (%.1fx)", (unsigned long)kIntegerMapEntryCount, boxedNs, mapNs, boxedNs / mapNs);
+
+    // removal keeps every other key reachable, and copies are independent
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i += 2)
+    {
+        [map removeIntegerForKey:i * 64];
+    }
+    NOBIntegerDictionary* copy = [map copy];
+    [map removeAllIntegers];
+    XCTAssertEqual(map.count, (NSUInteger)0, @"");
+    XCTAssertEqual(copy.count, (NSUInteger)kIntegerMapEntryCount / 2, @"");
+    for (NSUInteger i = 0; i < kIntegerMapEntryCount; i++)
+    {
+        XCTAssertEqual([copy integerForKey:i * 64 defaultValue:-1], (NSInteger)((i % 2) ? i : -1), @"");
+    }
+    [copy setInteger:7 forKey:NSUIntegerMax];
+    XCTAssertEqual([copy integerForKey:NSUIntegerMax defaultValue:0], (NSInteger)7, @"");
+}
+
+
+#pragma mark NOBTiming
+
+#define kTimingPairs (1000000)
+
+static void* StartCrossThreadTiming(void* context)
+{
+    @autoreleasepool {
+        StartTiming(@"cross thread");
+    }
+    return NULL;
+}
+
+- (void) testTiming
+{
+    NSString* timingId = @"hot path";
+    uint64_t  start    = mach_absolute_time();
+    for (NSUInteger i = 0; i < kTimingPairs; i++)
+    {
+        StartTiming(timingId);
+        StopTimingNanoseconds(timingId);
+    }
+    NSLog(@"NOBTiming start + stop: %.0fns", NanosecondsSince(start) / kTimingPairs);
+
+    XCTAssertTrue(StartTiming(timingId), @"");
+    XCTAssertFalse(StartTiming([timingId mutableCopy]), @"");
+    XCTAssertTrue(CheckTimeElapsedNanoseconds(timingId) < 1000 * NSEC_PER_MSEC, @"");
+    XCTAssertEqual(StopTimingNanoseconds(@"never started"), (uint64_t)kNOBTimingUnknown, @"");
+    XCTAssertEqual(StopTiming(@"never started"), NSTimeIntervalUnknown, @"");
+
+    // a timing started on one thread can be stopped on another, even after the first thread is gone
+    pthread_t thread;
+    XCTAssertEqual(pthread_create(&thread, NULL, StartCrossThreadTiming, NULL), 0, @"");
+    XCTAssertEqual(pthread_join(thread, NULL), 0, @"");
+    XCTAssertNotEqual(StopTimingNanoseconds(@"cross thread"), (uint64_t)kNOBTimingUnknown, @"");
+    XCTAssertNotEqual(StopTimingNanoseconds(timingId), (uint64_t)kNOBTimingUnknown, @"");
+    XCTAssertEqual(CheckTimeElapsedNanoseconds(timingId), (uint64_t)kNOBTimingUnknown, @"");
+}
+
+
+#pragma mark NOBTiming aggregation
+
+#define kTimingRecordsPerThread (250000)
+
+- (void) testTimingHistograms
+{
+    NOBTimingSnapshot(YES);
+
+    // 1..1000us on each of 4 threads
+    uint64_t         start = mach_absolute_time();
+    dispatch_group_t group = dispatch_group_create();
+    for (NSUInteger t = 0; t < 4; t++)
+    {
+        dispatch_group_async(group, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{
+            for (NSUInteger i = 0; i < kTimingRecordsPerThread; i++)
+            {
+                NOBTimingRecord(@"histogram", ((i % 1000) + 1) * NSEC_PER_USEC);
+            }
+        });
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+    NSLog(@"NOBTimingRecord with 4 threads: %.0fns", NanosecondsSince(start) / (kTimingRecordsPerThread * 4));
+
+    NOBTimingStatistics* statistics = NOBTimingSnapshot(YES)[@"histogram"];
+    NSLog(@"%@", statistics);
+    XCTAssertEqual(statistics.count, (uint64_t)kTimingRecordsPerThread * 4, @"");
+    XCTAssertEqual(statistics.minimum, (uint64_t)NSEC_PER_USEC, @"");
+    XCTAssertEqual(statistics.maximum, (uint64_t)1000 * NSEC_PER_USEC, @"");
+    XCTAssertEqualWithAccuracy(statistics.mean, 500.5 * NSEC_PER_USEC, 1.0, @"");
+    XCTAssertEqualWithAccuracy((double)statistics.p50, 500.0 * NSEC_PER_USEC, 0.02 * 500 * NSEC_PER_USEC, @"");
+    XCTAssertEqualWithAccuracy((double)statistics.p99, 990.0 * NSEC_PER_USEC, 0.02 * 990 * NSEC_PER_USEC, @"");
+    XCTAssertTrue(statistics.p90 <= statistics.p99 && statistics.p99 <= statistics.p999, @"");
+    XCTAssertNil(NOBTimingSnapshot(NO)[@"histogram"], @"");
+
+    // stopped timings are only recorded while aggregating
+    StartTiming(@"aggregated");
+    StopTiming(@"aggregated");
+    XCTAssertNil(NOBTimingSnapshot(NO)[@"aggregated"], @"");
+    NOBTimingSetAggregating(YES);
+    StartTiming(@"aggregated");
+    StopTiming(@"aggregated");
+    ExecuteNamedTimedBlock(@"aggregated", ^{ });
+    NOBTimingSetAggregating(NO);
+    statistics = NOBTimingSnapshot(YES)[@"aggregated"];
+    XCTAssertEqual(statistics.count, (uint64_t)2, @"");
+}
+
+
+#pragma mark NOBLogger compression
+
+// Compress the bytes to a file and read them back, whole and across a block boundary
+- (void) checkCompressedRoundTrip:(NSData*)data name:(NSString*)name
+{
+    NSString* sourcePath     = [_directory stringByAppendingPathComponent:[name stringByAppendingPathExtension:@"log"]];
+    NSString* compressedPath = [_directory stringByAppendingPathComponent:[name stringByAppendingPathExtension:kNOBLogCompressedFileExtension]];
+    XCTAssertTrue([data writeToFile:sourcePath atomically:NO], @"");
+
+    int fd = open(sourcePath.UTF8String, O_RDONLY);
+    XCTAssertTrue(NOBLogCompressFile(fd, 0, data.length, compressedPath.UTF8String), @"%@", name);
+    close(fd);
+
+    NOBLogCompressedFileRef file = NOBLogCompressedFileOpen(compressedPath.UTF8String);
+    XCTAssertTrue(file != NULL, @"%@", name);
+    XCTAssertEqual(NOBLogCompressedFileLength(file), (unsigned long long)data.length, @"%@", name);
+
+    NSMutableData* read = [NSMutableData dataWithLength:data.length];
+    XCTAssertEqual(NOBLogCompressedFileRead(file, read.mutableBytes, read.length, 0), (size_t)data.length, @"%@", name);
+    XCTAssertEqualObjects(read, data, @"%@", name);
+    if (data.length > kNOBLogCompressionBlockSize + 100)
+    {
+        NSRange range = NSMakeRange(kNOBLogCompressionBlockSize - 100, 200);
+        read = [NSMutableData dataWithLength:range.length];
+        XCTAssertEqual(NOBLogCompressedFileRead(file, read.mutableBytes, range.length, range.location), range.length, @"%@", name);
+        XCTAssertEqualObjects(read, [data subdataWithRange:range], @"%@", name);
+    }
+    NOBLogCompressedFileClose(file);
+}
+
+- (void) testLogCompression
+{
+    // blocks: empty input and incompressible input that has to be stored
+    NSMutableData* compressed   = [NSMutableData dataWithLength:kNOBLogCompressionBlockSize + kNOBLogCompressionBlockSize / 2];
+    NSMutableData* decompressed = [NSMutableData dataWithLength:kNOBLogCompressionBlockSize];
+    size_t         length       = NOBLogCompressBlock("", 0, compressed.mutableBytes, compressed.length);
+    XCTAssertTrue(length > 0, @"");
+    XCTAssertEqual(NOBLogDecompressBlock(compressed.bytes, length, decompressed.mutableBytes, decompressed.length), (size_t)0, @"");
+
+    NSMutableData* noise = [NSMutableData dataWithLength:3 * kNOBLogCompressionBlockSize + 1234];
+    arc4random_buf(noise.mutableBytes, noise.length);
+    XCTAssertEqual(NOBLogCompressBlock(noise.bytes, kNOBLogCompressionBlockSize, compressed.mutableBytes, kNOBLogCompressionBlockSize), (size_t)0, @"");
+
+    // a rolled log from a logger that does not compress
+    NSString*  directory = [_directory stringByAppendingPathComponent:@"compression"];
+    NOBLogger* logger    = [[NOBLogger alloc] initWithDirectory:directory
+                                                    filePrefix:nil
+                                                      logLevel:NOBLogLevel_Low
+                                          writesBeforeRollover:UINT32_MAX
+                                                  maxFileCount:0];
+    logger.bytesBeforeRollover = kNOBLogCompressionBlockSize * 2;
+    for (NSUInteger i = 0; i < 4000; i++)
+    {
+        [logger writeASync:[NSString stringWithFormat:@"compressible line %lu", (unsigned long)i] level:NOBLogLevel_Mid];
+    }
+    [logger flush];
+    NSArray* logs = logger.logFiles;
+    XCTAssertTrue(logs.count > 1, @"");
+    NSData* rolled   = [NSData dataWithContentsOfFile:[directory stringByAppendingPathComponent:logs[0]]];
+    NSData* expected = [logger mostRecentLogs:16 * 1024 * 1024];
+    logger = nil;
+
+    [self checkCompressedRoundTrip:[NSData data] name:@"empty"];
+    [self checkCompressedRoundTrip:noise name:@"noise"];
+    [self checkCompressedRoundTrip:rolled name:@"rolled"];
+
+    // a compressing logger compresses the rolled logs it finds and still reads them back as text
+    logger = [[NOBLogger alloc] initWithDirectory:directory
+                                       filePrefix:nil
+                                         logLevel:NOBLogLevel_Low
+                             writesBeforeRollover:UINT32_MAX
+                                     maxFileCount:0
+                                          options:NOBLoggerOption_CompressRolledLogs];
+    NSUInteger compressedCount = 0;
+    for (NSUInteger attempt = 0; attempt < 100 && compressedCount < logs.count; attempt++)
+    {
+        [NSThread sleepForTimeInterval:0.05];
+        [logger flush];
+        compressedCount = [[logger.logFiles filteredArrayUsingPredicate:[NSPredicate predicateWithFormat:@"pathExtension == %@", kNOBLogCompressedFileExtension]] count];
+    }
+    XCTAssertEqual(compressedCount, logs.count, @"");
+    XCTAssertTrue(logger.totalLogSize < expected.length, @"");
+
+    NSData* all = [logger mostRecentLogs:16 * 1024 * 1024];
+    XCTAssertTrue(all.length > expected.length, @"");
+    XCTAssertEqualObjects([all subdataWithRange:NSMakeRange(0, expected.length)], expected, @"");
+}
+
+
+#pragma mark NOBLogger binary records
+
+#define kBinaryRecordCount   (200)
+#define kBinaryIndexInterval (8)
+
+// Records one second apart cycling through the levels, every 50th one from the logger itself (level 0) and a "format check" at Mid
+- (NSData*) binaryLogStartingAt:(CFAbsoluteTime)base withIndex:(BOOL)withIndex
+{
+    NSMutableData*       data  = [NSMutableData dataWithLength:16];
+    NOBLogBinaryIndexRef index = NOBLogBinaryIndexCreate(kBinaryIndexInterval);
+    data.length = NOBLogBinaryEncodeFileHeader(data.mutableBytes, kBinaryIndexInterval);
+    for (NSUInteger i = 0; i < kBinaryRecordCount; i++)
+    {
+        NSString* payload = (i == 101 ? @"format check" : [NSString stringWithFormat:@"record %lu", (unsigned long)i]);
+        NOBLogBinaryRecordHeader header;
+        memset(&header, 0, sizeof(header));
+        header.timestamp = base + i;
+        header.level     = (i % 50 == 0 ? NOBLogLevel_Off : (i == 101 ? NOBLogLevel_Mid : NOBLogLevel_High + (i % 3)));
+        header.length    = (uint32_t)[payload lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+        NOBLogBinaryIndexNoteRecord(index, header.timestamp, data.length);
+        [data appendBytes:&header length:sizeof(header)];
+        [data appendData:[payload dataUsingEncoding:NSUTF8StringEncoding]];
+    }
+    if (withIndex)
+    {
+        NSMutableData* indexBlock = [NSMutableData dataWithLength:NOBLogBinaryIndexEncodedLength(index)];
+        NOBLogBinaryIndexEncode(index, data.length, indexBlock.mutableBytes);
+        [data appendData:indexBlock];
+    }
+    NOBLogBinaryIndexDestroy(index);
+    return data;
+}
+
+- (void) testBinaryLogQuery
+{
+    CFAbsoluteTime base  = floor(CFAbsoluteTimeGetCurrent()) - kBinaryRecordCount;
+    CFAbsoluteTime start = base + 37.5;
+    CFAbsoluteTime end   = base + 121;
+
+    // the text a text log file has for the "format check" record, minus its timestamp
+    NOBLogger* textLogger = [[NOBLogger alloc] initWithDirectory:[_directory stringByAppendingPathComponent:@"text"]
+                                                      filePrefix:nil
+                                                        logLevel:NOBLogLevel_Low
+                                            writesBeforeRollover:0
+                                                    maxFileCount:0];
+    [textLogger writeSync:@"format check" level:NOBLogLevel_Mid];
+    NSString* text      = [[NSString alloc] initWithData:[textLogger mostRecentLogs:1024] encoding:NSUTF8StringEncoding];
+    NSString* textLine  = nil;
+    for (NSString* line in [text componentsSeparatedByString:@"\n"])
+    {
+        if ([line hasSuffix:@"format check"])
+            textLine = [line substringFromIndex:[line rangeOfString:@"]"].location + 1];
+    }
+    XCTAssertNotNil(textLine, @"");
+
+    // indexed (a closed file) and scanned on open (a file still being written)
+    for (NSNumber* withIndex in @[ @YES, @NO ])
+    {
+        NSString* path = [_directory stringByAppendingPathComponent:[NSString stringWithFormat:@"query%@.%@", withIndex, kNOBLogBinaryFileExtension]];
+        XCTAssertTrue([[self binaryLogStartingAt:base withIndex:withIndex.boolValue] writeToFile:path atomically:NO], @"");
+
+        NOBLogBinaryReaderRef reader = NOBLogBinaryReaderOpen(path.UTF8String);
+        XCTAssertTrue(reader != NULL, @"");
+        XCTAssertEqual(NOBLogBinaryReaderFirstTimestamp(reader), base, @"");
+
+        NSMutableArray* expected = [NSMutableArray array];
+        for (NSUInteger i = 38; i <= 121; i++)
+        {
+            NOBLogLevel level = (i % 50 == 0 ? NOBLogLevel_Off : (i == 101 ? NOBLogLevel_Mid : NOBLogLevel_High + (i % 3)));
+            if (level <= NOBLogLevel_Mid)
+                [expected addObject:(i == 101 ? @"format check" : [NSString stringWithFormat:@"record %lu", (unsigned long)i])];
+        }
+
+        NSMutableArray* payloads = [NSMutableArray array];
+        NSUInteger count = NOBLogBinaryReaderEnumerate(reader, start, end, NOBLogLevel_Mid, ^(const NOBLogBinaryRecordHeader* header, const char* payload, BOOL* stop) {
+            XCTAssertTrue(header->timestamp >= start && header->timestamp <= end, @"");
+            XCTAssertTrue(header->level <= NOBLogLevel_Mid, @"");
+            [payloads addObject:[[NSString alloc] initWithBytes:payload length:header->length encoding:NSUTF8StringEncoding]];
+        });
+        XCTAssertEqual(count, expected.count, @"");
+        XCTAssertEqualObjects(payloads, expected, @"");
+
+        // the export is exactly the text format: the same prefix as a text log, nothing for the logger's own records
+        NSMutableData* exported = [NSMutableData data];
+        count = NOBLogBinaryReaderExportText(reader, start, end, NOBLogLevel_Mid, ^(const char* bytes, size_t length) {
+            [exported appendBytes:bytes length:length];
+        });
+        XCTAssertEqual(count, expected.count, @"");
+        NSArray* lines = [[[NSString alloc] initWithData:exported encoding:NSUTF8StringEncoding] componentsSeparatedByString:@"\n"];
+        XCTAssertEqual(lines.count, expected.count + 1, @"");
+        XCTAssertEqualObjects(lines.lastObject, @"", @"");
+        for (NSUInteger i = 0; i < expected.count; i++)
+        {
+            XCTAssertTrue([lines[i] hasSuffix:expected[i]], @"%@", lines[i]);
+            if ([expected[i] isEqualToString:@"format check"])
+                XCTAssertEqualObjects([lines[i] substringFromIndex:[lines[i] rangeOfString:@"]"].location + 1], textLine, @"");
+            else if ([expected[i] isEqualToString:@"record 50"] || [expected[i] isEqualToString:@"record 100"])
+                XCTAssertEqualObjects(lines[i], expected[i], @"");
+        }
+
+        // the tail is the end of the full export, starting at a record, without rendering the whole file
+        NSMutableData* all = [NSMutableData data];
+        NOBLogBinaryReaderExportText(reader, -DBL_MAX, DBL_MAX, NOBLogLevel_Low, ^(const char* bytes, size_t length) {
+            [all appendBytes:bytes length:length];
+        });
+        NSData* tail = NOBLogBinaryReaderTextTail(reader, NOBLogLevel_Low, 300);
+        XCTAssertTrue(tail.length >= 300 && tail.length < all.length / 2, @"%lu of %lu", (unsigned long)tail.length, (unsigned long)all.length);
+        XCTAssertEqualObjects([all subdataWithRange:NSMakeRange(all.length - tail.length, tail.length)], tail, @"");
+        XCTAssertTrue(0 == memcmp((const char*)all.bytes + all.length - tail.length - 1, "\n", 1), @"");
+        XCTAssertEqualObjects(NOBLogBinaryReaderTextTail(reader, NOBLogLevel_Low, all.length * 2), all, @"");
+
+        NOBLogBinaryReaderClose(reader);
+    }
+}
+
+
+#pragma mark NOBLogRateLimiter
+
+- (void) testLogRateLimiter
+{
+    // token bucket: the burst, then perSecond.  The first allowed record after suppressed ones carries the summary count.
+    NOBLogRateLimiter limiter    = kNOBLogRateLimiterInit;
+    int64_t           suppressed = 0;
+    int64_t           reported   = 0;
+    NSUInteger        admitted   = 0;
+    uint64_t          start      = mach_absolute_time();
+    for (NSUInteger i = 0; i < 1000; i++)
+    {
+        admitted += NOBLogRateLimiterAllowRate(&limiter, 10.0, 5, &suppressed);
+        reported += suppressed;
+    }
+    double elapsed = NanosecondsSince(start) / NSEC_PER_SEC;
+    XCTAssertTrue(admitted >= 5 && admitted <= 5 + (NSUInteger)(elapsed * 10.0) + 1, @"%lu admitted in %.3fs", (unsigned long)admitted, elapsed);
+    XCTAssertEqual(reported + limiter.suppressed, (int64_t)(1000 - admitted), @"");
+
+    [NSThread sleepForTimeInterval:0.35];
+    int64_t pending = limiter.suppressed;
+    XCTAssertTrue(NOBLogRateLimiterAllowRate(&limiter, 10.0, 5, &suppressed), @"");
+    XCTAssertEqual(suppressed, pending, @"");
+    reported = 0;
+    admitted = 1;
+    for (NSUInteger i = 1; i < 1000; i++)
+    {
+        admitted += NOBLogRateLimiterAllowRate(&limiter, 10.0, 5, &suppressed);
+        reported += suppressed;
+    }
+    XCTAssertTrue(admitted >= 3 && admitted <= 5, @"%lu admitted after 0.35s", (unsigned long)admitted);
+    XCTAssertEqual(reported, (int64_t)0, @"the next summary waits for kNOBLogRateLimiterSummaryInterval");
+    XCTAssertEqual(limiter.suppressed, (int64_t)(1000 - admitted), @"");
+
+    // 1 in N: exactly the first and every Nth after it
+    NOBLogRateLimiter sampler = kNOBLogRateLimiterInit;
+    admitted = 0;
+    reported = 0;
+    for (NSUInteger i = 0; i < 1000; i++)
+    {
+        BOOL allow = NOBLogRateLimiterAllowSample(&sampler, 10, &suppressed);
+        XCTAssertEqual(allow, (BOOL)(0 == i % 10), @"");
+        admitted += allow;
+        reported += suppressed;
+    }
+    XCTAssertEqual(admitted, (NSUInteger)100, @"");
+    XCTAssertEqual(reported + sampler.suppressed, (int64_t)900, @"");
+    XCTAssertEqual(reported, (int64_t)9, @"one summary per interval");
+
+    // summary line
+    XCTAssertEqualObjects(NOBLogRateLimiterSummary(1, "/path/to/file.m", 42), @"suppressed 1 similar line from file.m:42", @"");
+    NSString* count = [NSNumberFormatter localizedStringFromNumber:@12345 numberStyle:NSNumberFormatterDecimalStyle];
+    XCTAssertEqualObjects(NOBLogRateLimiterSummary(12345, "file.m", 7), ([NSString stringWithFormat:@"suppressed %@ similar lines from file.m:7", count]), @"");
+
+    // the macros, end to end
+    NOBLogger* logger = [[NOBLogger alloc] initWithDirectory:[_directory stringByAppendingPathComponent:@"limited"] logLevel:NOBLogLevel_Low];
+    [NOBLogger setSharedLog:logger];
+    for (NSUInteger i = 0; i < 100; i++)
+    {
+        LOG_SAMPLED(NOBLogLevel_Mid, 10, @"sampled line %lu", (unsigned long)i);
+    }
+    for (NSUInteger i = 0; i < 100; i++)
+    {
+        LOG_RATE_LIMITED(NOBLogLevel_Mid, 1.0, 3, @"limited line %lu", (unsigned long)i);
+    }
+    // both call sites went quiet, what they still had suppressed is summarized on its own
+    [NSThread sleepForTimeInterval:2.5 * kNOBLogRateLimiterSummaryInterval];
+    [NOBLogger setSharedLog:nil];
+    [logger flush];
+
+    NSString*  text       = [[NSString alloc] initWithData:[logger mostRecentLogs:64 * 1024] encoding:NSUTF8StringEncoding];
+    NSUInteger sampled    = 0;
+    NSUInteger limited    = 0;
+    NSInteger  suppressed = 0;
+    NSUInteger summaries  = 0;
+    for (NSString* line in [text componentsSeparatedByString:@"\n"])
+    {
+        sampled   += ([line rangeOfString:@"sampled line "].location != NSNotFound);
+        limited   += ([line rangeOfString:@"limited line "].location != NSNotFound);
+        summaries += ([line rangeOfString:@"suppressed 9 similar lines from NOBLibPerformanceTests.m:"].location != NSNotFound);
+        summaries += ([line rangeOfString:@"suppressed 81 similar lines from NOBLibPerformanceTests.m:"].location != NSNotFound);
+
+        NSRange range = [line rangeOfString:@"suppressed "];
+        if (range.location != NSNotFound)
+        {
+            NSInteger count = 0;
+            XCTAssertTrue([[NSScanner scannerWithString:[line substringFromIndex:NSMaxRange(range)]] scanInteger:&count], @"%@", line);
+            suppressed += count;
+        }
+    }
+    XCTAssertEqual(sampled, (NSUInteger)10, @"");
+    XCTAssertTrue(limited >= 3 && limited <= 4, @"%lu", (unsigned long)limited);
+    XCTAssertEqual(summaries, (NSUInteger)2, @"%@", text);
+    XCTAssertEqual((NSInteger)(sampled + limited) + suppressed, (NSInteger)200, @"every line is either logged or summarized: %@", text);
+}
+
+@end